@@ -0,0 +1,788 @@
+/**
+ * Microbenchmarks for the internal primitives of the collector.
+ * Every benchmark is run a number of times and the fastest run is reported,
+ * together with the amount of malloc, calloc and realloc calls per operation.
+ * Results are written as JSON, to the file given as the first argument or to
+ * stdout if none is given.
+ *
+ * Build and run with `make bench`, which links the benchmarks with
+ * -Wl,--wrap for the allocation functions counted below.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/allocation.h"
+#include "../src/allocation_map.h"
+#include "../src/compacting.h"
+#include "../src/format_encoding.h"
+#include "../src/free_run_index.h"
+#include "../src/gc.h"
+#include "../src/header.h"
+#include "../src/heap_internal.h"
+#include "../src/ptr_queue.h"
+
+/* Times each benchmark is run, the fastest run is reported.  */
+#define BENCH_REPEATS 5
+
+/* Size of the heaps used by benchmarks that need one.  */
+#define BENCH_HEAP_SIZE (1024 * 1024)
+
+/* Words in the fake stack scanned for roots.  */
+#define BENCH_STACK_WORDS 4096
+
+/**
+ * A benchmark.
+ * @param name: The name the result is reported under.
+ * @param setup: Creates the state used by run, not timed. May be NULL.
+ * @param run: Performs the operation iterations times.
+ * @param teardown: Frees the state created by setup, not timed. May be NULL.
+ * @param param: Sent to setup, such as the size of the live set.
+ * @param iterations: The amount of operations in one run.
+ */
+typedef struct benchmark
+{
+  char *name;
+  void *(*setup) (size_t param);
+  void (*run) (void *state, size_t iterations);
+  void (*teardown) (void *state);
+  size_t param;
+  size_t iterations;
+} benchmark_t;
+
+/* Written to by benchmarks so their results are not optimized away.  */
+static volatile uintptr_t sink;
+
+/* Allocation functions called since the counter was last reset.  */
+static size_t allocation_count = 0;
+
+void *__real_malloc (size_t size);
+void *__real_calloc (size_t count, size_t size);
+void *__real_realloc (void *ptr, size_t size);
+
+void *
+__wrap_malloc (size_t size)
+{
+  allocation_count++;
+  return __real_malloc (size);
+}
+
+void *
+__wrap_calloc (size_t count, size_t size)
+{
+  allocation_count++;
+  return __real_calloc (count, size);
+}
+
+void *
+__wrap_realloc (void *ptr, size_t size)
+{
+  allocation_count++;
+  return __real_realloc (ptr, size);
+}
+
+static uint64_t
+now_ns (void)
+{
+  struct timespec time;
+  clock_gettime (CLOCK_MONOTONIC, &time);
+  return (uint64_t)time.tv_sec * 1000000000u + time.tv_nsec;
+}
+
+/*
+ * Format encoding
+ */
+
+static char *bench_format = "*i*l3*d2i*";
+
+static void
+run_size_from_string (void *state, size_t iterations)
+{
+  (void)state;
+  bool success = false;
+  for (size_t i = 0; i < iterations; i++)
+    {
+      sink += size_from_string (bench_format, &success);
+    }
+}
+
+static void
+run_convert_to_bit_vector (void *state, size_t iterations)
+{
+  (void)state;
+  bool success = false;
+  size_t size = size_from_string (bench_format, &success);
+  for (size_t i = 0; i < iterations; i++)
+    {
+      sink += convert_to_bit_vector (bench_format, size, &success);
+    }
+}
+
+static void
+run_size_from_vector (void *state, size_t iterations)
+{
+  (void)state;
+  bool success = false;
+  size_t size = size_from_string (bench_format, &success);
+  uint_fast64_t vector = convert_to_bit_vector (bench_format, size, &success);
+  for (size_t i = 0; i < iterations; i++)
+    {
+      /* Changes the vector so the decode cache does not hide every decode. */
+      sink += size_from_vector (vector ^ (sink & 0x10));
+    }
+}
+
+/*
+ * Finding pointers in allocations
+ */
+
+static void *
+setup_heap_object (size_t param)
+{
+  (void)param;
+  heap_t *h = h_init (BENCH_HEAP_SIZE, true, 1);
+  void **object = h_alloc_struct (h, bench_format);
+  object[0] = object;
+  return h;
+}
+
+static void
+teardown_heap (void *state)
+{
+  h_delete ((heap_t *)state);
+}
+
+static void *
+first_object (heap_t *h)
+{
+  return (char *)h->heap_start + sizeof (header_t);
+}
+
+static void
+run_get_pointers_in_allocation (void *state, size_t iterations)
+{
+  void *object = first_object ((heap_t *)state);
+  for (size_t i = 0; i < iterations; i++)
+    {
+      ptr_queue_t *pointers = get_pointers_in_allocation (object);
+      sink += get_len (pointers);
+      destroy_ptr_queue (pointers);
+    }
+}
+
+static void
+count_field (void **field, void *arg)
+{
+  (void)arg;
+  sink += (uintptr_t)field;
+}
+
+static void
+run_for_each_pointer_field (void *state, size_t iterations)
+{
+  void *object = first_object ((heap_t *)state);
+  for (size_t i = 0; i < iterations; i++)
+    {
+      for_each_pointer_field (object, count_field, NULL);
+    }
+}
+
+/*
+ * Pointer queue
+ */
+
+static void *
+setup_ptr_queue (size_t param)
+{
+  (void)param;
+  return create_ptr_queue ();
+}
+
+static void
+teardown_ptr_queue (void *state)
+{
+  destroy_ptr_queue ((ptr_queue_t *)state);
+}
+
+static void
+run_enqueue_dequeue_ptr (void *state, size_t iterations)
+{
+  ptr_queue_t *queue = state;
+  void *field = NULL;
+  for (size_t i = 0; i < iterations; i++)
+    {
+      enqueue_ptr (queue, &field);
+      sink += (uintptr_t)dequeue_ptr (queue);
+    }
+}
+
+/*
+ * Allocation map
+ */
+
+static void *
+setup_alloc_map (size_t param)
+{
+  (void)param;
+  return create_allocation_map (BENCH_HEAP_SIZE);
+}
+
+static void
+run_update_alloc_map (void *state, size_t iterations)
+{
+  char *alloc_map = state;
+  size_t granules = BENCH_HEAP_SIZE / MIN_ALLOC_OBJECT_SIZE;
+  for (size_t i = 0; i < iterations; i++)
+    {
+      size_t offset = (i * 7 % granules) * MIN_ALLOC_OBJECT_SIZE;
+      update_alloc_map (alloc_map, offset, i & 1);
+      sink += is_offset_allocated (alloc_map, offset);
+    }
+}
+
+/*
+ * Finding space in a fragmented heap
+ */
+
+/**
+ * Creates a full heap with one free granule in every four and a free page at
+ * the end, the holes indexed if param is true.
+ */
+static void *
+setup_fragmented_heap (size_t param)
+{
+  heap_t *h = h_init (BENCH_HEAP_SIZE, true, 1);
+  update_alloc_map_range (h->alloc_map, 0, h->size, true);
+  size_t stride = 4 * MIN_ALLOC_OBJECT_SIZE;
+  for (size_t offset = 0; offset < h->size; offset += stride)
+    {
+      update_alloc_map_range (h->alloc_map, offset, MIN_ALLOC_OBJECT_SIZE,
+                              false);
+    }
+  /* The only space for an object bigger than a granule.  */
+  update_alloc_map_range (h->alloc_map, h->size - h->page_size,
+                          h->page_size, false);
+  if (param)
+    {
+      h->free_runs
+          = create_free_run_index (h->alloc_map, h->size, h->page_size);
+    }
+  return h;
+}
+
+static void
+run_move_to_next_available_space (void *state, size_t iterations)
+{
+  heap_t *h = state;
+  for (size_t i = 0; i < iterations; i++)
+    {
+      h->next_empty_mem_segment = h->heap_start;
+      sink += move_to_next_available_space (h, 4 * MIN_ALLOC_OBJECT_SIZE);
+    }
+}
+
+/*
+ * Stack scanning
+ */
+
+/**
+ * A fake stack where every fourth word points to an object in the heap, and
+ * the rest are values that are not pointers.
+ * @param heap: The heap the objects are in.
+ * @param words: The stack.
+ */
+typedef struct fake_stack
+{
+  heap_t *heap;
+  uintptr_t words[BENCH_STACK_WORDS];
+} fake_stack_t;
+
+static void *
+setup_fake_stack (size_t param)
+{
+  (void)param;
+  fake_stack_t *stack = calloc (1, sizeof (fake_stack_t));
+  stack->heap = h_init (BENCH_HEAP_SIZE, true, 1);
+  for (size_t i = 0; i < BENCH_STACK_WORDS; i++)
+    {
+      stack->words[i] = i % 4 == 0
+                            ? (uintptr_t)h_alloc_struct (stack->heap, "*l")
+                            : i * 2654435761u;
+    }
+  return stack;
+}
+
+static void
+teardown_fake_stack (void *state)
+{
+  fake_stack_t *stack = state;
+  h_delete (stack->heap);
+  free (stack);
+}
+
+static void
+run_find_root_pointers (void *state, size_t iterations)
+{
+  fake_stack_t *stack = state;
+  for (size_t i = 0; i < iterations; i++)
+    {
+      char *root_map
+          = find_root_pointers (stack->heap, (uintptr_t)stack->words,
+                                (uintptr_t)(stack->words + BENCH_STACK_WORDS));
+      sink += (uintptr_t)root_map[0];
+      free (root_map);
+    }
+}
+
+/*
+ * Garbage collection
+ */
+
+/* Hands the live set from setup to run, where it is put on the stack.  */
+static void *live_set_root;
+
+/**
+ * Fills a heap with a linked list of live nodes, and garbage nodes filling
+ * the rest of the heap up to half its size.
+ */
+static void
+fill_gc_heap (heap_t *h, size_t live_nodes)
+{
+  void **list = NULL;
+  size_t node_size
+      = align_alloc_size (2 * sizeof (void *)) + sizeof (header_t);
+  size_t node_count = h->size / 2 / node_size;
+  for (size_t i = 0; i < node_count; i++)
+    {
+      void **node = h_alloc_struct (h, "**");
+      if (i < live_nodes)
+        {
+          node[0] = list;
+          list = node;
+        }
+    }
+  live_set_root = list;
+}
+
+/**
+ * Creates a heap with a linked list of param live nodes, and garbage nodes
+ * filling the rest of the heap up to half its size.
+ */
+static void *
+setup_gc_heap (size_t param)
+{
+  heap_t *h = h_init (BENCH_HEAP_SIZE, true, 1);
+  fill_gc_heap (h, param);
+  return h;
+}
+
+/**
+ * Creates the heap of setup_gc_heap, split in two halves that the live
+ * nodes are copied between.
+ */
+static void *
+setup_gc_semispace_heap (size_t param)
+{
+  heap_options_t options = { .bytes = BENCH_HEAP_SIZE,
+                             .unsafe_stack = true,
+                             .gc_threshold = 1,
+                             .gc_threads = 1,
+                             .semispace = true };
+  heap_t *h = h_init_with_options (&options);
+  fill_gc_heap (h, param);
+  return h;
+}
+
+/**
+ * Creates the heap of setup_gc_heap with precise roots, the list only
+ * referenced by live_set_root, added as a global root.
+ */
+static void *
+setup_gc_precise_heap (size_t param)
+{
+  heap_options_t options = { .bytes = BENCH_HEAP_SIZE,
+                             .unsafe_stack = false,
+                             .gc_threshold = 1,
+                             .gc_threads = 1,
+                             .precise_roots = true };
+  heap_t *h = h_init_with_options (&options);
+  fill_gc_heap (h, param);
+  h_add_global_root (h, &live_set_root);
+  return h;
+}
+
+/**
+ * Creates the heap of setup_gc_heap, marked incrementally in slices of at
+ * most 0.1 ms and swept instead of compacted.
+ */
+static void *
+setup_gc_incremental_heap (size_t param)
+{
+  heap_options_t options = { .bytes = BENCH_HEAP_SIZE,
+                             .unsafe_stack = true,
+                             .gc_threshold = 1,
+                             .gc_threads = 1,
+                             .fragmentation_threshold = 0.5,
+                             .max_pause_ms = 0.1f };
+  heap_t *h = h_init_with_options (&options);
+  fill_gc_heap (h, param);
+  return h;
+}
+
+/* Shape of the live set used to compare marking with several threads.  */
+#define WIDE_LIVE_SET_LISTS 256
+#define WIDE_LIVE_SET_NODES 10000
+
+/**
+ * Creates a heap marked by param threads, with a live set of many short
+ * lists hanging off an array so that the threads have work to share.
+ */
+static void *
+setup_gc_wide_heap (size_t param)
+{
+  heap_options_t options = { .bytes = BENCH_HEAP_SIZE,
+                             .unsafe_stack = true,
+                             .gc_threshold = 1,
+                             .gc_threads = param };
+  heap_t *h = h_init_with_options (&options);
+  void **lists
+      = h_alloc_array (h, h_register_layout (h, "*"), WIDE_LIVE_SET_LISTS);
+  for (size_t i = 0; i < WIDE_LIVE_SET_NODES; i++)
+    {
+      void **node = h_alloc_struct (h, "**");
+      node[0] = lists[i % WIDE_LIVE_SET_LISTS];
+      lists[i % WIDE_LIVE_SET_LISTS] = node;
+    }
+  live_set_root = lists;
+  return h;
+}
+
+/**
+ * Creates a heap where almost every object stays alive, collected by
+ * sweeping if param is true and by compacting otherwise.
+ */
+static void *
+setup_gc_retained_heap (size_t param)
+{
+  heap_options_t options = { .bytes = BENCH_HEAP_SIZE,
+                             .unsafe_stack = true,
+                             .gc_threshold = 1,
+                             .gc_threads = 1,
+                             .fragmentation_threshold = param ? 0.5 : 0 };
+  heap_t *h = h_init_with_options (&options);
+  void **lists
+      = h_alloc_array (h, h_register_layout (h, "*"), WIDE_LIVE_SET_LISTS);
+  for (size_t i = 0; i < WIDE_LIVE_SET_NODES; i++)
+    {
+      void **node = h_alloc_struct (h, "**");
+      node[0] = lists[i % WIDE_LIVE_SET_LISTS];
+      lists[i % WIDE_LIVE_SET_LISTS] = node;
+      if (i % 64 == 0)
+        {
+          h_alloc_struct (h, "**");
+        }
+    }
+  live_set_root = lists;
+  return h;
+}
+
+/**
+ * Creates a heap where a quarter of every page stays alive, compacted as a
+ * whole if param is 0 and otherwise evacuating at most param pages per
+ * collection.
+ */
+static void *
+setup_gc_sparse_heap (size_t param)
+{
+  heap_options_t options = { .bytes = BENCH_HEAP_SIZE,
+                             .unsafe_stack = true,
+                             .gc_threshold = 1,
+                             .gc_threads = 1,
+                             .evacuated_pages = param };
+  heap_t *h = h_init_with_options (&options);
+  void **lists
+      = h_alloc_array (h, h_register_layout (h, "*"), WIDE_LIVE_SET_LISTS);
+  for (size_t i = 0; i < WIDE_LIVE_SET_NODES / 2; i++)
+    {
+      void **node = h_alloc_struct (h, "**");
+      node[0] = lists[i % WIDE_LIVE_SET_LISTS];
+      lists[i % WIDE_LIVE_SET_LISTS] = node;
+      h_alloc_struct (h, "2*");
+      h_alloc_struct (h, "2*");
+      h_alloc_struct (h, "2*");
+    }
+  live_set_root = lists;
+  return h;
+}
+
+/**
+ * Creates a heap from options and builds the retained live set of
+ * setup_gc_wide_heap in it.
+ */
+static void *
+build_temporaries_heap (heap_options_t *options)
+{
+  heap_t *h = h_init_with_options (options);
+  void **lists
+      = h_alloc_array (h, h_register_layout (h, "*"), WIDE_LIVE_SET_LISTS);
+  for (size_t i = 0; i < WIDE_LIVE_SET_NODES; i++)
+    {
+      /* Minor collections can run while the live set is built, so the
+         stores go through the write barrier.  */
+      void **node = h_alloc_struct (h, "**");
+      h_write_ptr (node, &node[0], lists[i % WIDE_LIVE_SET_LISTS]);
+      h_write_ptr (lists, &lists[i % WIDE_LIVE_SET_LISTS], node);
+    }
+  /* Start from a collected heap, the live set promoted if there is a
+     nursery.  */
+  void *volatile root = lists;
+  h_gc (h);
+  live_set_root = root;
+  return h;
+}
+
+/**
+ * Creates a heap with the retained live set of setup_gc_wide_heap, and a
+ * nursery of param bytes, 0 for none, that temporaries are allocated in.
+ */
+static void *
+setup_gc_temporaries_heap (size_t param)
+{
+  heap_options_t options = { .bytes = BENCH_HEAP_SIZE,
+                             .unsafe_stack = true,
+                             .gc_threshold = 0.5,
+                             .gc_threads = 1,
+                             .nursery_bytes = param };
+  return build_temporaries_heap (&options);
+}
+
+/**
+ * Creates a mark-region heap with the retained live set of
+ * setup_gc_wide_heap, evacuating at most param pages once its free lines
+ * are fragmented.
+ */
+static void *
+setup_mark_region_temporaries_heap (size_t param)
+{
+  heap_options_t options = { .bytes = BENCH_HEAP_SIZE,
+                             .unsafe_stack = true,
+                             .gc_threshold = 0.5,
+                             .gc_threads = 1,
+                             .fragmentation_threshold = 0.5,
+                             .evacuated_pages = param,
+                             .mark_region = true };
+  return build_temporaries_heap (&options);
+}
+
+/**
+ * Creates a semispace heap with the retained live set of setup_gc_wide_heap,
+ * collected once a half is full. param is unused.
+ */
+static void *
+setup_semispace_temporaries_heap (size_t param)
+{
+  (void)param;
+  heap_options_t options = { .bytes = BENCH_HEAP_SIZE,
+                             .unsafe_stack = true,
+                             .gc_threshold = 1,
+                             .gc_threads = 1,
+                             .semispace = true };
+  return build_temporaries_heap (&options);
+}
+
+/**
+ * Allocates short lived objects until several collections have run.
+ */
+static void
+run_alloc_temporaries (void *state, size_t iterations)
+{
+  heap_t *h = state;
+  void *volatile root = live_set_root;
+  for (size_t i = 0; i < iterations; i++)
+    {
+      for (size_t j = 0; j < 100000; j++)
+        {
+          sink += (uintptr_t)h_alloc_struct (h, "*l");
+        }
+    }
+  live_set_root = root;
+}
+
+static void
+teardown_gc_heap (void *state)
+{
+  live_set_root = NULL;
+  h_delete ((heap_t *)state);
+}
+
+static void
+run_h_gc (void *state, size_t iterations)
+{
+  heap_t *h = state;
+  /* The only root of the live set, found when the stack is scanned.  */
+  void *volatile root = live_set_root;
+  for (size_t i = 0; i < iterations; i++)
+    {
+      sink += h_gc (h);
+    }
+  live_set_root = root;
+}
+
+/**
+ * Collects a heap with precise roots, where nothing on the stack is looked
+ * at and live_set_root is updated by the collector.
+ */
+static void
+run_h_gc_precise (void *state, size_t iterations)
+{
+  heap_t *h = state;
+  for (size_t i = 0; i < iterations; i++)
+    {
+      sink += h_gc (h);
+    }
+}
+
+/**
+ * Runs slices of incremental collections, the last slice of each collection
+ * also remarking and sweeping the heap.
+ */
+static void
+run_h_gc_step (void *state, size_t iterations)
+{
+  heap_t *h = state;
+  void *volatile root = live_set_root;
+  for (size_t i = 0; i < iterations; i++)
+    {
+      sink += h_gc_step (h);
+    }
+  live_set_root = root;
+}
+
+static benchmark_t benchmarks[] = {
+  { "size_from_string", NULL, run_size_from_string, NULL, 0, 1000000 },
+  { "convert_to_bit_vector", NULL, run_convert_to_bit_vector, NULL, 0,
+    1000000 },
+  { "size_from_vector", NULL, run_size_from_vector, NULL, 0, 1000000 },
+  { "get_pointers_in_allocation", setup_heap_object,
+    run_get_pointers_in_allocation, teardown_heap, 0, 200000 },
+  { "for_each_pointer_field", setup_heap_object, run_for_each_pointer_field,
+    teardown_heap, 0, 1000000 },
+  { "enqueue_dequeue_ptr", setup_ptr_queue, run_enqueue_dequeue_ptr,
+    teardown_ptr_queue, 0, 1000000 },
+  { "update_alloc_map_is_offset_allocated", setup_alloc_map,
+    run_update_alloc_map, free, 0, 1000000 },
+  { "move_to_next_available_space_fragmented", setup_fragmented_heap,
+    run_move_to_next_available_space, teardown_heap, false, 1000 },
+  { "move_to_next_available_space_fragmented_indexed", setup_fragmented_heap,
+    run_move_to_next_available_space, teardown_heap, true, 1000 },
+  { "find_root_pointers_4096_words", setup_fake_stack, run_find_root_pointers,
+    teardown_fake_stack, 0, 1000 },
+  { "h_gc_live_0", setup_gc_heap, run_h_gc, teardown_gc_heap, 0, 20 },
+  { "h_gc_live_1000", setup_gc_heap, run_h_gc, teardown_gc_heap, 1000, 20 },
+  { "h_gc_live_5000", setup_gc_heap, run_h_gc, teardown_gc_heap, 5000, 20 },
+  { "h_gc_live_10000", setup_gc_heap, run_h_gc, teardown_gc_heap, 10000, 20 },
+  { "h_gc_precise_live_1000", setup_gc_precise_heap, run_h_gc_precise,
+    teardown_gc_heap, 1000, 20 },
+  { "h_gc_precise_live_10000", setup_gc_precise_heap, run_h_gc_precise,
+    teardown_gc_heap, 10000, 20 },
+  { "h_gc_semispace_live_1000", setup_gc_semispace_heap, run_h_gc,
+    teardown_gc_heap, 1000, 20 },
+  { "h_gc_semispace_live_10000", setup_gc_semispace_heap, run_h_gc,
+    teardown_gc_heap, 10000, 20 },
+  { "h_gc_step_live_10000", setup_gc_incremental_heap, run_h_gc_step,
+    teardown_gc_heap, 10000, 200 },
+  { "h_gc_wide_1_thread", setup_gc_wide_heap, run_h_gc, teardown_gc_heap, 1,
+    20 },
+  { "h_gc_wide_4_threads", setup_gc_wide_heap, run_h_gc, teardown_gc_heap, 4,
+    20 },
+  { "h_gc_retained_compacting", setup_gc_retained_heap, run_h_gc,
+    teardown_gc_heap, false, 20 },
+  { "h_gc_retained_sweeping", setup_gc_retained_heap, run_h_gc,
+    teardown_gc_heap, true, 20 },
+  { "h_gc_sparse_compacting", setup_gc_sparse_heap, run_h_gc,
+    teardown_gc_heap, 0, 20 },
+  { "h_gc_sparse_evacuating_8_pages", setup_gc_sparse_heap, run_h_gc,
+    teardown_gc_heap, 8, 20 },
+  { "alloc_temporaries_100000", setup_gc_temporaries_heap,
+    run_alloc_temporaries, teardown_gc_heap, 0, 5 },
+  { "alloc_temporaries_100000_nursery", setup_gc_temporaries_heap,
+    run_alloc_temporaries, teardown_gc_heap, 128 * 1024, 5 },
+  { "alloc_temporaries_100000_mark_region",
+    setup_mark_region_temporaries_heap, run_alloc_temporaries,
+    teardown_gc_heap, 8, 5 },
+  { "alloc_temporaries_100000_semispace", setup_semispace_temporaries_heap,
+    run_alloc_temporaries, teardown_gc_heap, 0, 5 },
+};
+
+/**
+ * Runs a benchmark BENCH_REPEATS times and writes the fastest run as a JSON
+ * object.
+ */
+static void
+run_benchmark (benchmark_t *bench, FILE *out, bool is_last)
+{
+  double best_ns_per_op = -1;
+  double allocations_per_op = 0;
+  for (int repeat = 0; repeat < BENCH_REPEATS; repeat++)
+    {
+      void *state = bench->setup != NULL ? bench->setup (bench->param) : NULL;
+
+      allocation_count = 0;
+      uint64_t start = now_ns ();
+      bench->run (state, bench->iterations);
+      uint64_t end = now_ns ();
+      size_t allocations = allocation_count;
+
+      if (bench->teardown != NULL)
+        {
+          bench->teardown (state);
+        }
+
+      double ns_per_op = (double)(end - start) / bench->iterations;
+      if (best_ns_per_op < 0 || ns_per_op < best_ns_per_op)
+        {
+          best_ns_per_op = ns_per_op;
+        }
+      allocations_per_op = (double)allocations / bench->iterations;
+    }
+
+  fprintf (out,
+           "    {\"name\": \"%s\", \"iterations\": %zu, \"ns_per_op\": %.3f, "
+           "\"allocations_per_op\": %.3f}%s\n",
+           bench->name, bench->iterations, best_ns_per_op, allocations_per_op,
+           is_last ? "" : ",");
+}
+
+int
+main (int argc, char *argv[])
+{
+  FILE *out = stdout;
+  if (argc > 1)
+    {
+      out = fopen (argv[1], "w");
+      if (out == NULL)
+        {
+          perror (argv[1]);
+          return 1;
+        }
+    }
+
+  size_t count = sizeof (benchmarks) / sizeof (benchmarks[0]);
+  fprintf (out, "{\n  \"repeats\": %d,\n  \"benchmarks\": [\n",
+           BENCH_REPEATS);
+  for (size_t i = 0; i < count; i++)
+    {
+      run_benchmark (&benchmarks[i], out, i + 1 == count);
+    }
+  fprintf (out, "  ]\n}\n");
+
+  if (out != stdout)
+    {
+      fclose (out);
+    }
+  return 0;
+}
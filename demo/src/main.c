@@ -8,8 +8,14 @@ int
 main (void)
 {
   // Initialize the heap with a specified size (e.g., 1024 bytes), set stack as
-  // unsafe, and set a GC threshold.
-  h_init (1024 * 1024 * 4, true, 0.75f);
+  // unsafe, and set a GC threshold. The catalogue is long-lived, so the heap
+  // is swept and only compacted once half of its free memory is fragmented.
+  heap_options_t options = { .bytes = 1024 * 1024 * 4,
+                             .unsafe_stack = true,
+                             .gc_threshold = 0.75f,
+                             .gc_threads = 1,
+                             .fragmentation_threshold = 0.5f };
+  h_init_with_options (&options);
 
   // Create the webstore using the heap memory.
   webstore_t *store = ioopm_create_webstore ();
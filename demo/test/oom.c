@@ -1,5 +1,6 @@
 #include <stdlib.h>
 
+#include "../../src/gc.h"
 #include "oom.h"
 
 /// @brief Remaing calls before malloc return NULL
@@ -15,6 +16,9 @@ extern void *__real_malloc (size_t size);
 extern void *__real_calloc (size_t count, size_t size);
 extern void *__real_h_alloc_struct (heap_t *h, char *layout);
 extern void *__real_h_alloc_raw (heap_t *h, size_t bytes);
+extern void *__real_h_alloc_layout (heap_t *h, layout_handle_t handle);
+extern void *__real_h_alloc_array (heap_t *h, layout_handle_t element,
+                                   size_t length);
 extern void __real_free (void *ptr);
 
 #define wrap_allocation(real_method_with_args)                                \
@@ -60,6 +64,20 @@ __wrap_h_alloc_raw (heap_t *h, size_t bytes)
   wrap_allocation (__real_h_alloc_raw (h, bytes));
 }
 
+/// @brief Allows for simulated failure of h_alloc_layout
+void *
+__wrap_h_alloc_layout (heap_t *h, layout_handle_t handle)
+{
+  wrap_allocation (__real_h_alloc_layout (h, handle));
+}
+
+/// @brief Allows for simulated failure of h_alloc_array
+void *
+__wrap_h_alloc_array (heap_t *h, layout_handle_t element, size_t length)
+{
+  wrap_allocation (__real_h_alloc_array (h, element, length));
+}
+
 /// @brief Normal free function, no changes made
 /// @param ptr to location in the heap to free
 void
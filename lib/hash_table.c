@@ -1,5 +1,4 @@
 #include <assert.h>
-#include <stdio.h>
 #include <stdlib.h>
 
 #include "../src/gc.h"
@@ -7,6 +6,7 @@
 #include "hash_table.h"
 #include "iterator.h"
 #include "linked_list.h"
+#include "utils.h"
 
 /**
  * A key-value pair
@@ -120,7 +120,9 @@ ioopm_create_hash_table (ioopm_hash_table_t **return_ht, size_t bucket_count,
     }
 
   // Allocate memory for hash table
-  *return_ht = h_alloc_struct (global_heap, "ll*lll");
+  static layout_handle_t table_layout = INVALID_LAYOUT;
+  *return_ht
+      = h_alloc_layout (global_heap, lazy_layout (&table_layout, "ll*lll"));
 
   // Check if allocation worked
   if (*return_ht == NULL)
@@ -130,10 +132,9 @@ ioopm_create_hash_table (ioopm_hash_table_t **return_ht, size_t bucket_count,
       return MEMORY_ALLOCATION_FAILURE;
     }
 
-  // Assume bucket_count < 1 000 000 000
-  char format_string[10];
-  sprintf (format_string, "%ld*", bucket_count);
-  bucket_t *bucket_array = h_alloc_struct (global_heap, format_string);
+  static layout_handle_t bucket_layout = INVALID_LAYOUT;
+  bucket_t *bucket_array = h_alloc_array (
+      global_heap, lazy_layout (&bucket_layout, "*"), bucket_count);
 
   // Check if allocation worked
   if (bucket_array == NULL)
@@ -180,7 +181,8 @@ ioopm_hash_table_insert (ioopm_hash_table_t *ht, const elem_t key,
   link_t *new_head = create_link (key, value, head);
 
   // Update hash table array to point to the new head
-  ht->buckets[get_index (ht, key)] = new_head;
+  h_write_ptr (ht->buckets, (void **)&ht->buckets[get_index (ht, key)],
+               new_head);
 
   // Increment hash table metadata for the total number of keys
   update_key_count (&ht, 1);
@@ -290,7 +292,8 @@ ioopm_hash_table_remove (ioopm_hash_table_t *ht, const elem_t key)
     {
       // remove link
       link_t *to_unlink = *prev;
-      *prev = to_unlink->next;
+      // prev is a field of either the bucket array or a link
+      h_write_ptr (prev, (void **)prev, to_unlink->next);
       // free (to_unlink);
 
       // Update hash table key_count metadata
@@ -561,6 +564,9 @@ ioopm_hash_table_apply_to_all (ioopm_hash_table_t *ht,
         {
           link_t *next_link = link_ptr->next;
           apply_fun (get_key (link_ptr), get_value_ptr (link_ptr), arg);
+          // The function may have stored a new pointer in the value
+          elem_t *value = get_value_ptr (link_ptr);
+          h_write_ptr (link_ptr, &value->pointer, value->pointer);
           link_ptr = next_link; // Go to next link
         }
     }
@@ -576,7 +582,9 @@ ioopm_hash_table_apply_to_all (ioopm_hash_table_t *ht,
 static void
 update_value (link_t *link_ptr, void *new_value)
 {
-  get_key_value_pair (link_ptr)->value = *((elem_t *)new_value);
+  key_value_pair_t *pair = get_key_value_pair (link_ptr);
+  h_write_ptr (link_ptr, &pair->value.pointer,
+               ((elem_t *)new_value)->pointer);
 }
 
 /**
@@ -715,7 +723,9 @@ get_linked_list_head (const ioopm_hash_table_t *ht, const elem_t key)
 static link_t *
 create_link (const elem_t key, const elem_t value, link_t *next)
 {
-  link_t *new_link = h_alloc_struct (global_heap, "***");
+  static layout_handle_t link_layout = INVALID_LAYOUT;
+  link_t *new_link
+      = h_alloc_layout (global_heap, lazy_layout (&link_layout, "***"));
   *new_link = (link_t){ .key_value_pair.key = key,
                         .key_value_pair.value = value,
                         .next = next };
@@ -843,7 +853,9 @@ initialize_hash_table (ioopm_hash_table_t **ht, bucket_t *bucket_array,
                        ioopm_eq_function *key_eq_check,
                        ioopm_eq_function *value_eq_check)
 {
-  (*ht)->buckets = bucket_array;
+  // The bucket array may have been allocated after a collection promoted
+  // the table
+  h_write_ptr (*ht, (void **)&(*ht)->buckets, bucket_array);
   (*ht)->bucket_count = bucket_count;
   (*ht)->key_count = 0;
   (*ht)->hash_func = hash_func;
@@ -903,6 +915,6 @@ hash_table_resize (ioopm_hash_table_t **ht, ioopm_hash_function *hash_func,
   (*ht)->bucket_count = new_table->bucket_count;
   (*ht)->key_count = new_table->key_count;
   // free ((*ht)->buckets);
-  (*ht)->buckets = new_table->buckets;
+  h_write_ptr (*ht, (void **)&(*ht)->buckets, new_table->buckets);
   // free (new_table);
 }
\ No newline at end of file
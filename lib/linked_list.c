@@ -4,6 +4,7 @@
 #include "common.h"
 #include "iterator.h"
 #include "linked_list.h"
+#include "utils.h"
 
 typedef struct node node_t;
 struct node
@@ -51,7 +52,9 @@ ioopm_linked_list_create (ioopm_list_t **return_list,
 #ifdef linked_list_use_malloc
   *return_list = calloc (1, sizeof (ioopm_list_t));
 #else
-  *return_list = h_alloc_struct (global_heap, "**ll");
+  static layout_handle_t list_layout = INVALID_LAYOUT;
+  *return_list
+      = h_alloc_layout (global_heap, lazy_layout (&list_layout, "**ll"));
 #endif
 
   if (*return_list == NULL)
@@ -387,6 +390,9 @@ ioopm_linked_list_apply_to_all (ioopm_list_t *list, ioopm_apply_function *fun,
       // This allows the function destroy node without issue.
       node_t *next = node_ptr->next;
       fun (&(node_ptr->entry), extra);
+      // The function may have stored a new pointer in the entry
+      h_write_ptr (node_ptr, &node_ptr->entry.pointer,
+                   node_ptr->entry.pointer);
       // Set next to be the new current
       node_ptr = next;
     }
@@ -421,7 +427,9 @@ create_node (node_t **return_new_node, const elem_t entry, const node_t *next)
 #ifdef linked_list_use_malloc
   *return_new_node = calloc (1, sizeof (node_t));
 #else
-  *return_new_node = h_alloc_struct (global_heap, "**");
+  static layout_handle_t node_layout = INVALID_LAYOUT;
+  *return_new_node
+      = h_alloc_layout (global_heap, lazy_layout (&node_layout, "**"));
 #endif
   if (*return_new_node == NULL)
     {
@@ -485,13 +493,13 @@ insert_at_index (ioopm_list_t *list, const size_t index, const elem_t element,
     {
       return MEMORY_ALLOCATION_FAILURE;
     }
-  (*prev)->next = new_node;
+  h_write_ptr (*prev, (void **)&(*prev)->next, new_node);
 
   // Check if we are inserting at the end of the list
   if (size == index)
     {
       // Update our last pointer to point to our new node
-      list->last = (*prev)->next;
+      h_write_ptr (list, (void **)&list->last, (*prev)->next);
     }
   return SUCCESS;
 }
@@ -527,9 +535,9 @@ insert_at_head (ioopm_list_t *list, const elem_t element, size_t size)
         {
           return MEMORY_ALLOCATION_FAILURE;
         }
-      list->last = new_node;
+      h_write_ptr (list, (void **)&list->last, new_node);
     }
-  list->first = new_node;
+  h_write_ptr (list, (void **)&list->first, new_node);
   return SUCCESS;
 }
 
@@ -561,13 +569,13 @@ remove_at_index (elem_t *return_removed, ioopm_list_t *list, size_t size,
   *return_removed = to_unlink->entry;
 
   // unlink previous from removal target
-  (*prev)->next = to_unlink->next;
+  h_write_ptr (*prev, (void **)&(*prev)->next, to_unlink->next);
 
   // check if removal target is our last link
   if (index == (size - 1))
     {
       // Relink list->last to the one before
-      list->last = *prev;
+      h_write_ptr (list, (void **)&list->last, *prev);
     }
 
 // Free memory of removal target
@@ -600,7 +608,7 @@ remove_at_head (elem_t *return_removed, ioopm_list_t *list, size_t size)
     {
       // We have more links,
       // Replace first link with the next link
-      list->first = to_unlink->next;
+      h_write_ptr (list, (void **)&list->first, to_unlink->next);
     }
   else
     {
@@ -656,8 +664,9 @@ list_iterator_next (elem_t *return_next, void *internal_data_struct)
   bool has_next = false;
   if (list_iterator_has_next (&has_next, list_iter) == SUCCESS && has_next)
     {
-      list_iter->current = list_iter->next;
-      list_iter->next = list_iter->next->next;
+      h_write_ptr (list_iter, (void **)&list_iter->current, list_iter->next);
+      h_write_ptr (list_iter, (void **)&list_iter->next,
+                   list_iter->next->next);
 
       // increment current index
       list_iter->index++;
@@ -774,7 +783,7 @@ list_iterator_reset (void *internal_data_struct)
   list_iterator_t *list_iter = cast_to_list_iter (internal_data_struct);
 
   list_iter->current = NULL;
-  list_iter->next = list_iter->list->first;
+  h_write_ptr (list_iter, (void **)&list_iter->next, list_iter->list->first);
   list_iter->index = -1;
 
   return SUCCESS;
@@ -860,7 +869,9 @@ initialize_list_iterator (list_iterator_t **list_iter, ioopm_list_t *list)
 #ifdef linked_list_use_malloc
   *list_iter = calloc (1, sizeof (list_iterator_t));
 #else
-  *list_iter = h_alloc_struct (global_heap, "***l");
+  static layout_handle_t iterator_layout = INVALID_LAYOUT;
+  *list_iter
+      = h_alloc_layout (global_heap, lazy_layout (&iterator_layout, "***l"));
 #endif
   if (*list_iter == NULL)
     {
@@ -17,11 +17,21 @@ heap_strdup (const char *str)
   char *copy = (char *)h_alloc_raw (global_heap, len);
   if (copy != NULL)
     {
-      strncpy (copy, str, len);
+      memcpy (copy, str, len);
     }
   return copy;
 }
 
+layout_handle_t
+lazy_layout (layout_handle_t *handle, char *format)
+{
+  if (*handle == INVALID_LAYOUT)
+    {
+      *handle = h_register_layout (global_heap, format);
+    }
+  return *handle;
+}
+
 bool
 not_empty (char *str)
 {
@@ -10,12 +10,23 @@
 #include <stdbool.h>
 #include <string.h>
 
+#include "../src/gc.h"
 #include "../src/heap.h"
 #include "common.h"
 
 extern char *strdup (const char *);
 char *heap_strdup (const char *str);
 
+/**
+ * @brief Registers a layout with the global heap the first time it is used.
+ * @param handle where the handle is kept between calls, INVALID_LAYOUT until
+ * the layout is registered
+ * @param format the format string of the layout
+ * @return the handle of the layout, or INVALID_LAYOUT if it could not be
+ * registered
+ */
+layout_handle_t lazy_layout (layout_handle_t *handle, char *format);
+
 typedef bool check_func (char *);
 
 typedef elem_t convert_func (char *);
@@ -14,25 +14,24 @@
 
 #include "allocation.h"
 #include "allocation_map.h"
+#include "blacklist.h"
 #include "format_encoding.h"
+#include "free_lists.h"
+#include "free_run_index.h"
 #include "gc.h"
 #include "gc_utils.h"
 #include "get_header.h"
 #include "header.h"
 #include "heap.h"
 #include "heap_internal.h"
+#include "layout.h"
+#include "mark_map.h"
+#include "mark_region.h"
+#include "mutators.h"
+#include "nursery.h"
 #include "page_map.h"
-
-/**
- * Finds the end address of the heap.
- * @param h the heap
- * @return the end address of the heap
- */
-char *
-find_heap_end (heap_t *h)
-{
-  return ((char *)h->heap_start) + h->size;
-}
+#include "semispace.h"
+#include "start_map.h"
 
 /**
  * Calculates the size of an allocation
@@ -57,6 +56,10 @@ calc_alloc_size (char *alloc)
       assert (success);
       return size;
     }
+  else if (header_type == HEADER_LAYOUT_INDEX)
+    {
+      return get_layout_object_size (header);
+    }
   else
     {
       assert (false); /* Any other formats should not appear at this point.  */
@@ -75,12 +78,17 @@ void
 trigger_gc_on_threshold_reached (heap_t *h, size_t new_alloc_size)
 {
   size_t size_after_alloc = h_used (h) + new_alloc_size;
-  double_t usage_percentage = ((double_t)size_after_alloc / h->size);
+  /* Only one half of a semispace heap is allocated in at a time */
+  size_t usable_size = h->semispace != NULL
+                           ? get_semispace_bytes (h->semispace)
+                           : h->size;
+  double_t usage_percentage = ((double_t)size_after_alloc / usable_size);
   if (usage_percentage >= h->gc_threshold)
     {
       /* Check if the percentage of memory used after allocation would exceed
-         the threshold. If so, trigger garbage collection before allocating. */
-      h_gc (h);
+         the threshold. If so, trigger garbage collection before allocating,
+         or a slice of it if the heap is marked incrementally.  */
+      h_gc_step (h);
     }
 }
 
@@ -98,6 +106,11 @@ make_alloc (heap_t *h, size_t alloc_size)
   memset (allocated, 0, alloc_size); /* Sets the newly allocated memory to be
                                         set to 0, much like calloc.  */
   h->used_bytes += alloc_size; /* Updates the number of used bytes variable. */
+  if (h->nursery != NULL)
+    {
+      /* Small objects are only allocated on young pages with a nursery */
+      count_young_bytes (h->nursery, alloc_size);
+    }
 
   /* Move bump pointer by the allocation size so that its new address is the
      next free area.  */
@@ -105,105 +118,188 @@ make_alloc (heap_t *h, size_t alloc_size)
   return allocated;
 }
 
+static bool find_large_object_space (heap_t *h, size_t total_alloc_size,
+                                     size_t *offset);
+
 /**
- * Checks if the requested allocation would not overwrite any data on the heap.
- * Used to avoid overwriting data in pages that could not be compacted.
- * @param h the heap to check within
- * @param total_alloc_size the requested allocation size (including header)
- * @note modifies fits to be true if the allocation can be allocated without
- * issues
+ * Moves the bump pointer to room for an allocation on the young page
+ * currently allocated on, or on a new empty page made young. A minor
+ * collection is run first if the nursery has no room for another page, and
+ * a full collection if the heap has no empty page left.
+ * @param h the heap, which has a nursery
+ * @param total_alloc_size the size of the allocation (including header)
+ * @return true if room was found
  */
-size_t
-does_alloc_fit (heap_t *h, size_t total_alloc_size, bool *fits)
+static bool
+move_to_nursery_space (heap_t *h, size_t total_alloc_size)
 {
-  *fits = true;
-  char *alloc_map = (char *)h->alloc_map;
-  size_t start_offset = calc_heap_offset (h->next_empty_mem_segment, h);
-  for (size_t offsets_to_move = 0; offsets_to_move < total_alloc_size;
-       offsets_to_move += HEAP_ALIGNMENT)
+  size_t offset = calc_heap_offset (h->next_empty_mem_segment, h);
+  if (has_nursery_space (h->nursery, offset, total_alloc_size))
     {
-      if (start_offset + offsets_to_move >= h->size)
-        {
-          return 0;
-        }
-      bool is_occupied
-          = is_offset_allocated (alloc_map, start_offset + offsets_to_move);
-      if (is_occupied)
+      return true;
+    }
+
+  if (is_nursery_full (h->nursery))
+    {
+      h_gc_minor (h);
+    }
+  /* Empty pages are searched for from the bump pointer onwards, so that
+     pages filled since the start of the heap are not searched again for
+     every new young page.  */
+  if (!find_large_object_space (h, h->page_size, &offset))
+    {
+      offset = 0;
+      if (!find_large_object_space (h, h->page_size, &offset))
         {
-          *fits = false;
-          return offsets_to_move + 1;
+          /* Promoted pages are not compacted until a full collection */
+          h_gc (h);
+          offset = 0;
+          if (!find_large_object_space (h, h->page_size, &offset))
+            {
+              return false;
+            }
         }
     }
-  return 0;
+
+  add_young_page (h->nursery, offset);
+  h->next_empty_mem_segment = (char *)h->heap_start + offset;
+  return true;
 }
 
 /**
- * Move to start of next page if allocation would cross into the next page.
- * @param h the heap to move within
+ * Moves the bump pointer to room for an allocation in the half of the heap
+ * allocated in. If the half is full its survivors are copied to the other
+ * half first, which leaves all of the rest of that half free.
+ * @param h the heap, which is split in two halves
  * @param total_alloc_size the requested allocation size (including header)
- * @return true if a skip was performed, otherwise false
+ * @return true if room was found
  */
-bool
-skip_on_page_overlap (heap_t *h, size_t total_alloc_size)
+static bool
+move_to_semispace_room (heap_t *h, size_t total_alloc_size)
 {
-  /* Move to start of next page if allocation would cross into the next page.
-   */
-  size_t offset = calc_heap_offset (h->next_empty_mem_segment, h);
-  size_t bytes_remaining_on_page = bytes_from_next_page (h->page_size, offset);
-  if (bytes_remaining_on_page < total_alloc_size)
+  size_t offset = 0;
+  if (!take_semispace_room (h->semispace, h->alloc_map, total_alloc_size,
+                            &offset))
     {
-      /* Move to the start of the next page.  */
-      h->next_empty_mem_segment += bytes_remaining_on_page;
-      return true;
+      h_gc (h);
+      if (!take_semispace_room (h->semispace, h->alloc_map,
+                                total_alloc_size, &offset))
+        {
+          return false;
+        }
     }
-  return false;
+  h->next_empty_mem_segment = (char *)h->heap_start + offset;
+  return true;
 }
 
 /**
- * Checks if the bump pointer has exceeded the end of the heap or not.
- * @param h the heap
- * @return true if the bump pointer has not exceeded the end of the heap
+ * Moves the bump pointer to the first room for an allocation from an offset
+ * onwards, in the holes indexed by the last garbage collection if there is
+ * an index and by searching the allocation map otherwise.
+ * @param h the heap, which is neither swept into free lists nor split into
+ * lines or halves
+ * @param total_alloc_size the requested allocation size (including header)
+ * @param avoid_blacklisted true to skip the pages false pointers were found
+ * to point into, remembering the room skipped
+ * @param offset the heap offset to search from
+ * @return true if room was found
  */
-bool
-is_bump_pointer_in_heap (heap_t *h)
+static bool
+find_small_object_space (heap_t *h, size_t total_alloc_size,
+                         bool avoid_blacklisted, size_t offset)
 {
-  char *heap_end = find_heap_end (h);
-  return h->next_empty_mem_segment < heap_end;
+  while (offset < h->size)
+    {
+      if (h->free_runs != NULL)
+        {
+          /* Holes in the index never cross a page, so the first one found
+             can be used as is.  */
+          if (!find_free_run (h->free_runs, total_alloc_size, &offset))
+            {
+              return false;
+            }
+        }
+      else
+        {
+          /* Jump straight to the next free range large enough for the
+             allocation, the allocation map is searched a word at a time.  */
+          if (!find_free_range (h->alloc_map, h->size, total_alloc_size,
+                                &offset))
+            {
+              /* Memory would exceed available heap memory even after GC! */
+              return false;
+            }
+
+          /* Moves to the next page if allocation would overlap.  */
+          size_t bytes_remaining_on_page
+              = bytes_from_next_page (h->page_size, offset);
+          if (bytes_remaining_on_page < total_alloc_size)
+            {
+              offset += bytes_remaining_on_page;
+              continue;
+            }
+        }
+
+      if (avoid_blacklisted
+          && is_range_blacklisted (h->blacklist, offset, total_alloc_size))
+        {
+          /* Something on the stack points here, and would keep whatever is
+             allocated here alive.  */
+          skip_blacklisted_offset (h->blacklist, offset);
+          offset += bytes_from_next_page (h->page_size, offset);
+          continue;
+        }
+      h->next_empty_mem_segment = (char *)h->heap_start + offset;
+      return true;
+    }
+  return false;
 }
 
 bool
 move_to_next_available_space (heap_t *h, size_t total_alloc_size)
 {
-  bool is_available = false;
-  while (!is_available && is_bump_pointer_in_heap (h))
-    {
-      /* Loops until an available space is found or the bump pointer has
-         exceeded the heap.
-         Checks if another allocation occupies the targeted area.  */
-      bool alloc_fits = true;
-      size_t bytes_to_move = does_alloc_fit (h, total_alloc_size, &alloc_fits);
-      if (!alloc_fits)
+  if (h->semispace != NULL)
+    {
+      return move_to_semispace_room (h, total_alloc_size);
+    }
+  if (h->nursery != NULL)
+    {
+      return move_to_nursery_space (h, total_alloc_size);
+    }
+
+  size_t offset = 0;
+  if (h->mark_region != NULL)
+    {
+      /* Holes between marked lines never cross a page either.  */
+      if (!take_line_space (h->mark_region, total_alloc_size, &offset))
         {
-          h->next_empty_mem_segment += bytes_to_move;
-          /* Go to next iteration to check if alloc fits in next space.  */
-          continue;
+          return false;
         }
+      h->next_empty_mem_segment = (char *)h->heap_start + offset;
+      return true;
+    }
 
-      /* Moves to the next page if allocation would overlap.  */
-      bool moved = skip_on_page_overlap (h, total_alloc_size);
-      is_available = !moved;
+  offset = calc_heap_offset (h->next_empty_mem_segment, h);
+  if (h->free_lists != NULL)
+    {
+      /* The heap was swept, take the room from the chunk of the smallest
+         size class that fits.  */
+      if (!take_free_chunk (h->free_lists, h->alloc_map, total_alloc_size,
+                            &offset))
+        {
+          return false;
+        }
+      h->next_empty_mem_segment = (char *)h->heap_start + offset;
+      return true;
     }
 
-  /* Lastly check that making an allocation here would not exceed the heap
-     space.  */
-  char *next_segment_after_alloc
-      = h->next_empty_mem_segment + total_alloc_size;
-  if (is_available && next_segment_after_alloc > find_heap_end (h))
+  if (find_small_object_space (h, total_alloc_size, true, offset))
     {
-      /* Memory would exceed available heap memory even after GC! */
-      return false;
+      return true;
     }
-  return is_available;
+  /* Only room on blacklisted pages is left, go back to the first skipped */
+  return find_skipped_offset (h->blacklist, &offset)
+         && find_small_object_space (h, total_alloc_size, false, offset);
 }
 
 size_t
@@ -220,7 +316,8 @@ align_alloc_size (size_t alloc_size)
 }
 
 /**
- * Updates the allocation map for all bytes in the allocation.
+ * Updates the allocation map for all bytes in the allocation, and records
+ * where it starts in the start map.
  * @param h the heap in which the allocation was made.
  * @param allocation_start the pointer to the start of the allocation
  * @param alloc_size
@@ -233,15 +330,19 @@ update_alloc_map_for_allocation (heap_t *h, void *allocation_start,
           && "Allocation's start address is before start of the heap!");
   size_t alloc_offset = calc_heap_offset (allocation_start, h);
   size_t start_alloc_offset = alloc_offset - sizeof (header_t);
-  size_t end_alloc_offset = alloc_offset + alloc_size;
 
-  /* Loops through each 16 bytes in the allocated space and set its
-    corresponding bit in the allocation map to 1.  */
-  for (size_t offset = start_alloc_offset; offset < end_alloc_offset;
-       offset += HEAP_ALIGNMENT)
-    {
-      update_alloc_map (h->alloc_map, offset, true);
-    }
+  /* Set the bits of every 16 bytes in the allocated space, including the
+     header, to 1 in the allocation map.  */
+  update_alloc_map_range (h->alloc_map, start_alloc_offset,
+                          alloc_size + sizeof (header_t), true);
+  record_object_start (h->start_map, start_alloc_offset,
+                       alloc_size + sizeof (header_t));
+}
+
+bool
+is_large_alloc (heap_t *h, size_t alloc_size)
+{
+  return alloc_size + sizeof (header_t) > h->page_size;
 }
 
 /**
@@ -249,17 +350,16 @@ update_alloc_map_for_allocation (heap_t *h, void *allocation_start,
  * heap if threshold is reached. If allocation is possible the bump pointer is
  * moved to the next available space.
  * @param h the heap
- * @param alloc_size the requested allocation size
+ * @param alloc_size the requested allocation size (excluding header)
  * @return true if the allocation is possible.
  */
 bool
 move_to_valid_space_if_alloc_possible (heap_t *h, size_t alloc_size)
 {
   size_t alloc_size_with_metadata = alloc_size + sizeof (header_t);
-  if (alloc_size_with_metadata > h->page_size)
+  if (alloc_size_with_metadata > h->page_size && h->semispace == NULL)
     {
-      /* Allocation is too large!
-         abort();  */
+      /* Too large to share a page, belongs in the large object space.  */
       return false;
     }
   /* Trigger gc if threshold would be reached when allocation is finished.  */
@@ -271,37 +371,160 @@ move_to_valid_space_if_alloc_possible (heap_t *h, size_t alloc_size)
   return space_found;
 }
 
-void *
-alloc_struct (heap_t *h, char *layout)
+/**
+ * Finds the first range of free memory large enough for a large object that
+ * starts at a page boundary. Ranges covering a page false pointers were
+ * found to point into are skipped, unless no other range is left.
+ * @param h the heap
+ * @param total_alloc_size the size of the allocation (including header size)
+ * @param offset the offset to search from, set to the offset of the range if
+ * one was found
+ * @return true if a range was found
+ */
+static bool
+find_large_object_space (heap_t *h, size_t total_alloc_size, size_t *offset)
 {
-  bool calc_size_success = false;
-  int_fast64_t alloc_size = size_from_string (layout, &calc_size_success);
-  if (!calc_size_success)
+  size_t blacklisted_offset = h->size;
+  size_t candidate
+      = ((*offset + h->page_size - 1) / h->page_size) * h->page_size;
+  while (find_free_range (h->alloc_map, h->size, total_alloc_size,
+                          &candidate))
     {
-      /* abort();  */
-      return NULL;
+      size_t page_start = ((candidate + h->page_size - 1) / h->page_size)
+                          * h->page_size;
+      if (page_start != candidate)
+        {
+          /* Free range does not start on a page, retry from the next
+             page.  */
+          candidate = page_start;
+        }
+      else if (is_range_blacklisted (h->blacklist, candidate,
+                                     total_alloc_size))
+        {
+          if (blacklisted_offset == h->size)
+            {
+              blacklisted_offset = candidate;
+            }
+          candidate += h->page_size;
+        }
+      else
+        {
+          *offset = candidate;
+          return true;
+        }
     }
 
-  alloc_size
-      = align_alloc_size (alloc_size); /* Align size to minimum alignment.  */
+  if (blacklisted_offset == h->size)
+    {
+      return false;
+    }
+  *offset = blacklisted_offset;
+  return true;
+}
 
-  bool header_success = false;
-  header_t header = create_header_struct (layout, alloc_size, &header_success);
-  if (get_header_type (header) == HEADER_POINTER_TO_FORMAT_STRING)
+/**
+ * Marks a new object black if the heap is being marked incrementally, so
+ * that it survives the collection without being traced. Its fields are
+ * still empty, so it holds nothing to trace. Only done once the object is
+ * complete, as a marking thread may scan any marked object.
+ * @param h the heap
+ * @param header_offset the heap offset of the header of the object
+ */
+static void
+mark_if_marking (heap_t *h, size_t header_offset)
+{
+  if (h->incremental_mark != NULL)
+    {
+      /* Atomically, as a marking thread may set bits of the same byte */
+      try_mark_offset (h->mark_map, header_offset);
+    }
+}
+
+/**
+ * Allocates an object larger than a page in its own extent of whole pages.
+ * The bump pointer is not moved, small objects keep filling the space around
+ * large objects, and compacting never moves a large object.
+ * @param h the heap
+ * @param header the header of the object
+ * @param alloc_size the size of the object (excluding header)
+ * @return the allocated object, or NULL if no extent was free
+ */
+static void *
+alloc_large_object (heap_t *h, header_t header, size_t alloc_size)
+{
+  size_t alloc_size_with_metadata = alloc_size + sizeof (header_t);
+
+  /* Trigger gc if threshold would be reached when allocation is finished.  */
+  trigger_gc_on_threshold_reached (h, alloc_size_with_metadata);
+
+  size_t offset = 0;
+  if (!find_large_object_space (h, alloc_size_with_metadata, &offset))
     {
-      /* Add 1 because strlen does not count null.  */
-      char *allocated_layout = alloc_raw (h, strlen (layout) + 1);
-      if (allocated_layout == NULL)
+      if (h->incremental_mark == NULL)
         {
           return NULL;
         }
-      strcpy (allocated_layout, layout);
-      header = change_pointer_in_header (header, allocated_layout);
-      header = set_header_pointer_to_format_string(header);
+      /* Marking is not done yet, so nothing has been freed.  */
+      h_gc (h);
+      offset = 0;
+      if (!find_large_object_space (h, alloc_size_with_metadata, &offset))
+        {
+          return NULL;
+        }
+    }
+
+  /* The extent may cover holes ahead of the bump pointer, search the
+     allocation map until the next GC indexes the holes again.  */
+  destroy_free_run_index (h->free_runs);
+  h->free_runs = NULL;
+  if (h->free_lists != NULL)
+    {
+      /* Chunks already swept may overlap the extent.  */
+      reset_free_lists (h->free_lists);
+    }
+
+  header_t *header_ptr = (header_t *)((char *)h->heap_start + offset);
+  *header_ptr = header;
+  void *allocation = header_ptr + 1;
+  update_alloc_map_for_allocation (h, allocation, alloc_size);
+  if (h->mark_region != NULL)
+    {
+      /* The extent may cover lines ahead of the cursors.  */
+      mark_extent (h->mark_region, offset, alloc_size_with_metadata);
+    }
+
+  memset (allocation, 0, alloc_size);
+  h->used_bytes += alloc_size;
+  mark_if_marking (h, offset);
+  return allocation;
+}
+
+/**
+ * Places an allocation with the given header in the heap, in the large
+ * object space if it does not fit in a page and at the bump pointer
+ * otherwise.
+ * @param h the heap
+ * @param header the header of the object
+ * @param alloc_size the aligned size of the object (excluding header)
+ * @return the allocated object, or NULL if there was no space for it
+ */
+static void *
+alloc_in_heap (heap_t *h, header_t header, size_t alloc_size)
+{
+  /* Large objects are copied like any other in a semispace heap */
+  if (is_large_alloc (h, alloc_size) && h->semispace == NULL)
+    {
+      return alloc_large_object (h, header, alloc_size);
     }
 
-  bool is_alloc_possible = move_to_valid_space_if_alloc_possible (
-      h, alloc_size + sizeof (header_t));
+  bool is_alloc_possible = move_to_valid_space_if_alloc_possible (h, alloc_size);
+  if (!is_alloc_possible && h->incremental_mark != NULL)
+    {
+      /* Marking is not done yet, so nothing has been freed.  */
+      h_gc (h);
+      is_alloc_possible
+          = move_to_valid_space_if_alloc_possible (h, alloc_size);
+    }
   if (!is_alloc_possible)
     {
       /* abort();  */
@@ -314,7 +537,174 @@ alloc_struct (heap_t *h, char *layout)
   /* Makes allocation and moves bump pointer.  */
   update_alloc_map_for_allocation (h, h->next_empty_mem_segment, alloc_size);
 
-  return make_alloc (h, alloc_size);
+  void *allocation = make_alloc (h, alloc_size);
+  mark_if_marking (h, calc_heap_offset (allocation, h) - sizeof (header_t));
+  return allocation;
+}
+
+/**
+ * Places an object in room taken from an allocation buffer. The room is
+ * already set in the allocation map and counted as used.
+ * @param h the heap
+ * @param offset the heap offset of the room
+ * @param header the header of the object
+ * @param alloc_size the aligned size of the object (excluding header)
+ * @return the allocated object
+ */
+static void *
+place_in_buffer (heap_t *h, size_t offset, header_t header,
+                 size_t alloc_size)
+{
+  header_t *header_ptr = (header_t *)((char *)h->heap_start + offset);
+  *header_ptr = header;
+  void *allocation = header_ptr + 1;
+  memset (allocation, 0, alloc_size);
+  set_object_start (h->start_map, offset);
+  mark_if_marking (h, offset);
+  return allocation;
+}
+
+/**
+ * Takes a new allocation buffer for a thread from the heap. The buffer is
+ * taken like an object of its size would be, so it never crosses a page,
+ * and is set in the allocation map and counted as used as a whole. Its
+ * bits in the start map are cleared, to be set as objects are placed.
+ * @param h the heap, locked by the thread
+ * @param self the thread, with its old buffer retired
+ * @return true if a buffer was found
+ */
+static bool
+refill_alloc_buffer (heap_t *h, mutator_t *self)
+{
+  if (!move_to_valid_space_if_alloc_possible (
+          h, ALLOC_BUFFER_SIZE - sizeof (header_t)))
+    {
+      return false;
+    }
+  size_t offset = calc_heap_offset (h->next_empty_mem_segment, h);
+  update_alloc_map_range (h->alloc_map, offset, ALLOC_BUFFER_SIZE, true);
+  clear_object_starts (h->start_map, offset, ALLOC_BUFFER_SIZE);
+  h->used_bytes += ALLOC_BUFFER_SIZE;
+  if (h->nursery != NULL)
+    {
+      count_young_bytes (h->nursery, ALLOC_BUFFER_SIZE);
+    }
+  h->next_empty_mem_segment += ALLOC_BUFFER_SIZE;
+  set_alloc_buffer (self, offset, ALLOC_BUFFER_SIZE);
+  return true;
+}
+
+/**
+ * Allocates an object for a registered thread. Small objects are bumped
+ * from the allocation buffer of the thread without taking any lock, the
+ * heap is only locked to take a new buffer or for larger objects.
+ * @param h the heap
+ * @param self the calling thread
+ * @param header the header of the object
+ * @param alloc_size the aligned size of the object (excluding header)
+ * @return the allocated object, or NULL if there was no space for it
+ */
+static void *
+alloc_for_mutator (heap_t *h, mutator_t *self, header_t header,
+                   size_t alloc_size)
+{
+  poll_safepoint (h->mutators, self);
+  size_t alloc_size_with_metadata = alloc_size + sizeof (header_t);
+  void *allocation = NULL;
+  if (alloc_size_with_metadata > MAX_BUFFERED_SIZE)
+    {
+      /* The buffer is kept for the small objects that follow */
+      lock_heap (h->mutators, self);
+      allocation = alloc_in_heap (h, header, alloc_size);
+      unlock_heap (h->mutators, self);
+      return allocation;
+    }
+
+  size_t offset = 0;
+  if (take_buffer_room (self, alloc_size_with_metadata, &offset))
+    {
+      return place_in_buffer (h, offset, header, alloc_size);
+    }
+
+  lock_heap (h->mutators, self);
+  h->used_bytes -= retire_alloc_buffer (self, h->alloc_map);
+  if (refill_alloc_buffer (h, self)
+      && take_buffer_room (self, alloc_size_with_metadata, &offset))
+    {
+      allocation = place_in_buffer (h, offset, header, alloc_size);
+    }
+  else
+    {
+      allocation = alloc_in_heap (h, header, alloc_size);
+    }
+  unlock_heap (h->mutators, self);
+  return allocation;
+}
+
+/**
+ * Allocates an object with the given header, in the allocation buffer of
+ * the calling thread if it is registered.
+ * @param h the heap
+ * @param header the header of the object
+ * @param alloc_size the aligned size of the object (excluding header)
+ * @return the allocated object, or NULL if there was no space for it
+ */
+static void *
+alloc_with_header (heap_t *h, header_t header, size_t alloc_size)
+{
+  mutator_t *self = get_current_mutator (h->mutators);
+  if (self != NULL)
+    {
+      return alloc_for_mutator (h, self, header, alloc_size);
+    }
+  return alloc_in_heap (h, header, alloc_size);
+}
+
+void *
+alloc_struct (heap_t *h, char *layout)
+{
+  bool calc_size_success = false;
+  int_fast64_t alloc_size = size_from_string (layout, &calc_size_success);
+  if (!calc_size_success)
+    {
+      /* abort();  */
+      return NULL;
+    }
+
+  alloc_size
+      = align_alloc_size (alloc_size); /* Align size to minimum alignment.  */
+
+  bool header_success = false;
+  header_t header = create_header_struct (layout, alloc_size, &header_success);
+  if (get_header_type (header) != HEADER_POINTER_TO_FORMAT_STRING)
+    {
+      return alloc_with_header (h, header, alloc_size);
+    }
+
+  /* Add 1 because strlen does not count null.  */
+  char *allocated_layout = alloc_raw (h, strlen (layout) + 1);
+  if (allocated_layout == NULL)
+    {
+      return NULL;
+    }
+  strcpy (allocated_layout, layout);
+  header = change_pointer_in_header (header, allocated_layout);
+  header = set_header_pointer_to_format_string (header);
+
+  /* Only the header will refer to the format string, so it is kept alive
+     through a collection run to make room for the object.  */
+  h_push_root (h, &allocated_layout);
+  void *allocation = alloc_with_header (h, header, alloc_size);
+  h_pop_roots (h, 1);
+  if (allocation != NULL
+      && (void *)allocated_layout != get_pointer_in_header (header))
+    {
+      /* The collection moved the format string */
+      header = change_pointer_in_header (header, allocated_layout);
+      *get_header_pointer (allocation)
+          = set_header_pointer_to_format_string (header);
+    }
+  return allocation;
 }
 
 void *
@@ -331,20 +721,30 @@ alloc_raw (heap_t *h, size_t alloc_size)
       return NULL;
     }
 
-  bool is_alloc_possible = move_to_valid_space_if_alloc_possible (
-      h, alloc_size + sizeof (header_t));
-  if (!is_alloc_possible)
+  return alloc_with_header (h, header, alloc_size);
+}
+
+void *
+alloc_layout (heap_t *h, layout_handle_t handle)
+{
+  if (!is_registered_layout (handle))
     {
-      /* abort();  */
       return NULL;
     }
 
-  /* Save the object's header metadata on the heap.  */
-  *((header_t *)h->next_empty_mem_segment) = header;
-  h->next_empty_mem_segment += sizeof (header_t);
+  return alloc_with_header (h, get_layout_header (handle),
+                            get_layout_size (handle));
+}
 
-  /* Makes allocation and moves bump pointer.  */
-  update_alloc_map_for_allocation (h, h->next_empty_mem_segment, alloc_size);
+void *
+alloc_array (heap_t *h, layout_handle_t element, size_t length)
+{
+  bool header_success = false;
+  header_t header = create_array_header (element, length, &header_success);
+  if (!header_success)
+    {
+      return NULL;
+    }
 
-  return make_alloc (h, alloc_size);
+  return alloc_with_header (h, header, calc_array_size (element, length));
 }
@@ -8,12 +8,23 @@
 #include <stdbool.h>
 #include <stdlib.h>
 
+#include "gc.h"
 #include "heap.h"
 
 size_t calc_alloc_size (char *alloc);
 
 bool move_to_valid_space_if_alloc_possible (heap_t *h, size_t alloc_size);
 
+/**
+ * Checks if an allocation is too large to share a page with other objects,
+ * such allocations are placed in the large object space. Large objects start
+ * at a page boundary, span as many pages as needed and are never moved.
+ * @param h the heap
+ * @param alloc_size the aligned size of the allocation (excluding header)
+ * @return true if the allocation belongs in the large object space
+ */
+bool is_large_alloc (heap_t *h, size_t alloc_size);
+
 /**
  * Allocate a new object on a heap with a given format string.
  *
@@ -46,6 +57,26 @@ void *alloc_struct (heap_t *h, char *layout);
  */
 void *alloc_raw (heap_t *h, size_t bytes);
 
+/**
+ * Allocate a new object on a heap with a registered layout.
+ *
+ * @param h the heap
+ * @param handle a handle returned by register_layout
+ * @return the newly allocated object, or NULL if the handle is not valid
+ */
+void *alloc_layout (heap_t *h, layout_handle_t handle);
+
+/**
+ * Allocate a new array on a heap.
+ *
+ * @param h the heap
+ * @param element a handle returned by register_layout for one element
+ * @param length the amount of elements
+ * @return the newly allocated array, or NULL if the handle is not valid or
+ * the array is too long
+ */
+void *alloc_array (heap_t *h, layout_handle_t element, size_t length);
+
 /**
  * Moves the bump pointer to the next available space that has room for the
  * allocation
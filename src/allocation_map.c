@@ -15,6 +15,7 @@
 #include <string.h>
 
 #include "allocation_map.h"
+#include "bitmap.h"
 #include "heap_internal.h"
 
 /* Creates an allocation map of a given amount of bytes. This size needs to be
@@ -28,12 +29,9 @@ create_allocation_map (size_t bytes)
   /* Bytes needs to be divisible evenly by BOOLEANS_PER_BYTE.  */
   assert (bytes % ALLOCATIONS_PER_BYTE == 0);
 
-  /* Calculate the smallest size needed to store the array
-  by adding BYTE_DENSITY - 1 and the dividing by BYTE_DENSITY
-  it will round up anything that is more than a multiple of
-  the BYTE_DENSITY constant. Lastly check so array size > 0 */
-  size_t size_of_array = (bytes + BYTE_DENSITY - 1) / BYTE_DENSITY;
-  size_of_array = size_of_array == 0 ? 1 : size_of_array;
+  /* Calculate the smallest size needed to store the array, rounded up to
+  whole words so the map can be scanned a word at a time.  */
+  size_t size_of_array = calc_bitmap_size (bytes / MIN_ALLOC_OBJECT_SIZE);
 
   /* Creation of allocation map  */
   char *heap_map = calloc (size_of_array, sizeof (char));
@@ -45,12 +43,9 @@ reset_allocation_map (heap_t *h)
 {
   size_t bytes = h->size;
 
-  /* Calculate the smallest size needed to store the array
-  by adding BYTE_DENSITY - 1 and the dividing by BYTE_DENSITY
-  it will round up anything that is more than a multiple of
-  the BYTE_DENSITY constant. Lastly check so array size > 0 */
-  size_t size_of_array = (bytes + BYTE_DENSITY - 1) / BYTE_DENSITY;
-  size_of_array = size_of_array == 0 ? 1 : size_of_array;
+  /* Calculate the smallest size needed to store the array, rounded up to
+  whole words so the map can be scanned a word at a time.  */
+  size_t size_of_array = calc_bitmap_size (bytes / MIN_ALLOC_OBJECT_SIZE);
 
   /* Creation of allocation map  */
   memset (h->alloc_map, 0, size_of_array);
@@ -105,3 +100,36 @@ is_offset_allocated (char *alloc_map, size_t offset)
   bool is_allocated = (byte & bitmask) == bitmask;
   return is_allocated;
 }
+
+void
+update_alloc_map_range (char *alloc_map, size_t offset, size_t bytes,
+                        bool is_allocated)
+{
+  size_t first = offset / MIN_ALLOC_OBJECT_SIZE;
+  size_t last = (offset + bytes + MIN_ALLOC_OBJECT_SIZE - 1)
+                / MIN_ALLOC_OBJECT_SIZE;
+  update_bit_range (alloc_map, first, last - first, is_allocated);
+}
+
+size_t
+count_allocated_bytes (char *alloc_map, size_t bytes)
+{
+  size_t granules = bytes / MIN_ALLOC_OBJECT_SIZE;
+  return count_set_bits (alloc_map, 0, granules) * MIN_ALLOC_OBJECT_SIZE;
+}
+
+bool
+find_free_range (char *alloc_map, size_t heap_bytes, size_t bytes,
+                 size_t *offset)
+{
+  size_t index = (*offset + MIN_ALLOC_OBJECT_SIZE - 1) / MIN_ALLOC_OBJECT_SIZE;
+  size_t run = (bytes + MIN_ALLOC_OBJECT_SIZE - 1) / MIN_ALLOC_OBJECT_SIZE;
+  run = run == 0 ? 1 : run;
+  if (!find_next_zero_run (alloc_map, heap_bytes / MIN_ALLOC_OBJECT_SIZE, run,
+                           &index))
+    {
+      return false;
+    }
+  *offset = index * MIN_ALLOC_OBJECT_SIZE;
+  return true;
+}
@@ -16,6 +16,9 @@
 /* Defines how much memory is represented by a boolean in the map.  */
 #define BOOLEANS_PER_BYTE 8
 
+/* Defines how many allocations a single byte of the map can represent.  */
+#define ALLOCATIONS_PER_BYTE BOOLEANS_PER_BYTE
+
 /* Defines how much memory is represented by a byte in the map.  */
 #define BYTE_DENSITY (MIN_ALLOC_OBJECT_SIZE * BOOLEANS_PER_BYTE)
 
@@ -67,3 +70,35 @@ void update_alloc_map (char *alloc_map, size_t offset, bool is_allocated);
 bool is_offset_allocated (char *alloc_map, size_t offset);
 
 void reset_allocation_map (heap_t *h);
+
+/**
+ * Sets the bits of every granule overlapping [offset, offset + bytes) in the
+ * allocation map, a word at a time.
+ * @param alloc_map - the allocation map
+ * @param offset - the heap offset of the first byte of the range
+ * @param bytes - the length of the range in bytes
+ * @param is_allocated - if the range should be marked as allocated or not
+ */
+void update_alloc_map_range (char *alloc_map, size_t offset, size_t bytes,
+                             bool is_allocated);
+
+/**
+ * Counts the allocated bytes in the allocation map using popcount.
+ * @param alloc_map - the allocation map
+ * @param bytes - the total amount of bytes the map represents
+ * @return the amount of bytes marked as allocated
+ */
+size_t count_allocated_bytes (char *alloc_map, size_t bytes);
+
+/**
+ * Finds the first free range of at least the given size that starts at or
+ * after offset.
+ * @param alloc_map - the allocation map
+ * @param heap_bytes - the total amount of bytes the map represents
+ * @param bytes - the size of the range needed
+ * @param offset - the offset to start searching from, set to the start of the
+ * free range if one was found
+ * @return true if a free range was found before the end of the heap.
+ */
+bool find_free_range (char *alloc_map, size_t heap_bytes, size_t bytes,
+                      size_t *offset);
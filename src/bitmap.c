@@ -0,0 +1,180 @@
+/**
+ * Word-at-a-time bitmap operations.
+ * Words are read and written with memcpy, which compiles down to a single
+ * load or store, and are converted to little endian order so bit k of word w
+ * is always bit w * 64 + k of the map regardless of platform.
+ */
+
+#include <string.h>
+
+#include "bitmap.h"
+
+/* Amount of bytes in a word of the bitmap.  */
+#define BYTES_PER_WORD (BITS_PER_WORD / 8)
+
+/**
+ * Reads word number index of the bitmap.
+ */
+static uint64_t
+load_word (char *map, size_t index)
+{
+  uint64_t word;
+  memcpy (&word, map + index * BYTES_PER_WORD, BYTES_PER_WORD);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  word = __builtin_bswap64 (word);
+#endif
+  return word;
+}
+
+/**
+ * Writes word number index of the bitmap.
+ */
+static void
+store_word (char *map, size_t index, uint64_t word)
+{
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  word = __builtin_bswap64 (word);
+#endif
+  memcpy (map + index * BYTES_PER_WORD, &word, BYTES_PER_WORD);
+}
+
+/**
+ * Creates a mask of the bits [from, to) in a word, where from < to <= 64.
+ */
+static uint64_t
+create_word_mask (size_t from, size_t to)
+{
+  uint64_t upper = to == BITS_PER_WORD ? ~(uint64_t)0
+                                       : ((uint64_t)1 << to) - 1;
+  uint64_t lower = ((uint64_t)1 << from) - 1;
+  return upper & ~lower;
+}
+
+size_t
+calc_bitmap_size (size_t bits)
+{
+  size_t words = (bits + BITS_PER_WORD - 1) / BITS_PER_WORD;
+  words = words == 0 ? 1 : words;
+  return words * BYTES_PER_WORD;
+}
+
+void
+update_bit_range (char *map, size_t start, size_t count, bool value)
+{
+  size_t end = start + count;
+  while (start < end)
+    {
+      size_t word_index = start / BITS_PER_WORD;
+      size_t from = start % BITS_PER_WORD;
+      size_t to = end - word_index * BITS_PER_WORD;
+      to = to > BITS_PER_WORD ? BITS_PER_WORD : to;
+
+      uint64_t mask = create_word_mask (from, to);
+      uint64_t word = load_word (map, word_index);
+      word = value ? word | mask : word & ~mask;
+      store_word (map, word_index, word);
+
+      start = (word_index + 1) * BITS_PER_WORD;
+    }
+}
+
+size_t
+count_set_bits (char *map, size_t start, size_t count)
+{
+  size_t set_bits = 0;
+  size_t end = start + count;
+  while (start < end)
+    {
+      size_t word_index = start / BITS_PER_WORD;
+      size_t from = start % BITS_PER_WORD;
+      size_t to = end - word_index * BITS_PER_WORD;
+      to = to > BITS_PER_WORD ? BITS_PER_WORD : to;
+
+      uint64_t word = load_word (map, word_index);
+      set_bits += __builtin_popcountll (word & create_word_mask (from, to));
+
+      start = (word_index + 1) * BITS_PER_WORD;
+    }
+  return set_bits;
+}
+
+/**
+ * Finds the first bit equal to value at or after index and before bits.
+ * Cleared bits are found by inverting each word before counting the
+ * trailing zeros.
+ */
+static bool
+find_next_bit (char *map, size_t bits, size_t *index, bool value)
+{
+  size_t current = *index;
+  uint64_t invert = value ? 0 : ~(uint64_t)0;
+  while (current < bits)
+    {
+      size_t word_index = current / BITS_PER_WORD;
+      uint64_t word = load_word (map, word_index) ^ invert;
+      word &= create_word_mask (current % BITS_PER_WORD, BITS_PER_WORD);
+      if (word != 0)
+        {
+          size_t found = word_index * BITS_PER_WORD + __builtin_ctzll (word);
+          if (found >= bits)
+            {
+              return false;
+            }
+          *index = found;
+          return true;
+        }
+      current = (word_index + 1) * BITS_PER_WORD;
+    }
+  return false;
+}
+
+bool
+find_next_set_bit (char *map, size_t bits, size_t *index)
+{
+  return find_next_bit (map, bits, index, true);
+}
+
+bool
+find_prev_set_bit (char *map, size_t *index)
+{
+  size_t word_index = *index / BITS_PER_WORD;
+  uint64_t word = load_word (map, word_index)
+                  & create_word_mask (0, *index % BITS_PER_WORD + 1);
+  while (word == 0)
+    {
+      if (word_index == 0)
+        {
+          return false;
+        }
+      word_index--;
+      word = load_word (map, word_index);
+    }
+  *index = word_index * BITS_PER_WORD + BITS_PER_WORD - 1
+           - __builtin_clzll (word);
+  return true;
+}
+
+bool
+find_next_zero_run (char *map, size_t bits, size_t run, size_t *index)
+{
+  size_t start = *index;
+  while (find_next_bit (map, bits, &start, false))
+    {
+      size_t end = start + run;
+      if (end > bits)
+        {
+          return false;
+        }
+
+      /* Look for a set bit that breaks the run, the run can at the earliest
+         start again after it.  */
+      size_t blocker = start;
+      if (!find_next_bit (map, end, &blocker, true))
+        {
+          *index = start;
+          return true;
+        }
+      start = blocker + 1;
+    }
+  return false;
+}
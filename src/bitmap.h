@@ -0,0 +1,74 @@
+/**
+ * Word-at-a-time operations on the bitmaps used by the heap, such as the
+ * allocation map and the mark map.
+ * A bitmap is stored as an array of bytes where bit i of byte j represents
+ * bit j * 8 + i of the map. The array is always a whole number of 64-bit
+ * words long, so the functions below can read and write a word at a time
+ * instead of a single bit per call.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* The number of bits handled at once by the bitmap functions.  */
+#define BITS_PER_WORD 64
+
+/**
+ * @brief Calculates the amount of bytes needed to store a bitmap, rounded up
+ * to a whole number of words.
+ * @param bits the amount of bits the bitmap represents
+ * @return the size of the bitmap in bytes, at least one word
+ */
+size_t calc_bitmap_size (size_t bits);
+
+/**
+ * @brief Sets every bit in the range [start, start + count) to value.
+ * @param map the bitmap
+ * @param start the index of the first bit to change
+ * @param count the amount of bits to change
+ * @param value true to set the bits to 1, false to set them to 0
+ */
+void update_bit_range (char *map, size_t start, size_t count, bool value);
+
+/**
+ * @brief Counts the set bits in the range [start, start + count).
+ * @param map the bitmap
+ * @param start the index of the first bit to count
+ * @param count the amount of bits to count
+ * @return the amount of bits set to 1
+ */
+size_t count_set_bits (char *map, size_t start, size_t count);
+
+/**
+ * @brief Finds the first set bit at or after index.
+ * @param map the bitmap
+ * @param bits the amount of bits in the bitmap
+ * @param index the index to start searching from, set to the index of the
+ * set bit if one was found
+ * @return true if a set bit was found, false if the end was reached
+ */
+bool find_next_set_bit (char *map, size_t bits, size_t *index);
+
+/**
+ * @brief Finds the last set bit at or before index, a word at a time.
+ * @param map the bitmap
+ * @param index the index to start searching backwards from, set to the index
+ * of the set bit if one was found
+ * @return true if a set bit was found, false if the start was reached
+ */
+bool find_prev_set_bit (char *map, size_t *index);
+
+/**
+ * @brief Finds the first run of at least run consecutive cleared bits that
+ * starts at or after index.
+ * @param map the bitmap
+ * @param bits the amount of bits in the bitmap
+ * @param run the amount of cleared bits needed, at least 1
+ * @param index the index to start searching from, set to the start of the run
+ * if one was found
+ * @return true if a run was found, false if the end was reached
+ */
+bool find_next_zero_run (char *map, size_t bits, size_t run, size_t *index);
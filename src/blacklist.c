@@ -0,0 +1,122 @@
+/**
+ * Function for creating and searching the blacklist of a heap.
+ * The blacklist has two generations of pages, laid out like the page map,
+ * so that a page stays blacklisted for the collection after the one that
+ * found a false pointer to it as well.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "blacklist.h"
+#include "page_map.h"
+
+/**
+ * @param recent: The pages hit since the start of the last collection.
+ * @param previous: The pages hit during the collection before it.
+ * @param map_size: The size of each of the maps in bytes.
+ * @param skipped_offset: The lowest heap offset allocation skipped since the
+ * last collection, or SIZE_MAX if none was.
+ */
+struct blacklist
+{
+  char *recent;
+  char *previous;
+  size_t map_size;
+  size_t skipped_offset;
+};
+
+blacklist_t *
+create_blacklist (size_t bytes)
+{
+  blacklist_t *blacklist = malloc (sizeof (blacklist_t));
+  assert (blacklist != NULL && "Malloc failed to allocate blacklist");
+  blacklist->map_size = calc_required_map_size (bytes);
+  blacklist->recent = calloc (blacklist->map_size, sizeof (char));
+  blacklist->previous = calloc (blacklist->map_size, sizeof (char));
+  assert (blacklist->recent != NULL && blacklist->previous != NULL
+          && "Calloc failed to allocate blacklist pages");
+  blacklist->skipped_offset = SIZE_MAX;
+  return blacklist;
+}
+
+void
+destroy_blacklist (blacklist_t *blacklist)
+{
+  if (blacklist == NULL)
+    {
+      return;
+    }
+  free (blacklist->recent);
+  free (blacklist->previous);
+  free (blacklist);
+}
+
+void
+age_blacklist (blacklist_t *blacklist)
+{
+  char *oldest = blacklist->previous;
+  blacklist->previous = blacklist->recent;
+  memset (oldest, 0, blacklist->map_size);
+  blacklist->recent = oldest;
+  blacklist->skipped_offset = SIZE_MAX;
+}
+
+void
+blacklist_offset (blacklist_t *blacklist, size_t offset)
+{
+  blacklist->recent[find_index_in_page_map (offset)]
+      |= create_page_bitmask (offset);
+}
+
+bool
+is_range_blacklisted (blacklist_t *blacklist, size_t offset, size_t bytes)
+{
+  size_t last_page = (offset + bytes - 1) / PAGE_SIZE;
+  for (size_t page = offset / PAGE_SIZE; page <= last_page; page++)
+    {
+      size_t page_offset = page * PAGE_SIZE;
+      size_t index = find_index_in_page_map (page_offset);
+      char pages = blacklist->recent[index] | blacklist->previous[index];
+      if (pages & create_page_bitmask (page_offset))
+        {
+          return true;
+        }
+    }
+  return false;
+}
+
+void
+skip_blacklisted_offset (blacklist_t *blacklist, size_t offset)
+{
+  if (offset < blacklist->skipped_offset)
+    {
+      blacklist->skipped_offset = offset;
+    }
+}
+
+bool
+find_skipped_offset (blacklist_t *blacklist, size_t *offset)
+{
+  if (blacklist->skipped_offset == SIZE_MAX)
+    {
+      return false;
+    }
+  *offset = blacklist->skipped_offset;
+  return true;
+}
+
+size_t
+count_blacklisted_pages (blacklist_t *blacklist)
+{
+  size_t count = 0;
+  for (size_t i = 0; i < blacklist->map_size; i++)
+    {
+      count += __builtin_popcount (
+          (unsigned char)(blacklist->recent[i] | blacklist->previous[i]));
+    }
+  return count;
+}
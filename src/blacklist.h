@@ -0,0 +1,81 @@
+/**
+ * Functions for keeping track of the pages of a heap that values on the
+ * stack falsely point to.
+ * A value that points into free memory during a garbage collection is not a
+ * pointer, but would become one to whatever is allocated there next, which
+ * could then never be freed. Such pages are blacklisted and allocation keeps
+ * away from them, until two collections in a row have found nothing
+ * pointing to them.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+/**
+ * The pages hit by false pointers during the last two collections.
+ */
+typedef struct blacklist blacklist_t;
+
+/**
+ * @brief Creates a blacklist without any page on it.
+ * @param bytes the size of the heap in bytes
+ * @return the blacklist
+ */
+blacklist_t *create_blacklist (size_t bytes);
+
+/**
+ * @brief Frees a blacklist.
+ * @param blacklist the blacklist, or NULL
+ */
+void destroy_blacklist (blacklist_t *blacklist);
+
+/**
+ * @brief Starts a new collection, forgetting the pages that were only hit
+ * during the one before the last, and the room skipped since the last.
+ * @param blacklist the blacklist
+ */
+void age_blacklist (blacklist_t *blacklist);
+
+/**
+ * @brief Blacklists the page holding a heap offset.
+ * @param blacklist the blacklist
+ * @param offset the heap offset a false pointer points to
+ */
+void blacklist_offset (blacklist_t *blacklist, size_t offset);
+
+/**
+ * @brief Checks if any page of a range of the heap is blacklisted.
+ * @param blacklist the blacklist
+ * @param offset the heap offset of the range
+ * @param bytes the length of the range, at least 1
+ * @return true if a false pointer was found on a page of the range during
+ * either of the last two collections
+ */
+bool is_range_blacklisted (blacklist_t *blacklist, size_t offset,
+                           size_t bytes);
+
+/**
+ * @brief Remembers that allocation skipped room at a blacklisted offset, to
+ * go back to once no other room is left.
+ * @param blacklist the blacklist
+ * @param offset the heap offset of the room skipped
+ */
+void skip_blacklisted_offset (blacklist_t *blacklist, size_t offset);
+
+/**
+ * @brief Gets the lowest offset allocation skipped since the last
+ * collection.
+ * @param blacklist the blacklist
+ * @param offset set to the heap offset of the room skipped if there was any
+ * @return false if no room was skipped
+ */
+bool find_skipped_offset (blacklist_t *blacklist, size_t *offset);
+
+/**
+ * @brief Counts the blacklisted pages.
+ * @param blacklist the blacklist
+ * @return the amount of pages on the blacklist
+ */
+size_t count_blacklisted_pages (blacklist_t *blacklist);
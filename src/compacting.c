@@ -1,43 +1,219 @@
-
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
 #include <string.h>
+#include <time.h>
 
 #include "allocation.h"
 #include "allocation_map.h"
+#include "bitmap.h"
+#include "blacklist.h"
 #include "compacting.h"
+#include "forwarding_table.h"
 #include "gc_utils.h"
+#include "gc_workers.h"
 #include "get_header.h"
+#include "header.h"
 #include "heap_internal.h"
 #include "is_pointer_in_alloc.h"
+#include "layout.h"
+#include "mark_map.h"
+#include "mark_stack.h"
+#include "mutators.h"
+#include "nursery.h"
 #include "page_map.h"
+#include "roots.h"
 #include "stack.h"
+#include "start_map.h"
+
+/* Arrays are scanned this many elements at a time.  */
+#define ARRAY_SCAN_CHUNK 128
+
+/* Set on mark stack entries that continue the scan of an array. The entry
+   below it holds the index of the next element to scan, shifted past
+   ARRAY_INDEX_TAG.  */
+#define ARRAY_CONTINUATION_TAG 0x1
+#define ARRAY_INDEX_TAG 0x2
+#define ARRAY_INDEX_SHIFT 2
+
+/* The most entries a tracer takes from another in one steal.  */
+#define MAX_STEAL_ENTRIES 256
+
+/* The heap is split into this many regions per gc worker when compacting,
+   so workers that finish early can take another region.  */
+#define REGIONS_PER_WORKER 4
+
+/* Objects an incremental mark scans between looking at the clock.  */
+#define SLICE_CLOCK_INTERVAL 32
+
+/* Objects a concurrent mark scans between taking the logged pointers.  */
+#define LOG_DRAIN_INTERVAL 256
+
+/* The amount of logged pointers space is first reserved for.  */
+#define INITIAL_LOG_CAPACITY 64
 
 typedef struct find_root_data
 {
   heap_t *heap;
-  ptr_queue_t *roots;
+  char *root_map;
 } find_root_data_t;
 
-typedef struct compact_data
+/**
+ * State shared by every step of a trace through the heap.
+ * @param heap: The heap being traced.
+ * @param visited: A mark map where the header of every discovered object is
+ * set.
+ * @param stack: Objects that have been discovered but not yet scanned.
+ * @param overflow_offset: The lowest header offset of a discovered object that
+ * did not fit on the stack, or the heap size if none has overflowed.
+ * @param lock: Guards the stack when other tracers may steal from it, or NULL
+ * if the trace is not shared with other threads.
+ * @param is_young_only: true if only objects on young pages are visited, as
+ * in a minor collection where every old object is assumed to be alive.
+ * @param is_concurrent: true if the program keeps running during the trace,
+ * marking the objects it allocates in the same map.
+ */
+typedef struct trace_state
 {
   heap_t *heap;
-  ptr_queue_t *roots;
-  ptr_queue_t *visited;
-} compact_data_t;
+  char *visited;
+  mark_stack_t *stack;
+  size_t overflow_offset;
+  pthread_mutex_t *lock;
+  bool is_young_only;
+  bool is_concurrent;
+} trace_state_t;
+
+/**
+ * State shared by the workers of a parallel mark.
+ * @param states: The trace state of each worker, indexed by worker.
+ * @param worker_count: The amount of workers.
+ * @param root_map: The roots, each worker visiting those in its own share of
+ * the heap.
+ * @param active_workers: The amount of workers that may still have entries on
+ * their stack. Marking is complete when it reaches 0.
+ */
+typedef struct parallel_trace
+{
+  trace_state_t *states;
+  size_t worker_count;
+  char *root_map;
+  size_t active_workers;
+} parallel_trace_t;
 
-static void recurse_find_pointer (heap_t *h, void *alloc,
-                                  ptr_queue_t *living_objects);
+static void trace_from_roots (trace_state_t *state, char *root_map);
+static void rescan_overflowed_objects (trace_state_t *state);
+static void mark_in_parallel (heap_t *h, char *root_map);
+static void scan_array (trace_state_t *state, void *array, size_t from);
+
+/**
+ * A part of the heap compacted by a single worker. Objects never leave the
+ * region they are in, so regions can be compacted at the same time.
+ * @param start: The heap offset of the first byte of the region.
+ * @param end: The heap offset directly after the region.
+ */
+typedef struct compact_region
+{
+  size_t start;
+  size_t end;
+} compact_region_t;
 
-static bool compact_ptr (heap_t *heap, void *object);
+/**
+ * State shared by the workers of a region by region compaction.
+ * @param heap: The heap being compacted.
+ * @param table: Where each marked object is moved.
+ * @param regions: The regions of the heap in address order.
+ * @param region_count: The amount of regions.
+ * @param next_region: The index of the next region a worker will take.
+ */
+typedef struct region_compaction
+{
+  heap_t *heap;
+  forwarding_table_t *table;
+  compact_region_t *regions;
+  size_t region_count;
+  size_t next_region;
+} region_compaction_t;
 
-static void apply_to_pointer_in_allocation (void *object,
-                                            apply_to_ptr_func *fun,
-                                            void *other);
+/**
+ * @brief Checks if a value points to the start of an object in the heap, that
+ * is to an allocated address directly after a header of a known type. The
+ * header must be where an object was placed, since a field inside an object
+ * may hold anything a header can.
+ * @param h the heap
+ * @param ptr the possible pointer to an object
+ * @return true if ptr can be treated as an object.
+ */
+static bool
+is_object_pointer (heap_t *h, void *ptr)
+{
+  if (!is_heap_pointer ((uintptr_t)ptr, h))
+    {
+      return false;
+    }
+
+  /* Objects always start directly after a header at the start of a granule */
+  size_t offset = calc_heap_offset (ptr, h);
+  if (offset < sizeof (header_t)
+      || (offset - sizeof (header_t)) % MIN_ALLOC_OBJECT_SIZE != 0)
+    {
+      return false;
+    }
+  size_t header_offset = offset - sizeof (header_t);
+  if (!is_offset_allocated (h->alloc_map, header_offset)
+      || !is_object_start (h->start_map, header_offset))
+    {
+      return false;
+    }
+
+  header_t h_value = get_header_value (get_header_pointer (ptr));
+  header_type_t h_type = get_header_type (h_value);
+  if (h_type == HEADER_BIT_VECTOR)
+    {
+      return true;
+    }
+  if (h_type == HEADER_POINTER_TO_FORMAT_STRING)
+    {
+      void *format_string_ptr = get_pointer_in_header (h_value);
+      return is_heap_pointer ((uintptr_t)format_string_ptr, h);
+    }
+  if (h_type == HEADER_LAYOUT_INDEX)
+    {
+      return is_valid_layout_header (h_value);
+    }
+  return false;
+}
+
+/**
+ * @brief Calculates the heap offset of the header belonging to an object.
+ * @param h the heap
+ * @param alloc the object
+ * @return the offset of the objects header from the heap start
+ */
+static size_t
+calc_header_offset (heap_t *h, void *alloc)
+{
+  return calc_heap_offset (alloc, h) - sizeof (header_t);
+}
+
+/**
+ * @brief Calculates the size of an object including its header, aligned the
+ * same way as when it was allocated.
+ * @param alloc the object
+ * @return the number of bytes the object occupies in the heap
+ */
+static size_t
+calc_total_alloc_size (void *alloc)
+{
+  size_t alloc_size = align_alloc_size (calc_alloc_size (alloc));
+  return alloc_size + sizeof (header_t);
+}
 
 /*
  * Checks if a given stack address holds a value to an active allocation.
- * If so, then enqueue the allocation to the pointer queue
- * given in the void* other argument.
+ * If so, then mark the allocation in the root map
+ * given in the void* other argument. With precise roots, or if the heap
+ * takes interior pointers, the value may point anywhere into the allocation.
  */
 static void
 enqueue_root_pointer (void *stack_address, void *other)
@@ -50,413 +226,1314 @@ enqueue_root_pointer (void *stack_address, void *other)
   void *potential_heap_ptr = *((void **)stack_address);
 
   /* Check if value stored in stack variable is a potential heap pointer */
-  if (!is_heap_pointer ((uintptr_t)potential_heap_ptr, h))
+  size_t header_offset;
+  if (!find_enclosing_object (h, potential_heap_ptr, &header_offset))
+    {
+      if (is_in_range ((uintptr_t)potential_heap_ptr, h)
+          && !is_heap_pointer ((uintptr_t)potential_heap_ptr, h))
+        {
+          /* Points to free memory, keep allocations away from it */
+          blacklist_offset (h->blacklist,
+                            calc_heap_offset (potential_heap_ptr, h));
+        }
+      return;
+    }
+  void *object = (char *)h->heap_start + header_offset + sizeof (header_t);
+  bool is_interior = h->is_precise_roots || h->is_interior_pointers;
+  if ((!is_interior && potential_heap_ptr != object)
+      || !is_object_pointer (h, object))
     {
       return;
     }
   /* Pointer points to living object, add object as a root */
-  ptr_queue_t *roots = data->roots;
-  enqueue_ptr (roots, potential_heap_ptr);
+  update_mark_map (data->root_map, header_offset, true);
 }
 
 /*
- * iterates over the stack and enqueues all objects
+ * iterates over the stack and marks all objects
  * found in the heap as root objects
  */
-ptr_queue_t *
+char *
 find_root_pointers (heap_t *h, uintptr_t start, uintptr_t end)
 {
-
   /* setup void *arg */
-  find_root_data_t *data = malloc (sizeof (find_root_data_t));
-  data->heap = h;
-  data->roots = create_ptr_queue ();
+  find_root_data_t data = { .heap = h, .root_map = create_mark_map (h->size) };
+
+  /* iterate over the roots populating our map as it goes */
+  apply_to_roots (h, start, end, (apply_to_ptr_func *)enqueue_root_pointer,
+                  &data);
+
+  return data.root_map;
+}
+
+void
+find_living_objects (heap_t *h, char *root_map)
+{
+  reset_mark_map (h);
+
+  if (h->gc_workers != NULL)
+    {
+      mark_in_parallel (h, root_map);
+      return;
+    }
 
-  /* iterate over the stack populating our queue as it goes */
-  apply_to_pointers_in_interval (
-      start, end, (apply_to_ptr_func *)enqueue_root_pointer, data);
+  trace_state_t state = { .heap = h,
+                          .visited = h->mark_map,
+                          .stack = create_mark_stack (h->mark_stack_size),
+                          .overflow_offset = h->size,
+                          .lock = NULL };
+  trace_from_roots (&state, root_map);
+  destroy_mark_stack (state.stack);
+}
+
+void
+find_remembered_roots (heap_t *h, char *root_map)
+{
+  find_root_data_t data = { .heap = h, .root_map = root_map };
+  uintptr_t heap_end = (uintptr_t)h->heap_start + h->size;
 
-  return data->roots;
+  size_t offset = 0;
+  while (find_next_dirty_card (h->nursery, &offset))
+    {
+      /* Cards hold no object boundaries, so every word of a dirty card is
+         treated like a word on the stack.  */
+      uintptr_t start = (uintptr_t)h->heap_start + offset;
+      uintptr_t end = start + CARD_SIZE < heap_end ? start + CARD_SIZE
+                                                   : heap_end;
+      apply_to_pointers_in_interval (
+          start, end, (apply_to_ptr_func *)enqueue_root_pointer, &data);
+      offset += CARD_SIZE;
+    }
 }
 
-ptr_queue_t *
-find_living_objects (heap_t *h, ptr_queue_t *roots)
+void
+find_thread_roots (heap_t *h, char *root_map)
 {
-  ptr_queue_t *living_objects = create_ptr_queue ();
+  if (h->is_precise_roots)
+    {
+      /* The slots other threads pushed were found with the rest */
+      return;
+    }
+  find_root_data_t data = { .heap = h, .root_map = root_map };
+  apply_to_stopped_stacks (h->mutators, get_current_mutator (h->mutators),
+                           (apply_to_ptr_func *)enqueue_root_pointer, &data);
+}
 
-  /* Find all pointers to allocations recursively */
-  for (size_t i = 0; i < get_len (roots); i++)
+void
+find_young_living_objects (heap_t *h, char *root_map)
+{
+  /* Only the marks of young pages are cleared, the rest of the map is left
+     as the last full collection marked it.  */
+  size_t offset = 0;
+  while (find_next_young_page (h->nursery, &offset))
     {
-      void *root_object = get_ptr (roots, i);
-      recurse_find_pointer (h, root_object, living_objects);
+      update_bit_range (h->mark_map, offset / MIN_ALLOC_OBJECT_SIZE,
+                        h->page_size / MIN_ALLOC_OBJECT_SIZE, false);
+      offset += h->page_size;
     }
 
-  /* return sorted queue of living objects */
-  return living_objects;
+  trace_state_t state = { .heap = h,
+                          .visited = h->mark_map,
+                          .stack = create_mark_stack (h->mark_stack_size),
+                          .overflow_offset = h->size,
+                          .lock = NULL,
+                          .is_young_only = true };
+  trace_from_roots (&state, root_map);
+  destroy_mark_stack (state.stack);
+}
+
+/**
+ * @brief Locks the mark stack of a tracer if it is shared.
+ * @param state the trace state
+ */
+static void
+lock_stack (trace_state_t *state)
+{
+  if (state->lock != NULL)
+    {
+      pthread_mutex_lock (state->lock);
+    }
 }
 
 /**
- * @brief Recursively travles through the heap enqueueing all pointers found in
- * each allocation. travels depth first, queue is sorted according position in
- * heap, closest to heap start first.
- * @param h heap refrence used to verify that a pointer is within heap.
- * @param alloc the allocation the find allocations within.
- * @param living_objects a queue of all living objects,
- * also provides inforamtion to avoid rechecking a pointer
+ * @brief Unlocks the mark stack of a tracer if it is shared.
+ * @param state the trace state
  */
 static void
-recurse_find_pointer (heap_t *h, void *alloc, ptr_queue_t *living_objects)
+unlock_stack (trace_state_t *state)
 {
-  bool is_new_ptr = enqueue_ptr (living_objects, alloc);
-  if (!is_new_ptr)
+  if (state->lock != NULL)
+    {
+      pthread_mutex_unlock (state->lock);
+    }
+}
+
+/**
+ * @brief Sets the visited bit of an object. Shared and concurrent traces set
+ * it atomically so that only one thread claims each object, and no other
+ * bit of the same byte is lost.
+ * @param state the trace state
+ * @param header_offset the heap offset of the objects header
+ * @return true if the object had not been visited before
+ */
+static bool
+mark_visited (trace_state_t *state, size_t header_offset)
+{
+  if (state->lock != NULL || state->is_concurrent)
+    {
+      return try_mark_offset (state->visited, header_offset);
+    }
+  if (is_offset_marked (state->visited, header_offset))
+    {
+      return false;
+    }
+  update_mark_map (state->visited, header_offset, true);
+  return true;
+}
+
+/**
+ * @brief Marks an object as visited and pushes it on the mark stack, unless
+ * it is not an object or has been visited before. If the stack is full the
+ * object stays marked but unscanned, and is found again by rescanning the
+ * visited map from the lowest such offset.
+ * @param state the trace state
+ * @param object the possible object to visit
+ */
+static void
+visit_object (trace_state_t *state, void *object)
+{
+  heap_t *h = state->heap;
+  if (!is_object_pointer (h, object))
     {
       return;
     }
 
-  /* Check if alloc has a pointer to format string */
-  header_t *h_ptr = get_header_pointer(alloc);
-  header_t h_value = get_header_value(h_ptr);
-  header_type_t h_type = get_header_type(h_value);
-  if (h_type == HEADER_POINTER_TO_FORMAT_STRING)
-  {
-    /* visit format string object */
-    void *format_string_ptr = get_pointer_in_header(h_value);
-    enqueue_ptr (living_objects, format_string_ptr);
-  }
-
-  ptr_queue_t *possible_struct_ptrs = get_pointers_in_allocation (alloc);
-  /* retrieve pointer to first internal pointer */
-  void **struct_pointer_ptr = dequeue_ptr (possible_struct_ptrs);
-  while (struct_pointer_ptr != NULL)
-    {
-      /* pointer is not null, create better variable name */
-      void *struct_pointer = *struct_pointer_ptr;
-
-      /* check if pointer is a refrence in our heap */
-      // TODO: Check if "is_heap_pointer()" is a better check...
-      if (is_in_range (((uintptr_t)struct_pointer), h))
+  size_t header_offset = calc_header_offset (h, object);
+  if (state->is_young_only && !is_young_offset (h->nursery, header_offset))
+    {
+      return;
+    }
+  if (!mark_visited (state, header_offset))
+    {
+      return;
+    }
+
+  /* The fields will be read when the object is popped, start loading them */
+  __builtin_prefetch (object);
+
+  lock_stack (state);
+  bool is_pushed = push_mark_stack (state->stack, object);
+  unlock_stack (state);
+  if (!is_pushed && header_offset < state->overflow_offset)
+    {
+      state->overflow_offset = header_offset;
+    }
+}
+
+/**
+ * @brief Visits the object a pointer field points to.
+ * @param field the pointer field inside the object being scanned
+ * @param arg the trace state
+ */
+static void
+scan_field (void **field, void *arg)
+{
+  visit_object ((trace_state_t *)arg, *field);
+}
+
+/**
+ * @brief Scans the pointer fields of an object, visiting every object they
+ * point to.
+ * @param state the trace state
+ * @param alloc the object to scan
+ */
+static void
+scan_object (trace_state_t *state, void *alloc)
+{
+  header_t *h_ptr = get_header_pointer (alloc);
+  header_t h_value = get_header_value (h_ptr);
+  if (get_header_type (h_value) == HEADER_POINTER_TO_FORMAT_STRING)
+    {
+      void *format_string_ptr = get_pointer_in_header (h_value);
+      /* visit format string object, it does not hold any pointers */
+      visit_object (state, format_string_ptr);
+    }
+  else if (get_header_type (h_value) == HEADER_LAYOUT_INDEX
+           && is_array_header (h_value))
+    {
+      scan_array (state, alloc, 0);
+      return;
+    }
+
+  for_each_pointer_field (alloc, scan_field, state);
+}
+
+/**
+ * @brief Scans one chunk of the elements of an array, starting at an index.
+ * The rest of the array is pushed back on the mark stack below the children
+ * of the chunk, so a long array is scanned a bit at a time in between its
+ * children instead of pushing all of them at once, and other tracers can
+ * steal the rest. If the stack has no room for the continuation the rest of
+ * the array is scanned directly.
+ * @param state the trace state
+ * @param array the array to scan
+ * @param from the index of the first element to scan
+ */
+static void
+scan_array (trace_state_t *state, void *array, size_t from)
+{
+  header_t header = get_header_value (get_header_pointer (array));
+  size_t length = get_array_length (header);
+  size_t to = length;
+  if (length - from > ARRAY_SCAN_CHUNK)
+    {
+      /* The pair is pushed under one lock so it is never split by a steal */
+      lock_stack (state);
+      if (has_mark_stack_space (state->stack, 2))
         {
-          /* recursively find pointers from inside the struct pointer */
-          recurse_find_pointer (h, struct_pointer, living_objects);
+          to = from + ARRAY_SCAN_CHUNK;
+          push_mark_stack (state->stack,
+                           (void *)((to << ARRAY_INDEX_SHIFT)
+                                    | ARRAY_INDEX_TAG));
+          push_mark_stack (state->stack, (void *)((uintptr_t)array
+                                                  | ARRAY_CONTINUATION_TAG));
         }
+      unlock_stack (state);
+    }
+
+  for_each_pointer_in_array (header, array, from, to, scan_field, state);
+}
 
-      /* go to next internal pointer of current struct */
-      struct_pointer_ptr = dequeue_ptr (possible_struct_ptrs);
+/**
+ * @brief Pops the next entry of the mark stack, together with the index
+ * below it if the entry continues an array.
+ * @param state the trace state
+ * @param from set to the index to continue from if the entry is an array
+ * @return the popped entry, or NULL if the stack is empty
+ */
+static void *
+pop_entry (trace_state_t *state, size_t *from)
+{
+  lock_stack (state);
+  void *entry = pop_mark_stack (state->stack);
+  if ((uintptr_t)entry & ARRAY_CONTINUATION_TAG)
+    {
+      *from = (uintptr_t)pop_mark_stack (state->stack) >> ARRAY_INDEX_SHIFT;
     }
+  unlock_stack (state);
+  return entry;
 }
 
-// TODO: For each object in compaction queue, find a new location and update
-// old header with forwarding to new dest.
-// TODO: find other way to store forwarding for object to allow compact data
-size_t
-compact_objects (heap_t *h, ptr_queue_t *roots, ptr_queue_t *compaction_queue)
+/**
+ * @brief Scans an entry popped from the mark stack.
+ * @param state the trace state
+ * @param entry the object, or the continuation of an array
+ * @param from the index to continue from if the entry is an array
+ */
+static void
+scan_entry (trace_state_t *state, void *entry, size_t from)
 {
-  /* set heap to completly empty */
-  h_reset_page_map (h);
-  reset_allocation_map (h);
-  h->next_empty_mem_segment = h->heap_start;
+  if ((uintptr_t)entry & ARRAY_CONTINUATION_TAG)
+    {
+      scan_array (state, (void *)((uintptr_t)entry & ~ARRAY_CONTINUATION_TAG),
+                  from);
+    }
+  else
+    {
+      scan_object (state, entry);
+    }
+}
 
-  size_t old_size = h->used_bytes;
-  h->used_bytes = 0;
+/**
+ * @brief Scans objects from the mark stack until it is empty.
+ * @param state the trace state
+ */
+static void
+drain_mark_stack (trace_state_t *state)
+{
+  size_t from = 0;
+  void *alloc = pop_entry (state, &from);
+  while (alloc != NULL)
+    {
+      scan_entry (state, alloc, from);
+      alloc = pop_entry (state, &from);
+    }
+}
+
+/**
+ * @brief Travels through the heap depth first from every root, visiting each
+ * reachable object once. Uses an explicit stack of bounded size, when the
+ * stack overflows every visited object at or after the lowest offset that
+ * could not be pushed is scanned again. Scanning an object twice does no harm
+ * since its children are already visited, so this repeats until a pass
+ * completes without overflowing.
+ * @param state the trace state
+ * @param root_map map of all roots
+ */
+static void
+trace_from_roots (trace_state_t *state, char *root_map)
+{
+  heap_t *h = state->heap;
 
-  /* if stack is unsafe we need to update heap to show roots as allocated */
-  if (h->is_unsafe_stack)
+  size_t offset = 0;
+  while (find_next_marked_offset (root_map, h->size, &offset))
     {
-      for (size_t i = 0; i < get_len (roots); i++)
-        {
-          void *root_ptr = get_ptr (roots, i);
+      void *root_object = (char *)h->heap_start + offset + sizeof (header_t);
+      visit_object (state, root_object);
+      drain_mark_stack (state);
+      offset += MIN_ALLOC_OBJECT_SIZE;
+    }
 
-          /* fix allocation map */
-          size_t obj_offset_from_start
-              = calc_heap_offset (root_ptr, h) - sizeof (header_t);
-          /* set root object position as allocated */
-          /* get size of allocation */
-          size_t alloc_size = calc_alloc_size (root_ptr);
+  rescan_overflowed_objects (state);
+}
 
-          /* align size with our alloc map (rounding up to nearest multiple of
-           * 16) */
-          alloc_size = align_alloc_size (alloc_size) + sizeof (header_t);
-          assert (alloc_size % 16 == 0 && "Is divisable by 16");
+/**
+ * @brief Scans every visited object at or after the lowest offset that did
+ * not fit on the stack, repeating until a pass completes without
+ * overflowing.
+ * @param state the trace state
+ */
+static void
+rescan_overflowed_objects (trace_state_t *state)
+{
+  heap_t *h = state->heap;
 
-          for (size_t i = 0; i < alloc_size; i += MIN_ALLOC_OBJECT_SIZE)
+  while (state->overflow_offset < h->size)
+    {
+      clear_mark_stack_overflow (state->stack);
+      size_t offset = state->overflow_offset;
+      state->overflow_offset = h->size;
+
+      while (find_next_marked_offset (state->visited, h->size, &offset))
+        {
+          if (state->is_young_only && !is_young_offset (h->nursery, offset))
             {
-              update_alloc_map (h->alloc_map, obj_offset_from_start + i, true);
+              /* Marked by an earlier full collection */
+              offset += MIN_ALLOC_OBJECT_SIZE;
+              continue;
             }
+          void *object = (char *)h->heap_start + offset + sizeof (header_t);
+          scan_object (state, object);
+          drain_mark_stack (state);
+          offset += MIN_ALLOC_OBJECT_SIZE;
+        }
+    }
+}
+
+/**
+ * A mark phase done a slice at a time, or on a thread of its own. Marked
+ * objects on the mark stack, or waiting for a rescan after an overflow, are
+ * grey. Other marked objects are black and unmarked ones white.
+ * @param state: The trace, kept between slices.
+ * @param rescan_offset: How far the current rescan of overflowed objects has
+ * come, or the heap size if no rescan is in progress.
+ * @param is_concurrent: true if the trace runs on the marking thread.
+ * @param thread: The marking thread, if the trace is concurrent.
+ * @param log_lock: Guards the logged pointers and is_done.
+ * @param log: Pointers overwritten by the program, to be shaded by the
+ * marking thread.
+ * @param log_count: The amount of logged pointers.
+ * @param log_capacity: The amount of pointers there is space for.
+ * @param is_done: Set by the marking thread when no grey object is left.
+ * @param is_cancelled: Set to make the marking thread stop.
+ */
+struct incremental_mark
+{
+  trace_state_t state;
+  size_t rescan_offset;
+  bool is_concurrent;
+  pthread_t thread;
+  pthread_mutex_t log_lock;
+  void **log;
+  size_t log_count;
+  size_t log_capacity;
+  bool is_done;
+  bool is_cancelled;
+};
+
+/**
+ * @brief Visits every root, pushing them on the mark stack without scanning
+ * them.
+ * @param state the trace state
+ * @param root_map map of all roots
+ */
+static void
+visit_roots (trace_state_t *state, char *root_map)
+{
+  heap_t *h = state->heap;
+
+  size_t offset = 0;
+  while (find_next_marked_offset (root_map, h->size, &offset))
+    {
+      visit_object (state,
+                    (char *)h->heap_start + offset + sizeof (header_t));
+      offset += MIN_ALLOC_OBJECT_SIZE;
+    }
+}
+
+/**
+ * @brief Scans one grey object, the top of the mark stack or once the stack
+ * is empty the next object of a rescan after an overflow.
+ * @param mark the incremental mark
+ * @return false if no grey object is left
+ */
+static bool
+scan_next_grey (incremental_mark_t *mark)
+{
+  trace_state_t *state = &mark->state;
+  heap_t *h = state->heap;
+
+  size_t from = 0;
+  void *entry = pop_entry (state, &from);
+  if (entry != NULL)
+    {
+      scan_entry (state, entry, from);
+      return true;
+    }
+
+  if (mark->rescan_offset == h->size && state->overflow_offset < h->size)
+    {
+      clear_mark_stack_overflow (state->stack);
+      mark->rescan_offset = state->overflow_offset;
+      state->overflow_offset = h->size;
+    }
+  if (mark->rescan_offset == h->size)
+    {
+      return false;
+    }
+
+  if (!find_next_marked_offset (state->visited, h->size,
+                                &mark->rescan_offset))
+    {
+      /* The pass is done, but may have overflowed again.  */
+      mark->rescan_offset = h->size;
+      return scan_next_grey (mark);
+    }
+  scan_object (state, (char *)h->heap_start + mark->rescan_offset
+                          + sizeof (header_t));
+  mark->rescan_offset += MIN_ALLOC_OBJECT_SIZE;
+  return true;
+}
 
-          /* fix bytes_used metric */
-          h->used_bytes += alloc_size - sizeof (header_t);
+/**
+ * @brief Calculates the time passed since a point in time.
+ * @param start the point in time, from CLOCK_MONOTONIC
+ * @return the time passed in milliseconds
+ */
+static float
+calc_elapsed_ms (struct timespec *start)
+{
+  struct timespec now;
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000.0f
+         + (now.tv_nsec - start->tv_nsec) / 1000000.0f;
+}
+
+incremental_mark_t *
+start_incremental_marking (heap_t *h, char *root_map)
+{
+  reset_mark_map (h);
+
+  incremental_mark_t *mark = calloc (1, sizeof (incremental_mark_t));
+  assert (mark != NULL && "Calloc failed to allocate incremental mark");
+  mark->state = (trace_state_t){ .heap = h,
+                                 .visited = h->mark_map,
+                                 .stack = create_mark_stack (
+                                     h->mark_stack_size),
+                                 .overflow_offset = h->size,
+                                 .lock = NULL };
+  mark->rescan_offset = h->size;
+  visit_roots (&mark->state, root_map);
+  return mark;
+}
+
+bool
+mark_incrementally (incremental_mark_t *mark, float budget_ms)
+{
+  struct timespec start;
+  clock_gettime (CLOCK_MONOTONIC, &start);
+
+  size_t scanned = 0;
+  while (scan_next_grey (mark))
+    {
+      scanned++;
+      if (scanned % SLICE_CLOCK_INTERVAL == 0
+          && calc_elapsed_ms (&start) >= budget_ms)
+        {
+          return false;
         }
     }
+  return true;
+}
 
-  /* compact allocations in order of closest to heap first, then next and
-   * lastly pointer allocated futherst away. */
-  if (h->is_unsafe_stack)
+/**
+ * @brief Visits every pointer the program has logged since the last call.
+ * @param mark the incremental mark
+ */
+static void
+visit_logged_pointers (incremental_mark_t *mark)
+{
+  pthread_mutex_lock (&mark->log_lock);
+  void **log = mark->log;
+  size_t count = mark->log_count;
+  mark->log = malloc (mark->log_capacity * sizeof (void *));
+  assert (mark->log != NULL && "Failed to allocate pointer log");
+  mark->log_count = 0;
+  pthread_mutex_unlock (&mark->log_lock);
+
+  for (size_t i = 0; i < count; i++)
     {
-      /* stack is unsafe, so we are not allowed to move root pointers */
-      for (size_t i = 0; i < get_len (compaction_queue); i++)
+      visit_object (&mark->state, log[i]);
+    }
+  free (log);
+}
+
+/**
+ * @brief Traces the heap on the marking thread, shading the pointers the
+ * program logs in between, until no grey object is left or it is
+ * cancelled.
+ * @param arg the incremental mark
+ * @return NULL
+ */
+static void *
+run_concurrent_marking (void *arg)
+{
+  incremental_mark_t *mark = arg;
+  while (!__atomic_load_n (&mark->is_cancelled, __ATOMIC_ACQUIRE))
+    {
+      visit_logged_pointers (mark);
+      size_t scanned = 0;
+      while (scanned < LOG_DRAIN_INTERVAL && scan_next_grey (mark))
         {
-          void *internal_pointer = get_ptr (compaction_queue, i);
-          /* Check if current pointer is any of recived root pointers */
-          bool is_root_obj = false;
-          for (size_t i = 0; i < get_len (roots); i++)
+          scanned++;
+        }
+      if (scanned < LOG_DRAIN_INTERVAL)
+        {
+          /* Done unless the program logged more pointers meanwhile.  */
+          pthread_mutex_lock (&mark->log_lock);
+          mark->is_done = mark->log_count == 0;
+          pthread_mutex_unlock (&mark->log_lock);
+          if (mark->is_done)
             {
-              void *root_ptr = get_ptr (roots, i);
-              if (root_ptr == internal_pointer)
-                {
-                  is_root_obj = true;
-                  break;
-                }
+              break;
             }
+        }
+    }
+  return NULL;
+}
+
+/**
+ * @brief Stops the marking thread of a concurrent mark and waits for it.
+ * @param mark the incremental mark
+ */
+static void
+stop_concurrent_marking (incremental_mark_t *mark)
+{
+  if (!mark->is_concurrent)
+    {
+      return;
+    }
+  __atomic_store_n (&mark->is_cancelled, true, __ATOMIC_RELEASE);
+  pthread_join (mark->thread, NULL);
+  mark->is_concurrent = false;
+}
+
+void
+start_concurrent_marking (incremental_mark_t *mark)
+{
+  pthread_mutex_init (&mark->log_lock, NULL);
+  mark->log_capacity = INITIAL_LOG_CAPACITY;
+  mark->log = malloc (mark->log_capacity * sizeof (void *));
+  assert (mark->log != NULL && "Failed to allocate pointer log");
+  mark->state.is_concurrent = true;
+  mark->is_concurrent = true;
+  int result
+      = pthread_create (&mark->thread, NULL, run_concurrent_marking, mark);
+  assert (result == 0 && "Failed to start marking thread");
+  (void)result;
+}
+
+bool
+is_concurrent_marking_done (incremental_mark_t *mark)
+{
+  pthread_mutex_lock (&mark->log_lock);
+  bool is_done = mark->is_done;
+  pthread_mutex_unlock (&mark->log_lock);
+  return is_done;
+}
 
-          /* if it is a root object, skip compacting this object */
-          if (is_root_obj)
+void
+shade_object (incremental_mark_t *mark, void *object)
+{
+  if (!mark->state.is_concurrent)
+    {
+      visit_object (&mark->state, object);
+      return;
+    }
+  if (!is_heap_pointer ((uintptr_t)object, mark->state.heap))
+    {
+      return;
+    }
+
+  /* The mark stack belongs to the marking thread, which takes the log.  */
+  pthread_mutex_lock (&mark->log_lock);
+  if (mark->log_count == mark->log_capacity)
+    {
+      mark->log_capacity *= 2;
+      mark->log = realloc (mark->log, mark->log_capacity * sizeof (void *));
+      assert (mark->log != NULL && "Realloc failed to grow pointer log");
+    }
+  mark->log[mark->log_count++] = object;
+  pthread_mutex_unlock (&mark->log_lock);
+}
+
+void
+finish_incremental_marking (incremental_mark_t *mark, char *root_map)
+{
+  stop_concurrent_marking (mark);
+  if (mark->state.is_concurrent)
+    {
+      visit_logged_pointers (mark);
+    }
+  visit_roots (&mark->state, root_map);
+  while (scan_next_grey (mark))
+    {
+    }
+}
+
+void
+destroy_incremental_marking (incremental_mark_t *mark)
+{
+  if (mark == NULL)
+    {
+      return;
+    }
+  stop_concurrent_marking (mark);
+  if (mark->state.is_concurrent)
+    {
+      pthread_mutex_destroy (&mark->log_lock);
+      free (mark->log);
+    }
+  destroy_mark_stack (mark->state.stack);
+  free (mark);
+}
+
+/**
+ * @brief Moves the oldest half of the entries of another workers stack to
+ * the stack of a worker. An array continuation is never separated from the
+ * index below it.
+ * @param trace the parallel trace
+ * @param thief the index of the worker looking for work
+ * @return true if any entries were stolen
+ */
+static bool
+steal_work (parallel_trace_t *trace, size_t thief)
+{
+  void *stolen[MAX_STEAL_ENTRIES + 1];
+
+  for (size_t i = 1; i < trace->worker_count; i++)
+    {
+      trace_state_t *victim
+          = &trace->states[(thief + i) % trace->worker_count];
+
+      lock_stack (victim);
+      size_t size = get_mark_stack_size (victim->stack);
+      size_t count = (size + 1) / 2;
+      count = count < MAX_STEAL_ENTRIES ? count : MAX_STEAL_ENTRIES;
+      if (count > 0
+          && (uintptr_t)get_mark_stack_entry (victim->stack, count - 1)
+                 & ARRAY_INDEX_TAG)
+        {
+          count++;
+        }
+      count = steal_mark_stack (victim->stack, stolen, count);
+      unlock_stack (victim);
+
+      if (count > 0)
+        {
+          trace_state_t *state = &trace->states[thief];
+          lock_stack (state);
+          for (size_t j = 0; j < count; j++)
             {
-              continue;
+              push_mark_stack (state->stack, stolen[j]);
             }
-          compact_ptr (h, internal_pointer);
+          unlock_stack (state);
+          return true;
         }
     }
-  else
+  return false;
+}
+
+/**
+ * @brief Checks if any other worker has entries on its stack.
+ * @param trace the parallel trace
+ * @param thief the index of the worker looking for work
+ * @return true if a steal may succeed
+ */
+static bool
+has_stealable_work (parallel_trace_t *trace, size_t thief)
+{
+  for (size_t i = 0; i < trace->worker_count; i++)
     {
-      for (size_t i = 0; i < get_len (compaction_queue); i++)
+      if (i == thief)
+        {
+          continue;
+        }
+      trace_state_t *victim = &trace->states[i];
+      lock_stack (victim);
+      bool is_empty = is_mark_stack_empty (victim->stack);
+      unlock_stack (victim);
+      if (!is_empty)
         {
-          void *internal_pointer = get_ptr (compaction_queue, i);
-          compact_ptr (h, internal_pointer);
+          return true;
         }
     }
-  size_t new_size = h->used_bytes;
-  return old_size - new_size;
+  return false;
 }
 
 /**
- * @brief compacts the given pointer, updating heap accordingly.
- * @param heap the heap which the object should be allocated within
- * @param object the object to compact
- * @return true if object was moved, false if object is in correct place
- * already.
+ * @brief Gives a worker with an empty stack new entries, or waits until
+ * every worker is out of work. A worker only counts itself as inactive while
+ * its stack is empty, and counts itself as active again before stealing, so
+ * when no worker is active every stack is empty and marking is complete.
+ * @param trace the parallel trace
+ * @param worker_index the index of the worker looking for work
+ * @return true if entries were stolen, false if marking is complete
  */
-// TODO: Orignial format string get overwritten due to it not being in living object queue.
-// When Adding format string to living object problem presists, and instead seems to 
 static bool
-compact_ptr (heap_t *heap, void *alloc)
+find_work (parallel_trace_t *trace, size_t worker_index)
 {
-  /* get pointer to objects header, we will need to replace value later */
-  header_t *header_ptr = get_header_pointer (alloc);
-  void *origin = header_ptr;
-
-  header_t h_value = get_header_value(header_ptr);
-  header_type_t h_type = get_header_type(h_value);
-  /* Check if string in header has been forwarded */
-  if (h_type == HEADER_FORWARDING_ADDRESS)
-  {
-    void *new_format_location = get_pointer_in_header(h_value);
-    header_t new_alloc_header = set_header_pointer_to_format_string((header_t)new_format_location);
-    *header_ptr = new_alloc_header;
-  }
-  if (h_type == HEADER_POINTER_TO_FORMAT_STRING)
-  {
-    /* Move format string first */
-    void *format_string_ptr = get_pointer_in_header(h_value);
-    if (compact_ptr(heap, format_string_ptr))
-    {
-      /* format string was moved during compacting,
-      need to update allocation header before we move it so the real header is copied correctly */
-      header_t *format_header_ptr = get_header_pointer(format_string_ptr);
-      header_t format_header_value = get_header_value(format_header_ptr);
-      void *new_format_location = get_pointer_in_header(format_header_value);
-      header_t new_alloc_header = set_header_pointer_to_format_string((header_t)new_format_location);
-      *header_ptr = new_alloc_header;
-      header_type_t h_form_type = get_header_type(format_header_value);
-    }
-    /* format string might not have been moved during compacting
-    if that is the case then the current format string pointer is still correct. */
-    
-  }
-  
-
-  /* get size of allocation */
-  size_t alloc_size = calc_alloc_size (alloc);
-
-  /* align size with our alloc map (rounding up to nearest multiple of 16) */
-  alloc_size = align_alloc_size (alloc_size);
-  alloc_size += sizeof (header_t);
-  assert (alloc_size % 16 == 0 && "Is divisable by 16");
-
-  /* Moves bump pointer to next available space in the heap.  */
-  bool space_found = move_to_next_available_space (heap, alloc_size);
-
-  if (!space_found)
-    {
-      /* Not enough space to allocated object during compacting */
-      abort ();
-    }
-
-  /* heap->next_empty_mem_segment is now set to next available position */
-  void *dest = heap->next_empty_mem_segment;
-
-  if ((uintptr_t)origin - (uintptr_t)dest < alloc_size)
-  {
-    /* first available spot is to close to existing allocation */
-    /* skip moving this allocation by setting dest to origin */
-    dest = origin;
-    /* update bump pointer */
-    heap->next_empty_mem_segment = origin;
-  }
-  
-  /* set allocation destination as allocated in heap */
-  size_t dest_offset_from_start = calc_heap_offset (dest, heap);
-  for (size_t i = 0; i < alloc_size; i += MIN_ALLOC_OBJECT_SIZE)
-    {
-      update_alloc_map (heap->alloc_map, dest_offset_from_start + i, true);
-    }
-
-  /* check if object is already at destination */
-  if (origin == dest)
-    {
-      /* skip moving object to same location */
-      heap->used_bytes += alloc_size - sizeof (header_t);
-      heap->next_empty_mem_segment += alloc_size;
-      return false;
+  if (steal_work (trace, worker_index))
+    {
+      return true;
+    }
+
+  __atomic_sub_fetch (&trace->active_workers, 1, __ATOMIC_SEQ_CST);
+  while (__atomic_load_n (&trace->active_workers, __ATOMIC_SEQ_CST) > 0)
+    {
+      if (has_stealable_work (trace, worker_index))
+        {
+          __atomic_add_fetch (&trace->active_workers, 1, __ATOMIC_SEQ_CST);
+          if (steal_work (trace, worker_index))
+            {
+              return true;
+            }
+          __atomic_sub_fetch (&trace->active_workers, 1, __ATOMIC_SEQ_CST);
+        }
+      sched_yield ();
+    }
+  return false;
+}
+
+/**
+ * @brief The marking done by each worker. Visits the roots in the workers
+ * share of the heap, then scans its own stack and steals from the others
+ * until no worker has anything left to scan.
+ * @param arg the parallel trace
+ * @param worker_index the index of the worker
+ */
+static void
+trace_worker (void *arg, size_t worker_index)
+{
+  parallel_trace_t *trace = (parallel_trace_t *)arg;
+  trace_state_t *state = &trace->states[worker_index];
+  heap_t *h = state->heap;
+
+  size_t granules = h->size / MIN_ALLOC_OBJECT_SIZE;
+  size_t share = (granules + trace->worker_count - 1) / trace->worker_count
+                 * MIN_ALLOC_OBJECT_SIZE;
+  size_t offset = share * worker_index;
+  size_t end = offset + share < h->size ? offset + share : h->size;
+
+  while (offset < end
+         && find_next_marked_offset (trace->root_map, end, &offset))
+    {
+      void *root_object = (char *)h->heap_start + offset + sizeof (header_t);
+      visit_object (state, root_object);
+      drain_mark_stack (state);
+      offset += MIN_ALLOC_OBJECT_SIZE;
     }
-  /* destination != origin */
 
-  /* Set origin header as allocated to prevent destruction in later stages */
-  size_t origin_offset_from_start = calc_heap_offset (origin, heap);
-  update_alloc_map (heap->alloc_map, origin_offset_from_start, true);
+  do
+    {
+      drain_mark_stack (state);
+    }
+  while (find_work (trace, worker_index));
+}
 
-  memmove (dest, origin, (alloc_size));
+/**
+ * @brief Marks every object reachable from the roots using the gc workers of
+ * the heap. Objects that did not fit on a workers stack are rescanned by the
+ * calling thread afterwards, the same way a single tracer handles overflow.
+ * @param h the heap
+ * @param root_map map of all roots
+ */
+static void
+mark_in_parallel (heap_t *h, char *root_map)
+{
+  size_t worker_count = get_gc_worker_count (h->gc_workers);
+  trace_state_t *states = calloc (worker_count, sizeof (trace_state_t));
+  pthread_mutex_t *locks = calloc (worker_count, sizeof (pthread_mutex_t));
+  assert (states != NULL && locks != NULL);
 
-  /* increase used_bytes metric */
-  heap->used_bytes += alloc_size - sizeof (header_t);
+  for (size_t i = 0; i < worker_count; i++)
+    {
+      pthread_mutex_init (&locks[i], NULL);
+      states[i] = (trace_state_t){ .heap = h,
+                                   .visited = h->mark_map,
+                                   .stack
+                                   = create_mark_stack (h->mark_stack_size),
+                                   .overflow_offset = h->size,
+                                   .lock = &locks[i] };
+    }
 
-  /* increase bump pointer to allocation dest */
-  heap->next_empty_mem_segment += sizeof (header_t);
+  parallel_trace_t trace = { .states = states,
+                             .worker_count = worker_count,
+                             .root_map = root_map,
+                             .active_workers = worker_count };
+  run_gc_workers (h->gc_workers, trace_worker, &trace);
 
-  /* set old allocation header to a forwarding to the new allocation */
-  // FIXME: if dest is less than alloc_size to the left the header pointer will overwrite data in allocation.
-  // Fix could be to put forwarding somewhere else entierly than the heap, or by checking destination distance.
-  *header_ptr
-      = set_header_forwarding_address ((header_t)heap->next_empty_mem_segment);
+  trace_state_t state = states[0];
+  state.lock = NULL;
+  for (size_t i = 1; i < worker_count; i++)
+    {
+      if (states[i].overflow_offset < state.overflow_offset)
+        {
+          state.overflow_offset = states[i].overflow_offset;
+        }
+      destroy_mark_stack (states[i].stack);
+    }
+  rescan_overflowed_objects (&state);
 
-  /* increase bump pointer to next allocation spot */
-  heap->next_empty_mem_segment += alloc_size - sizeof (header_t);
+  destroy_mark_stack (state.stack);
+  for (size_t i = 0; i < worker_count; i++)
+    {
+      pthread_mutex_destroy (&locks[i]);
+    }
+  free (locks);
+  free (states);
+}
 
-  return true;
+/**
+ * @brief Checks if a marked object must stay where it is during compacting.
+ * Large objects are never moved, roots found on an unsafe stack stay along
+ * with their whole page (see pin_root_pages()).
+ * @param h the heap
+ * @param header_offset the heap offset of the objects header
+ * @return true if the object may not be moved
+ */
+static bool
+is_pinned_object (heap_t *h, size_t header_offset)
+{
+  void *alloc = (char *)h->heap_start + header_offset + sizeof (header_t);
+  return is_large_alloc (h, align_alloc_size (calc_alloc_size (alloc)));
 }
 
 /**
- * @brief updates all pointers found when tracing using roots to thier new
- * location when following the forwarding adress.
- * TODO: can not forward stack adresses that point to roots. This is needed for safe stack
- * @param h heap which all objects exist within
- * @param roots queue of all roots
+ * @brief Calculates the size of the regions the heap is compacted in. The
+ * whole heap is a single region unless it has gc workers, then it is split
+ * into regions of whole pages, REGIONS_PER_WORKER for each worker.
+ * @param h the heap
+ * @return the size of a region in bytes, a multiple of FORWARDING_BLOCK_SIZE
  */
-void
-update_forwarded_pointers (heap_t *h, ptr_queue_t *roots)
-{
-  if (h->is_unsafe_stack)
-  {
-    ptr_queue_t *visited = create_ptr_queue ();
-    for (size_t i = 0; i < get_len (roots); i++)
-      {
-        void *ptr_to_root_obj = get_ptr (roots, i);
-        if (enqueue_ptr (visited, ptr_to_root_obj))
-          {
-            apply_to_pointer_in_allocation (ptr_to_root_obj, NULL, visited);
-          }
-      }
-    destroy_ptr_queue (visited);
-  }
-  else
-  {
-    // FIXEME: Add support for safe stack.
-  }
-  
+static size_t
+calc_region_size (heap_t *h)
+{
+  if (h->gc_workers == NULL)
+    {
+      return (h->size + FORWARDING_BLOCK_SIZE - 1) / FORWARDING_BLOCK_SIZE
+             * FORWARDING_BLOCK_SIZE;
+    }
+  size_t worker_count = get_gc_worker_count (h->gc_workers);
+  size_t pages = (h->size + h->page_size - 1) / h->page_size;
+  size_t wanted = worker_count * REGIONS_PER_WORKER;
+  return (pages + wanted - 1) / wanted * h->page_size;
+}
+
+/**
+ * @brief Splits the heap into the regions it is compacted in.
+ * @param h the heap
+ * @param table where each marked object is moved
+ * @return the compaction state with no region taken
+ */
+static region_compaction_t
+create_region_compaction (heap_t *h, forwarding_table_t *table)
+{
+  size_t region_size = calc_region_size (h);
+  region_compaction_t compaction
+      = { .heap = h,
+          .table = table,
+          .region_count = (h->size + region_size - 1) / region_size,
+          .next_region = 0 };
+  compaction.regions
+      = calloc (compaction.region_count, sizeof (compact_region_t));
+  assert (compaction.regions != NULL);
+
+  for (size_t i = 0; i < compaction.region_count; i++)
+    {
+      compaction.regions[i].start = i * region_size;
+      compaction.regions[i].end = (i + 1) * region_size < h->size
+                                      ? (i + 1) * region_size
+                                      : h->size;
+    }
+  return compaction;
+}
+
+/**
+ * @brief Takes the next region no worker has taken yet.
+ * @param compaction the compaction state
+ * @return the region, or NULL if every region has been taken
+ */
+static compact_region_t *
+claim_region (region_compaction_t *compaction)
+{
+  size_t index = __atomic_fetch_add (&compaction->next_region, 1,
+                                     __ATOMIC_RELAXED);
+  if (index >= compaction->region_count)
+    {
+      return NULL;
+    }
+  return &compaction->regions[index];
 }
 
 /**
- * fetches header of object, checks if object contains any pointers.
- * If object contains pointers it will check if that pointer has been forwarded
- * by compact_objects(). If pointer was forwarded then it sets pointer to the
- * forwarded location. It then checks the forwarded location in the same way.
- *
- * This will result in recursivly (depth first) travesring the heap and
- * updating all pointers that were forwarded.
+ * @brief Runs a task that claims regions until none are left, on the gc
+ * workers of the heap if it has any and on the calling thread otherwise.
+ * @param compaction the compaction state, with no region taken
+ * @param task the task to run
  */
 static void
-apply_to_pointer_in_allocation (void *object, apply_to_ptr_func *fun,
-                                void *other)
+run_on_regions (region_compaction_t *compaction, gc_task_func *task)
 {
-  /* get allocation */
-  void *alloc = object;
-  ptr_queue_t *visited = (ptr_queue_t *)other;
+  if (compaction->heap->gc_workers != NULL)
+    {
+      run_gc_workers (compaction->heap->gc_workers, task, compaction);
+    }
+  else
+    {
+      task (compaction, 0);
+    }
+}
 
-  /* get all pointers inside of allocation */
-  ptr_queue_t *internal_pointers = get_pointers_in_allocation (alloc);
+/**
+ * @brief Pins every page a root overlaps when the stack is unsafe, as the
+ * stack words referring to the root can not be updated. A pinned page is
+ * marked as not movable in the page map and all of its blocks are fixed, so
+ * every object on it is kept in place and no moved object is placed on it.
+ * Everything else is evacuated onto the pages that are not pinned, leaving
+ * no islands of single roots between them.
+ * @param h the heap
+ * @param root_map map of all roots
+ * @param table the forwarding table
+ */
+static void
+pin_root_pages (heap_t *h, char *root_map, forwarding_table_t *table)
+{
+  h_reset_page_map (h);
+  if (!h->is_unsafe_stack)
+    {
+      return;
+    }
 
-  /* retrieve pointer to first internal pointer */
-  void **internal_pointer = dequeue_ptr (internal_pointers);
-  while (internal_pointer != NULL)
+  size_t offset = 0;
+  while (find_next_marked_offset (root_map, h->size, &offset))
     {
-      /* check if it is a designated pointer, but is not set yet */
-      if (*internal_pointer == NULL)
+      void *alloc = (char *)h->heap_start + offset + sizeof (header_t);
+      size_t end = offset + calc_total_alloc_size (alloc);
+      for (size_t page = offset / h->page_size * h->page_size; page < end;
+           page += h->page_size)
         {
-          /* check next pointer in struct */
-          internal_pointer = dequeue_ptr (internal_pointers);
-          continue;
+          if (is_offset_movable (h->page_map, page))
+            {
+              size_t page_end = page + h->page_size < h->size
+                                    ? page + h->page_size
+                                    : h->size;
+              update_page_map (h->page_map, page, false);
+              fix_object_range (table, page, page_end - page);
+            }
         }
+      offset += MIN_ALLOC_OBJECT_SIZE;
+    }
+}
 
-      /* Check header of child pointer */
-      header_t child_obj_header
-          = get_header_value (get_header_pointer (*internal_pointer));
-      header_type_t type = get_header_type (child_obj_header);
-      /* Check if child has been forwarded */
-      if (type == HEADER_FORWARDING_ADDRESS)
+/**
+ * @brief Fixes the blocks of every object that has to stay where it is:
+ * pinned objects, objects crossing from one region into another and every
+ * object sharing a block with one of them. Fixing a block can make an object
+ * that was already passed stay as well, so the marked objects are scanned
+ * again until that no longer happens.
+ * @param h the heap
+ * @param table the forwarding table
+ * @param region_size the size of the regions the heap is compacted in
+ */
+static void
+fix_staying_objects (heap_t *h, forwarding_table_t *table, size_t region_size)
+{
+  bool is_rescan_needed = true;
+  while (is_rescan_needed)
+    {
+      is_rescan_needed = false;
+      /* The end of the last object passed that may still move */
+      size_t movable_end = 0;
+      size_t offset = 0;
+      while (find_next_marked_offset (h->mark_map, h->size, &offset))
         {
-          /* update child ref to the forwarded address */
-          *internal_pointer = get_pointer_in_header (child_obj_header);
+          void *alloc = (char *)h->heap_start + offset + sizeof (header_t);
+          size_t size = calc_total_alloc_size (alloc);
+          bool is_staying
+              = is_range_fixed (table, offset, size)
+                || is_pinned_object (h, offset)
+                || offset / region_size != (offset + size - 1) / region_size;
+
+          if (!is_staying)
+            {
+              movable_end = offset + size;
+            }
+          else if (fix_object_range (table, offset, size) && movable_end > 0
+                   && offset / FORWARDING_BLOCK_SIZE
+                          <= (movable_end - 1) / FORWARDING_BLOCK_SIZE)
+            {
+              is_rescan_needed = true;
+            }
+          offset += MIN_ALLOC_OBJECT_SIZE;
         }
+    }
+}
+
+forwarding_table_t *
+compute_forwarding_addresses (heap_t *h, char *root_map)
+{
+  forwarding_table_t *table = create_forwarding_table (h->size);
+  size_t region_size = calc_region_size (h);
+  pin_root_pages (h, root_map, table);
+  fix_staying_objects (h, table, region_size);
 
-      /* check if allocation has been visited before */
-      if (enqueue_ptr (visited, *internal_pointer))
+  size_t offset = 0;
+  while (find_next_marked_offset (h->mark_map, h->size, &offset))
+    {
+      void *alloc = (char *)h->heap_start + offset + sizeof (header_t);
+      size_t size = calc_total_alloc_size (alloc);
+      record_object (table, offset, size,
+                     !is_range_fixed (table, offset, size));
+      offset += MIN_ALLOC_OBJECT_SIZE;
+    }
+
+  for (size_t start = 0; start < h->size; start += region_size)
+    {
+      size_t end = start + region_size < h->size ? start + region_size
+                                                 : h->size;
+      compute_block_destinations (table, start, end);
+    }
+  return table;
+}
+
+/**
+ * @brief Gets the address an object is moved to.
+ * @param h the heap
+ * @param table where each marked object is moved
+ * @param ptr a possible pointer to an object
+ * @return the new address of the object, or ptr if it does not point to an
+ * object that is moved
+ */
+static void *
+get_forwarding_address (heap_t *h, forwarding_table_t *table, void *ptr)
+{
+  if (!is_heap_pointer ((uintptr_t)ptr, h))
+    {
+      return ptr;
+    }
+  size_t offset = calc_heap_offset (ptr, h);
+  if (offset < sizeof (header_t)
+      || (offset - sizeof (header_t)) % MIN_ALLOC_OBJECT_SIZE != 0)
+    {
+      return ptr;
+    }
+
+  size_t header_offset = offset - sizeof (header_t);
+  if (!is_offset_marked (h->mark_map, header_offset)
+      || !is_moved_object (table, header_offset))
+    {
+      return ptr;
+    }
+  return (char *)h->heap_start + get_forwarding_offset (table, header_offset)
+         + sizeof (header_t);
+}
+
+/**
+ * @brief Updates a pointer to the address the object it points to is moved
+ * to.
+ * @param field the pointer to update
+ * @param arg the compaction state
+ */
+static void
+forward_field (void **field, void *arg)
+{
+  region_compaction_t *compaction = (region_compaction_t *)arg;
+  *field = get_forwarding_address (compaction->heap, compaction->table,
+                                   *field);
+}
+
+/**
+ * @brief Updates the pointer fields and format string of a marked object
+ * before anything is moved.
+ * @param compaction the compaction state
+ * @param header_offset the heap offset of the objects header
+ */
+static void
+forward_object (region_compaction_t *compaction, size_t header_offset)
+{
+  heap_t *h = compaction->heap;
+  void *alloc = (char *)h->heap_start + header_offset + sizeof (header_t);
+
+  /* The fields are found through the format string, which is still at its
+     old location, so they are forwarded before the header is.  */
+  for_each_pointer_field (alloc, forward_field, compaction);
+
+  header_t *header_ptr = get_header_pointer (alloc);
+  header_t header = get_header_value (header_ptr);
+  if (get_header_type (header) == HEADER_POINTER_TO_FORMAT_STRING)
+    {
+      void *format_string_ptr = get_forwarding_address (
+          h, compaction->table, get_pointer_in_header (header));
+      *header_ptr
+          = set_header_pointer_to_format_string ((header_t)format_string_ptr);
+    }
+}
+
+/**
+ * @brief Task forwarding every marked object in the regions it can claim.
+ * The forwarding table is only read, so regions are forwarded at the same
+ * time without reading any object outside of them.
+ * @param arg the compaction state
+ * @param worker_index unused
+ */
+static void
+forward_regions_task (void *arg, size_t worker_index)
+{
+  (void)worker_index;
+  region_compaction_t *compaction = (region_compaction_t *)arg;
+  heap_t *h = compaction->heap;
+  compact_region_t *region = claim_region (compaction);
+  while (region != NULL)
+    {
+      size_t offset = region->start;
+      while (find_next_marked_offset (h->mark_map, region->end, &offset))
         {
-          /* it has not, update its internal pointers */
-          apply_to_pointer_in_allocation (*internal_pointer, fun, other);
+          forward_object (compaction, offset);
+          offset += MIN_ALLOC_OBJECT_SIZE;
         }
-
-      /* go to next internal pointer of current struct */
-      internal_pointer = dequeue_ptr (internal_pointers);
+      region = claim_region (compaction);
     }
 }
 
 void
-remove_forwarding_allocations (heap_t *h, ptr_queue_t *compaction_queue)
+update_forwarded_pointers (heap_t *h, forwarding_table_t *table)
+{
+  region_compaction_t compaction = create_region_compaction (h, table);
+  run_on_regions (&compaction, forward_regions_task);
+  free (compaction.regions);
+}
+
+/**
+ * @brief Updates a stack slot to the new address of the object it points to.
+ * A slot pointing into an object keeps pointing as far into it.
+ * @param stack_address the address of the stack slot
+ * @param arg the compaction state
+ */
+static void
+forward_stack_slot (void *stack_address, void *arg)
 {
-  /* retrieve pointer to first pointer */
-  void **forwarded_alloc = dequeue_ptr (compaction_queue);
-  while (forwarded_alloc != NULL)
+  region_compaction_t *compaction = (region_compaction_t *)arg;
+  heap_t *h = compaction->heap;
+  void **slot = (void **)stack_address;
+  size_t header_offset;
+  if (!find_enclosing_object (h, *slot, &header_offset)
+      || !is_offset_marked (h->mark_map, header_offset)
+      || !is_moved_object (compaction->table, header_offset))
     {
-      /* get offset for previous object location */
-      header_t *forwarded_obj_header = get_header_pointer (forwarded_alloc);
+      return;
+    }
+  size_t delta = calc_heap_offset (*slot, h) - header_offset;
+  *slot = (char *)h->heap_start
+          + get_forwarding_offset (compaction->table, header_offset) + delta;
+}
 
-      /* get type of header */
-      header_type_t type
-          = get_header_type (get_header_value (forwarded_obj_header));
+void
+update_root_pointers (heap_t *h, forwarding_table_t *table, uintptr_t start,
+                      uintptr_t end)
+{
+  region_compaction_t compaction = { .heap = h, .table = table };
+  apply_to_roots (h, start, end, (apply_to_ptr_func *)forward_stack_slot,
+                  &compaction);
+}
 
-      /* if header is a HEADER_FORWARDING_ADDRESS we need to free its
-       * allocation */
-      if (type == HEADER_FORWARDING_ADDRESS)
+/**
+ * @brief Task sliding the moved objects of the regions it can claim to their
+ * destinations in address order. Objects only move towards the start of
+ * their region and keep their order, so an object never lands on one that is
+ * still to be moved.
+ * @param arg the compaction state
+ * @param worker_index unused
+ */
+static void
+move_regions_task (void *arg, size_t worker_index)
+{
+  (void)worker_index;
+  region_compaction_t *compaction = (region_compaction_t *)arg;
+  heap_t *h = compaction->heap;
+  compact_region_t *region = claim_region (compaction);
+  while (region != NULL)
+    {
+      size_t offset = region->start;
+      while (find_next_marked_offset (h->mark_map, region->end, &offset))
         {
-          size_t forwarded_obj_offset
-              = calc_heap_offset (forwarded_obj_header, h);
-
-          /* set root object position as allocated */
-          update_alloc_map (h->alloc_map, forwarded_obj_offset, false);
+          if (is_moved_object (compaction->table, offset))
+            {
+              size_t size = get_recorded_object_size (compaction->table,
+                                                      offset);
+              size_t dest = get_forwarding_offset (compaction->table, offset);
+              assert (dest <= offset);
+              memmove ((char *)h->heap_start + dest,
+                       (char *)h->heap_start + offset, size);
+              update_alloc_map_range (h->alloc_map, dest, size, true);
+              record_object_start (h->start_map, dest, size);
+            }
+          offset += MIN_ALLOC_OBJECT_SIZE;
         }
-      /* if header is NOT a HEADER_FORWARDING_ADDRESS, the object was not
-       * forwarded */
+      region = claim_region (compaction);
+    }
+}
+
+size_t
+compact_objects (heap_t *h, forwarding_table_t *table)
+{
+  /* set heap to completly empty, the page map keeps the pinned pages */
+  reset_allocation_map (h);
+
+  size_t old_size = h->used_bytes;
+  h->used_bytes = 0;
 
-      /* go to next pointer of current struct */
-      forwarded_alloc = dequeue_ptr (compaction_queue);
+  /* Objects that stay can cross from one region into another, so they are
+     allocated before the regions are compacted.  */
+  size_t offset = 0;
+  while (find_next_marked_offset (h->mark_map, h->size, &offset))
+    {
+      size_t size = get_recorded_object_size (table, offset);
+      if (!is_moved_object (table, offset))
+        {
+          update_alloc_map_range (h->alloc_map, offset, size, true);
+        }
+      h->used_bytes += size - sizeof (header_t);
+      offset += MIN_ALLOC_OBJECT_SIZE;
     }
+
+  region_compaction_t compaction = create_region_compaction (h, table);
+  run_on_regions (&compaction, move_regions_task);
+  free (compaction.regions);
+
+  /* Holes are left around objects that stay, start allocating from the
+     first one.  */
+  h->next_empty_mem_segment = h->heap_start;
+
+  return old_size - h->used_bytes;
 }
@@ -4,45 +4,167 @@
 
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "forwarding_table.h"
 #include "heap.h"
-#include "ptr_queue.h"
 
 /**
  * @brief Finds all pointers in the stack
  * that points to an allocation object in heap
- * @param  EMPTY
- * @return A queue of pointers to allocations
- * starting with the object closets to heap_start
+ * @param h the heap to find root objects in
+ * @param start the lowest stack address to scan
+ * @param end the highest stack address to scan (non-inclusive)
+ * @return A root map, with the same layout as the mark map, where the header
+ * of each object referenced from the stack is set. Free it with free().
  */
-ptr_queue_t *find_root_pointers (heap_t *h, uintptr_t start, uintptr_t end);
+char *find_root_pointers (heap_t *h, uintptr_t start, uintptr_t end);
 
 /**
- * @brief Traces all living objects from queue of root pointers.
- * for each root object it will check allocation header for anyt internal
+ * @brief Traces all living objects from the map of root objects.
+ * for each root object it will check allocation header for any internal
  * pointers. If a internal pointer was found it will recursively search
- * internal pointer for more. Each allocation pointer found is enqueued into a
- * priority queue with the allocation closest to heap start first.
+ * internal pointer for more. Each allocation found is marked in the mark map
+ * of the heap, which is cleared before tracing starts.
  * @param h the heap in which root objects exist in
- * @param roots a queue of roots to trace heap from.
- * @return a queue of all living objects found using given roots.
+ * @param root_map a map of roots to trace heap from.
  */
-ptr_queue_t *find_living_objects (heap_t *h, ptr_queue_t *roots);
+void find_living_objects (heap_t *h, char *root_map);
 
 /**
- * @brief iterates through the compacting queue moving each object found to the
- * earliest available spot in the heap. Due to the way we use forwarding
- * addresses a allocation of 16 bytes will be reserved for each allocation
- * moved. If allocations new position would be the same as the old, nothing is
- * done.
- * @param h heap which objects will be placed in
- * @param roots a queue of roots found, needed if stack is set to unsafe.
- * @param compaction_queue a queue of ALL living objects including roots.
- * @return number of bytes released. (dose not include allocation for
- * forwarding adress)
+ * The state of a mark phase done a slice at a time while the program keeps
+ * running. Objects allocated meanwhile must be marked, and every pointer
+ * stored into an object must be shaded with shade_object().
+ */
+typedef struct incremental_mark incremental_mark_t;
+
+/**
+ * @brief Starts marking the heap incrementally, clearing its mark map and
+ * shading every root grey without tracing any further.
+ * @param h the heap
+ * @param root_map a map of roots to trace from, not needed after the call
+ * @return the incremental mark, free it with destroy_incremental_marking()
+ */
+incremental_mark_t *start_incremental_marking (heap_t *h, char *root_map);
+
+/**
+ * @brief Traces grey objects until none is left or the budget is spent. The
+ * clock is only read every few objects, so a slice may run slightly over.
+ * @param mark the incremental mark
+ * @param budget_ms the time the slice may take in milliseconds
+ * @return true if no grey object is left
+ */
+bool mark_incrementally (incremental_mark_t *mark, float budget_ms);
+
+/**
+ * @brief Hands the rest of an incremental mark to a thread of its own, which
+ * traces until no grey object is left while the program keeps running.
+ * @param mark the incremental mark, not traced by the caller from now on
  */
-size_t compact_objects (heap_t *h, ptr_queue_t *roots,
-                        ptr_queue_t *compaction_queue);
+void start_concurrent_marking (incremental_mark_t *mark);
 
-void update_forwarded_pointers (heap_t *h, ptr_queue_t *roots);
+/**
+ * @brief Checks if the marking thread of a concurrent mark has run out of
+ * grey objects, so that the mark can be finished.
+ * @param mark the incremental mark, started with start_concurrent_marking()
+ * @return true if the marking thread is done
+ */
+bool is_concurrent_marking_done (incremental_mark_t *mark);
+
+/**
+ * @brief Shades an object grey unless it is already marked, so that it is
+ * not missed. If the mark is concurrent the object is logged instead, and
+ * shaded by the marking thread or by the final remark.
+ * @param mark the incremental mark
+ * @param object the possible object, ignored if it is not one
+ */
+void shade_object (incremental_mark_t *mark, void *object);
+
+/**
+ * @brief Remarks from a new set of roots and traces every grey object left,
+ * after which the mark map of the heap holds every living object. A marking
+ * thread is stopped first.
+ * @param mark the incremental mark
+ * @param root_map the roots found on the stack at the end of marking
+ */
+void finish_incremental_marking (incremental_mark_t *mark, char *root_map);
+
+/**
+ * @brief Frees all memory allocated to an incremental mark.
+ * @param mark the incremental mark to destroy, may be NULL
+ */
+void destroy_incremental_marking (incremental_mark_t *mark);
 
-void remove_forwarding_allocations (heap_t *h, ptr_queue_t *compaction_queue);
\ No newline at end of file
+/**
+ * @brief Adds every object a word on a dirty card points to as a root, so
+ * that young objects only referenced from old objects survive a minor
+ * collection.
+ * @param h the heap, which has a nursery
+ * @param root_map the map of roots to add to
+ */
+void find_remembered_roots (heap_t *h, char *root_map);
+
+/**
+ * @brief Adds every object a word on the stack of another stopped thread
+ * points to as a root, registers included.
+ * @param h the heap, with every other registered thread stopped
+ * @param root_map the map of roots to add to
+ */
+void find_thread_roots (heap_t *h, char *root_map);
+
+/**
+ * @brief Traces the young objects reachable from the roots, treating every
+ * old object as alive without tracing through it. Only the marks of young
+ * pages are cleared first.
+ * @param h the heap, which has a nursery
+ * @param root_map a map of roots to trace from, old roots are skipped.
+ */
+void find_young_living_objects (heap_t *h, char *root_map);
+
+/**
+ * @brief Plans where each marked object is moved to. Objects slide towards
+ * the start of their region in address order, leaving no holes between
+ * them. Large objects, objects crossing a region boundary and every object
+ * sharing a forwarding block with them stay where they are. If the stack is
+ * unsafe, every page holding a root is pinned as a whole: its objects stay
+ * and nothing is moved onto it, and the pinned pages are left marked as not
+ * movable in the page map. The heap is a single region unless it has gc
+ * workers.
+ * @param h the heap, with its living objects marked
+ * @param root_map a map of roots found, needed if stack is set to unsafe.
+ * @return the forwarding table, free it with destroy_forwarding_table()
+ */
+forwarding_table_t *compute_forwarding_addresses (heap_t *h, char *root_map);
+
+/**
+ * @brief updates the pointer fields and format string of every marked object
+ * to the new location of what they point to, before anything is moved. If
+ * the heap has gc workers the regions are updated at the same time.
+ * @param h heap which all objects exist within
+ * @param table the forwarding table from compute_forwarding_addresses()
+ */
+void update_forwarded_pointers (heap_t *h, forwarding_table_t *table);
+
+/**
+ * @brief updates every pointer to a moved object found on the stack. Only
+ * safe when the stack holds nothing but real pointers, as every word that
+ * looks like a pointer to a moved object is changed.
+ * @param h heap which all objects exist within
+ * @param table the forwarding table from compute_forwarding_addresses()
+ * @param start the lowest stack address to update
+ * @param end the highest stack address to update (non-inclusive)
+ */
+void update_root_pointers (heap_t *h, forwarding_table_t *table,
+                           uintptr_t start, uintptr_t end);
+
+/**
+ * @brief moves each marked object to the address planned for it. Objects
+ * are copied in address order so a move never overwrites an object that is
+ * still to be moved, and no forwarding address is written into the heap.
+ * @param h heap which objects will be placed in
+ * @param table the forwarding table from compute_forwarding_addresses()
+ * @return number of bytes released.
+ */
+size_t compact_objects (heap_t *h, forwarding_table_t *table);
@@ -0,0 +1,464 @@
+/**
+ * Functions for evacuating a collection set of sparsely used pages into
+ * empty ones. Which pages are chosen is decided from how much of each page
+ * the sweep left allocated, and the pointers to the evacuated objects are
+ * found through a remembered set of each page instead of by tracing the
+ * heap again.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "allocation.h"
+#include "allocation_map.h"
+#include "bitmap.h"
+#include "evacuation.h"
+#include "gc_utils.h"
+#include "get_header.h"
+#include "header.h"
+#include "heap_internal.h"
+#include "is_pointer_in_alloc.h"
+#include "mark_map.h"
+#include "move_data.h"
+#include "page_map.h"
+#include "roots.h"
+#include "start_map.h"
+
+/* The set index of a page that is not in the collection set.  */
+#define NOT_COLLECTED SIZE_MAX
+
+/* The amount of fields space is first reserved for in a remembered set.  */
+#define INITIAL_FIELD_CAPACITY 16
+
+/**
+ * The fields outside of the collection set pointing to objects on one of its
+ * pages.
+ * @param fields: The address of each field.
+ * @param count: The amount of fields.
+ * @param capacity: The amount of fields there is space for.
+ */
+typedef struct remembered_set
+{
+  void ***fields;
+  size_t count;
+  size_t capacity;
+} remembered_set_t;
+
+/**
+ * A page that may be put in the collection set.
+ * @param page: The index of the page.
+ * @param live_granules: The amount of granules allocated on the page.
+ */
+typedef struct page_candidate
+{
+  size_t page;
+  size_t live_granules;
+} page_candidate_t;
+
+/**
+ * State of an evacuation.
+ * @param heap: The heap being evacuated.
+ * @param page_count: The amount of pages in the heap.
+ * @param set_index: The index in the collection set of each page of the
+ * heap, or NOT_COLLECTED.
+ * @param pages: The page of each entry of the collection set.
+ * @param remembered: The remembered set of each entry of the collection set.
+ * @param set_count: The amount of pages in the collection set.
+ * @param dest_offset: The heap offset the next evacuated object is copied to.
+ * @param dest_end: The end of the page dest_offset is on.
+ * @param next_dest_page: The first page not yet checked for being empty.
+ */
+typedef struct evacuation
+{
+  heap_t *heap;
+  size_t page_count;
+  size_t *set_index;
+  size_t *pages;
+  remembered_set_t *remembered;
+  size_t set_count;
+  size_t dest_offset;
+  size_t dest_end;
+  size_t next_dest_page;
+} evacuation_t;
+
+/**
+ * @brief Counts the granules set in a map with the layout of the allocation
+ * map on one page.
+ * @param h the heap
+ * @param map the allocation map or a mark map of the heap
+ * @param page the index of the page
+ * @return the amount of granules set on the page
+ */
+static size_t
+count_page_granules (heap_t *h, char *map, size_t page)
+{
+  size_t granules = h->size / MIN_ALLOC_OBJECT_SIZE;
+  size_t granules_per_page = h->page_size / MIN_ALLOC_OBJECT_SIZE;
+  size_t start = page * granules_per_page;
+  size_t count = granules - start < granules_per_page ? granules - start
+                                                      : granules_per_page;
+  return count_set_bits (map, start, count);
+}
+
+/**
+ * Orders candidates with the least live granules first, and by address
+ * when they have the same amount.
+ */
+static int
+compare_candidates (const void *a, const void *b)
+{
+  const page_candidate_t *first = (const page_candidate_t *)a;
+  const page_candidate_t *second = (const page_candidate_t *)b;
+  if (first->live_granules != second->live_granules)
+    {
+      return first->live_granules < second->live_granules ? -1 : 1;
+    }
+  return first->page < second->page ? -1 : first->page > second->page;
+}
+
+/**
+ * @brief Chooses the pages to evacuate: those holding live objects with the
+ * lowest share of live granules, at most the evacuated_pages of the heap.
+ * Pages holding a root are pinned instead if the stack is unsafe.
+ * @param evac the evacuation, with an empty collection set
+ * @param root_map a map of the roots found
+ */
+static void
+choose_collection_set (evacuation_t *evac, char *root_map)
+{
+  heap_t *h = evac->heap;
+  size_t granules_per_page = h->page_size / MIN_ALLOC_OBJECT_SIZE;
+  size_t max_live = (size_t)(MAX_EVACUATED_LIVE_RATIO * granules_per_page);
+  page_candidate_t *candidates
+      = malloc (evac->page_count * sizeof (page_candidate_t));
+  assert (candidates != NULL);
+
+  h_reset_page_map (h);
+  size_t candidate_count = 0;
+  for (size_t page = 0; page < evac->page_count; page++)
+    {
+      if (h->is_unsafe_stack && count_page_granules (h, root_map, page) > 0)
+        {
+          update_page_map (h->page_map, page * h->page_size, false);
+          continue;
+        }
+      size_t live = count_page_granules (h, h->alloc_map, page);
+      if (live > 0 && live <= max_live)
+        {
+          candidates[candidate_count++] = (page_candidate_t){
+            .page = page, .live_granules = live
+          };
+        }
+    }
+  qsort (candidates, candidate_count, sizeof (page_candidate_t),
+         compare_candidates);
+
+  evac->set_count = candidate_count < h->evacuated_pages
+                        ? candidate_count
+                        : h->evacuated_pages;
+  evac->pages = malloc (evac->set_count * sizeof (size_t));
+  evac->remembered = calloc (evac->set_count, sizeof (remembered_set_t));
+  assert (evac->pages != NULL && evac->remembered != NULL);
+  for (size_t i = 0; i < evac->set_count; i++)
+    {
+      evac->pages[i] = candidates[i].page;
+      evac->set_index[candidates[i].page] = i;
+    }
+  free (candidates);
+}
+
+/**
+ * @brief Finds the page of the collection set a pointer points to an object
+ * on.
+ * @param evac the evacuation
+ * @param ptr a possible pointer to a marked object
+ * @return the set index of the page of the object, or NOT_COLLECTED if ptr
+ * is not a pointer to a marked object on a page in the collection set
+ */
+static size_t
+find_collected_page (evacuation_t *evac, void *ptr)
+{
+  heap_t *h = evac->heap;
+  /* The old copies of evacuated objects are no longer allocated, only the
+     mark map tells them apart.  */
+  if (!is_in_range ((uintptr_t)ptr, h))
+    {
+      return NOT_COLLECTED;
+    }
+  size_t offset = calc_heap_offset (ptr, h);
+  if (offset < sizeof (header_t)
+      || (offset - sizeof (header_t)) % MIN_ALLOC_OBJECT_SIZE != 0)
+    {
+      return NOT_COLLECTED;
+    }
+  size_t header_offset = offset - sizeof (header_t);
+  if (!is_offset_marked (h->mark_map, header_offset))
+    {
+      return NOT_COLLECTED;
+    }
+  return evac->set_index[header_offset / h->page_size];
+}
+
+/**
+ * @brief Adds a field to the remembered set of the page it points into, if
+ * that page is in the collection set.
+ * @param field the pointer field
+ * @param arg the evacuation
+ */
+static void
+remember_field (void **field, void *arg)
+{
+  evacuation_t *evac = (evacuation_t *)arg;
+  size_t index = find_collected_page (evac, *field);
+  if (index == NOT_COLLECTED)
+    {
+      return;
+    }
+
+  remembered_set_t *set = &evac->remembered[index];
+  if (set->count == set->capacity)
+    {
+      set->capacity = set->capacity == 0 ? INITIAL_FIELD_CAPACITY
+                                         : 2 * set->capacity;
+      set->fields = realloc (set->fields, set->capacity * sizeof (void **));
+      assert (set->fields != NULL && "Realloc failed to grow remembered set");
+    }
+  set->fields[set->count++] = field;
+}
+
+/**
+ * @brief Fills the remembered sets of the collection set from every marked
+ * object outside of it. Objects in the collection set are updated on their
+ * own once they have been evacuated.
+ * @param evac the evacuation, with its collection set chosen
+ */
+static void
+build_remembered_sets (evacuation_t *evac)
+{
+  heap_t *h = evac->heap;
+  size_t offset = 0;
+  while (find_next_marked_offset (h->mark_map, h->size, &offset))
+    {
+      if (evac->set_index[offset / h->page_size] == NOT_COLLECTED)
+        {
+          void *alloc = (char *)h->heap_start + offset + sizeof (header_t);
+          for_each_reference (alloc, remember_field, evac);
+        }
+      offset += MIN_ALLOC_OBJECT_SIZE;
+    }
+}
+
+/**
+ * @brief Takes room for an evacuated object on an empty page outside of the
+ * collection set, moving on to the next empty page when the current one is
+ * full.
+ * @param evac the evacuation
+ * @param size the size of the object including its header
+ * @param offset set to the heap offset of the room taken if there was any
+ * @return false if no empty page is left
+ */
+static bool
+find_destination (evacuation_t *evac, size_t size, size_t *offset)
+{
+  heap_t *h = evac->heap;
+  while (evac->dest_offset + size > evac->dest_end)
+    {
+      if (evac->next_dest_page == evac->page_count)
+        {
+          return false;
+        }
+      size_t page = evac->next_dest_page++;
+      if (evac->set_index[page] == NOT_COLLECTED
+          && count_page_granules (h, h->alloc_map, page) == 0)
+        {
+          evac->dest_offset = page * h->page_size;
+          evac->dest_end = evac->dest_offset + h->page_size < h->size
+                               ? evac->dest_offset + h->page_size
+                               : h->size;
+        }
+    }
+  *offset = evac->dest_offset;
+  evac->dest_offset += size;
+  return true;
+}
+
+/**
+ * @brief Copies a marked object to an empty page, leaving its forwarding
+ * address in the header of the old copy. Large objects are never moved.
+ * @param evac the evacuation
+ * @param header_offset the heap offset of the objects header
+ */
+static void
+evacuate_object (evacuation_t *evac, size_t header_offset)
+{
+  heap_t *h = evac->heap;
+  void *alloc = (char *)h->heap_start + header_offset + sizeof (header_t);
+  size_t alloc_size = align_alloc_size (calc_alloc_size (alloc));
+  if (is_large_alloc (h, alloc_size))
+    {
+      return;
+    }
+
+  size_t size = alloc_size + sizeof (header_t);
+  size_t dest;
+  if (!find_destination (evac, size, &dest))
+    {
+      return;
+    }
+  void *destination = (char *)h->heap_start + dest + sizeof (header_t);
+  bool is_moved = move_alloc (&alloc, destination);
+  assert (is_moved);
+  (void)is_moved;
+  update_alloc_map_range (h->alloc_map, header_offset, size, false);
+  update_alloc_map_range (h->alloc_map, dest, size, true);
+  record_object_start (h->start_map, dest, size);
+}
+
+/**
+ * @brief Updates a pointer to an evacuated object to its new address.
+ * @param field the pointer to update
+ * @param arg the evacuation
+ */
+static void
+forward_field (void **field, void *arg)
+{
+  evacuation_t *evac = (evacuation_t *)arg;
+  if (find_collected_page (evac, *field) == NOT_COLLECTED)
+    {
+      return;
+    }
+  header_t header = get_header_value (get_header_pointer (*field));
+  if (get_header_type (header) == HEADER_FORWARDING_ADDRESS)
+    {
+      *field = get_pointer_in_header (header);
+    }
+}
+
+/**
+ * @brief Updates a stack slot to the new address of the object it points
+ * into. A slot pointing into an object keeps pointing as far into the copy.
+ * The old copy is no longer allocated, so its start is searched for in the
+ * start map and checked in the mark map.
+ * @param stack_address the address of the stack slot
+ * @param arg the evacuation
+ */
+static void
+forward_stack_slot (void *stack_address, void *arg)
+{
+  evacuation_t *evac = (evacuation_t *)arg;
+  heap_t *h = evac->heap;
+  void **slot = (void **)stack_address;
+  size_t header_offset;
+  if (!is_in_range ((uintptr_t)*slot, h)
+      || !find_object_start (h->start_map, calc_heap_offset (*slot, h),
+                             &header_offset)
+      || !is_offset_marked (h->mark_map, header_offset)
+      || evac->set_index[header_offset / h->page_size] == NOT_COLLECTED)
+    {
+      return;
+    }
+  void *alloc = (char *)h->heap_start + header_offset + sizeof (header_t);
+  header_t header = get_header_value (get_header_pointer (alloc));
+  if (get_header_type (header) != HEADER_FORWARDING_ADDRESS)
+    {
+      return;
+    }
+  void *copy = get_pointer_in_header (header);
+  size_t size = align_alloc_size (calc_alloc_size (copy)) + sizeof (header_t);
+  if (calc_heap_offset (*slot, h) < header_offset + size)
+    {
+      *slot = (char *)copy + ((char *)*slot - (char *)alloc);
+    }
+}
+
+/**
+ * @brief Updates the references of every marked object of the collection
+ * set, at its new address if it was evacuated and where it is otherwise.
+ * @param evac the evacuation, with every object evacuated
+ */
+static void
+forward_collected_objects (evacuation_t *evac)
+{
+  heap_t *h = evac->heap;
+  for (size_t i = 0; i < evac->set_count; i++)
+    {
+      size_t offset = evac->pages[i] * h->page_size;
+      size_t page_end = offset + h->page_size < h->size
+                            ? offset + h->page_size
+                            : h->size;
+      while (find_next_marked_offset (h->mark_map, page_end, &offset))
+        {
+          void *alloc = (char *)h->heap_start + offset + sizeof (header_t);
+          header_t header = get_header_value (get_header_pointer (alloc));
+          if (get_header_type (header) == HEADER_FORWARDING_ADDRESS)
+            {
+              alloc = get_pointer_in_header (header);
+            }
+          for_each_reference (alloc, forward_field, evac);
+          offset += MIN_ALLOC_OBJECT_SIZE;
+        }
+    }
+}
+
+size_t
+evacuate_sparse_pages (heap_t *h, char *root_map, uintptr_t start,
+                       uintptr_t end)
+{
+  evacuation_t evac = { .heap = h,
+                        .page_count
+                        = (h->size + h->page_size - 1) / h->page_size };
+  evac.set_index = malloc (evac.page_count * sizeof (size_t));
+  assert (evac.set_index != NULL);
+  for (size_t page = 0; page < evac.page_count; page++)
+    {
+      evac.set_index[page] = NOT_COLLECTED;
+    }
+
+  choose_collection_set (&evac, root_map);
+  build_remembered_sets (&evac);
+
+  /* Old copies keep their forwarding address until every reference has
+     been updated, nothing is evacuated onto a page of the set.  */
+  for (size_t i = 0; i < evac.set_count; i++)
+    {
+      size_t offset = evac.pages[i] * h->page_size;
+      size_t page_end = offset + h->page_size < h->size
+                            ? offset + h->page_size
+                            : h->size;
+      while (find_next_marked_offset (h->mark_map, page_end, &offset))
+        {
+          evacuate_object (&evac, offset);
+          offset += MIN_ALLOC_OBJECT_SIZE;
+        }
+    }
+
+  for (size_t i = 0; i < evac.set_count; i++)
+    {
+      remembered_set_t *set = &evac.remembered[i];
+      for (size_t j = 0; j < set->count; j++)
+        {
+          forward_field (set->fields[j], &evac);
+        }
+    }
+  forward_collected_objects (&evac);
+  if (!h->is_unsafe_stack)
+    {
+      apply_to_roots (h, start, end, (apply_to_ptr_func *)forward_stack_slot,
+                      &evac);
+    }
+
+  size_t emptied = 0;
+  for (size_t i = 0; i < evac.set_count; i++)
+    {
+      if (count_page_granules (h, h->alloc_map, evac.pages[i]) == 0)
+        {
+          emptied++;
+        }
+      free (evac.remembered[i].fields);
+    }
+  free (evac.remembered);
+  free (evac.pages);
+  free (evac.set_index);
+  return emptied;
+}
@@ -0,0 +1,35 @@
+/**
+ * Functions for evacuating the most sparsely used pages of a swept heap,
+ * instead of compacting all of it.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "heap.h"
+
+/* The largest share of a page that may be alive for it to be evacuated,
+   evacuating fuller pages costs more copying than the space it frees.  */
+#define MAX_EVACUATED_LIVE_RATIO 0.85f
+
+/**
+ * @brief Evacuates a collection set of pages. The pages with the lowest
+ * share of live data, up to the evacuated_pages of the heap, have their
+ * objects copied to empty pages, leaving them empty in turn.
+ *
+ * A remembered set of the fields pointing into each page of the collection
+ * set is gathered from the objects outside of it, so only those fields and
+ * the evacuated objects themselves are updated afterwards. Pages holding a
+ * root are never evacuated when the stack is unsafe, and are marked as not
+ * movable in the page map instead. Large objects and objects that find no
+ * room on an empty page stay where they are.
+ * @param h the heap, swept with its living objects still marked
+ * @param root_map a map of the roots found
+ * @param start the lowest stack address, to update if the stack is safe
+ * @param end the highest stack address (non-inclusive)
+ * @return the amount of pages evacuated
+ */
+size_t evacuate_sparse_pages (heap_t *h, char *root_map, uintptr_t start,
+                              uintptr_t end);
@@ -40,6 +40,143 @@ check_if_too_big_size (uint_fast64_t new, uint_fast64_t old)
   return false;
 }
 
+/**
+ * The result of decoding four parts of a bit vector, starting at an offset
+ * that is either a multiple of 8 or 4 bytes past one.
+ * @param bytes: The bytes the parts take up, including padding before them.
+ * @param pointer_words: Bit i is set if a pointer is found i words after the
+ * word the parts start in.
+ * @param has_eight: If any part needs to be aligned to 8 bytes.
+ */
+typedef struct vector_byte_step
+{
+  uint8_t bytes;
+  uint8_t pointer_words;
+  uint8_t has_eight;
+} vector_byte_step_t;
+
+/**
+ * A decoded bit vector.
+ * @param vector: The bit vector without format encoding, 0 if unused.
+ * @param size: The size of the struct, including padding at the end.
+ * @param pointer_words: Bit i is set if there is a pointer at offset
+ * i * sizeof (void *).
+ */
+typedef struct decoded_vector
+{
+  uint_fast64_t vector;
+  uint_fast64_t size;
+  uint64_t pointer_words;
+} decoded_vector_t;
+
+/* Decoded bit vectors are remembered in 2^DECODED_VECTOR_CACHE_BITS slots.  */
+#define DECODED_VECTOR_CACHE_BITS 6
+
+/* Steps for every byte of a bit vector, indexed by if the byte starts 4
+   bytes past a multiple of 8, and the byte.  */
+static vector_byte_step_t vector_byte_steps[2][UINT8_MAX + 1];
+static bool has_vector_byte_steps = false;
+
+/* Recently decoded bit vectors. Each thread has its own, so an entry is never
+   read while half written.  */
+static _Thread_local decoded_vector_t
+    decoded_vector_cache[1 << DECODED_VECTOR_CACHE_BITS];
+
+/**
+ * Fills the byte step table by decoding every byte one part at a time.
+ */
+static void
+create_vector_byte_steps (void)
+{
+  for (uint_fast8_t phase = 0; phase < 2; phase++)
+    {
+      for (uint_fast16_t byte = 0; byte <= UINT8_MAX; byte++)
+        {
+          vector_byte_step_t *step = &vector_byte_steps[phase][byte];
+          uint_fast8_t start = phase * 4;
+          uint_fast8_t offset = start;
+          *step = (vector_byte_step_t){ 0 };
+          for (int_fast8_t shift = 8 - BITS_PER_VECTOR_PART; shift >= 0;
+               shift -= BITS_PER_VECTOR_PART)
+            {
+              uint_fast8_t part = (byte >> shift) & LAST_VECTOR_PART;
+              if (part == FOUR_BYTES_IN_VECTOR)
+                {
+                  offset += 4;
+                  continue;
+                }
+              if (part == END_OF_VECTOR)
+                {
+                  /* Only found before the first part of the vector.  */
+                  continue;
+                }
+              offset += (8 - offset % 8) % 8;
+              if (part == POINTER_IN_VECTOR)
+                {
+                  step->pointer_words |= 1 << (offset / 8);
+                }
+              offset += 8;
+              step->has_eight = true;
+            }
+          step->bytes = offset - start;
+        }
+    }
+  has_vector_byte_steps = true;
+}
+
+/**
+ * Decodes the size and pointer offsets of a bit vector a byte at a time,
+ * starting from the byte holding the first part.
+ */
+static void
+decode_bit_vector_bytes (uint_fast64_t vector, decoded_vector_t *decoded)
+{
+  if (!has_vector_byte_steps)
+    {
+      create_vector_byte_steps ();
+    }
+
+  uint_fast64_t size = 0;
+  uint64_t pointer_words = 0;
+  bool has_eight = false;
+  if (vector != 0)
+    {
+      int_fast8_t shift = (63 - __builtin_clzll (vector)) & ~7;
+      for (/* empty */; shift >= 0; shift -= 8)
+        {
+          vector_byte_step_t *step
+              = &vector_byte_steps[(size / 4) % 2][(vector >> shift) & 0xff];
+          pointer_words |= (uint64_t)step->pointer_words << (size / 8);
+          size += step->bytes;
+          has_eight |= step->has_eight;
+        }
+    }
+
+  /* Struct size is always divisible by size of largest element.  */
+  uint_fast8_t largest = has_eight ? 8 : 4;
+  decoded->size = size + (largest - size % largest) % largest;
+  decoded->pointer_words = pointer_words;
+  decoded->vector = vector;
+}
+
+/**
+ * Gets the size and pointer offsets of a bit vector without format encoding,
+ * decoding it only if it is not cached.
+ */
+static decoded_vector_t *
+decode_bit_vector (uint_fast64_t vector)
+{
+  /* Multiplicative hash, the top bits depend on every bit of the vector.  */
+  size_t index
+      = (vector * 0x9E3779B97F4A7C15u) >> (64 - DECODED_VECTOR_CACHE_BITS);
+  decoded_vector_t *decoded = &decoded_vector_cache[index];
+  if (decoded->vector != vector || vector == 0)
+    {
+      decode_bit_vector_bytes (vector, decoded);
+    }
+  return decoded;
+}
+
 /**
  * @brief adds an amount of bytes, for an amount of repetitions, to a size
  * variable. Also adds padding. As a side effect, updates variables that keep
@@ -182,57 +319,7 @@ size_from_vector (uint_fast64_t vector)
       return 0;
     }
 
-  uint_fast64_t size = 0;
-  /* Sets current part to first vector part, moved to LSB for easier
-   * operations.  */
-  uint_fast64_t current_part = ((vector & FIRST_VECTOR_PART))
-                               >> (BITS_IN_VECTOR - BITS_PER_VECTOR_PART);
-  uint_fast8_t largest
-      = 4; /* Bit vector cannot contain parts smaller than 4.  */
-  uint_fast64_t repeats = 1; /* Needed to reuse update_size.  */
-  bool is_too_big = false;
-
-  uint_fast8_t bits_passed = 0;
-  while (current_part == 0x0 && bits_passed < BITS_IN_VECTOR)
-    {
-      vector = vector << BITS_PER_VECTOR_PART;
-      current_part = (vector & FIRST_VECTOR_PART)
-                     >> (BITS_IN_VECTOR - BITS_PER_VECTOR_PART);
-      bits_passed += BITS_PER_VECTOR_PART;
-    }
-
-  /* Will always terminate due to shifting left at the end of the loop.  */
-  while (current_part != 0x0)
-    {
-      if (current_part == FOUR_BYTES_IN_VECTOR)
-        {
-          size = update_size (size, 4, &repeats, &largest, &is_too_big);
-        }
-      else if (current_part == EIGHT_BYTES_IN_VECTOR)
-        {
-          size = update_size (size, 8, &repeats, &largest, &is_too_big);
-        }
-      else if (current_part == POINTER_IN_VECTOR)
-        {
-          size = update_size (size, sizeof (void *), &repeats, &largest,
-                              &is_too_big);
-        }
-      else /* Currently unreachable.  */
-        {
-          assert (false); /* Incorrect format of bit vector.  */
-        }
-      vector = vector << BITS_PER_VECTOR_PART;
-      current_part = (vector & FIRST_VECTOR_PART)
-                     >> (BITS_IN_VECTOR - BITS_PER_VECTOR_PART);
-      bits_passed += BITS_PER_VECTOR_PART;
-    }
-
-  /* Struct size is always divisible by size of largest element.  */
-  uint_fast64_t final_size = size + (largest - size % largest) % largest;
-  is_too_big = check_if_too_big_size (final_size, size);
-
-  assert (!is_too_big); /* Should never fail due to size of bit vector.  */
-  return final_size;
+  return decode_bit_vector (vector)->size;
 }
 
 /**
@@ -599,67 +686,43 @@ find_pointer_in_alloc (void *allocation_start, uint_fast64_t offset)
   return pointer_location;
 }
 
-/* Does not have support for size with pointers.  */
-ptr_queue_t *
-get_pointers_from_bit_vector (uint_fast64_t vector, void *allocation_start)
+/**
+ * Enqueues a pointer field in the pointer queue given as argument
+ */
+static void
+enqueue_pointer_field (void **field, void *queue)
 {
-  ptr_queue_t *pointers = create_ptr_queue ();
+  enqueue_ptr ((ptr_queue_t *)queue, field);
+}
 
+/* Does not have support for size with pointers.  */
+void
+for_each_pointer_in_bit_vector (uint_fast64_t vector, void *allocation_start,
+                                pointer_field_func *func, void *arg)
+{
   enum FormatType type = get_format_type (vector);
   vector = remove_formating_encoding (vector);
 
   if (type != FORMAT_VECTOR)
-    return pointers;
+    return;
 
-  uint_fast64_t size = 0;
-  uint_fast64_t current_part = ((vector & FIRST_VECTOR_PART))
-                               >> (BITS_IN_VECTOR - BITS_PER_VECTOR_PART);
-  uint_fast8_t largest = 1;  /* Needed to reuse update_size.  */
-  uint_fast64_t repeats = 1; /* Needed to reuse update_size.  */
-  bool is_too_big = false;
-
-  /* Find start of bit vector.  */
-  uint_fast8_t bits_passed = 0;
-  while (current_part == 0x0 && bits_passed < BITS_IN_VECTOR)
+  uint64_t pointer_words = decode_bit_vector (vector)->pointer_words;
+  while (pointer_words != 0)
     {
-      vector = vector << BITS_PER_VECTOR_PART;
-      current_part = (vector & FIRST_VECTOR_PART)
-                     >> (BITS_IN_VECTOR - BITS_PER_VECTOR_PART);
-      bits_passed += BITS_PER_VECTOR_PART;
+      /* Lowest set bit first, compiles to tzcnt where the CPU has it.  */
+      uint_fast64_t word = __builtin_ctzll (pointer_words);
+      func (find_pointer_in_alloc (allocation_start, word * sizeof (void *)),
+            arg);
+      pointer_words &= pointer_words - 1;
     }
+}
 
-  /* Will always terminate due to shifting left at the end of the loop.  */
-  while (current_part != 0x0)
-    {
-      if (current_part == FOUR_BYTES_IN_VECTOR)
-        {
-          size = update_size (size, 4, &repeats, &largest, &is_too_big);
-        }
-      else if (current_part == EIGHT_BYTES_IN_VECTOR)
-        {
-          size = update_size (size, 8, &repeats, &largest, &is_too_big);
-        }
-      else if (current_part == POINTER_IN_VECTOR)
-        {
-          /* Size needs to be calculated first, to account for padding.  */
-          size = update_size (size, sizeof (void *), &repeats, &largest,
-                              &is_too_big);
-          enqueue_ptr (pointers,
-                       find_pointer_in_alloc (allocation_start,
-                                              size - sizeof (void *)));
-        }
-      else /* Currently unreachable.  */
-        {
-          assert (false); /* incorrect format of bit vector.  */
-        }
-      vector = vector << BITS_PER_VECTOR_PART;
-      current_part = (vector & FIRST_VECTOR_PART)
-                     >> (BITS_IN_VECTOR - BITS_PER_VECTOR_PART);
-      bits_passed += BITS_PER_VECTOR_PART;
-    }
-
-  assert (!is_too_big); /* Should never fail due to size of bit vector.  */
-
+ptr_queue_t *
+get_pointers_from_bit_vector (uint_fast64_t vector, void *allocation_start)
+{
+  ptr_queue_t *pointers = create_ptr_queue ();
+  for_each_pointer_in_bit_vector (vector, allocation_start,
+                                  enqueue_pointer_field, pointers);
   return pointers;
 }
 
@@ -673,10 +736,10 @@ round_up_to_multiple (size_t input, size_t multiple)
   return input;
 }
 
-ptr_queue_t *
-get_pointers_from_format_string (char *format, void *allocation_start)
+void
+for_each_pointer_in_format_string (char *format, void *allocation_start,
+                                   pointer_field_func *func, void *arg)
 {
-  ptr_queue_t *pointers = create_ptr_queue ();
   /* for each char in format, check if it is a number preceeding a pointer */
   /* or if it is a pointer */
   size_t internal_offset = 0;
@@ -736,10 +799,12 @@ get_pointers_from_format_string (char *format, void *allocation_start)
           repeats = repeats == 0 ? 1 : repeats;
           for (size_t i = 0; i < repeats; i++)
             {
-              void *internal_pointter
-                  = (((char *)allocation_start) + internal_offset);
-              enqueue_ptr (pointers, internal_pointter);
-              internal_offset = round_up_to_multiple (internal_offset, 8) + 8;
+              /* pointers are aligned, padding comes before the field */
+              internal_offset = round_up_to_multiple (internal_offset, 8);
+              void **internal_pointter
+                  = find_pointer_in_alloc (allocation_start, internal_offset);
+              func (internal_pointter, arg);
+              internal_offset += 8;
             }
           repeats = 0;
           break;
@@ -754,6 +819,14 @@ get_pointers_from_format_string (char *format, void *allocation_start)
       cursor++;
       ch = *cursor;
     }
+}
+
+ptr_queue_t *
+get_pointers_from_format_string (char *format, void *allocation_start)
+{
+  ptr_queue_t *pointers = create_ptr_queue ();
+  for_each_pointer_in_format_string (format, allocation_start,
+                                     enqueue_pointer_field, pointers);
   return pointers;
 }
 
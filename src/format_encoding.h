@@ -142,6 +142,39 @@ uint_fast64_t size_from_vector (uint_fast64_t vector);
 uint_fast64_t convert_to_bit_vector (char *format, uint_fast64_t size,
                                      bool *success);
 
+/**
+ * @param field the address of a pointer field inside an allocation
+ * @param arg an optional argument sent along to the function
+ */
+typedef void pointer_field_func (void **field, void *arg);
+
+/**
+ * @brief Calls func with the address of every pointer field in an allocation
+ * described by a bit vector, in order of increasing offset. Does not allocate
+ * any memory.
+ * @note See get_pointers_from_bit_vector for how the bit vector is read.
+ * @param vector a bit vector describing a struct
+ * @param allocation_start a pointer to the start of the allocation
+ * @param func the function to call for each pointer field
+ * @param arg an optional argument sent to func
+ */
+void for_each_pointer_in_bit_vector (uint_fast64_t vector,
+                                     void *allocation_start,
+                                     pointer_field_func *func, void *arg);
+
+/**
+ * @brief Calls func with the address of every pointer field in an allocation
+ * described by a format string, in order of increasing offset. Does not
+ * allocate any memory.
+ * @note See get_pointers_from_format_string for valid format strings.
+ * @param format a format string describing layout of the allocation
+ * @param allocation_start a pointer to the start of the allocation
+ * @param func the function to call for each pointer field
+ * @param arg an optional argument sent to func
+ */
+void for_each_pointer_in_format_string (char *format, void *allocation_start,
+                                        pointer_field_func *func, void *arg);
+
 /**
  * @brief Finds pointers to all pointers in an allocation described by a bit
  * vector
@@ -0,0 +1,172 @@
+/**
+ * Functions for building and reading a forwarding table.
+ */
+
+#include <assert.h>
+
+#include "allocation_map.h"
+#include "bitmap.h"
+#include "forwarding_table.h"
+
+/* The amount of granules in a block of the table.  */
+#define BLOCK_GRANULES (FORWARDING_BLOCK_SIZE / MIN_ALLOC_OBJECT_SIZE)
+
+/**
+ * @param granule_count: The amount of granules in the heap.
+ * @param block_count: The amount of blocks in the heap.
+ * @param block_dest: For each block without fixed objects, the heap offset
+ * its first moved granule is moved to. For each fixed block, the heap offset
+ * directly after the last object that stays in it.
+ * @param fixed_blocks: A bitmap of the blocks where objects stay in place.
+ * @param moved_map: A bitmap with every granule of every moved object set.
+ * @param end_map: A bitmap with the last granule of every recorded object
+ * set, used to find the size of an object.
+ */
+struct forwarding_table
+{
+  size_t granule_count;
+  size_t block_count;
+  size_t *block_dest;
+  char *fixed_blocks;
+  char *moved_map;
+  char *end_map;
+};
+
+forwarding_table_t *
+create_forwarding_table (size_t heap_bytes)
+{
+  forwarding_table_t *table = calloc (1, sizeof (forwarding_table_t));
+  assert (table != NULL && "Calloc failed to allocate forwarding table");
+  table->granule_count = heap_bytes / MIN_ALLOC_OBJECT_SIZE;
+  table->block_count
+      = (heap_bytes + FORWARDING_BLOCK_SIZE - 1) / FORWARDING_BLOCK_SIZE;
+  table->block_dest = calloc (table->block_count, sizeof (size_t));
+  table->fixed_blocks = calloc (calc_bitmap_size (table->block_count), 1);
+  table->moved_map = calloc (calc_bitmap_size (table->granule_count), 1);
+  table->end_map = calloc (calc_bitmap_size (table->granule_count), 1);
+  assert (table->block_dest != NULL && table->fixed_blocks != NULL
+          && table->moved_map != NULL && table->end_map != NULL);
+  return table;
+}
+
+void
+destroy_forwarding_table (forwarding_table_t *table)
+{
+  if (table == NULL)
+    {
+      return;
+    }
+  free (table->end_map);
+  free (table->moved_map);
+  free (table->fixed_blocks);
+  free (table->block_dest);
+  free (table);
+}
+
+bool
+fix_object_range (forwarding_table_t *table, size_t offset, size_t size)
+{
+  bool is_changed = false;
+  size_t end = offset + size;
+  for (size_t block = offset / FORWARDING_BLOCK_SIZE;
+       block <= (end - 1) / FORWARDING_BLOCK_SIZE; block++)
+    {
+      if (count_set_bits (table->fixed_blocks, block, 1) == 0)
+        {
+          update_bit_range (table->fixed_blocks, block, 1, true);
+          table->block_dest[block] = 0;
+          is_changed = true;
+        }
+      if (table->block_dest[block] < end)
+        {
+          table->block_dest[block] = end;
+        }
+    }
+  return is_changed;
+}
+
+bool
+is_range_fixed (forwarding_table_t *table, size_t offset, size_t size)
+{
+  size_t first = offset / FORWARDING_BLOCK_SIZE;
+  size_t last = (offset + size - 1) / FORWARDING_BLOCK_SIZE;
+  return count_set_bits (table->fixed_blocks, first, last - first + 1) > 0;
+}
+
+void
+record_object (forwarding_table_t *table, size_t offset, size_t size,
+               bool is_moved)
+{
+  size_t granule = offset / MIN_ALLOC_OBJECT_SIZE;
+  size_t granules = size / MIN_ALLOC_OBJECT_SIZE;
+  update_bit_range (table->end_map, granule + granules - 1, 1, true);
+  if (is_moved)
+    {
+      update_bit_range (table->moved_map, granule, granules, true);
+    }
+  else
+    {
+      fix_object_range (table, offset, size);
+    }
+}
+
+void
+compute_block_destinations (forwarding_table_t *table, size_t start,
+                            size_t end)
+{
+  assert (start % FORWARDING_BLOCK_SIZE == 0);
+  size_t cursor = start;
+  size_t last_block
+      = (end + FORWARDING_BLOCK_SIZE - 1) / FORWARDING_BLOCK_SIZE;
+  for (size_t block = start / FORWARDING_BLOCK_SIZE; block < last_block;
+       block++)
+    {
+      if (count_set_bits (table->fixed_blocks, block, 1) > 0)
+        {
+          /* Step over the objects that stay, the free space after them can
+             still be used  */
+          if (table->block_dest[block] > cursor)
+            {
+              cursor = table->block_dest[block];
+            }
+          continue;
+        }
+
+      table->block_dest[block] = cursor;
+      size_t first = block * BLOCK_GRANULES;
+      size_t count = table->granule_count - first < BLOCK_GRANULES
+                         ? table->granule_count - first
+                         : BLOCK_GRANULES;
+      cursor += count_set_bits (table->moved_map, first, count)
+                * MIN_ALLOC_OBJECT_SIZE;
+    }
+}
+
+bool
+is_moved_object (forwarding_table_t *table, size_t offset)
+{
+  return count_set_bits (table->moved_map, offset / MIN_ALLOC_OBJECT_SIZE, 1)
+         > 0;
+}
+
+size_t
+get_forwarding_offset (forwarding_table_t *table, size_t offset)
+{
+  size_t block = offset / FORWARDING_BLOCK_SIZE;
+  size_t first = block * BLOCK_GRANULES;
+  size_t moved_before = count_set_bits (
+      table->moved_map, first, offset / MIN_ALLOC_OBJECT_SIZE - first);
+  return table->block_dest[block] + moved_before * MIN_ALLOC_OBJECT_SIZE;
+}
+
+size_t
+get_recorded_object_size (forwarding_table_t *table, size_t offset)
+{
+  size_t granule = offset / MIN_ALLOC_OBJECT_SIZE;
+  size_t last = granule;
+  bool is_found = find_next_set_bit (table->end_map, table->granule_count,
+                                     &last);
+  assert (is_found && "Object was not recorded");
+  (void)is_found;
+  return (last - granule + 1) * MIN_ALLOC_OBJECT_SIZE;
+}
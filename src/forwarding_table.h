@@ -0,0 +1,103 @@
+/**
+ * A table of where every marked object is moved when the heap is compacted.
+ * The table is kept outside of the heap, so objects can slide over the old
+ * location of other objects without losing any forwarding address.
+ *
+ * Only the destination of the first moved granule of each block is stored.
+ * Moved objects keep their order and are packed without gaps within a
+ * block, so the destination of an object is the destination of its block
+ * plus the amount of moved granules before it in the block, counted with a
+ * popcount over a bitmap.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+/* The amount of heap bytes sharing a destination in the table, one word of
+   a bitmap with a bit per granule.  */
+#define FORWARDING_BLOCK_SIZE 1024
+
+typedef struct forwarding_table forwarding_table_t;
+
+/**
+ * @brief Creates an empty forwarding table.
+ * @param heap_bytes the size of the heap the table is for
+ * @return a table where no object is moved and no block is fixed
+ */
+forwarding_table_t *create_forwarding_table (size_t heap_bytes);
+
+/**
+ * @brief Frees all memory allocated to a forwarding table.
+ * @param table the table to destroy, may be NULL
+ */
+void destroy_forwarding_table (forwarding_table_t *table);
+
+/**
+ * @brief Marks every block an object that stays in place overlaps as fixed.
+ * Nothing is moved into or out of a fixed block.
+ * @param table the forwarding table
+ * @param offset the heap offset of the objects header
+ * @param size the size of the object including its header
+ * @return true if any of the blocks was not fixed before
+ */
+bool fix_object_range (forwarding_table_t *table, size_t offset, size_t size);
+
+/**
+ * @brief Checks if an object overlaps any fixed block.
+ * @param table the forwarding table
+ * @param offset the heap offset of the objects header
+ * @param size the size of the object including its header
+ * @return true if the object can not be moved
+ */
+bool is_range_fixed (forwarding_table_t *table, size_t offset, size_t size);
+
+/**
+ * @brief Adds a marked object to the table. Objects that stay fix their
+ * blocks, moved objects get a destination once the block destinations are
+ * computed.
+ * @param table the forwarding table
+ * @param offset the heap offset of the objects header
+ * @param size the size of the object including its header
+ * @param is_moved true if the object is moved
+ */
+void record_object (forwarding_table_t *table, size_t offset, size_t size,
+                    bool is_moved);
+
+/**
+ * @brief Computes the destination of each block in a part of the heap,
+ * packing the moved objects of the part towards its start while stepping
+ * over the objects of fixed blocks. Parts may be computed at the same time
+ * as long as no moved object crosses from one to another.
+ * @param table the forwarding table with every object recorded
+ * @param start the heap offset of the part, a multiple of
+ * FORWARDING_BLOCK_SIZE
+ * @param end the heap offset directly after the part
+ */
+void compute_block_destinations (forwarding_table_t *table, size_t start,
+                                 size_t end);
+
+/**
+ * @brief Checks if a recorded object is moved.
+ * @param table the forwarding table
+ * @param offset the heap offset of the objects header
+ * @return true if the object was recorded as moved
+ */
+bool is_moved_object (forwarding_table_t *table, size_t offset);
+
+/**
+ * @brief Gets the destination of a moved object.
+ * @param table the forwarding table with the block destinations computed
+ * @param offset the heap offset of the objects header
+ * @return the heap offset the header is moved to
+ */
+size_t get_forwarding_offset (forwarding_table_t *table, size_t offset);
+
+/**
+ * @brief Gets the size of a recorded object without reading its header.
+ * @param table the forwarding table
+ * @param offset the heap offset of the objects header
+ * @return the size of the object including its header
+ */
+size_t get_recorded_object_size (forwarding_table_t *table, size_t offset);
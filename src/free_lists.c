@@ -0,0 +1,247 @@
+/**
+ * Functions for lazily sweeping a heap into segregated free lists and taking
+ * room for allocations from them.
+ * Sweeping a page walks the holes of its allocation map a word at a time,
+ * the same way the free run index is built, but only when an allocation
+ * needs more room than the pages swept so far have left.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "allocation_map.h"
+#include "bitmap.h"
+#include "free_lists.h"
+
+/* The amount of chunks space is first reserved for in each size class.  */
+#define INITIAL_CHUNK_CAPACITY 16
+
+/* The largest chunk, in granules, with a size class of its own.  */
+#define EXACT_CLASS_GRANULES 8
+
+/**
+ * A free chunk of the heap.
+ * @param offset: The offset of the first free byte from the heap start.
+ * @param length: The length of the chunk in bytes.
+ */
+typedef struct free_chunk
+{
+  size_t offset;
+  size_t length;
+} free_chunk_t;
+
+/**
+ * The chunks of one size class, used as a stack.
+ * @param chunks: The chunks of the class.
+ * @param count: The amount of chunks.
+ * @param capacity: The amount of chunks there is space for.
+ */
+typedef struct size_class
+{
+  free_chunk_t *chunks;
+  size_t count;
+  size_t capacity;
+} size_class_t;
+
+/**
+ * @param classes: The chunks of each size class.
+ * @param heap_bytes: The size of the heap in bytes.
+ * @param page_size: The size of a page in bytes.
+ * @param page_count: The amount of pages in the heap.
+ * @param next_page: The first page not swept yet.
+ */
+struct free_lists
+{
+  size_class_t classes[SIZE_CLASS_COUNT];
+  size_t heap_bytes;
+  size_t page_size;
+  size_t page_count;
+  size_t next_page;
+};
+
+size_t
+get_size_class (size_t bytes)
+{
+  size_t granules = bytes / MIN_ALLOC_OBJECT_SIZE;
+  assert (granules > 0);
+  if (granules <= EXACT_CLASS_GRANULES)
+    {
+      return granules - 1;
+    }
+
+  size_t size_class = EXACT_CLASS_GRANULES;
+  size_t limit = 2 * EXACT_CLASS_GRANULES;
+  while (granules > limit && size_class < SIZE_CLASS_COUNT - 1)
+    {
+      limit *= 2;
+      size_class++;
+    }
+  return size_class;
+}
+
+/**
+ * Adds a chunk to the list of its size class, growing the list if needed.
+ */
+static void
+push_free_chunk (free_lists_t *lists, size_t offset, size_t length)
+{
+  size_class_t *size_class = &lists->classes[get_size_class (length)];
+  if (size_class->count == size_class->capacity)
+    {
+      size_class->capacity *= 2;
+      size_class->chunks = realloc (
+          size_class->chunks, size_class->capacity * sizeof (free_chunk_t));
+      assert (size_class->chunks != NULL
+              && "Realloc failed to grow free list");
+    }
+  size_class->chunks[size_class->count++]
+      = (free_chunk_t){ .offset = offset, .length = length };
+}
+
+free_lists_t *
+create_free_lists (size_t heap_bytes, size_t page_size)
+{
+  free_lists_t *lists = calloc (1, sizeof (free_lists_t));
+  assert (lists != NULL && "Calloc failed to allocate free lists");
+  lists->heap_bytes = heap_bytes;
+  lists->page_size = page_size;
+  lists->page_count = (heap_bytes + page_size - 1) / page_size;
+
+  for (size_t i = 0; i < SIZE_CLASS_COUNT; i++)
+    {
+      lists->classes[i].capacity = INITIAL_CHUNK_CAPACITY;
+      lists->classes[i].chunks
+          = malloc (INITIAL_CHUNK_CAPACITY * sizeof (free_chunk_t));
+      assert (lists->classes[i].chunks != NULL
+              && "Failed to allocate free list");
+    }
+  return lists;
+}
+
+void
+destroy_free_lists (free_lists_t *lists)
+{
+  if (lists == NULL)
+    {
+      return;
+    }
+  for (size_t i = 0; i < SIZE_CLASS_COUNT; i++)
+    {
+      free (lists->classes[i].chunks);
+    }
+  free (lists);
+}
+
+void
+reset_free_lists (free_lists_t *lists)
+{
+  for (size_t i = 0; i < SIZE_CLASS_COUNT; i++)
+    {
+      lists->classes[i].count = 0;
+    }
+  lists->next_page = 0;
+}
+
+/**
+ * Adds every hole of the next page not swept yet to the lists.
+ * @return false if every page was already swept
+ */
+static bool
+sweep_next_page (free_lists_t *lists, char *alloc_map)
+{
+  if (lists->next_page == lists->page_count)
+    {
+      return false;
+    }
+
+  size_t granules = lists->heap_bytes / MIN_ALLOC_OBJECT_SIZE;
+  size_t granules_per_page = lists->page_size / MIN_ALLOC_OBJECT_SIZE;
+  size_t page = lists->next_page++;
+  size_t page_end = (page + 1) * granules_per_page;
+  page_end = page_end > granules ? granules : page_end;
+
+  size_t start = page * granules_per_page;
+  while (find_next_zero_run (alloc_map, page_end, 1, &start))
+    {
+      size_t end = start;
+      if (!find_next_set_bit (alloc_map, page_end, &end))
+        {
+          end = page_end;
+        }
+      push_free_chunk (lists, start * MIN_ALLOC_OBJECT_SIZE,
+                       (end - start) * MIN_ALLOC_OBJECT_SIZE);
+      start = end;
+    }
+  return true;
+}
+
+/**
+ * Removes the first chunk of at least bytes from the lists.
+ * @return true if a chunk was found
+ */
+static bool
+pop_free_chunk (free_lists_t *lists, size_t bytes, free_chunk_t *chunk)
+{
+  size_t first_class = get_size_class (bytes);
+  for (size_t i = first_class; i < SIZE_CLASS_COUNT; i++)
+    {
+      size_class_t *size_class = &lists->classes[i];
+      /* Chunks of larger classes always fit, so only the class of the
+         allocation itself has to be searched.  */
+      size_t index = size_class->count;
+      while (index > 0)
+        {
+          index--;
+          if (size_class->chunks[index].length >= bytes)
+            {
+              *chunk = size_class->chunks[index];
+              size_class->chunks[index]
+                  = size_class->chunks[--size_class->count];
+              return true;
+            }
+          if (i != first_class)
+            {
+              break;
+            }
+        }
+    }
+  return false;
+}
+
+bool
+take_free_chunk (free_lists_t *lists, char *alloc_map, size_t bytes,
+                 size_t *offset)
+{
+  /* Allocations occupy whole granules.  */
+  bytes = ((bytes + MIN_ALLOC_OBJECT_SIZE - 1) / MIN_ALLOC_OBJECT_SIZE)
+          * MIN_ALLOC_OBJECT_SIZE;
+
+  free_chunk_t chunk;
+  while (!pop_free_chunk (lists, bytes, &chunk))
+    {
+      if (!sweep_next_page (lists, alloc_map))
+        {
+          return false;
+        }
+    }
+
+  if (chunk.length > bytes)
+    {
+      push_free_chunk (lists, chunk.offset + bytes, chunk.length - bytes);
+    }
+  *offset = chunk.offset;
+  return true;
+}
+
+size_t
+get_free_chunk_count (free_lists_t *lists, size_t size_class)
+{
+  return lists->classes[size_class].count;
+}
+
+size_t
+get_swept_page_count (free_lists_t *lists)
+{
+  return lists->next_page;
+}
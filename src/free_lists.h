@@ -0,0 +1,78 @@
+/**
+ * Segregated free lists of a heap collected without compacting, used to
+ * find room for an allocation of a given size without probing the
+ * allocation map.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+/* The amount of size classes, the last one holds every larger chunk.  */
+#define SIZE_CLASS_COUNT 13
+
+/**
+ * Free chunks of the heap sorted into size classes. Chunks of up to 8
+ * granules have a class of their own size, larger chunks are grouped by
+ * powers of two.
+ * The lists are filled lazily: a page is swept, adding its holes to the
+ * lists, only once the chunks already found can not fit an allocation.
+ */
+typedef struct free_lists free_lists_t;
+
+/**
+ * @brief Creates free lists where every page is still to be swept.
+ * @param heap_bytes the size of the heap in bytes
+ * @param page_size the size of a page in bytes
+ * @return the created free lists
+ */
+free_lists_t *create_free_lists (size_t heap_bytes, size_t page_size);
+
+/**
+ * @brief Frees all memory allocated to free lists.
+ * @param lists the free lists to destroy, may be NULL
+ */
+void destroy_free_lists (free_lists_t *lists);
+
+/**
+ * @brief Empties every list and marks every page as not swept, for when the
+ * allocation map was changed without going through the lists.
+ * @param lists the free lists
+ */
+void reset_free_lists (free_lists_t *lists);
+
+/**
+ * @brief Takes room for an allocation from the lists, sweeping more pages
+ * until a chunk large enough is found. The rest of the chunk is put back.
+ * @param lists the free lists
+ * @param alloc_map the allocation map of the heap
+ * @param bytes the amount of bytes needed
+ * @param offset set to the start of the room taken if there was any
+ * @return true if room was found, false if every page is swept and no chunk
+ * is large enough
+ */
+bool take_free_chunk (free_lists_t *lists, char *alloc_map, size_t bytes,
+                      size_t *offset);
+
+/**
+ * @brief Gets the size class of a chunk.
+ * @param bytes the size of the chunk in bytes
+ * @return the index of the size class
+ */
+size_t get_size_class (size_t bytes);
+
+/**
+ * @brief Gets the amount of chunks in a size class.
+ * @param lists the free lists
+ * @param size_class the index of the size class
+ * @return the amount of chunks in the class
+ */
+size_t get_free_chunk_count (free_lists_t *lists, size_t size_class);
+
+/**
+ * @brief Gets the amount of pages swept into the lists.
+ * @param lists the free lists
+ * @return the amount of swept pages
+ */
+size_t get_swept_page_count (free_lists_t *lists);
@@ -0,0 +1,173 @@
+/**
+ * Functions for building and searching the free run index of a heap.
+ * The index is built from the allocation map once per garbage collection,
+ * after which finding room for an allocation costs a walk over the pages
+ * after the bump pointer and the holes of the first page large enough.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "allocation_map.h"
+#include "bitmap.h"
+#include "free_run_index.h"
+
+/* The amount of free runs space is first reserved for.  */
+#define INITIAL_RUN_CAPACITY 16
+
+/**
+ * A free run of the heap.
+ * @param offset: The offset of the first free byte from the heap start.
+ * @param length: The length of the run in bytes.
+ */
+typedef struct free_run
+{
+  size_t offset;
+  size_t length;
+} free_run_t;
+
+/**
+ * @param runs: Every free run in address order.
+ * @param run_count: The amount of free runs.
+ * @param run_capacity: The amount of free runs there is space for.
+ * @param page_first_run: For each page the index of its first run, and
+ * run_count for one page past the last.
+ * @param page_largest_run: For each page the length of its largest run.
+ * @param page_count: The amount of pages in the heap.
+ * @param page_size: The size of a page in bytes.
+ */
+struct free_run_index
+{
+  free_run_t *runs;
+  size_t run_count;
+  size_t run_capacity;
+  size_t *page_first_run;
+  size_t *page_largest_run;
+  size_t page_count;
+  size_t page_size;
+};
+
+/**
+ * Appends a run to the index, growing the array of runs if needed.
+ */
+static void
+add_free_run (free_run_index_t *index, size_t offset, size_t length)
+{
+  if (index->run_count == index->run_capacity)
+    {
+      index->run_capacity *= 2;
+      index->runs
+          = realloc (index->runs, index->run_capacity * sizeof (free_run_t));
+      assert (index->runs != NULL && "Realloc failed to grow free runs");
+    }
+  index->runs[index->run_count++]
+      = (free_run_t){ .offset = offset, .length = length };
+}
+
+free_run_index_t *
+create_free_run_index (char *alloc_map, size_t heap_bytes, size_t page_size)
+{
+  free_run_index_t *index = calloc (1, sizeof (free_run_index_t));
+  assert (index != NULL && "Calloc failed to allocate free run index");
+  index->page_size = page_size;
+  index->page_count = (heap_bytes + page_size - 1) / page_size;
+  index->page_first_run = calloc (index->page_count + 1, sizeof (size_t));
+  index->page_largest_run = calloc (index->page_count, sizeof (size_t));
+  index->run_capacity = INITIAL_RUN_CAPACITY;
+  index->runs = malloc (index->run_capacity * sizeof (free_run_t));
+  assert (index->page_first_run != NULL && index->page_largest_run != NULL
+          && index->runs != NULL && "Failed to allocate free run index");
+
+  size_t granules = heap_bytes / MIN_ALLOC_OBJECT_SIZE;
+  size_t granules_per_page = page_size / MIN_ALLOC_OBJECT_SIZE;
+  for (size_t page = 0; page < index->page_count; page++)
+    {
+      index->page_first_run[page] = index->run_count;
+
+      size_t page_end = (page + 1) * granules_per_page;
+      page_end = page_end > granules ? granules : page_end;
+
+      /* Alternate between the start of a hole and the allocation ending it,
+         both found a word at a time.  */
+      size_t start = page * granules_per_page;
+      while (find_next_zero_run (alloc_map, page_end, 1, &start))
+        {
+          size_t end = start;
+          if (!find_next_set_bit (alloc_map, page_end, &end))
+            {
+              end = page_end;
+            }
+
+          size_t length = (end - start) * MIN_ALLOC_OBJECT_SIZE;
+          add_free_run (index, start * MIN_ALLOC_OBJECT_SIZE, length);
+          if (length > index->page_largest_run[page])
+            {
+              index->page_largest_run[page] = length;
+            }
+          start = end;
+        }
+    }
+  index->page_first_run[index->page_count] = index->run_count;
+
+  return index;
+}
+
+void
+destroy_free_run_index (free_run_index_t *index)
+{
+  if (index == NULL)
+    {
+      return;
+    }
+  free (index->runs);
+  free (index->page_first_run);
+  free (index->page_largest_run);
+  free (index);
+}
+
+bool
+find_free_run (free_run_index_t *index, size_t bytes, size_t *offset)
+{
+  /* Allocations occupy whole granules.  */
+  bytes = ((bytes + MIN_ALLOC_OBJECT_SIZE - 1) / MIN_ALLOC_OBJECT_SIZE)
+          * MIN_ALLOC_OBJECT_SIZE;
+  size_t start = ((*offset + MIN_ALLOC_OBJECT_SIZE - 1) / MIN_ALLOC_OBJECT_SIZE)
+                 * MIN_ALLOC_OBJECT_SIZE;
+
+  for (size_t page = start / index->page_size; page < index->page_count;
+       page++)
+    {
+      if (index->page_largest_run[page] < bytes)
+        {
+          /* No hole on this page is large enough.  */
+          continue;
+        }
+
+      for (size_t i = index->page_first_run[page];
+           i < index->page_first_run[page + 1]; i++)
+        {
+          free_run_t *run = &index->runs[i];
+          size_t run_end = run->offset + run->length;
+          if (run_end <= start)
+            {
+              continue;
+            }
+
+          /* Only the part of the run after the start offset can be used.  */
+          size_t run_start = run->offset > start ? run->offset : start;
+          if (run_end - run_start >= bytes)
+            {
+              *offset = run_start;
+              return true;
+            }
+        }
+    }
+  return false;
+}
+
+size_t
+get_free_run_count (free_run_index_t *index)
+{
+  return index->run_count;
+}
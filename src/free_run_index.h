@@ -0,0 +1,54 @@
+/**
+ * An index of the free runs (holes) left in the heap after garbage
+ * collection, used to find room for an allocation without probing the
+ * allocation map.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+/**
+ * The holes of a heap in address order, split at page boundaries since an
+ * allocation never crosses a page, together with the largest hole of each
+ * page so pages without enough room are skipped without looking at their
+ * holes.
+ * The index stays correct while allocations are only made at or after the
+ * bump pointer, as everything allocated since it was built lies before it.
+ */
+typedef struct free_run_index free_run_index_t;
+
+/**
+ * @brief Creates an index of every free run in an allocation map.
+ * @param alloc_map the allocation map of the heap
+ * @param heap_bytes the size of the heap in bytes
+ * @param page_size the size of a page in bytes
+ * @return the created index
+ */
+free_run_index_t *create_free_run_index (char *alloc_map, size_t heap_bytes,
+                                         size_t page_size);
+
+/**
+ * @brief Frees all memory allocated to a free run index.
+ * @param index the index to destroy, may be NULL
+ */
+void destroy_free_run_index (free_run_index_t *index);
+
+/**
+ * @brief Finds the first free space of at least the given size at or after
+ * offset, where the space does not cross a page boundary.
+ * @param index the free run index
+ * @param bytes the amount of bytes needed
+ * @param offset the offset to start searching from, set to the start of the
+ * free space if one was found
+ * @return true if a free space was found, false otherwise
+ */
+bool find_free_run (free_run_index_t *index, size_t bytes, size_t *offset);
+
+/**
+ * @brief Gets the amount of free runs in the index.
+ * @param index the free run index
+ * @return the amount of free runs
+ */
+size_t get_free_run_count (free_run_index_t *index);
@@ -4,12 +4,14 @@
 
 #include <assert.h>
 #include <math.h>
+#include <pthread.h>
 #include <setjmp.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <valgrind/memcheck.h>
 
 /* Stops gc.h from copying "extern heap_t *global_heap"  */
@@ -17,23 +19,48 @@
 #include "allocation.h"
 #include "allocation_map.h"
 #include "compacting.h"
+#include "evacuation.h"
 #include "format_encoding.h"
+#include "free_lists.h"
+#include "free_run_index.h"
 #include "gc.h"
 #include "gc_utils.h"
+#include "gc_workers.h"
 #include "get_header.h"
 #include "header.h"
 #include "heap_internal.h"
 #include "is_pointer_in_alloc.h"
-#include "move_data.h"
+#include "layout.h"
+#include "mark_map.h"
+#include "mark_region.h"
+#include "mark_stack.h"
+#include "mutators.h"
+#include "nursery.h"
 #include "page_map.h"
-#include "ptr_queue.h"
+#include "roots.h"
+#include "semispace.h"
 #include "stack.h"
+#include "start_map.h"
+#include "sweeping.h"
 
 /* The amount of bytes to mark as defined for valgrind, in order to avoid
  * warnings for using uninitialized values when looping through stack pointers.
  */
 #define MEM_TO_DEFINE 32
 
+/* Where the memory of a heap is asked for. Far above the program and its
+ * malloc heap, where only large integers look like pointers into the heap.
+ * The memory is placed anywhere else if the address is taken or out of
+ * reach.  */
+#if UINTPTR_MAX > 0xFFFFFFFF
+#define HEAP_ADDRESS_HINT ((void *)0x700000000000)
+#else
+#define HEAP_ADDRESS_HINT NULL
+#endif
+
+/* The most heaps with a write barrier that may exist at once.  */
+#define MAX_BARRIER_HEAPS 16
+
 #define Dump_registers()                                                      \
   jmp_buf env;                                                                \
   if (setjmp (env))                                                           \
@@ -51,9 +78,93 @@ typedef struct apply_dbg_info apply_dbg_info_t;
 
 heap_t *global_heap = NULL;
 
+/* The heaps that h_write_ptr has to find the owner of an object among,
+   read without the lock by the barrier.  */
+static heap_t *barrier_heaps[MAX_BARRIER_HEAPS];
+static pthread_mutex_t barrier_heaps_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Checks if stores into a heap have to go through the write barrier.
+ */
+static bool
+has_write_barrier (heap_t *h)
+{
+  return h->nursery != NULL || h->max_pause_ms > 0
+         || h->is_concurrent_marking;
+}
+
+/**
+ * Lets the write barrier find a heap, or forget it if it is deleted.
+ * @param h the heap
+ * @param is_added true to add the heap, false to remove it
+ * @return false if the heap was to be added but the table is full, or was
+ * to be removed but was never added
+ */
+static bool
+update_barrier_heaps (heap_t *h, bool is_added)
+{
+  heap_t *from = is_added ? NULL : h;
+  heap_t *to = is_added ? h : NULL;
+  pthread_mutex_lock (&barrier_heaps_lock);
+  size_t i = 0;
+  while (i < MAX_BARRIER_HEAPS && barrier_heaps[i] != from)
+    {
+      i++;
+    }
+  if (i < MAX_BARRIER_HEAPS)
+    {
+      __atomic_store_n (&barrier_heaps[i], to, __ATOMIC_RELEASE);
+    }
+  pthread_mutex_unlock (&barrier_heaps_lock);
+  return i < MAX_BARRIER_HEAPS;
+}
+
+/**
+ * Finds the heap that an address lies in, among the global heap and the
+ * heaps with a write barrier.
+ * @return the heap, or NULL if no such heap holds the address
+ */
+static heap_t *
+find_barrier_heap (void *ptr)
+{
+  if (global_heap != NULL && is_heap_pointer ((uintptr_t)ptr, global_heap))
+    {
+      return global_heap;
+    }
+  for (size_t i = 0; i < MAX_BARRIER_HEAPS; i++)
+    {
+      heap_t *h = __atomic_load_n (&barrier_heaps[i], __ATOMIC_ACQUIRE);
+      if (h != NULL && is_heap_pointer ((uintptr_t)ptr, h))
+        {
+          return h;
+        }
+    }
+  return NULL;
+}
+
 heap_t *
 h_init (size_t bytes, bool unsafe_stack, float gc_threshold)
 {
+  heap_options_t options = { .bytes = bytes,
+                             .unsafe_stack = unsafe_stack,
+                             .gc_threshold = gc_threshold,
+                             .gc_threads = 1,
+                             .fragmentation_threshold = 0,
+                             .nursery_bytes = 0,
+                             .max_pause_ms = 0,
+                             .concurrent_marking = false,
+                             .evacuated_pages = 0,
+                             .mark_region = false,
+                             .semispace = false,
+                             .precise_roots = false,
+                             .interior_pointers = false };
+  return h_init_with_options (&options);
+}
+
+heap_t *
+h_init_with_options (heap_options_t *options)
+{
+  size_t bytes = options->bytes;
   /* Allocate heap struct on the heap.  */
   heap_t *heap = malloc (sizeof (heap_t));
 
@@ -66,10 +177,11 @@ h_init (size_t bytes, bool unsafe_stack, float gc_threshold)
 
   /* Set fields:  */
   /* Threshold before running GC.  */
-  heap->gc_threshold = gc_threshold;
+  heap->gc_threshold = options->gc_threshold;
 
-  /* Are stack pointers considered safe? true = yes, false = no  */
-  heap->is_unsafe_stack = unsafe_stack;
+  /* Are stack pointers considered safe? true = yes, false = no. With
+     precise roots the stack is never scanned, so every root is safe.  */
+  heap->is_unsafe_stack = options->unsafe_stack && !options->precise_roots;
 
   /* Size of allocated heap.  */
   heap->size = aligned_size;
@@ -81,8 +193,74 @@ h_init (size_t bytes, bool unsafe_stack, float gc_threshold)
   /* Map of active/inactive allocations.  */
   heap->alloc_map = create_allocation_map (aligned_size);
 
-  /* The actual heap which objects will be allocated on.  */
-  heap->heap_start = calloc (aligned_size, sizeof (char));
+  /* Map of objects found alive during the mark-phase.  */
+  heap->mark_map = create_mark_map (aligned_size);
+
+  /* Map of where each object begins, to tell headers from other words and
+     to find the object a pointer points into.  */
+  heap->start_map = create_start_map (aligned_size);
+
+  /* Amount of objects that may wait to be scanned while tracing.  */
+  heap->mark_stack_size = DEFAULT_MARK_STACK_SIZE;
+
+  /* No holes exist before the first GC, the bump pointer is enough.  */
+  heap->free_runs = NULL;
+  heap->free_lists = NULL;
+
+  /* How fragmented the heap may get before it is compacted, 0 always
+     compacts.  */
+  heap->fragmentation_threshold = options->fragmentation_threshold;
+
+  /* How many sparse pages each collection may evacuate, 0 never does.  */
+  heap->evacuated_pages = options->evacuated_pages;
+
+  /* Young pages small objects are allocated on, if any.  */
+  heap->nursery = options->nursery_bytes > 0
+                      ? create_nursery (aligned_size, PAGE_SIZE,
+                                        options->nursery_bytes)
+                      : NULL;
+
+  /* The halves to copy between, copying needs no marking at all.  */
+  heap->semispace = heap->nursery == NULL && options->semispace
+                        ? create_semispace (aligned_size)
+                        : NULL;
+  bool is_marked = heap->nursery == NULL && heap->semispace == NULL;
+
+  /* Lines and blocks to bump allocate through instead of holes of any
+     size, a nursery has its own way of allocating.  */
+  heap->mark_region = is_marked && options->mark_region
+                          ? create_mark_region (aligned_size, PAGE_SIZE)
+                          : NULL;
+
+  /* How long each slice of marking may take, a nursery collects often
+     enough on its own.  */
+  heap->max_pause_ms = is_marked ? options->max_pause_ms : 0;
+  heap->is_concurrent_marking = is_marked && options->concurrent_marking;
+  heap->incremental_mark = NULL;
+
+  /* Threads that help marking, the calling thread is always one of them.  */
+  heap->gc_workers = options->gc_threads > 1
+                         ? create_gc_workers (options->gc_threads)
+                         : NULL;
+
+  /* No other thread shares the heap until one registers.  */
+  heap->mutators = create_mutators ();
+
+  /* Slots registered as roots, the only ones if the roots are precise.  */
+  heap->is_precise_roots = options->precise_roots;
+  heap->is_interior_pointers = options->interior_pointers;
+  heap->global_roots = create_root_stack ();
+  heap->shadow_stack = create_root_stack ();
+
+  /* No page has been pointed into before the first collection.  */
+  heap->blacklist = create_blacklist (aligned_size);
+
+  /* The actual heap which objects will be allocated on, zeroed like
+     calloc would.  */
+  heap->heap_start = mmap (HEAP_ADDRESS_HINT, aligned_size,
+                           PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                           -1, 0);
+  assert (heap->heap_start != MAP_FAILED && "Mmap failed to map heap");
 
   /* The bump pointer to where the next allocation will be made.  */
   heap->next_empty_mem_segment = heap->heap_start;
@@ -90,6 +268,13 @@ h_init (size_t bytes, bool unsafe_stack, float gc_threshold)
   /* Initializes the current number of used allocated bytes to 0.  */
   heap->used_bytes = 0;
 
+  /* The write barrier can only find a bounded number of heaps.  */
+  if (has_write_barrier (heap) && !update_barrier_heaps (heap, true))
+    {
+      h_delete (heap);
+      return NULL;
+    }
+
   /* Store a reference to the first created heap in the global heap.  */
   if (global_heap == NULL)
     {
@@ -102,6 +287,11 @@ h_init (size_t bytes, bool unsafe_stack, float gc_threshold)
 void
 h_delete (heap_t *h)
 {
+  if (has_write_barrier (h))
+    {
+      /* Not found if h_init_with_options gave up on the heap.  */
+      update_barrier_heaps (h, false);
+    }
   if (h->alloc_map != NULL)
     { /* The check can be removed when the allocation map is implemented in
          h_init
@@ -114,6 +304,19 @@ h_delete (heap_t *h)
          Frees the allocation map if it exists.  */
       free (h->page_map);
     }
+  free (h->mark_map);
+  free (h->start_map);
+  destroy_free_run_index (h->free_runs);
+  destroy_free_lists (h->free_lists);
+  destroy_nursery (h->nursery);
+  destroy_mark_region (h->mark_region);
+  destroy_semispace (h->semispace);
+  destroy_incremental_marking (h->incremental_mark);
+  destroy_gc_workers (h->gc_workers);
+  destroy_mutators (h->mutators);
+  destroy_root_stack (h->global_roots);
+  destroy_root_stack (h->shadow_stack);
+  destroy_blacklist (h->blacklist);
 
   /* if we are destroying the heap ref stored in global heap,
      we want to clear it to allow next h_init to set it.  */
@@ -122,10 +325,24 @@ h_delete (heap_t *h)
       global_heap = NULL;
     }
 
-  free (h->heap_start); /* Frees the heap.  */
+  munmap (h->heap_start, h->size); /* Frees the heap.  */
   free (h);
 }
 
+/**
+ * Finds the beginning of the stack of the calling thread. Unless it is
+ * registered, the thread is assumed to be the main thread, whose stack
+ * begins at the environment variables.
+ * @param h the heap
+ * @return the address right before the start of the stack
+ */
+static uintptr_t
+find_own_stack_beginning (heap_t *h)
+{
+  mutator_t *self = get_current_mutator (h->mutators);
+  return self != NULL ? get_stack_base (self) : find_stack_beginning ();
+}
+
 void
 set_heap_ptr_to_dbg_val (void *ptr, void *info)
 {
@@ -154,7 +371,7 @@ h_delete_dbg (heap_t *h, void *dbg_value)
 {
   Dump_registers ();
 
-  uintptr_t start = find_stack_beginning ();
+  uintptr_t start = find_own_stack_beginning (h);
   uintptr_t end = find_stack_end ();
   sort_stack_ends (&start, &end);
 
@@ -166,8 +383,8 @@ h_delete_dbg (heap_t *h, void *dbg_value)
      accessing memory that is not defined.  */
   VALGRIND_MAKE_MEM_DEFINED ((void *)start, end - start);
 
-  apply_to_pointers_in_interval (
-      start, end, (apply_to_ptr_func *)set_heap_ptr_to_dbg_val, apply_info);
+  apply_to_roots (h, start, end, (apply_to_ptr_func *)set_heap_ptr_to_dbg_val,
+                  apply_info);
 
   free (apply_info);
   h_delete (h);
@@ -176,16 +393,7 @@ h_delete_dbg (heap_t *h, void *dbg_value)
 size_t
 h_avail (heap_t *h)
 {
-  size_t free_bytes = 0;
-  size_t heap_size = h->size;
-  for (size_t offset = 0; offset < heap_size; offset += HEAP_ALIGNMENT)
-    {
-      if (!is_offset_allocated (h->alloc_map, offset))
-        {
-          free_bytes += HEAP_ALIGNMENT;
-        }
-    }
-  return free_bytes;
+  return h->size - count_allocated_bytes (h->alloc_map, h->size);
 }
 
 size_t
@@ -208,6 +416,27 @@ h_alloc_raw (heap_t *h, size_t bytes)
   return allocation;
 }
 
+layout_handle_t
+h_register_layout (heap_t *h, char *layout)
+{
+  (void)h;
+  return register_layout (layout);
+}
+
+void *
+h_alloc_layout (heap_t *h, layout_handle_t handle)
+{
+  void *allocation = alloc_layout (h, handle);
+  return allocation;
+}
+
+void *
+h_alloc_array (heap_t *h, layout_handle_t element, size_t length)
+{
+  void *allocation = alloc_array (h, element, length);
+  return allocation;
+}
+
 /**
  * Checks if the pointer points within a page and if so marks the page as
  * non-movable.
@@ -243,428 +472,462 @@ h_mark_pages (heap_t *h)
       return;
     }
 
-  uintptr_t start = find_stack_beginning ();
+  uintptr_t start = find_own_stack_beginning (h);
   uintptr_t end = find_stack_end ();
   sort_stack_ends (&start, &end);
-  apply_to_pointers_in_interval (start, end,
-                                 (apply_to_ptr_func *)mark_page_if_ptr, h);
+  apply_to_roots (h, start, end, (apply_to_ptr_func *)mark_page_if_ptr, h);
 }
 
 /**
- * A struct containing information about the compacting status.
- */
-typedef struct compacting_info compacting_info_t;
-struct compacting_info
-{
-  heap_t *h;
-  char *new_alloc_map;
-  size_t num_alive;
-  ptr_queue_t *compacting_queue;
-  ptr_queue_t *visited;
-  ptr_queue_t *forwarding_addresses;
-};
-
-/**
- * Checks if alloc is a pointer to an allocation, if it is add it to the
- * compacting_queue and call this function for all pointers in the allocation.
- * @param alloc the ptr to add to queue
- * @param c_info the struct with info about the compacting process
- * @return true if compact was successful else false.
+ * Frees every object left unmarked by the mark phase, by sweeping or by
+ * compacting the heap.
+ * @param h the heap, with its living objects marked
+ * @param root_map the roots found on the stack, freed by the call
+ * @param start the lowest stack address
+ * @param end the highest stack address (non-inclusive)
  */
-void
-add_alloc_to_move_queue (char **alloc_ptr, compacting_info_t *c_info)
+static void
+collect_marked_heap (heap_t *h, char *root_map, uintptr_t start,
+                     uintptr_t end)
 {
-  char *alloc = *alloc_ptr;
-  heap_t *h = c_info->h;
-  if (!is_heap_pointer ((uintptr_t)alloc, h))
+  /* Compacting or sweeping rewrites the allocation map, so the holes found
+     by the last GC are no longer valid.  */
+  destroy_free_run_index (h->free_runs);
+  h->free_runs = NULL;
+  destroy_free_lists (h->free_lists);
+  h->free_lists = NULL;
+
+  /* Every object found is old after a full collection */
+  if (h->nursery != NULL)
     {
-      return;
-    }
-  if (alloc == h->heap_start)
-    {
-      return;
+      reset_nursery (h->nursery);
     }
 
-  header_t *header_p = get_header_pointer (alloc);
-
-  if (!is_heap_pointer ((uintptr_t)header_p, h))
-    {
-      return;
-    }
-
-  header_t header = get_header_value (header_p);
-  if (header == 0)
+  if (h->mark_region != NULL)
     {
+      /* Free the dead objects where they are, and only go on to evacuate
+         the sparsest pages once too many of the free lines are stranded
+         between live ones.  */
+      sweep_heap (h);
+      mark_lines (h->mark_region, h->alloc_map);
+      if (h->evacuated_pages > 0
+          && calc_line_fragmentation (h->mark_region)
+                 > h->fragmentation_threshold)
+        {
+          evacuate_sparse_pages (h, root_map, start, end);
+          mark_lines (h->mark_region, h->alloc_map);
+        }
+      free (root_map);
       return;
     }
 
-  header_type_t header_type = get_header_type (header);
-  if (!(header_type == HEADER_BIT_VECTOR
-        || header_type == HEADER_POINTER_TO_FORMAT_STRING))
+  if (h->evacuated_pages > 0)
     {
+      /* Free the dead objects where they are, then empty the pages with
+         the least left alive on them.  */
+      sweep_heap (h);
+      evacuate_sparse_pages (h, root_map, start, end);
+      free (root_map);
+      h->free_lists = create_free_lists (h->size, h->page_size);
       return;
     }
 
-  size_t offset = calc_heap_offset (alloc, h);
-  bool is_moveable = is_offset_movable (h->page_map, offset);
-  if (is_moveable)
-    {
-      bool already_in_queue = !enqueue_ptr (c_info->compacting_queue, alloc);
-      if (already_in_queue)
-        {
-          return;
-        }
-    }
-  else
+  if (h->fragmentation_threshold > 0)
     {
-      bool already_in_queue = !enqueue_ptr (c_info->visited, alloc);
-      if (already_in_queue)
+      /* Free the dead objects where they are, and only go on to compact the
+         heap once too much of its free memory is stranded between
+         objects.  */
+      sweep_heap (h);
+      if (calc_fragmentation (h) <= h->fragmentation_threshold)
         {
+          free (root_map);
+          h->free_lists = create_free_lists (h->size, h->page_size);
           return;
         }
-      size_t alloc_size = calc_alloc_size (alloc);
-      c_info->num_alive++;
-      for (size_t curr_offset = offset; curr_offset <= offset + alloc_size;
-           curr_offset += HEAP_ALIGNMENT)
-        {
-          update_alloc_map (c_info->new_alloc_map, curr_offset, true);
-        }
     }
 
-  if (header_type == HEADER_POINTER_TO_FORMAT_STRING)
+  /* Plan where each object goes in a table outside of the heap, then update
+     every pointer before any object is moved.  */
+  forwarding_table_t *table = compute_forwarding_addresses (h, root_map);
+  update_forwarded_pointers (h, table);
+  if (!h->is_unsafe_stack)
     {
-      char *ptr_to_format = (char *)(clear_formating_encoding (header));
-      add_alloc_to_move_queue (&ptr_to_format, c_info);
+      update_root_pointers (h, table, start, end);
     }
 
-  ptr_queue_t *pointers_in_alloc = get_pointers_in_allocation (alloc);
-  void **current_ptr = dequeue_ptr (pointers_in_alloc);
-  while (current_ptr != NULL)
-    {
-      add_alloc_to_move_queue ((char **)current_ptr, c_info);
-      current_ptr = dequeue_ptr (pointers_in_alloc);
-    }
-  destroy_ptr_queue (pointers_in_alloc);
+  compact_objects (h, table);
+  destroy_forwarding_table (table);
+
+  /* clean up maps no longer used */
+  free (root_map);
+
+  /* Index the holes left by pinned objects so allocation can jump straight
+     to one that fits.  */
+  h->free_runs = create_free_run_index (h->alloc_map, h->size, h->page_size);
 }
 
 /**
- * Check if a stack pointer points into the heap and if so add it and its own
- * pointers to the compacting queue.
- * @param ptr the stack pointer to check
- * @param extra an argument containing information about the compacting
+ * Stops every other thread registered with a heap if the calling thread is
+ * registered, and retires every allocation buffer so that the allocation
+ * map only holds objects. The registers the other threads stopped with can
+ * not be updated, so the stack is treated as unsafe while they share the
+ * heap, pinning what their stacks point to, unless the roots are precise.
+ * @param h the heap
+ * @param was_unsafe_stack set to whether the stack was unsafe before
+ * @return the calling thread, or NULL if it is not registered and nothing
+ * was stopped
  */
-void
-add_stack_ptr_to_move_queue (void *ptr, void *extra)
+static mutator_t *
+stop_world (heap_t *h, bool *was_unsafe_stack)
 {
-  compacting_info_t *c_info = (compacting_info_t *)extra;
-  char *c_ptr = (char *)ptr;
-
-  VALGRIND_MAKE_MEM_DEFINED (c_ptr, MEM_TO_DEFINE);
-
-  add_alloc_to_move_queue ((char **)c_ptr, c_info);
+  *was_unsafe_stack = h->is_unsafe_stack;
+  mutator_t *self = get_current_mutator (h->mutators);
+  if (self == NULL)
+    {
+      return NULL;
+    }
+  lock_heap (h->mutators, self);
+  stop_mutators (h->mutators, self);
+  h->used_bytes -= retire_alloc_buffers (h->mutators, h->alloc_map);
+  h->is_unsafe_stack
+      = h->is_unsafe_stack
+        || (!h->is_precise_roots && has_other_mutators (h->mutators));
+  return self;
 }
 
 /**
- * Populate the compacting queue by looping through all allocations that can be
- * reached from the stack and add them to the queue.
- * @param c_info the compacting info object
+ * Lets the threads stopped by stop_world go on.
+ * @param h the heap
+ * @param self the calling thread returned by stop_world
+ * @param was_unsafe_stack whether the stack was unsafe before stop_world
  */
-void
-populate_compacting_queue (compacting_info_t *c_info, uintptr_t stack_begin,
-                           uintptr_t stack_end)
+static void
+restart_world (heap_t *h, mutator_t *self, bool was_unsafe_stack)
 {
-  /* Populate the compacting queue by looping through all allocations that can
-     be reached from the stack and add them to the queue.  */
-  apply_to_pointers_in_interval (
-      stack_begin, stack_end, (apply_to_ptr_func *)add_stack_ptr_to_move_queue,
-      c_info);
+  if (self == NULL)
+    {
+      return;
+    }
+  h->is_unsafe_stack = was_unsafe_stack;
+  resume_mutators (h->mutators);
+  unlock_heap (h->mutators, self);
 }
 
 /**
- * Creates a struct containing data about the compacting stage.
+ * Finds the roots on the stack of the calling thread and on the stacks of
+ * the threads it stopped. The pages hit by false pointers are blacklisted
+ * anew.
  * @param h the heap
- * @return the struct of compacting data
+ * @param start the lowest address of the stack of the calling thread
+ * @param end the highest address of it (non-inclusive)
+ * @return a map of the roots found
  */
-compacting_info_t *
-create_compacting_info (heap_t *h)
-{
-  compacting_info_t *c_info = calloc (1, sizeof (compacting_info_t));
-  c_info->h = h;
-  c_info->compacting_queue
-      = create_ptr_queue (); /*  A priority queue of pointers to be compacted.
-                              */
-  c_info->visited
-      = create_ptr_queue (); /* A priority queue of visited stack pointers.  */
-  c_info->forwarding_addresses
-      = create_ptr_queue (); /* A queue containing all allocations for.
-                                forwarding addresses. */
-  c_info->new_alloc_map = create_allocation_map (h->size);
-  return c_info;
+static char *
+find_stack_roots (heap_t *h, uintptr_t start, uintptr_t end)
+{
+  age_blacklist (h->blacklist);
+  char *root_map = find_root_pointers (h, start, end);
+  find_thread_roots (h, root_map);
+  return root_map;
 }
 
 /**
- * Frees all heap memory related to the c_info
- * @param c_info the compacting_info to be freed.
+ * Collects the whole heap, see h_gc.
+ * @param h the heap, with every other registered thread stopped
+ * @return the number of bytes collected
  */
-void
-destroy_compacting_info (compacting_info_t *c_info)
+static size_t
+collect_heap (heap_t *h)
 {
-  destroy_ptr_queue (c_info->compacting_queue);
-  destroy_ptr_queue (c_info->visited);
-  destroy_ptr_queue (c_info->forwarding_addresses);
-  free (c_info);
+  /* For some reason this works to clear any additional old stack variables
+     that point onto allocations.  */
+  void *i = 0;
+  (void)i;
+  Dump_registers ()
+
+      uintptr_t start
+      = find_own_stack_beginning (h);
+  uintptr_t end = find_stack_end ();
+  sort_stack_ends (&start, &end);
+
+  size_t old_size = h->used_bytes;
+
+  /* An incremental mark in progress is replaced by marking everything now */
+  destroy_incremental_marking (h->incremental_mark);
+  h->incremental_mark = NULL;
+
+  /* Find root pointers */
+  char *root_map = find_stack_roots (h, start, end);
+
+  if (h->semispace != NULL)
+    {
+      /* Copying finds the living objects on its own */
+      copy_live_objects (h, root_map, start, end);
+      free (root_map);
+      return old_size - h->used_bytes;
+    }
+
+  /* Mark every living object in the mark map of the heap, a linear scan of
+   * the map gives the objects with the one nearest to heap start first. */
+  find_living_objects (h, root_map);
+
+  collect_marked_heap (h, root_map, start, end);
+
+  return old_size - h->used_bytes;
+}
+
+size_t
+h_gc (heap_t *h)
+{
+  bool was_unsafe_stack = false;
+  mutator_t *self = stop_world (h, &was_unsafe_stack);
+  size_t collected = collect_heap (h);
+  restart_world (h, self, was_unsafe_stack);
+  return collected;
 }
 
 /**
- * Compacts the pointer to an allocation by moving the allocation to the next
- * available space near the start of the heap and marking the old location with
- * a forwarding address.
- * @param h the heap
- * @param alloc the pointer
+ * Performs one slice of an incremental collection, see h_gc_step.
+ * @param h the heap, with every other registered thread stopped
+ * @return the number of bytes collected
  */
-void
-compact_ptr (compacting_info_t *c_info, void *alloc)
+static size_t
+step_collection (heap_t *h)
 {
-  heap_t *h = c_info->h;
-  size_t alloc_size = sizeof (header_t) + calc_alloc_size (alloc);
+  if (h->max_pause_ms <= 0 && !h->is_concurrent_marking)
+    {
+      return h_gc (h);
+    }
 
-  bool is_space_available = move_to_next_available_space (h, alloc_size);
-  assert (is_space_available); /* Should always be true during compacting.  */
+  /* Same as in h_gc, clears old stack variables and spills registers.  */
+  void *i = 0;
+  (void)i;
+  Dump_registers ();
 
-  char *dest = h->next_empty_mem_segment + sizeof (header_t);
+  uintptr_t start = find_own_stack_beginning (h);
+  uintptr_t end = find_stack_end ();
+  sort_stack_ends (&start, &end);
 
-  // Check if the next aavailable destination is the origin.
-  if ((void *)dest == alloc)
+  if (h->incremental_mark == NULL)
     {
-      // first available spot is the origin.
-      // set space to allocated and do not move pointer
-      size_t new_offset = calc_heap_offset (dest, h) - sizeof (header_t);
-      for (size_t offset = 0; offset < alloc_size + sizeof (header_t);
-           offset += HEAP_ALIGNMENT)
+      char *root_map = find_stack_roots (h, start, end);
+      h->incremental_mark = start_incremental_marking (h, root_map);
+      free (root_map);
+      if (h->is_concurrent_marking)
         {
-          update_alloc_map (h->alloc_map, new_offset + offset, true);
+          start_concurrent_marking (h->incremental_mark);
+          return 0;
         }
-      c_info->num_alive++;
-      return;
     }
 
-  size_t old_offset = calc_heap_offset (alloc, h);
-  update_alloc_map (h->alloc_map, old_offset,
-                    true); /* Mark old address as allocated to not allow
-                              overwrite of forwarding address.  */
-  enqueue_ptr (c_info->forwarding_addresses, alloc);
-
-  move_alloc (&alloc, dest);
-  h->next_empty_mem_segment += alloc_size;
-  c_info->num_alive++;
-
-  size_t new_offset = calc_heap_offset (dest, h);
-  for (size_t offset = 0; offset < alloc_size; offset += HEAP_ALIGNMENT)
+  bool is_marked
+      = h->is_concurrent_marking
+            ? is_concurrent_marking_done (h->incremental_mark)
+            : mark_incrementally (h->incremental_mark, h->max_pause_ms);
+  if (!is_marked)
     {
-      update_alloc_map (h->alloc_map, new_offset + offset, true);
+      return 0;
     }
+
+  /* The stack has no write barrier, so it is scanned again and everything
+     reachable from it is marked before anything is freed.  */
+  size_t old_size = h->used_bytes;
+  char *root_map = find_stack_roots (h, start, end);
+  finish_incremental_marking (h->incremental_mark, root_map);
+  destroy_incremental_marking (h->incremental_mark);
+  h->incremental_mark = NULL;
+
+  collect_marked_heap (h, root_map, start, end);
+
+  return old_size - h->used_bytes;
+}
+
+size_t
+h_gc_step (heap_t *h)
+{
+  bool was_unsafe_stack = false;
+  mutator_t *self = stop_world (h, &was_unsafe_stack);
+  size_t collected = step_collection (h);
+  restart_world (h, self, was_unsafe_stack);
+  return collected;
 }
 
 /**
- * Checks if the pointer is pointing into the heap, to an object that is a
- * forwarding address, if so, make the pointer point at the new address.
- * @param ptr an address of a pointer
- * @param c_info the struct containing info about the compacting.
+ * Collects the young objects of a heap, see h_gc_minor.
+ * @param h the heap, which has a nursery, with every other registered
+ * thread stopped
+ * @return the number of bytes collected
  */
-void
-update_ptr_to_forwarding_address (void **ptr, compacting_info_t *c_info,
-                                  bool is_stack_ptr)
+static size_t
+collect_young_objects (heap_t *h)
 {
-  heap_t *h = c_info->h;
-  char *c_ptr = (char *)*ptr;
+  /* Same as in h_gc, clears old stack variables and spills registers.  */
+  void *i = 0;
+  (void)i;
+  Dump_registers ();
+
+  uintptr_t start = find_own_stack_beginning (h);
+  uintptr_t end = find_stack_end ();
+  sort_stack_ends (&start, &end);
+
+  /* The roots of the young objects are the stack and the dirty cards, old
+     objects are never traced.  */
+  char *root_map = find_stack_roots (h, start, end);
+  find_remembered_roots (h, root_map);
+  find_young_living_objects (h, root_map);
+  free (root_map);
 
-  if (!is_heap_pointer ((uintptr_t)c_ptr, h)
-      || (c_ptr == (char *)h->heap_start))
+  /* Nothing is moved, the pages of the survivors become old.  */
+  return promote_survivors (h);
+}
+
+size_t
+h_gc_minor (heap_t *h)
+{
+  if (h->nursery == NULL)
     {
-      return;
+      return h_gc (h);
     }
 
-  if (!(is_stack_ptr && h->is_unsafe_stack))
+  bool was_unsafe_stack = false;
+  mutator_t *self = stop_world (h, &was_unsafe_stack);
+  size_t collected = collect_young_objects (h);
+  restart_world (h, self, was_unsafe_stack);
+  return collected;
+}
+
+void
+h_write_ptr (void *obj, void **field, void *value)
+{
+  heap_t *h = find_barrier_heap (obj);
+  if (h != NULL && h->incremental_mark != NULL && h->is_concurrent_marking)
     {
-      header_t header = get_header_value (get_header_pointer (c_ptr));
-      header_type_t header_type = get_header_type (header);
-      if (header_type == HEADER_FORWARDING_ADDRESS)
-        {
-          void *forwarding_address
-              = (void *)(clear_formating_encoding (header));
-          *ptr = forwarding_address;
-          c_ptr = forwarding_address;
-        }
+      /* The pointer about to be overwritten may be the last path to an
+         object that was reachable when marking started.  */
+      shade_object (h->incremental_mark, *field);
     }
+  *field = value;
 
-  header_t header = get_header_value (get_header_pointer (c_ptr));
-  header_type_t header_type = get_header_type (header);
-  if (header_type == HEADER_POINTER_TO_FORMAT_STRING)
+  if (h == NULL || !is_heap_pointer ((uintptr_t)value, h))
     {
-      char *ptr_to_format = (char *)(clear_formating_encoding (header));
-      header_t *header_p = get_header_pointer (ptr_to_format);
-      if (!is_heap_pointer ((uintptr_t)header_p, h))
-        {
-          return;
-        }
+      return;
+    }
 
-      header_t format_header = get_header_value (header_p);
-      header_type_t header_type = get_header_type (format_header);
-      if (header_type == HEADER_FORWARDING_ADDRESS)
+  if (h->incremental_mark != NULL && !h->is_concurrent_marking)
+    {
+      /* A black object may not point to a white one, or the white one would
+         never be traced. The grey objects are shared by every registered
+         thread, and marking may be finished while waiting for them.  */
+      mutator_t *self = get_current_mutator (h->mutators);
+      lock_heap (h->mutators, self);
+      if (h->incremental_mark != NULL)
         {
-          header_t *header_p = get_header_pointer (c_ptr);
-          *header_p = set_header_pointer_to_format_string (format_header);
+          shade_object (h->incremental_mark, value);
         }
+      unlock_heap (h->mutators, self);
+    }
+  if (h->nursery == NULL)
+    {
+      return;
     }
 
-  ptr_queue_t *pointers_in_alloc = get_pointers_in_allocation (c_ptr);
-  void **current_ptr = dequeue_ptr (pointers_in_alloc);
-  while (current_ptr != NULL)
+  size_t field_offset = calc_heap_offset (field, h);
+  if (!is_young_offset (h->nursery, field_offset)
+      && is_young_offset (h->nursery, calc_heap_offset (value, h)))
     {
-      update_ptr_to_forwarding_address (current_ptr, c_info, false);
-      current_ptr = dequeue_ptr (pointers_in_alloc);
+      mark_card (h->nursery, field_offset);
     }
-  destroy_ptr_queue (pointers_in_alloc);
 }
 
-/**
- * Loops through all pointers that can be reached from the stack that points
- * into the heap. If a pointer points toward an object that has a forwarding
- * address, make the pointer point at the new address.
- * @param c_info the struct containing info about the compacting.
- * @param stack_begin the start of the stack (lower address)
- * @param stack_end the end of the stack (higher address)
- */
+bool
+h_register_thread (heap_t *h)
+{
+  return register_mutator (h->mutators) != NULL;
+}
+
 void
-update_ptrs_to_forwarding_address (compacting_info_t *c_info,
-                                   uintptr_t stack_begin, uintptr_t stack_end)
+h_unregister_thread (heap_t *h)
 {
-  for (uintptr_t possible_ptr = stack_begin; possible_ptr < stack_end;
-       possible_ptr += sizeof (void *))
+  mutator_t *self = get_current_mutator (h->mutators);
+  if (self == NULL)
     {
-      update_ptr_to_forwarding_address ((void **)possible_ptr, c_info, true);
+      return;
     }
+  lock_heap (h->mutators, self);
+  h->used_bytes -= retire_alloc_buffer (self, h->alloc_map);
+  unlock_heap (h->mutators, self);
+  unregister_mutator (h->mutators, self);
 }
 
-/**
- * Counts the number of bytes collected during compacting.
- * @param c_info the struct containing info about the compacting
- * @return the number of bytes freed.
- */
-size_t
-count_collected_bytes (compacting_info_t *c_info)
+void
+h_safepoint (heap_t *h)
 {
-  heap_t *h = c_info->h;
-  size_t num_alloc = 0;
-  for (size_t offset = 0; offset < h->size; offset += HEAP_ALIGNMENT)
+  mutator_t *self = get_current_mutator (h->mutators);
+  if (self != NULL)
     {
-      if (is_offset_allocated (h->alloc_map, offset))
-        {
-          num_alloc += HEAP_ALIGNMENT;
-        }
+      poll_safepoint (h->mutators, self);
     }
+}
 
-  void *current_forwarding_address
-      = dequeue_ptr (c_info->forwarding_addresses);
-  while (current_forwarding_address != NULL)
+void *
+h_do_blocking (heap_t *h, void *(*func) (void *), void *arg)
+{
+  mutator_t *self = get_current_mutator (h->mutators);
+  if (self == NULL)
     {
-      size_t offset = calc_heap_offset (current_forwarding_address, h);
-      num_alloc -= HEAP_ALIGNMENT;
-      update_alloc_map (h->alloc_map, offset, false);
-      current_forwarding_address = dequeue_ptr (c_info->forwarding_addresses);
+      return func (arg);
     }
-
-  /* Remove counting of metadata.  */
-  num_alloc -= (c_info->num_alive) * sizeof (header_t);
-
-  int diff = h->used_bytes - num_alloc;
-  return (size_t)diff;
+  return run_stopped (h->mutators, self, func, arg);
 }
 
 /**
- * Compacts the heap
+ * Gets the slots pushed by the calling thread.
  * @param h the heap
- * @return the number of bytes collected.
+ * @return the root stack of the thread if it is registered, otherwise the
+ * one of the heap
  */
-size_t
-h_compact (heap_t *h)
+static root_stack_t *
+get_own_root_stack (heap_t *h)
 {
-  Dump_registers ();
-  uintptr_t stack_begin = find_stack_beginning ();
-  uintptr_t stack_end = find_stack_end ();
-  sort_stack_ends (&stack_begin, &stack_end);
-
-  compacting_info_t *c_info = create_compacting_info (h);
-  populate_compacting_queue (c_info, stack_begin, stack_end);
-
-  char *prev_alloc_map = h->alloc_map;
-  h->alloc_map = c_info->new_alloc_map;
-  h->next_empty_mem_segment = h->heap_start;
-  free (prev_alloc_map);
-
-  ptr_queue_t *compacting_queue = c_info->compacting_queue;
-  void *current_alloc = dequeue_ptr (compacting_queue);
-  while (current_alloc != NULL)
-    {
-      compact_ptr (c_info, current_alloc);
-      current_alloc = dequeue_ptr (compacting_queue);
-    }
-
-  update_ptrs_to_forwarding_address (c_info, stack_begin, stack_end);
-
-  size_t bytes_collected = count_collected_bytes (c_info);
-  destroy_compacting_info (c_info);
-
-  h->used_bytes -= bytes_collected;
-
-  return bytes_collected;
+  mutator_t *self = get_current_mutator (h->mutators);
+  return self != NULL ? get_root_stack (self) : h->shadow_stack;
 }
 
-size_t
-h_gc (heap_t *h)
+void
+h_push_root (heap_t *h, void *slot)
 {
-  /* For some reason this works to clear any additional old stack variables
-     that point onto allocations.  */
-  void *i = 0;
-  (void)i;
-  Dump_registers ()
-
-      uintptr_t start
-      = find_stack_beginning ();
-  uintptr_t end = find_stack_end ();
-  sort_stack_ends (&start, &end);
-
-  /* Find root pointers */
-  ptr_queue_t *roots = find_root_pointers (h, start, end);
-
-  /* Populate a compacting queue, that will hold each allocation with first
-   * being nearest to heap start. */
-  ptr_queue_t *compaction_queue = find_living_objects (h, roots);
-
-  // TODO: For each object in compaction queue, find a new location and update
-  // old header with forwarding to new dest.
-  // TODO: find other way to store forwarding for object to allow compact data
-  size_t bytes_collected = compact_objects (h, roots, compaction_queue);
-
-  // TODO: after all objects have been copied and their headers updated,
-  // iterate through using roots and update recursively.
-  update_forwarded_pointers (h, roots);
+  push_root (get_own_root_stack (h), slot);
+}
 
-  // TODO: after all pointers has been forwarded, go through heap removing
-  // forwarding allocations.
-  remove_forwarding_allocations (h, compaction_queue);
+void
+h_pop_roots (heap_t *h, size_t count)
+{
+  pop_roots (get_own_root_stack (h), count);
+}
 
-  /* clean up queues no longer used */
-  destroy_ptr_queue (compaction_queue);
-  destroy_ptr_queue (roots);
+void
+h_pop_root_scope (heap_t **scope)
+{
+  h_pop_roots (*scope, 1);
+}
 
-  return bytes_collected;
+void
+h_add_global_root (heap_t *h, void *slot)
+{
+  mutator_t *self = get_current_mutator (h->mutators);
+  lock_heap (h->mutators, self);
+  push_root (h->global_roots, slot);
+  unlock_heap (h->mutators, self);
+}
 
-  // Old solution bellow
-  // destroy_ptr_queue (roots);
-  // h_mark_pages (h);
-  // size_t bytes_collected = h_compact (h);
-  // return bytes_collected;
+bool
+h_remove_global_root (heap_t *h, void *slot)
+{
+  mutator_t *self = get_current_mutator (h->mutators);
+  lock_heap (h->mutators, self);
+  bool is_removed = remove_root (h->global_roots, slot);
+  unlock_heap (h->mutators, self);
+  return is_removed;
 }
 
 size_t
@@ -14,6 +14,12 @@
 
 typedef uint64_t header_t;
 
+/* A format string registered with h_register_layout.  */
+typedef size_t layout_handle_t;
+
+/* Returned by h_register_layout for format strings that are not valid.  */
+#define INVALID_LAYOUT ((layout_handle_t)-1)
+
 /* Smallest heap possible to allocated.  */
 #define MINIMUM_ALIGNMENT 16
 
@@ -55,6 +61,101 @@ extern heap_t *global_heap;
  */
 heap_t *h_init (size_t bytes, bool unsafe_stack, float gc_threshold);
 
+/**
+ * Settings of a heap created with h_init_with_options.
+ *
+ * @param bytes: The total size of the heap in bytes.
+ * @param unsafe_stack: true if pointers on the stack are to be considered
+ * unsafe pointers.
+ * @param gc_threshold: The memory pressure at which gc should be triggered
+ * (1.0 = full memory).
+ * @param gc_threads: The amount of threads that mark the heap during garbage
+ * collection, including the thread that triggered it. 0 and 1 both mark on
+ * the calling thread only.
+ * @param fragmentation_threshold: 0 to compact the heap on every garbage
+ * collection. Otherwise nothing is moved and the heap is swept into free
+ * lists, unless the share of free memory stranded on pages that still hold
+ * objects is larger than this, e.g. 0.5.
+ * @param nursery_bytes: 0 to allocate every object in one space. Otherwise
+ * small objects are allocated young, on at most this many bytes of pages,
+ * and a minor collection of the young objects is run when they are full.
+ * Every pointer stored into an existing object must then be stored with
+ * h_write_ptr.
+ * @param max_pause_ms: 0 to mark the whole heap in one pause. Otherwise the
+ * heap is marked incrementally, each allocation past gc_threshold marking
+ * for at most this many milliseconds, and only the final remark of the stack
+ * and the collection after it pause for longer. That collection is short if
+ * the heap is swept, see fragmentation_threshold. Every pointer stored into
+ * an existing object must then be stored with h_write_ptr. Ignored if the
+ * heap has a nursery.
+ * @param concurrent_marking: true to mark the heap on a thread of its own,
+ * started once an allocation passes gc_threshold. The program only pauses
+ * to scan the stack when marking starts, and for the final remark and the
+ * collection after it. Every pointer stored into an existing object must
+ * then be stored with h_write_ptr. Ignored if the heap has a nursery.
+ * @param evacuated_pages: 0 to sweep or compact the whole heap, see
+ * fragmentation_threshold. Otherwise the heap is swept, and then at most
+ * this many of the pages with the least live data left on them are
+ * evacuated into empty pages, so that each collection only copies a bounded
+ * amount of objects. Takes the place of fragmentation_threshold.
+ * @param mark_region: true to collect the heap without moving objects, as
+ * lines of 128 bytes within blocks of 32 KiB. Lines holding no live object
+ * are freed, and small objects are bump allocated through the runs of free
+ * lines. Once more than fragmentation_threshold of the free lines lie in
+ * blocks still in use, the sparsest pages are evacuated, see
+ * evacuated_pages, which is 0 to never move anything. Ignored if the heap
+ * has a nursery.
+ * @param semispace: true to split the heap in two halves, allocate in one
+ * of them with a bump pointer, and copy the objects reachable on garbage
+ * collection into the other. The cost of a collection then only depends on
+ * what survives it, but only half of the heap can be used. Objects the
+ * stack points to are pinned where they are if the stack is unsafe. Takes
+ * the place of every other way of collecting the heap. Ignored if the heap
+ * has a nursery.
+ * @param precise_roots: true to never scan the stack, and only take the
+ * slots pushed with h_push_root or H_ROOT and those added with
+ * h_add_global_root as roots. Every root is then known to be a pointer, so
+ * any object may be moved and unsafe_stack is ignored, but an object only
+ * referenced from a variable that is not registered is freed, or left
+ * pointing at the wrong object once it is moved. Works with every other
+ * setting, other registered threads included.
+ * @param interior_pointers: true to let a word on the stack that points
+ * into the middle of an object keep it alive, such as a cursor into an
+ * array. A stack holds more stale values than pointers to the start of
+ * objects, so more garbage may be kept. With precise_roots every root may
+ * point into an object, and every pointer into a moved object is moved as
+ * far into it either way.
+ */
+typedef struct heap_options
+{
+  size_t bytes;
+  bool unsafe_stack;
+  float gc_threshold;
+  size_t gc_threads;
+  float fragmentation_threshold;
+  size_t nursery_bytes;
+  float max_pause_ms;
+  bool concurrent_marking;
+  size_t evacuated_pages;
+  bool mark_region;
+  bool semispace;
+  bool precise_roots;
+  bool interior_pointers;
+} heap_options_t;
+
+/**
+ * Create a new heap from a set of options. Extra gc threads are started
+ * here and kept until the heap is deleted.
+ *
+ * At most 16 heaps that need the write barrier of h_write_ptr, those with
+ * a nursery, a max_pause_ms or concurrent marking, may exist at once.
+ *
+ * @param options the settings of the heap
+ * @return the new heap, or NULL if it needs the write barrier and 16 such
+ * heaps already exist
+ */
+heap_t *h_init_with_options (heap_options_t *options);
+
 /**
  * Delete a heap.
  *
@@ -106,6 +207,48 @@ void *h_alloc_struct (heap_t *h, char *layout);
  */
 void *h_alloc_raw (heap_t *h, size_t bytes);
 
+/**
+ * Register a format string so objects with it can be allocated without
+ * parsing it again.
+ *
+ * The format string is parsed once and its size, header and pointer fields
+ * are remembered. Registering the same format string again returns the same
+ * handle. Handles are valid for every heap until the program exits.
+ *
+ * @param h the heap
+ * @param layout the format string, see h_alloc_struct for valid characters
+ * @return a handle to the layout, or INVALID_LAYOUT if layout is not valid
+ *
+ * @note: the heap does *not* retain an alias to layout.
+ */
+layout_handle_t h_register_layout (heap_t *h, char *layout);
+
+/**
+ * Allocate a new object on a heap with a registered layout.
+ *
+ * Equivalent to h_alloc_struct with the format string the layout was
+ * registered with, but without parsing it or copying it into the heap.
+ *
+ * @param h the heap
+ * @param handle a handle returned by h_register_layout
+ * @return the newly allocated object
+ */
+void *h_alloc_layout (heap_t *h, layout_handle_t handle);
+
+/**
+ * Allocate a new array on a heap.
+ *
+ * The elements are laid out like a C array of the struct the element layout
+ * was registered with. The header of the array stores the element layout and
+ * the length, so no format string is built or parsed for it.
+ *
+ * @param h the heap
+ * @param element a handle returned by h_register_layout for one element
+ * @param length the amount of elements
+ * @return the newly allocated array
+ */
+void *h_alloc_array (heap_t *h, layout_handle_t element, size_t length);
+
 /**
  * Manually trigger garbage collection.
  *
@@ -117,6 +260,180 @@ void *h_alloc_raw (heap_t *h, size_t bytes);
  */
 size_t h_gc (heap_t *h);
 
+/**
+ * Collect only the young objects of a heap created with a nursery. Young
+ * objects reachable from the stack, or from an old object through a
+ * pointer stored with h_write_ptr, are promoted to the old generation
+ * without being moved, the rest are freed. Old objects are not traced.
+ *
+ * Run automatically when the nursery is full. Runs h_gc on a heap without
+ * a nursery.
+ *
+ * @param h the heap
+ * @return the number of bytes collected
+ */
+size_t h_gc_minor (heap_t *h);
+
+/**
+ * Perform one slice of an incremental collection, starting a new one if
+ * none is in progress. Once no grey object is left, the stack is scanned
+ * again and marked from, and the heap is collected. Allocations past the
+ * threshold call this on their own.
+ *
+ * With concurrent_marking the slices are run by the marking thread, and a
+ * step only starts it or finishes the collection once it is done.
+ *
+ * A heap created without max_pause_ms or concurrent_marking is collected
+ * at once, as by h_gc.
+ *
+ * @param h the heap
+ * @return the number of bytes collected, 0 if marking is still in progress
+ */
+size_t h_gc_step (heap_t *h);
+
+/**
+ * Store a pointer into a field of an object on any heap. If the heap has a
+ * nursery, a pointer from an old object to a young one is remembered so the
+ * young object survives minor collections. While the heap is marked
+ * incrementally, the stored object is shaded so it is not missed. While it
+ * is marked concurrently, the overwritten pointer is shaded instead, so that
+ * everything reachable when marking started is marked. Objects that are not
+ * on a heap get a plain store.
+ *
+ * @param obj the object holding the field, or any address inside it
+ * @param field the pointer field to store into
+ * @param value the pointer to store
+ */
+void h_write_ptr (void *obj, void **field, void *value);
+
+/**
+ * Register the calling thread with a heap, so that the heap may be shared
+ * with other threads. Once a heap is shared, every thread using it, the
+ * main thread included, must be registered, and a thread can only be
+ * registered with one heap at a time.
+ *
+ * A registered thread allocates small objects in a buffer of its own
+ * without taking any lock. A collection run by a registered thread first
+ * stops every other registered thread at a safepoint and scans their stacks
+ * and registers as well. What another thread's stack points to is never
+ * moved, as if the stack were unsafe, unless the heap has precise_roots and
+ * only their shadow stacks are read. A registered thread stops at a
+ * safepoint whenever it allocates or calls h_safepoint, so a thread running
+ * for long without either holds up every collection, and a thread about to
+ * block should do so through h_do_blocking.
+ *
+ * @param h the heap
+ * @return false if the thread is already registered with a heap
+ */
+bool h_register_thread (heap_t *h);
+
+/**
+ * Unregister the calling thread from a heap, giving back what is left of
+ * its allocation buffer. A thread must be unregistered before it exits, and
+ * every thread before the heap is deleted. Does nothing for a thread that is
+ * not registered.
+ *
+ * @param h the heap
+ */
+void h_unregister_thread (heap_t *h);
+
+/**
+ * Stop here if another thread is waiting to collect the heap, until it is
+ * done. Registered threads that run for long without allocating should call
+ * this every now and then. Does nothing for a thread that is not
+ * registered.
+ *
+ * @param h the heap
+ */
+void h_safepoint (heap_t *h);
+
+/**
+ * Run a function that may block, e.g. waiting for a lock or for input, so
+ * that other threads may collect the heap meanwhile. The calling thread
+ * counts as stopped while the function runs, so the function must not use
+ * the heap or any object on it. Once the function returns, the thread waits
+ * for a collection in progress to finish.
+ *
+ * @param h the heap
+ * @param func the function to run
+ * @param arg the argument sent to func
+ * @return what func returned
+ */
+void *h_do_blocking (heap_t *h, void *(*func) (void *), void *arg);
+
+/**
+ * Push the address of a pointer variable on the shadow stack of the calling
+ * thread, making what it points to a root of a heap with precise_roots.
+ * The variable must hold NULL or a pointer to the start of an object on the
+ * heap, and is updated if the object is moved. It must be popped with
+ * h_pop_roots before it goes out of scope, see H_ROOT for doing so on its
+ * own. Each thread has a shadow stack of its own. Without precise_roots
+ * the stack is scanned anyway, and pushed variables are not looked at.
+ *
+ * @param h the heap
+ * @param slot the address of the pointer variable, e.g. &list
+ */
+void h_push_root (heap_t *h, void *slot);
+
+/**
+ * Pop the variables pushed last with h_push_root by the calling thread.
+ *
+ * @param h the heap
+ * @param count the amount of variables to pop
+ */
+void h_pop_roots (heap_t *h, size_t count);
+
+/**
+ * Pop the variable pushed by H_ROOT when the block declaring it ends.
+ * Not to be called directly.
+ *
+ * @param scope the variable declared by H_ROOT, holding the heap
+ */
+void h_pop_root_scope (heap_t **scope);
+
+#define H_ROOT_SCOPE_NAME_(line) h_root_scope_##line
+#define H_ROOT_SCOPE_NAME(line) H_ROOT_SCOPE_NAME_ (line)
+
+/**
+ * Push the address of a pointer variable with h_push_root until the end of
+ * the enclosing block, using the cleanup attribute of GCC and Clang, e.g.
+ *
+ *   node_t *list = NULL;
+ *   H_ROOT (h, list);
+ *
+ * Only one H_ROOT fits on a line. Leaving the block with longjmp skips the
+ * pop, so the shadow stack must then be popped with h_pop_roots.
+ *
+ * @param h the heap
+ * @param var the pointer variable, declared before
+ */
+#define H_ROOT(h, var)                                                        \
+  heap_t *H_ROOT_SCOPE_NAME (__LINE__)                                        \
+      __attribute__ ((cleanup (h_pop_root_scope)))                            \
+      = (h);                                                                  \
+  h_push_root (H_ROOT_SCOPE_NAME (__LINE__), &(var))
+
+/**
+ * Make a pointer variable that lives for as long as a heap, e.g. a global
+ * variable, a root of the heap. The variable is read by every collection,
+ * with or without precise_roots, and updated if what it points to is moved,
+ * so it must hold NULL or a pointer to the start of an object on the heap.
+ * It must not lie on the stack or in the heap.
+ *
+ * @param h the heap
+ * @param slot the address of the pointer variable, e.g. &cache
+ */
+void h_add_global_root (heap_t *h, void *slot);
+
+/**
+ * Stop treating a variable added with h_add_global_root as a root.
+ *
+ * @param h the heap
+ * @param slot the address of the pointer variable
+ * @return false if the variable was not added
+ */
+bool h_remove_global_root (heap_t *h, void *slot);
+
 /* TODO: remove? This does not exit vv */
 /**
  * Manually trigger garbage collection with the ability to
@@ -0,0 +1,167 @@
+/**
+ * Functions for running tasks on a pool of garbage collector threads.
+ * Each task is numbered by a generation counter, a worker runs a task once
+ * when it sees the counter change.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "gc_workers.h"
+
+/**
+ * @param pool: The pool the worker belongs to.
+ * @param index: The index given to tasks run by the worker.
+ */
+typedef struct gc_worker
+{
+  struct gc_workers *pool;
+  size_t index;
+} gc_worker_t;
+
+/**
+ * @param threads: The started threads, count - 1 of them.
+ * @param workers: The worker of each thread, indexed from 1.
+ * @param count: The amount of workers, including the calling thread.
+ * @param lock: Guards every field below.
+ * @param task_ready: Signalled when a task is started or the pool stops.
+ * @param task_done: Signalled when the last worker finishes a task.
+ * @param task: The current task.
+ * @param arg: The argument of the current task.
+ * @param generation: Incremented every time a task is started.
+ * @param running: The amount of threads that have not finished the task.
+ * @param is_stopping: Set when the threads should exit.
+ */
+struct gc_workers
+{
+  pthread_t *threads;
+  gc_worker_t *workers;
+  size_t count;
+  pthread_mutex_t lock;
+  pthread_cond_t task_ready;
+  pthread_cond_t task_done;
+  gc_task_func *task;
+  void *arg;
+  size_t generation;
+  size_t running;
+  bool is_stopping;
+};
+
+/**
+ * The loop of a worker thread, waiting for and running tasks until the pool
+ * stops.
+ */
+static void *
+run_worker (void *arg)
+{
+  gc_worker_t *worker = (gc_worker_t *)arg;
+  gc_workers_t *pool = worker->pool;
+  size_t seen_generation = 0;
+
+  pthread_mutex_lock (&pool->lock);
+  while (true)
+    {
+      while (pool->generation == seen_generation && !pool->is_stopping)
+        {
+          pthread_cond_wait (&pool->task_ready, &pool->lock);
+        }
+      if (pool->is_stopping)
+        {
+          break;
+        }
+      seen_generation = pool->generation;
+      gc_task_func *task = pool->task;
+      void *task_arg = pool->arg;
+      pthread_mutex_unlock (&pool->lock);
+
+      task (task_arg, worker->index);
+
+      pthread_mutex_lock (&pool->lock);
+      if (--pool->running == 0)
+        {
+          pthread_cond_signal (&pool->task_done);
+        }
+    }
+  pthread_mutex_unlock (&pool->lock);
+  return NULL;
+}
+
+gc_workers_t *
+create_gc_workers (size_t count)
+{
+  assert (count > 0);
+  gc_workers_t *pool = calloc (1, sizeof (gc_workers_t));
+  assert (pool != NULL && "Calloc failed to allocate gc workers");
+  pool->count = count;
+  pool->threads = calloc (count, sizeof (pthread_t));
+  pool->workers = calloc (count, sizeof (gc_worker_t));
+  assert (pool->threads != NULL && pool->workers != NULL);
+  pthread_mutex_init (&pool->lock, NULL);
+  pthread_cond_init (&pool->task_ready, NULL);
+  pthread_cond_init (&pool->task_done, NULL);
+
+  for (size_t i = 1; i < count; i++)
+    {
+      pool->workers[i] = (gc_worker_t){ .pool = pool, .index = i };
+      int error = pthread_create (&pool->threads[i], NULL, run_worker,
+                                  &pool->workers[i]);
+      assert (error == 0 && "Failed to start gc worker");
+      (void)error;
+    }
+
+  return pool;
+}
+
+void
+destroy_gc_workers (gc_workers_t *workers)
+{
+  if (workers == NULL)
+    {
+      return;
+    }
+
+  pthread_mutex_lock (&workers->lock);
+  workers->is_stopping = true;
+  pthread_cond_broadcast (&workers->task_ready);
+  pthread_mutex_unlock (&workers->lock);
+
+  for (size_t i = 1; i < workers->count; i++)
+    {
+      pthread_join (workers->threads[i], NULL);
+    }
+
+  pthread_cond_destroy (&workers->task_done);
+  pthread_cond_destroy (&workers->task_ready);
+  pthread_mutex_destroy (&workers->lock);
+  free (workers->workers);
+  free (workers->threads);
+  free (workers);
+}
+
+size_t
+get_gc_worker_count (gc_workers_t *workers)
+{
+  return workers->count;
+}
+
+void
+run_gc_workers (gc_workers_t *workers, gc_task_func *task, void *arg)
+{
+  pthread_mutex_lock (&workers->lock);
+  workers->task = task;
+  workers->arg = arg;
+  workers->running = workers->count - 1;
+  workers->generation++;
+  pthread_cond_broadcast (&workers->task_ready);
+  pthread_mutex_unlock (&workers->lock);
+
+  task (arg, 0);
+
+  pthread_mutex_lock (&workers->lock);
+  while (workers->running > 0)
+    {
+      pthread_cond_wait (&workers->task_done, &workers->lock);
+    }
+  pthread_mutex_unlock (&workers->lock);
+}
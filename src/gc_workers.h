@@ -0,0 +1,49 @@
+/**
+ * A pool of threads that help the thread running the garbage collector.
+ * The threads are started once, when the heap is created, and wait for work
+ * between collections.
+ */
+
+#pragma once
+
+#include <stdlib.h>
+
+/**
+ * A task run by every worker in the pool.
+ * @param arg the argument given to run_gc_workers
+ * @param worker_index the index of the worker running the task, 0 for the
+ * thread calling run_gc_workers
+ */
+typedef void gc_task_func (void *arg, size_t worker_index);
+
+typedef struct gc_workers gc_workers_t;
+
+/**
+ * @brief Starts a pool of workers.
+ * @param count the amount of workers, including the thread that will call
+ * run_gc_workers, so count - 1 threads are started
+ * @return a pointer to the pool
+ */
+gc_workers_t *create_gc_workers (size_t count);
+
+/**
+ * @brief Stops the threads of a pool and frees it.
+ * @param workers a pool, or NULL
+ */
+void destroy_gc_workers (gc_workers_t *workers);
+
+/**
+ * @brief Gets the amount of workers in a pool.
+ * @param workers a pool
+ * @return the amount of workers, including the calling thread
+ */
+size_t get_gc_worker_count (gc_workers_t *workers);
+
+/**
+ * @brief Runs a task on every worker of a pool, the calling thread being
+ * worker 0, and waits until every worker has finished it.
+ * @param workers a pool
+ * @param task the task to run
+ * @param arg the argument sent to task
+ */
+void run_gc_workers (gc_workers_t *workers, gc_task_func *task, void *arg);
@@ -83,11 +83,11 @@ set_header_forwarding_address (header_t the_header)
   return set_header_type (the_header, HEADER_FORWARDING_ADDRESS);
 }
 
-/* Returns a the binary string with updated header, HEADER_UNUSED.  */
+/* Returns a the binary string with updated header, HEADER_LAYOUT_INDEX.  */
 header_t
-set_header_unused (header_t the_header)
+set_header_layout_index (header_t the_header)
 {
-  return set_header_type (the_header, HEADER_UNUSED);
+  return set_header_type (the_header, HEADER_LAYOUT_INDEX);
 }
 
 /* Returns a new binary string with updated header, HEADER_BIT_VECTOR  */
@@ -123,8 +123,8 @@ get_header_type (header_t the_header)
       return HEADER_POINTER_TO_FORMAT_STRING;
     case HEADER_FORWARDING_ADDRESS: /* 0x1 (01)  */
       return HEADER_FORWARDING_ADDRESS;
-    case HEADER_UNUSED: /* 0x2 (10)  */
-      return HEADER_UNUSED;
+    case HEADER_LAYOUT_INDEX: /* 0x2 (10)  */
+      return HEADER_LAYOUT_INDEX;
     case HEADER_BIT_VECTOR: /* 0x3 (11)  */
       return HEADER_BIT_VECTOR;
     default: /* impossible to reach  */
@@ -60,11 +60,11 @@ header_t set_header_forwarding_address (header_t binary_string);
 
 /**
  * Returns a header with updated header type
- * HEADER_UNUSED.
+ * HEADER_LAYOUT_INDEX.
  * @param binary_string - A binary string.
  * @return The updated binary string.
  */
-header_t set_header_unused (header_t the_header);
+header_t set_header_layout_index (header_t the_header);
 
 /**
  * Returns a header with updated header type
@@ -9,6 +9,7 @@
 #include "format_encoding.h"
 #include "get_header.h"
 #include "header.h"
+#include "layout.h"
 
 /**
  * Helper function that creates a header containing a bit vector
@@ -58,16 +59,15 @@ create_header_raw (size_t size, bool *success)
   return create_header_vector ("", size, success);
 }
 
-/* Currently does not have support for format string in header.  */
-// TODO: Fix support to format string pointers
-ptr_queue_t *
-get_pointers_in_allocation (void *allocation_start)
+void
+for_each_pointer_field (void *allocation_start, pointer_field_func *func,
+                        void *arg)
 {
   header_t *header_p = get_header_pointer (allocation_start);
 
   if (!header_p)
     {
-      return create_ptr_queue ();
+      return;
     }
 
   header_t header = get_header_value (header_p);
@@ -76,18 +76,49 @@ get_pointers_in_allocation (void *allocation_start)
   if (type == HEADER_BIT_VECTOR)
     {
       uint_fast64_t vector = header >> BITS_FOR_HEADER_TYPE;
-      return get_pointers_from_bit_vector (vector, allocation_start);
+      for_each_pointer_in_bit_vector (vector, allocation_start, func, arg);
     }
   else if (type == HEADER_POINTER_TO_FORMAT_STRING)
     {
-      // FIXME: currently dose not support pointer to forward strings...
-      header_t header_val = get_header_value(header_p);
-      char *format_string = get_pointer_in_header(header_val);
-      return get_pointers_from_format_string (format_string, allocation_start);
+      char *format_string = get_pointer_in_header (header);
+      for_each_pointer_in_format_string (format_string, allocation_start,
+                                         func, arg);
     }
-  else
+  else if (type == HEADER_LAYOUT_INDEX)
     {
-        return create_ptr_queue ();
+      for_each_pointer_in_layout_object (header, allocation_start, func,
+                                         arg);
     }
-    
+}
+
+void
+for_each_reference (void *allocation_start, pointer_field_func *func,
+                    void *arg)
+{
+  /* The fields are found through the format string, so the header is
+     handled last.  */
+  for_each_pointer_field (allocation_start, func, arg);
+  header_t *header_p = get_header_pointer (allocation_start);
+  if (get_header_type (get_header_value (header_p))
+      == HEADER_POINTER_TO_FORMAT_STRING)
+    {
+      func ((void **)header_p, arg);
+    }
+}
+
+/**
+ * Enqueues a pointer field in the pointer queue given as argument
+ */
+static void
+enqueue_pointer_field (void **field, void *queue)
+{
+  enqueue_ptr ((ptr_queue_t *)queue, field);
+}
+
+ptr_queue_t *
+get_pointers_in_allocation (void *allocation_start)
+{
+  ptr_queue_t *pointers = create_ptr_queue ();
+  for_each_pointer_field (allocation_start, enqueue_pointer_field, pointers);
+  return pointers;
 }
@@ -4,6 +4,7 @@
  */
 
 #pragma once
+#include "format_encoding.h"
 #include "ptr_queue.h"
 #include <stdbool.h>
 #include <stdint.h>
@@ -29,8 +30,8 @@ typedef enum
 {
   HEADER_POINTER_TO_FORMAT_STRING = 0x0,
   HEADER_FORWARDING_ADDRESS = 0x1,
-  /* UNUSED is available for further implementation. */
-  HEADER_UNUSED = 0x2,
+  /* Index of a layout registered with h_register_layout.  */
+  HEADER_LAYOUT_INDEX = 0x2,
   HEADER_BIT_VECTOR = 0x3,
 } header_type_t;
 
@@ -92,3 +93,26 @@ header_t create_header_raw (size_t size, bool *success);
  * @return a pointer queue containing the pointers in the struct
  */
 ptr_queue_t *get_pointers_in_allocation (void *allocation_start);
+
+/**
+ * @brief Calls func with the address of every pointer field in an allocation,
+ * walking the bit vector or format string in its header in place. Unlike
+ * get_pointers_in_allocation no memory is allocated, so the cost only depends
+ * on the number of fields.
+ * @param allocation_start a pointer to the start of the allocation
+ * @param func the function to call for each pointer field
+ * @param arg an optional argument sent to func
+ */
+void for_each_pointer_field (void *allocation_start, pointer_field_func *func,
+                             void *arg);
+
+/**
+ * @brief Calls func with every pointer field of an allocation, and with its
+ * header if it points to a format string. A format string pointer has no
+ * type bits set, so the header can be treated as a field.
+ * @param allocation_start a pointer to the start of the allocation
+ * @param func the function to call for each reference
+ * @param arg an optional argument sent to func
+ */
+void for_each_reference (void *allocation_start, pointer_field_func *func,
+                         void *arg);
@@ -8,7 +8,17 @@
 #include <stdint.h>
 #include <stdlib.h>
 
+#include "blacklist.h"
+#include "compacting.h"
+#include "free_lists.h"
+#include "free_run_index.h"
+#include "gc_workers.h"
 #include "heap.h"
+#include "mark_region.h"
+#include "mutators.h"
+#include "roots.h"
+#include "semispace.h"
+#include "nursery.h"
 
 /**
  * @param gc_threshold: The percentage of memory that has to be utilized before
@@ -21,6 +31,46 @@
  * page is active or not.
  * @param alloc_map: An array of booleans representing if each location in the
  * heap is used or empty.
+ * @param mark_map: A bitvector with the same layout as the alloc_map, where the
+ * bit of each object header found alive during the mark-phase is set.
+ * @param start_map: A bitvector with the same layout as the alloc_map, where the
+ * bit of each object header is set when the object is placed.
+ * @param mark_stack_size: The amount of objects the mark stack may hold while
+ * tracing the heap.
+ * @param free_runs: An index of the holes left by the last garbage collection,
+ * or NULL if the allocation map should be searched instead.
+ * @param free_lists: Free lists of the holes left by the last garbage
+ * collection if it swept the heap instead of compacting it, or NULL.
+ * @param fragmentation_threshold: The share of free memory that has to be
+ * stranded on pages holding objects before a collection compacts the heap,
+ * or 0 if every collection compacts.
+ * @param evacuated_pages: The most pages a collection evacuates after
+ * sweeping the heap, or 0 if it is swept or compacted as a whole.
+ * @param semispace: The halves of the heap if it is collected by copying,
+ * otherwise NULL.
+ * @param mark_region: The lines and blocks small objects are allocated in
+ * if the heap is collected as a mark-region heap, otherwise NULL.
+ * @param nursery: The young pages and card table of the heap, or NULL if every
+ * object is allocated in one space.
+ * @param max_pause_ms: The time a slice of incremental marking may take, or 0
+ * if the heap is marked in a single pause.
+ * @param is_concurrent_marking: true if the heap is marked on a thread of its
+ * own.
+ * @param incremental_mark: The mark phase in progress if the heap is being
+ * marked incrementally, otherwise NULL.
+ * @param gc_workers: Threads that help marking the heap, or NULL if it is
+ * marked by the thread running the garbage collector alone.
+ * @param mutators: The threads registered to share the heap, and the lock
+ * they allocate and collect under.
+ * @param is_precise_roots: true if only the registered slots are roots, and
+ * the stack is never scanned.
+ * @param is_interior_pointers: true if a word on the stack pointing into an
+ * object makes it a root, not only a word pointing to its start.
+ * @param global_roots: The slots registered with h_add_global_root.
+ * @param shadow_stack: The slots pushed by threads that are not registered
+ * with the heap, registered threads have their own.
+ * @param blacklist: The pages values on the stack falsely pointed into
+ * during the last collections, which allocation avoids.
  * @param heap_start: The pointer to the heap.
  * @param next_empty_mem_segment: A bump pointer to the next empty available
  * space in the heap that can be used for allocation.
@@ -34,6 +84,26 @@ struct heap
   size_t page_size;
   char *page_map;
   char *alloc_map;
+  char *mark_map;
+  char *start_map;
+  size_t mark_stack_size;
+  free_run_index_t *free_runs;
+  free_lists_t *free_lists;
+  float fragmentation_threshold;
+  size_t evacuated_pages;
+  semispace_t *semispace;
+  mark_region_t *mark_region;
+  nursery_t *nursery;
+  float max_pause_ms;
+  bool is_concurrent_marking;
+  incremental_mark_t *incremental_mark;
+  gc_workers_t *gc_workers;
+  mutators_t *mutators;
+  bool is_precise_roots;
+  bool is_interior_pointers;
+  root_stack_t *global_roots;
+  root_stack_t *shadow_stack;
+  blacklist_t *blacklist;
   void *heap_start;
   char *next_empty_mem_segment;
   size_t used_bytes;
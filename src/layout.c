@@ -0,0 +1,318 @@
+/**
+ * Functions for registering layouts and looking them up by handle.
+ * A handle is the index of the layout in the registry, which only grows.
+ * Layouts are kept in chunks that never move, so that collector threads can
+ * read them while another thread registers a new layout.
+ */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "allocation.h"
+#include "get_header.h"
+#include "header.h"
+#include "layout.h"
+
+/* The amount of layouts in each chunk of the registry.  */
+#define LAYOUT_CHUNK_SIZE 256
+
+/* The most layouts that can be registered, as many as arrays can refer to.  */
+#define MAX_LAYOUTS ((size_t)1 << BITS_FOR_ARRAY_ELEMENT_LAYOUT)
+
+/* The amount of chunks needed for the most layouts.  */
+#define MAX_LAYOUT_CHUNKS (MAX_LAYOUTS / LAYOUT_CHUNK_SIZE)
+
+/**
+ * A registered layout.
+ * @param format: An off-heap copy of the format string.
+ * @param stride: The size of the struct, the distance between elements in an
+ * array.
+ * @param size: The aligned size of objects using the layout.
+ * @param header: The header written before objects using the layout.
+ * @param pointer_offsets: The offset of every pointer field from the start of
+ * the object, in increasing order.
+ * @param pointer_count: The amount of pointer fields.
+ */
+typedef struct layout
+{
+  char *format;
+  size_t stride;
+  size_t size;
+  header_t header;
+  size_t *pointer_offsets;
+  size_t pointer_count;
+} layout_t;
+
+/**
+ * @param chunks: The chunks of layouts, allocated as they are needed.
+ * @param count: The amount of registered layouts, read atomically.
+ * @param lock: Held while looking up and registering a layout.
+ */
+typedef struct layout_registry
+{
+  layout_t *chunks[MAX_LAYOUT_CHUNKS];
+  size_t count;
+  pthread_mutex_t lock;
+} layout_registry_t;
+
+static layout_registry_t registry = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/**
+ * Gets a registered layout from its handle.
+ */
+static layout_t *
+get_layout (layout_handle_t handle)
+{
+  layout_t *chunk = registry.chunks[handle / LAYOUT_CHUNK_SIZE];
+  return &chunk[handle % LAYOUT_CHUNK_SIZE];
+}
+
+/**
+ * Collects the offset of a pointer field into the layout given as argument.
+ * The format string is walked with a start address of 0, so the address of
+ * the field is its offset.
+ */
+static void
+collect_pointer_offset (void **field, void *arg)
+{
+  layout_t *layout = (layout_t *)arg;
+  layout->pointer_offsets[layout->pointer_count++] = (uintptr_t)field;
+}
+
+/**
+ * Counts pointer fields, used to size the pointer map before collecting.
+ */
+static void
+count_pointer_field (void **field, void *arg)
+{
+  (void)field;
+  (*(size_t *)arg)++;
+}
+
+/**
+ * Finds or adds a layout to the registry, with the registry lock held.
+ */
+static layout_handle_t
+find_or_add_layout (char *format)
+{
+  size_t count = registry.count;
+  for (size_t i = 0; i < count; i++)
+    {
+      if (strcmp (get_layout (i)->format, format) == 0)
+        {
+          return i;
+        }
+    }
+
+  bool success = false;
+  size_t stride = size_from_string (format, &success);
+  if (!success || count == MAX_LAYOUTS)
+    {
+      return INVALID_LAYOUT;
+    }
+  size_t size = align_alloc_size (stride);
+
+  header_t header = create_header_struct (format, size, &success);
+  if (!success)
+    {
+      return INVALID_LAYOUT;
+    }
+
+  size_t pointer_count = 0;
+  for_each_pointer_in_format_string (format, NULL, count_pointer_field,
+                                     &pointer_count);
+  char *format_copy = strdup (format);
+  size_t *pointer_offsets = calloc (pointer_count + 1, sizeof (size_t));
+  if (format_copy == NULL || pointer_offsets == NULL)
+    {
+      free (format_copy);
+      free (pointer_offsets);
+      return INVALID_LAYOUT;
+    }
+
+  layout_t **chunk = &registry.chunks[count / LAYOUT_CHUNK_SIZE];
+  if (*chunk == NULL)
+    {
+      *chunk = calloc (LAYOUT_CHUNK_SIZE, sizeof (layout_t));
+      if (*chunk == NULL)
+        {
+          free (format_copy);
+          free (pointer_offsets);
+          return INVALID_LAYOUT;
+        }
+    }
+
+  layout_handle_t handle = count;
+  layout_t *layout = get_layout (handle);
+  layout->format = format_copy;
+  layout->stride = stride;
+  layout->size = size;
+  if (get_header_type (header) == HEADER_POINTER_TO_FORMAT_STRING)
+    {
+      /* Does not fit a bit vector, refer to the registry instead of a copy
+         of the format string in the heap.  */
+      header = set_header_layout_index ((header_t)handle
+                                        << BITS_BEFORE_LAYOUT_INDEX);
+    }
+  layout->header = header;
+  layout->pointer_offsets = pointer_offsets;
+  layout->pointer_count = 0;
+  for_each_pointer_in_format_string (format, NULL, collect_pointer_offset,
+                                     layout);
+
+  /* Publishes the layout to threads reading the registry without the lock */
+  __atomic_store_n (&registry.count, count + 1, __ATOMIC_RELEASE);
+  return handle;
+}
+
+layout_handle_t
+register_layout (char *format)
+{
+  pthread_mutex_lock (&registry.lock);
+  layout_handle_t handle = find_or_add_layout (format);
+  pthread_mutex_unlock (&registry.lock);
+  return handle;
+}
+
+bool
+is_registered_layout (layout_handle_t handle)
+{
+  return handle < __atomic_load_n (&registry.count, __ATOMIC_ACQUIRE);
+}
+
+size_t
+get_layout_size (layout_handle_t handle)
+{
+  assert (is_registered_layout (handle));
+  return get_layout (handle)->size;
+}
+
+header_t
+get_layout_header (layout_handle_t handle)
+{
+  assert (is_registered_layout (handle));
+  return get_layout (handle)->header;
+}
+
+header_t
+create_array_header (layout_handle_t element, size_t length, bool *success)
+{
+  *success = is_registered_layout (element)
+             && element < ((size_t)1 << BITS_FOR_ARRAY_ELEMENT_LAYOUT)
+             && length <= MAX_ARRAY_LENGTH;
+  if (!*success)
+    {
+      return 0;
+    }
+
+  header_t header = (header_t)length << BITS_FOR_ARRAY_ELEMENT_LAYOUT;
+  header = (header | element) << BITS_BEFORE_LAYOUT_INDEX;
+  return set_header_layout_index (header | LAYOUT_ARRAY_BIT);
+}
+
+size_t
+calc_array_size (layout_handle_t element, size_t length)
+{
+  assert (is_registered_layout (element));
+  return align_alloc_size (get_layout (element)->stride * length);
+}
+
+layout_handle_t
+get_layout_in_header (header_t header)
+{
+  return header >> BITS_BEFORE_LAYOUT_INDEX;
+}
+
+bool
+is_array_header (header_t header)
+{
+  return (header & LAYOUT_ARRAY_BIT) != 0;
+}
+
+layout_handle_t
+get_array_element_layout (header_t header)
+{
+  return (header >> BITS_BEFORE_LAYOUT_INDEX)
+         & (((size_t)1 << BITS_FOR_ARRAY_ELEMENT_LAYOUT) - 1);
+}
+
+size_t
+get_array_length (header_t header)
+{
+  return header >> (BITS_BEFORE_LAYOUT_INDEX + BITS_FOR_ARRAY_ELEMENT_LAYOUT);
+}
+
+bool
+is_valid_layout_header (header_t header)
+{
+  if (is_array_header (header))
+    {
+      return is_registered_layout (get_array_element_layout (header));
+    }
+  return is_registered_layout (get_layout_in_header (header));
+}
+
+size_t
+get_layout_object_size (header_t header)
+{
+  if (is_array_header (header))
+    {
+      return calc_array_size (get_array_element_layout (header),
+                              get_array_length (header));
+    }
+  return get_layout_size (get_layout_in_header (header));
+}
+
+/**
+ * Calls func with every pointer field of a struct with the given layout.
+ */
+static void
+for_each_pointer_in_struct (layout_t *layout, char *struct_start,
+                            pointer_field_func *func, void *arg)
+{
+  for (size_t i = 0; i < layout->pointer_count; i++)
+    {
+      func ((void **)(struct_start + layout->pointer_offsets[i]), arg);
+    }
+}
+
+void
+for_each_pointer_in_layout_object (header_t header, void *allocation_start,
+                                   pointer_field_func *func, void *arg)
+{
+  if (is_array_header (header))
+    {
+      for_each_pointer_in_array (header, allocation_start, 0,
+                                 get_array_length (header), func, arg);
+      return;
+    }
+
+  layout_handle_t handle = get_layout_in_header (header);
+  assert (is_registered_layout (handle));
+  for_each_pointer_in_struct (get_layout (handle), allocation_start, func,
+                              arg);
+}
+
+void
+for_each_pointer_in_array (header_t header, void *allocation_start,
+                           size_t from, size_t to, pointer_field_func *func,
+                           void *arg)
+{
+  layout_handle_t element = get_array_element_layout (header);
+  assert (is_registered_layout (element));
+  assert (to <= get_array_length (header));
+  layout_t *layout = get_layout (element);
+  if (layout->pointer_count == 0)
+    {
+      return;
+    }
+
+  char *element_start = (char *)allocation_start + from * layout->stride;
+  for (size_t i = from; i < to; i++)
+    {
+      for_each_pointer_in_struct (layout, element_start, func, arg);
+      element_start += layout->stride;
+    }
+}
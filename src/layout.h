@@ -0,0 +1,156 @@
+/**
+ * The layout registry. Layouts registered with h_register_layout are parsed
+ * once and stored off-heap, together with the header and pointer map of
+ * objects using them. Objects with a layout too large for a bit vector refer
+ * to their layout by index in a HEADER_LAYOUT_INDEX header instead of having
+ * a copy of the format string in the heap.
+ * Arrays use the same header type with the array bit set, storing both the
+ * layout of their elements and their length in the header.
+ * The registry is shared by all heaps, so a handle stays valid for the
+ * lifetime of the program.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "format_encoding.h"
+#include "gc.h"
+
+/* Set in HEADER_LAYOUT_INDEX headers of arrays.  */
+#define LAYOUT_ARRAY_BIT 0x4
+
+/* Bits before the layout index in a HEADER_LAYOUT_INDEX header.  */
+#define BITS_BEFORE_LAYOUT_INDEX 3
+
+/* Bits for the element layout of an array, the length uses the rest.  */
+#define BITS_FOR_ARRAY_ELEMENT_LAYOUT 20
+
+/* The longest array that fits in a header.  */
+#define MAX_ARRAY_LENGTH                                                      \
+  (((size_t)1                                                                 \
+    << (64 - BITS_BEFORE_LAYOUT_INDEX - BITS_FOR_ARRAY_ELEMENT_LAYOUT))      \
+   - 1)
+
+/**
+ * @brief Finds the layout registered for a format string, registering it if
+ * it has not been seen before.
+ * @param format a format string describing a struct
+ * @return a handle to the layout, or INVALID_LAYOUT if the format string is
+ * not valid
+ */
+layout_handle_t register_layout (char *format);
+
+/**
+ * @brief Checks if a handle refers to a registered layout.
+ * @param handle the handle to check
+ * @return true if the handle was returned by register_layout
+ */
+bool is_registered_layout (layout_handle_t handle);
+
+/**
+ * @brief Gets the aligned size of objects using a layout.
+ * @param handle a registered layout
+ * @return the size in bytes, excluding the header
+ */
+size_t get_layout_size (layout_handle_t handle);
+
+/**
+ * @brief Gets the header written before objects using a layout. This is a
+ * bit vector header when the layout fits one, and a HEADER_LAYOUT_INDEX
+ * header otherwise.
+ * @param handle a registered layout
+ * @return the header for new objects
+ */
+header_t get_layout_header (layout_handle_t handle);
+
+/**
+ * @brief Creates the header of an array.
+ * @param element a registered layout for the elements
+ * @param length the amount of elements
+ * @param success set to false if the element layout or length does not fit
+ * in a header
+ * @return the header for the array
+ */
+header_t create_array_header (layout_handle_t element, size_t length,
+                              bool *success);
+
+/**
+ * @brief Gets the size of an array.
+ * @param element a registered layout for the elements
+ * @param length the amount of elements
+ * @return the aligned size in bytes, excluding the header
+ */
+size_t calc_array_size (layout_handle_t element, size_t length);
+
+/**
+ * @brief Gets the layout referred to by a HEADER_LAYOUT_INDEX header that is
+ * not an array.
+ * @param header a header of type HEADER_LAYOUT_INDEX
+ * @return the handle stored in the header
+ */
+layout_handle_t get_layout_in_header (header_t header);
+
+/**
+ * @brief Checks if a HEADER_LAYOUT_INDEX header belongs to an array.
+ * @param header a header of type HEADER_LAYOUT_INDEX
+ * @return true if the header is an array header
+ */
+bool is_array_header (header_t header);
+
+/**
+ * @brief Gets the layout of the elements of an array.
+ * @param header an array header
+ * @return the handle of the element layout
+ */
+layout_handle_t get_array_element_layout (header_t header);
+
+/**
+ * @brief Gets the amount of elements in an array.
+ * @param header an array header
+ * @return the length of the array
+ */
+size_t get_array_length (header_t header);
+
+/**
+ * @brief Checks if a HEADER_LAYOUT_INDEX header refers to a registered
+ * layout.
+ * @param header a header of type HEADER_LAYOUT_INDEX
+ * @return true if the layout in the header is registered
+ */
+bool is_valid_layout_header (header_t header);
+
+/**
+ * @brief Gets the size of an object with a HEADER_LAYOUT_INDEX header.
+ * @param header a valid header of type HEADER_LAYOUT_INDEX
+ * @return the aligned size in bytes, excluding the header
+ */
+size_t get_layout_object_size (header_t header);
+
+/**
+ * @brief Calls func with the address of every pointer field in an object
+ * with a HEADER_LAYOUT_INDEX header, using the pointer map computed when its
+ * layout was registered.
+ * @param header a valid header of type HEADER_LAYOUT_INDEX
+ * @param allocation_start a pointer to the start of the object
+ * @param func the function to call for each pointer field
+ * @param arg an optional argument sent to func
+ */
+void for_each_pointer_in_layout_object (header_t header,
+                                        void *allocation_start,
+                                        pointer_field_func *func, void *arg);
+
+/**
+ * @brief Calls func with the address of every pointer field in a range of
+ * elements of an array.
+ * @param header an array header
+ * @param allocation_start a pointer to the start of the array
+ * @param from the index of the first element to visit
+ * @param to the index after the last element to visit, at most the length
+ * @param func the function to call for each pointer field
+ * @param arg an optional argument sent to func
+ */
+void for_each_pointer_in_array (header_t header, void *allocation_start,
+                                size_t from, size_t to,
+                                pointer_field_func *func, void *arg);
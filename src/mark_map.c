@@ -0,0 +1,80 @@
+/**
+ * Function for creating a mark map.
+ * The mark map records which objects were found to be alive during the
+ * mark-phase. It shares the layout of the allocation map, each bit
+ * representing 16 bytes on the heap and each byte of the map 128 bytes, so
+ * the indexing helpers of the allocation map are reused.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocation_map.h"
+#include "bitmap.h"
+#include "heap_internal.h"
+#include "mark_map.h"
+
+/**
+ * Calculates the number of bytes needed for a mark map of a heap.
+ * @param bytes the size of the heap in bytes
+ * @return the size of the mark map in bytes
+ */
+static size_t
+calc_mark_map_size (size_t bytes)
+{
+  return calc_bitmap_size (bytes / MIN_ALLOC_OBJECT_SIZE);
+}
+
+char *
+create_mark_map (size_t bytes)
+{
+  char *mark_map = calloc (calc_mark_map_size (bytes), sizeof (char));
+  assert (mark_map != NULL && "Calloc failed to allocate mark map");
+  return mark_map;
+}
+
+void
+reset_mark_map (heap_t *h)
+{
+  memset (h->mark_map, 0, calc_mark_map_size (h->size));
+}
+
+void
+update_mark_map (char *mark_map, size_t offset, bool is_marked)
+{
+  /* Same layout as the allocation map.  */
+  update_alloc_map (mark_map, offset, is_marked);
+}
+
+bool
+try_mark_offset (char *mark_map, size_t offset)
+{
+  char mask = create_bitmask (offset);
+  char *byte = &mark_map[find_index_in_alloc_map (offset)];
+  if (__atomic_load_n (byte, __ATOMIC_RELAXED) & mask)
+    {
+      return false;
+    }
+  return !(__atomic_fetch_or (byte, mask, __ATOMIC_RELAXED) & mask);
+}
+
+bool
+is_offset_marked (char *mark_map, size_t offset)
+{
+  return is_offset_allocated (mark_map, offset);
+}
+
+bool
+find_next_marked_offset (char *mark_map, size_t bytes, size_t *offset)
+{
+  /* Round up to the granule the offset belongs to.  */
+  size_t index = (*offset + MIN_ALLOC_OBJECT_SIZE - 1) / MIN_ALLOC_OBJECT_SIZE;
+  if (!find_next_set_bit (mark_map, bytes / MIN_ALLOC_OBJECT_SIZE, &index))
+    {
+      return false;
+    }
+  *offset = index * MIN_ALLOC_OBJECT_SIZE;
+  return true;
+}
@@ -0,0 +1,65 @@
+/**
+ * Functions for creating and scanning a mark map.
+ * The mark map is laid out exactly like the allocation map, one bit per
+ * MIN_ALLOC_OBJECT_SIZE bytes, but only the bit of the granule holding an
+ * object's header is set. A linear scan of the map therefore visits every
+ * marked object once, in address order.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "heap.h"
+
+/**
+ * @brief Creates an empty mark map for the memory of given amount of bytes.
+ * @param bytes the total amount of bytes that the mark map will represent
+ * @return a mark map with no bits set.
+ */
+char *create_mark_map (size_t bytes);
+
+/**
+ * @brief Clears every bit in the mark map of the heap.
+ * @param h the heap which mark map is to be reset
+ */
+void reset_mark_map (heap_t *h);
+
+/**
+ * Sets the bit associated with the heap offset in the mark map to 0 if
+ * is_marked is false and 1 if it is true.
+ * @param mark_map - the mark map
+ * @param offset - the heap offset of the object's header
+ * @param is_marked - if the bit should be marked or not
+ */
+void update_mark_map (char *mark_map, size_t offset, bool is_marked);
+
+/**
+ * Atomically sets the bit associated with the heap offset in the mark map, so
+ * that several threads may mark objects in the same map.
+ * @param mark_map - the mark map
+ * @param offset - the heap offset of the object's header
+ * @return true if this call set the bit, false if it was already set.
+ */
+bool try_mark_offset (char *mark_map, size_t offset);
+
+/**
+ * Checks if the given offset corresponds to a marked granule in the mark map.
+ * @param mark_map - the mark map
+ * @param offset - the offset to check
+ * @return true if the granule the offset corresponds to is marked.
+ */
+bool is_offset_marked (char *mark_map, size_t offset);
+
+/**
+ * @brief Finds the first marked granule at or after offset. Unmarked parts of
+ * the map are skipped a word, 64 granules, at a time.
+ * @param mark_map - the mark map
+ * @param bytes - the total amount of bytes the mark map represents
+ * @param offset - the offset to start searching from, set to the offset of
+ * the marked granule if one was found.
+ * @return true if a marked granule was found, false if the end of the map was
+ * reached.
+ */
+bool find_next_marked_offset (char *mark_map, size_t bytes, size_t *offset);
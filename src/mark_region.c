@@ -0,0 +1,472 @@
+/**
+ * Functions for marking the lines of a heap after garbage collection and
+ * bump allocating through the holes between marked lines.
+ * Every byte of the allocation map covers one line, so a line is marked by
+ * checking if its byte is zero, without looking at any object.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocation_map.h"
+#include "bitmap.h"
+#include "mark_region.h"
+
+/* The amount of lines covered by each byte of the line marks.  */
+#define LINES_PER_BYTE 8
+
+/**
+ * Where allocation is bumping through the holes of a block.
+ * @param cursor: The heap offset of the next free byte of the hole.
+ * @param limit: The heap offset directly after the hole.
+ * @param line: The first line of the block not searched for holes yet.
+ * @param block_end: The line directly after the block.
+ */
+typedef struct line_cursor
+{
+  size_t cursor;
+  size_t limit;
+  size_t line;
+  size_t block_end;
+} line_cursor_t;
+
+/**
+ * @param heap_bytes: The size of the heap in bytes.
+ * @param page_size: The size of a page in bytes.
+ * @param line_count: The amount of lines in the heap.
+ * @param block_count: The amount of blocks in the heap.
+ * @param line_marks: A bitmap with the bit of every marked line set.
+ * @param recycled_blocks: The blocks with both marked and free lines, in
+ * address order.
+ * @param recycled_count: The amount of recycled blocks.
+ * @param next_recycled: The index of the next recycled block to allocate in.
+ * @param free_blocks: The blocks without a marked line, in address order.
+ * @param free_count: The amount of free blocks.
+ * @param next_free: The index of the next free block to allocate in.
+ * @param free_lines: The amount of lines that were not marked.
+ * @param recycled_lines: The amount of free lines in recycled blocks.
+ * @param small: Where objects of up to a line, and larger objects that fit
+ * the current hole, are allocated.
+ * @param overflow: Where larger objects are allocated.
+ */
+struct mark_region
+{
+  size_t heap_bytes;
+  size_t page_size;
+  size_t line_count;
+  size_t block_count;
+  char *line_marks;
+  size_t *recycled_blocks;
+  size_t recycled_count;
+  size_t next_recycled;
+  size_t *free_blocks;
+  size_t free_count;
+  size_t next_free;
+  size_t free_lines;
+  size_t recycled_lines;
+  line_cursor_t small;
+  line_cursor_t overflow;
+};
+
+mark_region_t *
+create_mark_region (size_t heap_bytes, size_t page_size)
+{
+  assert (page_size % LINE_SIZE == 0);
+  assert (LINE_SIZE == LINES_PER_BYTE * MIN_ALLOC_OBJECT_SIZE);
+
+  mark_region_t *region = calloc (1, sizeof (mark_region_t));
+  assert (region != NULL && "Calloc failed to allocate mark region");
+  region->heap_bytes = heap_bytes;
+  region->page_size = page_size;
+  region->line_count = (heap_bytes + LINE_SIZE - 1) / LINE_SIZE;
+  region->block_count = (heap_bytes + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  region->line_marks = calloc (calc_bitmap_size (region->line_count), 1);
+  region->recycled_blocks = malloc (region->block_count * sizeof (size_t));
+  region->free_blocks = malloc (region->block_count * sizeof (size_t));
+  assert (region->line_marks != NULL && region->recycled_blocks != NULL
+          && region->free_blocks != NULL
+          && "Failed to allocate the blocks of a mark region");
+
+  /* Nothing is allocated yet, every block is free */
+  for (size_t i = 0; i < region->block_count; i++)
+    {
+      region->free_blocks[i] = i;
+    }
+  region->free_count = region->block_count;
+  region->free_lines = region->line_count;
+  return region;
+}
+
+void
+destroy_mark_region (mark_region_t *region)
+{
+  if (region == NULL)
+    {
+      return;
+    }
+  free (region->line_marks);
+  free (region->recycled_blocks);
+  free (region->free_blocks);
+  free (region);
+}
+
+void
+mark_lines (mark_region_t *region, char *alloc_map)
+{
+  size_t mark_bytes = (region->line_count + LINES_PER_BYTE - 1)
+                      / LINES_PER_BYTE;
+  memset (region->line_marks, 0, mark_bytes);
+  for (size_t line = 0; line < region->line_count; line++)
+    {
+      if (alloc_map[line] != 0)
+        {
+          region->line_marks[line / LINES_PER_BYTE]
+              |= (char)(1 << (line % LINES_PER_BYTE));
+        }
+    }
+
+  region->recycled_count = 0;
+  region->free_count = 0;
+  region->free_lines = 0;
+  region->recycled_lines = 0;
+  size_t lines_per_block = BLOCK_SIZE / LINE_SIZE;
+  for (size_t block = 0; block < region->block_count; block++)
+    {
+      size_t start = block * lines_per_block;
+      size_t count = region->line_count - start < lines_per_block
+                         ? region->line_count - start
+                         : lines_per_block;
+      size_t free = count - count_set_bits (region->line_marks, start, count);
+      region->free_lines += free;
+      if (free == count)
+        {
+          region->free_blocks[region->free_count++] = block;
+        }
+      else if (free > 0)
+        {
+          region->recycled_blocks[region->recycled_count++] = block;
+          region->recycled_lines += free;
+        }
+    }
+
+  region->next_recycled = 0;
+  region->next_free = 0;
+  region->small = (line_cursor_t){ 0 };
+  region->overflow = (line_cursor_t){ 0 };
+}
+
+/**
+ * @brief Finds a block in a list of blocks in address order.
+ * @param blocks the list of blocks
+ * @param count the amount of blocks in the list
+ * @param block the block to find
+ * @return the index of the block, or count if it is not in the list
+ */
+static size_t
+find_block (size_t *blocks, size_t count, size_t block)
+{
+  size_t low = 0;
+  size_t high = count;
+  while (low < high)
+    {
+      size_t middle = low + (high - low) / 2;
+      if (blocks[middle] < block)
+        {
+          low = middle + 1;
+        }
+      else
+        {
+          high = middle;
+        }
+    }
+  return low < count && blocks[low] == block ? low : count;
+}
+
+/**
+ * @brief Removes a block from a list of blocks, keeping the index of the
+ * next block to allocate in on the same block.
+ * @param blocks the list of blocks
+ * @param count the amount of blocks in the list
+ * @param next the index of the next block to allocate in
+ * @param index the index of the block to remove, or count to remove nothing
+ */
+static void
+drop_block (size_t *blocks, size_t *count, size_t *next, size_t index)
+{
+  if (index == *count)
+    {
+      return;
+    }
+  memmove (&blocks[index], &blocks[index + 1],
+           (*count - index - 1) * sizeof (size_t));
+  (*count)--;
+  if (*next > index)
+    {
+      (*next)--;
+    }
+}
+
+/**
+ * @brief Cuts the hole of a cursor short where it overlaps an extent.
+ * @param cursor the cursor
+ * @param offset the heap offset of the extent
+ * @param bytes the length of the extent
+ */
+static void
+clip_hole (line_cursor_t *cursor, size_t offset, size_t bytes)
+{
+  if (offset >= cursor->limit || cursor->cursor >= offset + bytes)
+    {
+      return;
+    }
+  if (cursor->cursor < offset)
+    {
+      cursor->limit = offset;
+    }
+  else
+    {
+      cursor->cursor = cursor->limit;
+    }
+}
+
+void
+mark_extent (mark_region_t *region, size_t offset, size_t bytes)
+{
+  size_t first_line = offset / LINE_SIZE;
+  size_t end_line = (offset + bytes + LINE_SIZE - 1) / LINE_SIZE;
+  size_t lines_per_block = BLOCK_SIZE / LINE_SIZE;
+  for (size_t block = first_line / lines_per_block;
+       block * lines_per_block < end_line; block++)
+    {
+      size_t block_start = block * lines_per_block;
+      size_t block_lines = region->line_count - block_start < lines_per_block
+                               ? region->line_count - block_start
+                               : lines_per_block;
+      size_t start = block_start > first_line ? block_start : first_line;
+      size_t end = block_start + block_lines;
+      end = end < end_line ? end : end_line;
+      size_t count = end - start;
+      size_t marked
+          = count - count_set_bits (region->line_marks, start, count);
+      update_bit_range (region->line_marks, start, count, true);
+
+      size_t recycled = find_block (region->recycled_blocks,
+                                    region->recycled_count, block);
+      size_t free
+          = find_block (region->free_blocks, region->free_count, block);
+      region->free_lines -= marked;
+      if (recycled < region->recycled_count)
+        {
+          region->recycled_lines -= marked;
+        }
+      if (count_set_bits (region->line_marks, block_start, block_lines)
+          < block_lines)
+        {
+          /* The holes left in the block are still found by the cursors */
+          continue;
+        }
+      drop_block (region->recycled_blocks, &region->recycled_count,
+                  &region->next_recycled, recycled);
+      drop_block (region->free_blocks, &region->free_count,
+                  &region->next_free, free);
+    }
+
+  clip_hole (&region->small, offset, bytes);
+  clip_hole (&region->overflow, offset, bytes);
+}
+
+/**
+ * Moves a cursor of a mark region on to its next hole.
+ */
+typedef bool next_hole_func (mark_region_t *region);
+
+/**
+ * @brief Starts searching a block for holes.
+ * @param region the mark region
+ * @param cursor the cursor to move to the block
+ * @param block the index of the block
+ */
+static void
+enter_block (mark_region_t *region, line_cursor_t *cursor, size_t block)
+{
+  size_t lines_per_block = BLOCK_SIZE / LINE_SIZE;
+  cursor->line = block * lines_per_block;
+  cursor->block_end = cursor->line + lines_per_block < region->line_count
+                          ? cursor->line + lines_per_block
+                          : region->line_count;
+}
+
+/**
+ * @brief Moves a cursor to the next hole of the block it is in, a run of
+ * free lines cut short at the end of a page.
+ * @param region the mark region
+ * @param cursor the cursor
+ * @return false if the block has no hole left
+ */
+static bool
+find_next_hole (mark_region_t *region, line_cursor_t *cursor)
+{
+  size_t start = cursor->line;
+  if (start >= cursor->block_end
+      || !find_next_zero_run (region->line_marks, cursor->block_end, 1,
+                              &start))
+    {
+      cursor->line = cursor->block_end;
+      return false;
+    }
+
+  size_t lines_per_page = region->page_size / LINE_SIZE;
+  size_t page_end = (start / lines_per_page + 1) * lines_per_page;
+  page_end = page_end < cursor->block_end ? page_end : cursor->block_end;
+  size_t end = start;
+  if (!find_next_set_bit (region->line_marks, page_end, &end))
+    {
+      end = page_end;
+    }
+
+  cursor->cursor = start * LINE_SIZE;
+  cursor->limit = end * LINE_SIZE < region->heap_bytes ? end * LINE_SIZE
+                                                       : region->heap_bytes;
+  cursor->line = end;
+  return true;
+}
+
+/**
+ * @brief Moves the small object cursor to its next hole, going on to the
+ * next recycled block and then to the next free block once the block it is
+ * in has none left.
+ * @param region the mark region
+ * @return false if no hole is left
+ */
+static bool
+next_small_hole (mark_region_t *region)
+{
+  while (!find_next_hole (region, &region->small))
+    {
+      if (region->next_recycled < region->recycled_count)
+        {
+          enter_block (region, &region->small,
+                       region->recycled_blocks[region->next_recycled++]);
+        }
+      else if (region->next_free < region->free_count)
+        {
+          enter_block (region, &region->small,
+                       region->free_blocks[region->next_free++]);
+        }
+      else
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+/**
+ * @brief Moves the overflow cursor to its next hole, going on to the next
+ * free block once the block it is in has none left.
+ * @param region the mark region
+ * @return false if no free block is left
+ */
+static bool
+next_overflow_hole (mark_region_t *region)
+{
+  while (!find_next_hole (region, &region->overflow))
+    {
+      if (region->next_free == region->free_count)
+        {
+          return false;
+        }
+      enter_block (region, &region->overflow,
+                   region->free_blocks[region->next_free++]);
+    }
+  return true;
+}
+
+/**
+ * @brief Takes room from the hole of a cursor, moving it on to later holes
+ * until one is large enough.
+ * @param region the mark region
+ * @param cursor the cursor
+ * @param next_hole moves the cursor to its next hole
+ * @param bytes the amount of bytes needed
+ * @param offset set to the start of the room taken if there was any
+ * @return false if the cursor ran out of holes
+ */
+static bool
+bump_through_holes (mark_region_t *region, line_cursor_t *cursor,
+                    next_hole_func *next_hole, size_t bytes, size_t *offset)
+{
+  while (cursor->cursor + bytes > cursor->limit)
+    {
+      if (!next_hole (region))
+        {
+          return false;
+        }
+    }
+  *offset = cursor->cursor;
+  cursor->cursor += bytes;
+  return true;
+}
+
+bool
+take_line_space (mark_region_t *region, size_t bytes, size_t *offset)
+{
+  assert (bytes <= region->page_size);
+  line_cursor_t *small = &region->small;
+  if (small->cursor == small->limit)
+    {
+      /* Nothing is lost by moving on from a used up hole */
+      next_small_hole (region);
+    }
+  /* Skipping the rest of the hole for a larger object would waste it, the
+     object goes to an overflow block instead.  */
+  if (bytes > LINE_SIZE && small->cursor + bytes > small->limit
+      && bump_through_holes (region, &region->overflow, next_overflow_hole,
+                             bytes, offset))
+    {
+      return true;
+    }
+  /* Once no free block is left the holes it does not fit are skipped, but
+     only if one of the later holes fits it.  */
+  line_cursor_t saved = *small;
+  size_t next_recycled = region->next_recycled;
+  size_t next_free = region->next_free;
+  if (!bump_through_holes (region, small, next_small_hole, bytes, offset))
+    {
+      *small = saved;
+      region->next_recycled = next_recycled;
+      region->next_free = next_free;
+      return false;
+    }
+  return true;
+}
+
+float
+calc_line_fragmentation (mark_region_t *region)
+{
+  if (region->free_lines == 0)
+    {
+      return 0;
+    }
+  return (float)region->recycled_lines / (float)region->free_lines;
+}
+
+size_t
+get_recycled_block_count (mark_region_t *region)
+{
+  return region->recycled_count;
+}
+
+size_t
+get_free_block_count (mark_region_t *region)
+{
+  return region->free_count;
+}
+
+bool
+is_line_marked (mark_region_t *region, size_t offset)
+{
+  return count_set_bits (region->line_marks, offset / LINE_SIZE, 1) == 1;
+}
@@ -0,0 +1,108 @@
+/**
+ * Lines and blocks of a heap collected as a mark-region heap, used to bump
+ * allocate through the holes of free lines left by garbage collection
+ * without probing the allocation map.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+/* The size of a line in bytes, the granules of one byte of the allocation
+   map.  */
+#define LINE_SIZE 128
+
+/* The size of a block in bytes, the unit free lines are recycled in.  */
+#define BLOCK_SIZE (32 * 1024)
+
+/**
+ * The line marks of a heap and the blocks allocation bumps through.
+ * A line is marked if any part of it is allocated, and a hole is a run of
+ * unmarked lines. Small objects are bump allocated through the holes of
+ * partly used (recycled) blocks first, and then through free blocks.
+ * Objects larger than a line that do not fit the current hole are placed
+ * in a free block of their own instead, an overflow block, so that the
+ * hole is not skipped. Holes never cross a page, like any small object.
+ */
+typedef struct mark_region mark_region_t;
+
+/**
+ * @brief Creates the lines and blocks of a heap where every line is free.
+ * @param heap_bytes the size of the heap in bytes
+ * @param page_size the size of a page in bytes, a multiple of LINE_SIZE
+ * @return the created mark region
+ */
+mark_region_t *create_mark_region (size_t heap_bytes, size_t page_size);
+
+/**
+ * @brief Frees all memory allocated to a mark region.
+ * @param region the mark region to destroy, may be NULL
+ */
+void destroy_mark_region (mark_region_t *region);
+
+/**
+ * @brief Marks every line that holds an allocated granule, sorts the blocks
+ * into recycled and free blocks and starts allocating from the first hole
+ * again. Done after every collection, and whenever the allocation map was
+ * changed without going through the region.
+ * @param region the mark region
+ * @param alloc_map the allocation map of the heap
+ */
+void mark_lines (mark_region_t *region, char *alloc_map);
+
+/**
+ * @brief Marks the lines of an extent allocated without going through the
+ * region, and drops the blocks it leaves without a free line from the
+ * recycled and free blocks. Only the holes that overlap the extent are cut
+ * short.
+ * @param region the mark region
+ * @param offset the heap offset of the extent
+ * @param bytes the length of the extent in bytes
+ */
+void mark_extent (mark_region_t *region, size_t offset, size_t bytes);
+
+/**
+ * @brief Takes room for an allocation by bumping through the holes, or
+ * through an overflow block for an object larger than a line that does not
+ * fit the current hole.
+ * @param region the mark region
+ * @param bytes the amount of bytes needed, at most a page
+ * @param offset set to the start of the room taken if there was any
+ * @return true if room was found, false if no hole or free block is left
+ * that the allocation fits in
+ */
+bool take_line_space (mark_region_t *region, size_t bytes, size_t *offset);
+
+/**
+ * @brief Measures how fragmented the free lines are, as the share of them
+ * lying in recycled blocks.
+ * @param region the mark region, with its lines marked
+ * @return 0 if every free line is in a free block, up to 1 if every free
+ * line is in a block that still holds objects
+ */
+float calc_line_fragmentation (mark_region_t *region);
+
+/**
+ * @brief Gets the amount of blocks that were partly used when the lines
+ * were last marked.
+ * @param region the mark region
+ * @return the amount of recycled blocks
+ */
+size_t get_recycled_block_count (mark_region_t *region);
+
+/**
+ * @brief Gets the amount of blocks that were empty when the lines were last
+ * marked.
+ * @param region the mark region
+ * @return the amount of free blocks
+ */
+size_t get_free_block_count (mark_region_t *region);
+
+/**
+ * @brief Checks if a line was marked when the lines were last marked.
+ * @param region the mark region
+ * @param offset a heap offset in the line
+ * @return true if the line is marked
+ */
+bool is_line_marked (mark_region_t *region, size_t offset);
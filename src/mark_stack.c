@@ -0,0 +1,104 @@
+#include <assert.h>
+#include <string.h>
+
+#include "mark_stack.h"
+
+struct mark_stack
+{
+  void **entries;
+  size_t capacity;
+  size_t size;
+  bool overflowed;
+};
+
+mark_stack_t *
+create_mark_stack (size_t capacity)
+{
+  assert (capacity > 0);
+  mark_stack_t *stack = calloc (1, sizeof (mark_stack_t));
+  assert (stack != NULL);
+  stack->entries = calloc (capacity, sizeof (void *));
+  assert (stack->entries != NULL);
+  stack->capacity = capacity;
+  return stack;
+}
+
+void
+destroy_mark_stack (mark_stack_t *stack)
+{
+  free (stack->entries);
+  free (stack);
+}
+
+bool
+push_mark_stack (mark_stack_t *stack, void *object)
+{
+  if (stack->size == stack->capacity)
+    {
+      stack->overflowed = true;
+      return false;
+    }
+  stack->entries[stack->size++] = object;
+  return true;
+}
+
+void *
+pop_mark_stack (mark_stack_t *stack)
+{
+  if (stack->size == 0)
+    {
+      return NULL;
+    }
+  return stack->entries[--stack->size];
+}
+
+bool
+is_mark_stack_empty (mark_stack_t *stack)
+{
+  return stack->size == 0;
+}
+
+bool
+has_mark_stack_space (mark_stack_t *stack, size_t count)
+{
+  return stack->capacity - stack->size >= count;
+}
+
+size_t
+get_mark_stack_size (mark_stack_t *stack)
+{
+  return stack->size;
+}
+
+void *
+get_mark_stack_entry (mark_stack_t *stack, size_t index)
+{
+  assert (index < stack->size);
+  return stack->entries[index];
+}
+
+size_t
+steal_mark_stack (mark_stack_t *stack, void **entries, size_t count)
+{
+  if (count > stack->size)
+    {
+      count = stack->size;
+    }
+  memcpy (entries, stack->entries, count * sizeof (void *));
+  memmove (stack->entries, stack->entries + count,
+           (stack->size - count) * sizeof (void *));
+  stack->size -= count;
+  return count;
+}
+
+bool
+has_mark_stack_overflowed (mark_stack_t *stack)
+{
+  return stack->overflowed;
+}
+
+void
+clear_mark_stack_overflow (mark_stack_t *stack)
+{
+  stack->overflowed = false;
+}
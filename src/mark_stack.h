@@ -0,0 +1,106 @@
+/**
+ * A bounded stack of objects that have been marked but not yet scanned,
+ * used to trace the heap without recursion.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+/**
+ * The default amount of entries a mark stack may hold while tracing a heap.
+ * 4096 entries costs 32 KiB regardless of the shape of the object graph.
+ */
+#define DEFAULT_MARK_STACK_SIZE 4096
+
+/**
+ * A fixed capacity LIFO stack of object pointers. Pushing to a full stack
+ * fails and records an overflow, the caller is then responsible for finding
+ * the objects that could not be pushed again.
+ */
+typedef struct mark_stack mark_stack_t;
+
+/**
+ * @brief Creates an empty mark stack.
+ * @param capacity the maximum amount of entries the stack may hold
+ * @return a pointer to the created stack
+ */
+mark_stack_t *create_mark_stack (size_t capacity);
+
+/**
+ * @brief Frees all memory allocated to a mark stack
+ * @param stack the mark stack to destroy
+ */
+void destroy_mark_stack (mark_stack_t *stack);
+
+/**
+ * @brief Pushes an object onto the mark stack if there is room for it.
+ * If the stack is full the stack is flagged as overflowed instead.
+ * @param stack a mark stack
+ * @param object the object to push
+ * @return true if the object was pushed, false if the stack was full
+ */
+bool push_mark_stack (mark_stack_t *stack, void *object);
+
+/**
+ * @brief Removes and returns the most recently pushed object.
+ * @param stack a mark stack
+ * @return the object removed from the stack, or NULL if the stack is empty
+ */
+void *pop_mark_stack (mark_stack_t *stack);
+
+/**
+ * @brief Checks if a mark stack is empty
+ * @param stack a mark stack
+ * @return true if the stack is empty, false otherwise
+ */
+bool is_mark_stack_empty (mark_stack_t *stack);
+
+/**
+ * @brief Checks if a number of entries can be pushed without overflowing.
+ * @param stack a mark stack
+ * @param count the amount of entries to push
+ * @return true if there is room for count more entries
+ */
+bool has_mark_stack_space (mark_stack_t *stack, size_t count);
+
+/**
+ * @brief Gets the amount of entries on a mark stack.
+ * @param stack a mark stack
+ * @return the amount of entries
+ */
+size_t get_mark_stack_size (mark_stack_t *stack);
+
+/**
+ * @brief Reads an entry without removing it.
+ * @param stack a mark stack
+ * @param index the position of the entry, 0 being the oldest entry
+ * @return the entry at index
+ */
+void *get_mark_stack_entry (mark_stack_t *stack, size_t index);
+
+/**
+ * @brief Removes the oldest entries of a mark stack, the ones furthest from
+ * the entries its owner is working on, so another tracer can scan them.
+ * @param stack the mark stack to steal from
+ * @param entries where the stolen entries are written, oldest first
+ * @param count the amount of entries to steal
+ * @return the amount of entries stolen, less than count if the stack had
+ * fewer entries
+ */
+size_t steal_mark_stack (mark_stack_t *stack, void **entries, size_t count);
+
+/**
+ * @brief Checks if a push has failed since the overflow flag was last
+ * cleared.
+ * @param stack a mark stack
+ * @return true if the stack has overflowed
+ */
+bool has_mark_stack_overflowed (mark_stack_t *stack);
+
+/**
+ * @brief Clears the overflow flag of a mark stack.
+ * @param stack a mark stack
+ */
+void clear_mark_stack_overflow (mark_stack_t *stack);
@@ -6,6 +6,7 @@
 
 #include "format_encoding.h"
 #include "get_header.h"
+#include "layout.h"
 #include "move_data.h"
 
 /**
@@ -51,6 +52,25 @@ move_ptr_to_formatstring (header_t header, void **origin, void *destination)
   *origin = destination;
 }
 
+/**
+ * Moves an allocation that has a header which is the index of a layout.
+ * @param header the header
+ * @param origin the allocation origin
+ * @param destination the target address to move the allocation to.
+ */
+void
+move_layout (header_t header, void **origin, void *destination)
+{
+  size_t alloc_size = get_layout_object_size (header);
+
+  size_t header_size = sizeof (header_t);
+  char *header_and_alloc = (char *)*origin - header_size;
+  char *dest = ((char *)destination - header_size);
+
+  memmove ((void *)dest, (void *)header_and_alloc, (alloc_size + header_size));
+  *origin = destination;
+}
+
 bool
 move_alloc (void **alloc, void *destination)
 {
@@ -68,6 +88,12 @@ move_alloc (void **alloc, void *destination)
       move_ptr_to_formatstring (header, alloc, destination);
       move_success = true;
     }
+  else if (header_type == HEADER_LAYOUT_INDEX
+           && is_valid_layout_header (header))
+    {
+      move_layout (header, alloc, destination);
+      move_success = true;
+    }
   if (move_success)
     {
       /* Replace header with forwarding address. */
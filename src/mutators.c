@@ -0,0 +1,400 @@
+/**
+ * Functions for registering the threads that use a heap and stopping them
+ * at safepoints. A thread only stops where it polls for it, or while it
+ * waits for the lock of the heap or runs a blocking function, so a stopped
+ * thread is never in the middle of changing the heap. Its callee saved
+ * registers are spilled into the frame it stops in, which lies within the
+ * part of its stack scanned by the collector.
+ */
+
+#define _GNU_SOURCE /* For pthread_getattr_np */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "allocation_map.h"
+#include "gc.h"
+#include "gc_utils.h"
+#include "mutators.h"
+#include "roots.h"
+#include "stack.h"
+
+/**
+ * @param threads: The threads the thread is registered with.
+ * @param stack_base: The address directly after the stack of the thread.
+ * @param stack_top: The lowest address of the stack in use when the thread
+ * last stopped.
+ * @param is_stopped: true while the thread is stopped.
+ * @param buffer_cursor: The heap offset of the next free byte of the
+ * allocation buffer.
+ * @param buffer_limit: The heap offset directly after the allocation
+ * buffer.
+ * @param buffer_objects: The amount of objects placed in the allocation
+ * buffer.
+ * @param roots: The slots the thread registered as roots of a heap with
+ * precise roots.
+ * @param next: The next registered thread.
+ */
+struct mutator
+{
+  mutators_t *threads;
+  uintptr_t stack_base;
+  uintptr_t stack_top;
+  bool is_stopped;
+  size_t buffer_cursor;
+  size_t buffer_limit;
+  size_t buffer_objects;
+  root_stack_t *roots;
+  mutator_t *next;
+};
+
+/**
+ * @param heap_lock: Held while allocating outside of a buffer and while
+ * collecting.
+ * @param owner: The registered thread holding heap_lock, or NULL.
+ * @param lock_depth: The amount of times owner has taken heap_lock.
+ * @param world_lock: Guards every field below.
+ * @param world_changed: Broadcast when a thread stops or goes on, and when
+ * the stopped threads may go on.
+ * @param first: The first registered thread.
+ * @param count: The amount of registered threads.
+ * @param stopped_count: The amount of registered threads that are stopped.
+ * @param is_stop_requested: Set while a collector wants every other thread
+ * stopped, read without the lock when polling.
+ * @param collector: The thread that requested the stop, or NULL.
+ * @param stop_depth: The amount of nested calls to stop_mutators, only
+ * changed by the thread holding heap_lock.
+ */
+struct mutators
+{
+  pthread_mutex_t heap_lock;
+  mutator_t *owner;
+  size_t lock_depth;
+  pthread_mutex_t world_lock;
+  pthread_cond_t world_changed;
+  mutator_t *first;
+  size_t count;
+  size_t stopped_count;
+  bool is_stop_requested;
+  mutator_t *collector;
+  size_t stop_depth;
+};
+
+/* The registration of the calling thread, if it has one.  */
+static _Thread_local mutator_t *current_mutator = NULL;
+
+mutators_t *
+create_mutators (void)
+{
+  mutators_t *threads = calloc (1, sizeof (mutators_t));
+  assert (threads != NULL && "Calloc failed to allocate mutators");
+  pthread_mutex_init (&threads->heap_lock, NULL);
+  pthread_mutex_init (&threads->world_lock, NULL);
+  pthread_cond_init (&threads->world_changed, NULL);
+  return threads;
+}
+
+void
+destroy_mutators (mutators_t *threads)
+{
+  if (threads == NULL)
+    {
+      return;
+    }
+  assert (threads->count == 0 && "A thread is still registered");
+  pthread_cond_destroy (&threads->world_changed);
+  pthread_mutex_destroy (&threads->world_lock);
+  pthread_mutex_destroy (&threads->heap_lock);
+  free (threads);
+}
+
+/**
+ * @brief Finds where the stack of the calling thread begins.
+ * @return the address directly after the stack
+ */
+static uintptr_t
+find_thread_stack_base (void)
+{
+  pthread_attr_t attr;
+  void *stack_addr = NULL;
+  size_t stack_size = 0;
+  int error = pthread_getattr_np (pthread_self (), &attr);
+  assert (error == 0 && "Failed to find the stack of a thread");
+  (void)error;
+  pthread_attr_getstack (&attr, &stack_addr, &stack_size);
+  pthread_attr_destroy (&attr);
+  return (uintptr_t)stack_addr + stack_size;
+}
+
+mutator_t *
+register_mutator (mutators_t *threads)
+{
+  if (current_mutator != NULL)
+    {
+      return NULL;
+    }
+
+  mutator_t *self = calloc (1, sizeof (mutator_t));
+  assert (self != NULL && "Calloc failed to allocate mutator");
+  self->threads = threads;
+  self->stack_base = find_thread_stack_base ();
+  self->roots = create_root_stack ();
+
+  /* Not registered yet, so no collector waits for it to stop */
+  pthread_mutex_lock (&threads->heap_lock);
+  pthread_mutex_lock (&threads->world_lock);
+  self->next = threads->first;
+  threads->first = self;
+  threads->count++;
+  pthread_mutex_unlock (&threads->world_lock);
+  pthread_mutex_unlock (&threads->heap_lock);
+
+  current_mutator = self;
+  return self;
+}
+
+void
+unregister_mutator (mutators_t *threads, mutator_t *self)
+{
+  assert (self->buffer_cursor == self->buffer_limit);
+  lock_heap (threads, self);
+  pthread_mutex_lock (&threads->world_lock);
+  mutator_t **link = &threads->first;
+  while (*link != self)
+    {
+      link = &(*link)->next;
+    }
+  *link = self->next;
+  threads->count--;
+  pthread_cond_broadcast (&threads->world_changed);
+  pthread_mutex_unlock (&threads->world_lock);
+  unlock_heap (threads, self);
+
+  current_mutator = NULL;
+  destroy_root_stack (self->roots);
+  free (self);
+}
+
+mutator_t *
+get_current_mutator (mutators_t *threads)
+{
+  mutator_t *self = current_mutator;
+  return self != NULL && self->threads == threads ? self : NULL;
+}
+
+/**
+ * Takes the lock of a heap, as run by a stopped thread.
+ */
+static void *
+take_heap_lock (void *arg)
+{
+  mutators_t *threads = arg;
+  pthread_mutex_lock (&threads->heap_lock);
+  return NULL;
+}
+
+void
+lock_heap (mutators_t *threads, mutator_t *self)
+{
+  if (self == NULL)
+    {
+      return;
+    }
+  if (__atomic_load_n (&threads->owner, __ATOMIC_RELAXED) == self)
+    {
+      threads->lock_depth++;
+      return;
+    }
+  run_stopped (threads, self, take_heap_lock, threads);
+  __atomic_store_n (&threads->owner, self, __ATOMIC_RELAXED);
+  threads->lock_depth = 1;
+}
+
+void
+unlock_heap (mutators_t *threads, mutator_t *self)
+{
+  if (self == NULL)
+    {
+      return;
+    }
+  assert (threads->owner == self && "The heap is not locked by the thread");
+  if (--threads->lock_depth > 0)
+    {
+      return;
+    }
+  __atomic_store_n (&threads->owner, NULL, __ATOMIC_RELAXED);
+  pthread_mutex_unlock (&threads->heap_lock);
+}
+
+__attribute__ ((noinline)) void *
+run_stopped (mutators_t *threads, mutator_t *self, stopped_func *func,
+             void *arg)
+{
+  /* Spill every callee saved register into this frame, where the stack is
+     scanned from. A jmp_buf would not do, glibc mangles some of them.  */
+  __builtin_unwind_init ();
+  self->stack_top = find_stack_end ();
+
+  pthread_mutex_lock (&threads->world_lock);
+  self->is_stopped = true;
+  threads->stopped_count++;
+  pthread_cond_broadcast (&threads->world_changed);
+  pthread_mutex_unlock (&threads->world_lock);
+
+  void *result = func != NULL ? func (arg) : NULL;
+
+  /* The heap may not be touched again until the collector is done */
+  pthread_mutex_lock (&threads->world_lock);
+  while (threads->is_stop_requested && threads->collector != self)
+    {
+      pthread_cond_wait (&threads->world_changed, &threads->world_lock);
+    }
+  self->is_stopped = false;
+  threads->stopped_count--;
+  pthread_mutex_unlock (&threads->world_lock);
+  return result;
+}
+
+void
+poll_safepoint (mutators_t *threads, mutator_t *self)
+{
+  if (__atomic_load_n (&threads->is_stop_requested, __ATOMIC_ACQUIRE)
+      && threads->collector != self)
+    {
+      run_stopped (threads, self, NULL, NULL);
+    }
+}
+
+void
+stop_mutators (mutators_t *threads, mutator_t *self)
+{
+  assert (threads->owner == self && "The heap is not locked by the thread");
+  if (threads->stop_depth++ > 0)
+    {
+      return;
+    }
+
+  pthread_mutex_lock (&threads->world_lock);
+  threads->collector = self;
+  __atomic_store_n (&threads->is_stop_requested, true, __ATOMIC_RELEASE);
+  while (threads->stopped_count + 1 < threads->count)
+    {
+      pthread_cond_wait (&threads->world_changed, &threads->world_lock);
+    }
+  pthread_mutex_unlock (&threads->world_lock);
+}
+
+void
+resume_mutators (mutators_t *threads)
+{
+  assert (threads->stop_depth > 0);
+  if (--threads->stop_depth > 0)
+    {
+      return;
+    }
+
+  pthread_mutex_lock (&threads->world_lock);
+  threads->collector = NULL;
+  __atomic_store_n (&threads->is_stop_requested, false, __ATOMIC_RELEASE);
+  pthread_cond_broadcast (&threads->world_changed);
+  pthread_mutex_unlock (&threads->world_lock);
+}
+
+bool
+has_other_mutators (mutators_t *threads)
+{
+  pthread_mutex_lock (&threads->world_lock);
+  bool has_others = threads->count > 1;
+  pthread_mutex_unlock (&threads->world_lock);
+  return has_others;
+}
+
+uintptr_t
+get_stack_base (mutator_t *self)
+{
+  return self->stack_base;
+}
+
+void
+apply_to_stopped_stacks (mutators_t *threads, mutator_t *self,
+                         apply_to_ptr_func *func, void *arg)
+{
+  for (mutator_t *thread = threads->first; thread != NULL;
+       thread = thread->next)
+    {
+      if (thread != self && thread->is_stopped)
+        {
+          apply_to_pointers_in_interval (thread->stack_top,
+                                         thread->stack_base, func, arg);
+        }
+    }
+}
+
+root_stack_t *
+get_root_stack (mutator_t *self)
+{
+  return self->roots;
+}
+
+void
+apply_to_mutator_roots (mutators_t *threads, apply_to_ptr_func *func,
+                        void *arg)
+{
+  for (mutator_t *thread = threads->first; thread != NULL;
+       thread = thread->next)
+    {
+      apply_to_root_slots (thread->roots, func, arg);
+    }
+}
+
+bool
+take_buffer_room (mutator_t *self, size_t bytes, size_t *offset)
+{
+  if (self->buffer_limit - self->buffer_cursor < bytes)
+    {
+      return false;
+    }
+  *offset = self->buffer_cursor;
+  self->buffer_cursor += bytes;
+  self->buffer_objects++;
+  return true;
+}
+
+void
+set_alloc_buffer (mutator_t *self, size_t offset, size_t bytes)
+{
+  assert (self->buffer_cursor == self->buffer_limit);
+  self->buffer_cursor = offset;
+  self->buffer_limit = offset + bytes;
+  self->buffer_objects = 0;
+}
+
+size_t
+retire_alloc_buffer (mutator_t *self, char *alloc_map)
+{
+  size_t unused = self->buffer_limit - self->buffer_cursor;
+  if (unused > 0)
+    {
+      update_alloc_map_range (alloc_map, self->buffer_cursor, unused, false);
+    }
+  unused += self->buffer_objects * sizeof (header_t);
+  self->buffer_cursor = 0;
+  self->buffer_limit = 0;
+  self->buffer_objects = 0;
+  return unused;
+}
+
+size_t
+retire_alloc_buffers (mutators_t *threads, char *alloc_map)
+{
+  size_t unused = 0;
+  for (mutator_t *thread = threads->first; thread != NULL;
+       thread = thread->next)
+    {
+      unused += retire_alloc_buffer (thread, alloc_map);
+    }
+  return unused;
+}
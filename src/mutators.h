@@ -0,0 +1,211 @@
+/**
+ * The threads registered to use a heap, used to stop them all at safepoints
+ * before a collection and to give each of them a buffer of its own to
+ * allocate in without taking a lock.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "gc_utils.h"
+#include "roots.h"
+
+/* The amount of heap bytes taken at a time for the allocation buffer of a
+   registered thread, a fraction of a page so that one can be found in most
+   holes.  */
+#define ALLOC_BUFFER_SIZE 1024
+
+/* The largest allocation, including its header, placed in an allocation
+   buffer. Larger ones would leave too much of a buffer unused, and are
+   allocated on the heap directly.  */
+#define MAX_BUFFERED_SIZE (ALLOC_BUFFER_SIZE / 4)
+
+typedef struct mutators mutators_t;
+
+/**
+ * A thread registered with a heap. While it is stopped, the part of its
+ * stack in use is known, along with the registers it had, so that the
+ * collector can scan them.
+ */
+typedef struct mutator mutator_t;
+
+/**
+ * A function run by a thread while it counts as stopped.
+ * @param arg the argument given along with the function
+ * @return anything, handed back to the caller
+ */
+typedef void *stopped_func (void *arg);
+
+/**
+ * @brief Creates an empty set of registered threads, along with the lock
+ * of the heap.
+ * @return the created set
+ */
+mutators_t *create_mutators (void);
+
+/**
+ * @brief Frees a set of registered threads. Every thread should have been
+ * unregistered first.
+ * @param threads the set to destroy, may be NULL
+ */
+void destroy_mutators (mutators_t *threads);
+
+/**
+ * @brief Registers the calling thread, finding where its stack begins. Waits
+ * for a collection in progress to finish first.
+ * @param threads the threads of a heap
+ * @return the registered thread, or NULL if the calling thread is already
+ * registered with a heap
+ */
+mutator_t *register_mutator (mutators_t *threads);
+
+/**
+ * @brief Unregisters the calling thread. Its allocation buffer must have
+ * been retired.
+ * @param threads the threads of a heap
+ * @param self the calling thread, registered with threads
+ */
+void unregister_mutator (mutators_t *threads, mutator_t *self);
+
+/**
+ * @brief Gets the calling thread.
+ * @param threads the threads of a heap
+ * @return the calling thread, or NULL if it is not registered with threads
+ */
+mutator_t *get_current_mutator (mutators_t *threads);
+
+/**
+ * @brief Locks the heap. A registered thread counts as stopped while it
+ * waits for the lock, so that a thread holding it may collect the heap.
+ * The lock may be taken again by the thread holding it.
+ * @param threads the threads of a heap
+ * @param self the calling thread, or NULL if it is not registered, in which
+ * case it is assumed to have the heap to itself and nothing is locked
+ */
+void lock_heap (mutators_t *threads, mutator_t *self);
+
+/**
+ * @brief Unlocks the heap, once for every time it was locked.
+ * @param threads the threads of a heap
+ * @param self the calling thread, or NULL if it is not registered
+ */
+void unlock_heap (mutators_t *threads, mutator_t *self);
+
+/**
+ * @brief Runs a function while counting as stopped, with the registers
+ * saved on the stack. Once the function returns, waits for a collection in
+ * progress to finish before going on.
+ * @param threads the threads of a heap
+ * @param self the calling thread, registered with threads
+ * @param func the function, or NULL to only wait for a collection
+ * @param arg the argument sent to func
+ * @return what func returned, or NULL
+ */
+void *run_stopped (mutators_t *threads, mutator_t *self, stopped_func *func,
+                   void *arg);
+
+/**
+ * @brief Stops at a safepoint if another thread is waiting to collect the
+ * heap, until it is done.
+ * @param threads the threads of a heap
+ * @param self the calling thread, registered with threads
+ */
+void poll_safepoint (mutators_t *threads, mutator_t *self);
+
+/**
+ * @brief Waits until every other registered thread is stopped. Calls may
+ * be nested, the threads stay stopped until the outermost call is resumed.
+ * @param threads the threads of a heap, locked by the calling thread
+ * @param self the calling thread, registered with threads
+ */
+void stop_mutators (mutators_t *threads, mutator_t *self);
+
+/**
+ * @brief Lets the threads stopped by stop_mutators go on.
+ * @param threads the threads of a heap, locked by the calling thread
+ */
+void resume_mutators (mutators_t *threads);
+
+/**
+ * @brief Checks if any thread other than the calling one is registered.
+ * @param threads the threads of a heap
+ * @return true if the heap is shared with other threads
+ */
+bool has_other_mutators (mutators_t *threads);
+
+/**
+ * @brief Gets the highest address of the stack of a thread.
+ * @param self a registered thread
+ * @return the address directly after its stack
+ */
+uintptr_t get_stack_base (mutator_t *self);
+
+/**
+ * @brief Applies a function to every word of the stack in use by each
+ * stopped thread, registers included.
+ * @param threads the threads of a heap, stopped by stop_mutators
+ * @param self the calling thread, which is skipped
+ * @param func the function to apply
+ * @param arg the argument sent to func
+ */
+void apply_to_stopped_stacks (mutators_t *threads, mutator_t *self,
+                              apply_to_ptr_func *func, void *arg);
+
+/**
+ * @brief Gets the slots a thread registered as roots.
+ * @param self a registered thread
+ * @return its root stack
+ */
+root_stack_t *get_root_stack (mutator_t *self);
+
+/**
+ * @brief Applies a function to every slot registered as a root by any
+ * registered thread, the calling one included.
+ * @param threads the threads of a heap, stopped by stop_mutators
+ * @param func the function, given the address of each slot
+ * @param arg the argument sent to func
+ */
+void apply_to_mutator_roots (mutators_t *threads, apply_to_ptr_func *func,
+                             void *arg);
+
+/**
+ * @brief Takes room from the allocation buffer of a thread by bumping its
+ * cursor, without any lock.
+ * @param self the calling thread
+ * @param bytes the amount of bytes needed, header included
+ * @param offset set to the heap offset of the room taken if there was any
+ * @return false if the buffer has no room left that fits
+ */
+bool take_buffer_room (mutator_t *self, size_t bytes, size_t *offset);
+
+/**
+ * @brief Gives a thread a new allocation buffer. The room must already be
+ * set in the allocation map.
+ * @param self the thread
+ * @param offset the heap offset of the buffer
+ * @param bytes the size of the buffer
+ */
+void set_alloc_buffer (mutator_t *self, size_t offset, size_t bytes);
+
+/**
+ * @brief Gives the unused end of the allocation buffer of a thread back to
+ * the heap, clearing it in the allocation map.
+ * @param self the thread
+ * @param alloc_map the allocation map of the heap
+ * @return the bytes of the buffer not used by objects, their headers
+ * included
+ */
+size_t retire_alloc_buffer (mutator_t *self, char *alloc_map);
+
+/**
+ * @brief Retires the allocation buffer of every registered thread, so that
+ * the allocation map only holds objects.
+ * @param threads the threads of a heap, stopped by stop_mutators
+ * @param alloc_map the allocation map of the heap
+ * @return the bytes of the buffers not used by objects, their headers
+ * included
+ */
+size_t retire_alloc_buffers (mutators_t *threads, char *alloc_map);
@@ -0,0 +1,216 @@
+/**
+ * Functions for keeping track of the young pages and dirty cards of a heap,
+ * and for promoting the survivors of a minor collection.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocation.h"
+#include "allocation_map.h"
+#include "bitmap.h"
+#include "get_header.h"
+#include "heap_internal.h"
+#include "mark_map.h"
+#include "nursery.h"
+
+/**
+ * @param young_pages: A bitmap with the bit of every young page set.
+ * @param cards: One byte per card, non-zero if the card is dirty.
+ * @param heap_bytes: The size of the heap in bytes.
+ * @param page_size: The size of a page in bytes.
+ * @param page_count: The amount of pages in the heap.
+ * @param card_count: The amount of cards in the heap.
+ * @param max_young_pages: The amount of young pages allowed before a minor
+ * collection.
+ * @param young_page_count: The amount of young pages.
+ * @param current_end: The heap offset directly after the page currently
+ * allocated on, or 0 if no page is.
+ * @param young_bytes: The amount of bytes allocated to young objects,
+ * excluding headers.
+ */
+struct nursery
+{
+  char *young_pages;
+  char *cards;
+  size_t heap_bytes;
+  size_t page_size;
+  size_t page_count;
+  size_t card_count;
+  size_t max_young_pages;
+  size_t young_page_count;
+  size_t current_end;
+  size_t young_bytes;
+};
+
+nursery_t *
+create_nursery (size_t heap_bytes, size_t page_size, size_t nursery_bytes)
+{
+  nursery_t *nursery = calloc (1, sizeof (nursery_t));
+  assert (nursery != NULL && "Calloc failed to allocate nursery");
+  nursery->heap_bytes = heap_bytes;
+  nursery->page_size = page_size;
+  nursery->page_count = (heap_bytes + page_size - 1) / page_size;
+  nursery->card_count = (heap_bytes + CARD_SIZE - 1) / CARD_SIZE;
+  nursery->max_young_pages = (nursery_bytes + page_size - 1) / page_size;
+  nursery->max_young_pages
+      = nursery->max_young_pages > 0 ? nursery->max_young_pages : 1;
+  nursery->young_pages = calloc (calc_bitmap_size (nursery->page_count), 1);
+  nursery->cards = calloc (nursery->card_count, 1);
+  assert (nursery->young_pages != NULL && nursery->cards != NULL
+          && "Failed to allocate nursery");
+  return nursery;
+}
+
+void
+destroy_nursery (nursery_t *nursery)
+{
+  if (nursery == NULL)
+    {
+      return;
+    }
+  free (nursery->young_pages);
+  free (nursery->cards);
+  free (nursery);
+}
+
+void
+reset_nursery (nursery_t *nursery)
+{
+  memset (nursery->young_pages, 0, calc_bitmap_size (nursery->page_count));
+  memset (nursery->cards, 0, nursery->card_count);
+  nursery->young_page_count = 0;
+  nursery->current_end = 0;
+  nursery->young_bytes = 0;
+}
+
+bool
+is_young_offset (nursery_t *nursery, size_t offset)
+{
+  return count_set_bits (nursery->young_pages, offset / nursery->page_size, 1)
+         > 0;
+}
+
+bool
+is_nursery_full (nursery_t *nursery)
+{
+  return nursery->young_page_count >= nursery->max_young_pages;
+}
+
+void
+add_young_page (nursery_t *nursery, size_t offset)
+{
+  assert (offset % nursery->page_size == 0);
+  assert (!is_young_offset (nursery, offset));
+  update_bit_range (nursery->young_pages, offset / nursery->page_size, 1,
+                    true);
+  nursery->young_page_count++;
+  nursery->current_end = offset + nursery->page_size;
+}
+
+void
+count_young_bytes (nursery_t *nursery, size_t bytes)
+{
+  nursery->young_bytes += bytes;
+}
+
+bool
+has_nursery_space (nursery_t *nursery, size_t offset, size_t bytes)
+{
+  return nursery->current_end > 0
+         && offset >= nursery->current_end - nursery->page_size
+         && offset < nursery->current_end
+         && bytes <= nursery->current_end - offset;
+}
+
+bool
+find_next_young_page (nursery_t *nursery, size_t *offset)
+{
+  size_t page = (*offset + nursery->page_size - 1) / nursery->page_size;
+  if (!find_next_set_bit (nursery->young_pages, nursery->page_count, &page))
+    {
+      return false;
+    }
+  *offset = page * nursery->page_size;
+  return true;
+}
+
+size_t
+get_young_page_count (nursery_t *nursery)
+{
+  return nursery->young_page_count;
+}
+
+void
+mark_card (nursery_t *nursery, size_t offset)
+{
+  nursery->cards[offset / CARD_SIZE] = 1;
+}
+
+bool
+is_card_dirty (nursery_t *nursery, size_t offset)
+{
+  return nursery->cards[offset / CARD_SIZE] != 0;
+}
+
+bool
+find_next_dirty_card (nursery_t *nursery, size_t *offset)
+{
+  size_t card = (*offset + CARD_SIZE - 1) / CARD_SIZE;
+  char *dirty = memchr (nursery->cards + card, 1, nursery->card_count - card);
+  if (dirty == NULL)
+    {
+      return false;
+    }
+  *offset = (dirty - nursery->cards) * CARD_SIZE;
+  return true;
+}
+
+size_t
+promote_survivors (heap_t *h)
+{
+  size_t granules = h->size / MIN_ALLOC_OBJECT_SIZE;
+  size_t survivor_bytes = 0;
+
+  size_t page = 0;
+  while (find_next_young_page (h->nursery, &page))
+    {
+      size_t page_end = page + h->page_size < h->size ? page + h->page_size
+                                                      : h->size;
+
+      /* A young page is bump allocated from its start without holes, so it
+         is used up to its first free granule.  */
+      size_t used_end = page / MIN_ALLOC_OBJECT_SIZE;
+      if (!find_next_zero_run (h->alloc_map, granules, 1, &used_end)
+          || used_end * MIN_ALLOC_OBJECT_SIZE > page_end)
+        {
+          used_end = page_end / MIN_ALLOC_OBJECT_SIZE;
+        }
+      used_end *= MIN_ALLOC_OBJECT_SIZE;
+
+      /* Most young objects are dead, so the page is freed as a whole and
+         only the marked survivors are allocated again.  */
+      update_alloc_map_range (h->alloc_map, page, used_end - page, false);
+      size_t offset = page;
+      while (find_next_marked_offset (h->mark_map, used_end, &offset))
+        {
+          char *alloc = (char *)h->heap_start + offset + sizeof (header_t);
+          size_t alloc_size = align_alloc_size (calc_alloc_size (alloc));
+          update_alloc_map_range (h->alloc_map, offset,
+                                  alloc_size + sizeof (header_t), true);
+          survivor_bytes += alloc_size;
+          offset += alloc_size + sizeof (header_t);
+        }
+      page = page_end;
+    }
+
+  size_t freed = h->nursery->young_bytes - survivor_bytes;
+  h->used_bytes -= freed;
+
+  /* Every young page is now either empty or holds promoted objects only */
+  reset_nursery (h->nursery);
+
+  return freed;
+}
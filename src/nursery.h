@@ -0,0 +1,133 @@
+/**
+ * The young generation of a heap: the pages new small objects are bump
+ * allocated on, and a card table remembering where old objects were given a
+ * pointer to a young object.
+ * Survivors of a minor collection are promoted in place, the page they are
+ * on simply stops being young, so a minor collection never moves anything
+ * and works with an unsafe stack.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "heap.h"
+
+/* The amount of heap bytes covered by one entry of the card table.  */
+#define CARD_SIZE 256
+
+typedef struct nursery nursery_t;
+
+/**
+ * @brief Creates a nursery where every page is old and every card clean.
+ * @param heap_bytes the size of the heap in bytes
+ * @param page_size the size of a page in bytes
+ * @param nursery_bytes the amount of young pages allowed before a minor
+ * collection, in bytes, rounded up to whole pages
+ * @return the created nursery
+ */
+nursery_t *create_nursery (size_t heap_bytes, size_t page_size,
+                           size_t nursery_bytes);
+
+/**
+ * @brief Frees all memory allocated to a nursery.
+ * @param nursery the nursery to destroy, may be NULL
+ */
+void destroy_nursery (nursery_t *nursery);
+
+/**
+ * @brief Makes every page old and cleans every card, for when everything
+ * young has been collected or promoted.
+ * @param nursery the nursery
+ */
+void reset_nursery (nursery_t *nursery);
+
+/**
+ * @brief Checks if a heap offset is on a young page.
+ * @param nursery the nursery
+ * @param offset the heap offset
+ * @return true if the offset is young
+ */
+bool is_young_offset (nursery_t *nursery, size_t offset);
+
+/**
+ * @brief Checks if the nursery has as many young pages as it may hold.
+ * @param nursery the nursery
+ * @return true if a minor collection is needed before another page is added
+ */
+bool is_nursery_full (nursery_t *nursery);
+
+/**
+ * @brief Makes an empty page young and the one new objects are bump
+ * allocated on.
+ * @param nursery the nursery
+ * @param offset the heap offset of the start of the page
+ */
+void add_young_page (nursery_t *nursery, size_t offset);
+
+/**
+ * @brief Adds a new young object to the bytes the next minor collection
+ * frees unless it survives.
+ * @param nursery the nursery
+ * @param bytes the size of the object excluding its header
+ */
+void count_young_bytes (nursery_t *nursery, size_t bytes);
+
+/**
+ * @brief Checks if an allocation fits on the page currently allocated on.
+ * @param nursery the nursery
+ * @param offset the heap offset of the bump pointer
+ * @param bytes the size of the allocation including its header
+ * @return true if the allocation fits before the end of the page
+ */
+bool has_nursery_space (nursery_t *nursery, size_t offset, size_t bytes);
+
+/**
+ * @brief Finds the first young page at or after offset.
+ * @param nursery the nursery
+ * @param offset the heap offset to start searching from, set to the start of
+ * the young page if one was found
+ * @return true if a young page was found
+ */
+bool find_next_young_page (nursery_t *nursery, size_t *offset);
+
+/**
+ * @brief Gets the amount of young pages.
+ * @param nursery the nursery
+ * @return the amount of young pages
+ */
+size_t get_young_page_count (nursery_t *nursery);
+
+/**
+ * @brief Marks the card holding a heap offset as dirty.
+ * @param nursery the nursery
+ * @param offset the heap offset of a pointer field
+ */
+void mark_card (nursery_t *nursery, size_t offset);
+
+/**
+ * @brief Checks if the card holding a heap offset is dirty.
+ * @param nursery the nursery
+ * @param offset the heap offset
+ * @return true if the card is dirty
+ */
+bool is_card_dirty (nursery_t *nursery, size_t offset);
+
+/**
+ * @brief Finds the first dirty card at or after offset.
+ * @param nursery the nursery
+ * @param offset the heap offset to start searching from, set to the start of
+ * the dirty card if one was found
+ * @return true if a dirty card was found
+ */
+bool find_next_dirty_card (nursery_t *nursery, size_t *offset);
+
+/**
+ * @brief Frees every young object that was not marked by a minor
+ * collection, and promotes the rest by making their pages old. The
+ * nursery is reset afterwards.
+ * @param h the heap, with its living young objects marked
+ * @return number of bytes released.
+ */
+size_t promote_survivors (heap_t *h);
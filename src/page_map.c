@@ -56,7 +56,7 @@ char
 create_page_bitmask (size_t offset)
 {
   /* Find the specific bit within a byte  */
-  size_t bit_position = (offset / PAGE_SIZE) % ALLOCATIONS_PER_BYTE;
+  size_t bit_position = (offset / PAGE_SIZE) % BOOLEANS_PER_BYTE;
   /* Set the specific bit*/
   return 1 << bit_position;
 }
@@ -0,0 +1,116 @@
+/**
+ * A growable stack of the slots registered as roots of a heap, and the
+ * walk over every root of a heap.
+ */
+
+#include <assert.h>
+
+#include "heap_internal.h"
+#include "mutators.h"
+#include "roots.h"
+
+/* The amount of slots a root stack has room for when it is created.  */
+#define INITIAL_ROOT_CAPACITY 32
+
+/**
+ * @param slots: The addresses of the registered pointer variables, in the
+ * order they were pushed.
+ * @param count: The amount of slots in use.
+ * @param capacity: The amount of slots there is room for.
+ */
+struct root_stack
+{
+  void ***slots;
+  size_t count;
+  size_t capacity;
+};
+
+root_stack_t *
+create_root_stack (void)
+{
+  root_stack_t *roots = calloc (1, sizeof (root_stack_t));
+  assert (roots != NULL && "Calloc failed to allocate root stack");
+  roots->slots = calloc (INITIAL_ROOT_CAPACITY, sizeof (void **));
+  assert (roots->slots != NULL && "Calloc failed to allocate root slots");
+  roots->capacity = INITIAL_ROOT_CAPACITY;
+  return roots;
+}
+
+void
+destroy_root_stack (root_stack_t *roots)
+{
+  if (roots == NULL)
+    {
+      return;
+    }
+  free (roots->slots);
+  free (roots);
+}
+
+void
+push_root (root_stack_t *roots, void **slot)
+{
+  if (roots->count == roots->capacity)
+    {
+      roots->capacity *= 2;
+      roots->slots = realloc (roots->slots, roots->capacity * sizeof (void **));
+      assert (roots->slots != NULL && "Realloc failed to grow root slots");
+    }
+  roots->slots[roots->count++] = slot;
+}
+
+void
+pop_roots (root_stack_t *roots, size_t count)
+{
+  assert (count <= roots->count && "Popped more roots than were pushed");
+  roots->count -= count;
+}
+
+bool
+remove_root (root_stack_t *roots, void **slot)
+{
+  for (size_t i = roots->count; i > 0; i--)
+    {
+      if (roots->slots[i - 1] == slot)
+        {
+          /* Keep the order of the rest, it is a stack */
+          roots->count--;
+          for (size_t j = i - 1; j < roots->count; j++)
+            {
+              roots->slots[j] = roots->slots[j + 1];
+            }
+          return true;
+        }
+    }
+  return false;
+}
+
+size_t
+count_roots (root_stack_t *roots)
+{
+  return roots->count;
+}
+
+void
+apply_to_root_slots (root_stack_t *roots, apply_to_ptr_func *func, void *arg)
+{
+  for (size_t i = 0; i < roots->count; i++)
+    {
+      func (roots->slots[i], arg);
+    }
+}
+
+void
+apply_to_roots (heap_t *h, uintptr_t start, uintptr_t end,
+                apply_to_ptr_func *func, void *arg)
+{
+  apply_to_root_slots (h->global_roots, func, arg);
+  if (h->is_precise_roots)
+    {
+      /* Nothing on the stack is a root unless it was pushed */
+      apply_to_root_slots (h->shadow_stack, func, arg);
+      apply_to_mutator_roots (h->mutators, func, arg);
+      return;
+    }
+  apply_to_pointers_in_interval (start, end, func, arg);
+}
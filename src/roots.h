@@ -0,0 +1,87 @@
+/**
+ * Slots registered as roots of a heap, used instead of scanning the stack
+ * when the roots of the heap are precise.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "gc_utils.h"
+#include "heap.h"
+
+/**
+ * A stack of addresses of pointer variables, each of which holds NULL or a
+ * pointer to the start of an object. The variables are read when roots are
+ * found, and updated when the objects they point to are moved.
+ */
+typedef struct root_stack root_stack_t;
+
+/**
+ * @brief Creates an empty root stack.
+ * @return the created stack
+ */
+root_stack_t *create_root_stack (void);
+
+/**
+ * @brief Frees all memory allocated to a root stack, the slots themselves
+ * are left alone.
+ * @param roots the root stack to destroy, may be NULL
+ */
+void destroy_root_stack (root_stack_t *roots);
+
+/**
+ * @brief Pushes a slot on a root stack, growing it if needed.
+ * @param roots the root stack
+ * @param slot the address of the pointer variable
+ */
+void push_root (root_stack_t *roots, void **slot);
+
+/**
+ * @brief Pops the slots pushed last from a root stack.
+ * @param roots the root stack
+ * @param count the amount of slots to pop, at most as many as were pushed
+ */
+void pop_roots (root_stack_t *roots, size_t count);
+
+/**
+ * @brief Removes the slot pushed last with a given address, wherever it is
+ * in a root stack.
+ * @param roots the root stack
+ * @param slot the address of the pointer variable
+ * @return false if the slot was not on the stack
+ */
+bool remove_root (root_stack_t *roots, void **slot);
+
+/**
+ * @brief Gets the amount of slots on a root stack.
+ * @param roots the root stack
+ * @return the amount of slots
+ */
+size_t count_roots (root_stack_t *roots);
+
+/**
+ * @brief Applies a function to every slot on a root stack, as
+ * apply_to_pointers_in_interval does to every word of an interval.
+ * @param roots the root stack
+ * @param func the function, given the address of each slot
+ * @param arg an optional argument sent to func
+ */
+void apply_to_root_slots (root_stack_t *roots, apply_to_ptr_func *func,
+                          void *arg);
+
+/**
+ * @brief Applies a function to every root slot of a heap. The slots are the
+ * global roots, and either every word of the stack interval or, if the
+ * roots of the heap are precise, the slots pushed by every thread instead.
+ * The stacks of other threads are left to the caller.
+ * @param h the heap, with every other registered thread stopped
+ * @param start the lowest stack address (inclusive)
+ * @param end the highest stack address (non-inclusive)
+ * @param func the function, given the address of each slot
+ * @param arg an optional argument sent to func
+ */
+void apply_to_roots (heap_t *h, uintptr_t start, uintptr_t end,
+                     apply_to_ptr_func *func, void *arg);
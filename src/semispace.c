@@ -0,0 +1,449 @@
+/**
+ * Functions for allocating in one half of a heap and copying the objects
+ * that survive a collection into the other half. Only the objects reached
+ * are ever visited, the garbage left behind is freed by clearing the
+ * allocation map of the old half.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "allocation.h"
+#include "allocation_map.h"
+#include "bitmap.h"
+#include "gc_utils.h"
+#include "get_header.h"
+#include "header.h"
+#include "heap_internal.h"
+#include "is_pointer_in_alloc.h"
+#include "mark_map.h"
+#include "move_data.h"
+#include "roots.h"
+#include "semispace.h"
+#include "start_map.h"
+
+/* The amount of objects space is first reserved for in the list of objects
+   kept in place.  */
+#define INITIAL_IN_PLACE_CAPACITY 16
+
+/**
+ * @param half_bytes: The size of each half in bytes.
+ * @param active_start: The heap offset of the half allocated in.
+ * @param cursor: The heap offset of the next free byte of the hole bumped
+ * through.
+ * @param limit: The heap offset directly after the hole.
+ */
+struct semispace
+{
+  size_t half_bytes;
+  size_t active_start;
+  size_t cursor;
+  size_t limit;
+};
+
+/**
+ * The state of copying the survivors of a heap into its other half.
+ * @param heap: The heap.
+ * @param from_start: The heap offset of the half copied from.
+ * @param to_start: The heap offset of the half copied to.
+ * @param to_end: The heap offset directly after the half copied to.
+ * @param dest: Where the next object is copied to.
+ * @param dest_limit: The heap offset directly after the hole dest is in.
+ * @param in_place: The header offsets of the reached objects that were not
+ * copied, in the order they were reached.
+ * @param in_place_count: The amount of objects kept in place.
+ * @param in_place_capacity: The amount of objects there is space for.
+ * @param live_bytes: The size of every object reached, excluding headers.
+ */
+typedef struct copy_state
+{
+  heap_t *heap;
+  size_t from_start;
+  size_t to_start;
+  size_t to_end;
+  size_t dest;
+  size_t dest_limit;
+  size_t *in_place;
+  size_t in_place_count;
+  size_t in_place_capacity;
+  size_t live_bytes;
+} copy_state_t;
+
+semispace_t *
+create_semispace (size_t heap_bytes)
+{
+  semispace_t *space = calloc (1, sizeof (semispace_t));
+  assert (space != NULL && "Calloc failed to allocate semispace");
+  /* Both halves start at a granule, so every object does too */
+  space->half_bytes
+      = heap_bytes / 2 / MIN_ALLOC_OBJECT_SIZE * MIN_ALLOC_OBJECT_SIZE;
+  return space;
+}
+
+void
+destroy_semispace (semispace_t *space)
+{
+  free (space);
+}
+
+size_t
+get_semispace_bytes (semispace_t *space)
+{
+  return space->half_bytes;
+}
+
+/**
+ * @brief Finds the next run of free granules, between the objects already
+ * allocated in a half.
+ * @param alloc_map the allocation map
+ * @param end the heap offset directly after the half
+ * @param cursor the offset to search from, set to the start of the hole
+ * @param limit set to the offset directly after the hole
+ * @return false if the half has no hole left
+ */
+static bool
+find_hole (char *alloc_map, size_t end, size_t *cursor, size_t *limit)
+{
+  size_t bits = end / MIN_ALLOC_OBJECT_SIZE;
+  size_t index = *cursor / MIN_ALLOC_OBJECT_SIZE;
+  if (index >= bits || !find_next_zero_run (alloc_map, bits, 1, &index))
+    {
+      return false;
+    }
+  size_t next = index;
+  if (!find_next_set_bit (alloc_map, bits, &next))
+    {
+      next = bits;
+    }
+  *cursor = index * MIN_ALLOC_OBJECT_SIZE;
+  *limit = next * MIN_ALLOC_OBJECT_SIZE;
+  return true;
+}
+
+/**
+ * @brief Bumps a cursor past an allocation, going on to the next hole of the
+ * half while the allocation does not fit the current one.
+ * @param alloc_map the allocation map
+ * @param end the heap offset directly after the half
+ * @param cursor the cursor to bump
+ * @param limit the offset directly after the hole of the cursor
+ * @param bytes the amount of bytes needed
+ * @param offset set to the start of the room taken if there was any
+ * @return false if no hole left fits the allocation
+ */
+static bool
+bump_past_objects (char *alloc_map, size_t end, size_t *cursor, size_t *limit,
+                   size_t bytes, size_t *offset)
+{
+  while (*cursor + bytes > *limit)
+    {
+      *cursor = *limit;
+      if (!find_hole (alloc_map, end, cursor, limit))
+        {
+          return false;
+        }
+    }
+  *offset = *cursor;
+  *cursor += bytes;
+  return true;
+}
+
+bool
+take_semispace_room (semispace_t *space, char *alloc_map, size_t bytes,
+                     size_t *offset)
+{
+  return bump_past_objects (alloc_map, space->active_start + space->half_bytes,
+                            &space->cursor, &space->limit, bytes, offset);
+}
+
+/**
+ * @brief Calculates the size of an object including its header.
+ * @param alloc the object
+ * @return the number of bytes the object occupies in the heap
+ */
+static size_t
+calc_total_size (void *alloc)
+{
+  return align_alloc_size (calc_alloc_size (alloc)) + sizeof (header_t);
+}
+
+/**
+ * @brief Finds the header of the allocated object a pointer points to.
+ * @param h the heap
+ * @param ptr the pointer
+ * @param header_offset set to the heap offset of the header if found
+ * @return false if ptr does not point to the start of an allocated object
+ */
+static bool
+find_object_header (heap_t *h, void *ptr, size_t *header_offset)
+{
+  /* The old copies of objects stay allocated until every reference to them
+     has been forwarded.  */
+  if (!is_in_range ((uintptr_t)ptr, h))
+    {
+      return false;
+    }
+  size_t offset = calc_heap_offset (ptr, h);
+  if (offset < sizeof (header_t)
+      || (offset - sizeof (header_t)) % MIN_ALLOC_OBJECT_SIZE != 0
+      || !is_offset_allocated (h->alloc_map, offset - sizeof (header_t))
+      || !is_object_start (h->start_map, offset - sizeof (header_t)))
+    {
+      return false;
+    }
+  *header_offset = offset - sizeof (header_t);
+  return true;
+}
+
+/**
+ * @brief Keeps a reached object where it is, to be scanned in place.
+ * @param state the copy state
+ * @param header_offset the heap offset of the objects header
+ */
+static void
+keep_in_place (copy_state_t *state, size_t header_offset)
+{
+  heap_t *h = state->heap;
+  update_mark_map (h->mark_map, header_offset, true);
+  void *alloc = (char *)h->heap_start + header_offset + sizeof (header_t);
+  state->live_bytes += align_alloc_size (calc_alloc_size (alloc));
+
+  if (state->in_place_count == state->in_place_capacity)
+    {
+      state->in_place_capacity = state->in_place_capacity == 0
+                                     ? INITIAL_IN_PLACE_CAPACITY
+                                     : 2 * state->in_place_capacity;
+      state->in_place = realloc (state->in_place, state->in_place_capacity
+                                                      * sizeof (size_t));
+      assert (state->in_place != NULL
+              && "Realloc failed to grow the objects kept in place");
+    }
+  state->in_place[state->in_place_count++] = header_offset;
+}
+
+/**
+ * @brief Copies an object to the next room of the half copied to, leaving
+ * its forwarding address in the header of the old copy. An object that
+ * finds no room is kept in place instead.
+ * @param state the copy state
+ * @param header_offset the heap offset of the objects header
+ * @return the object at its new address
+ */
+static void *
+copy_object (copy_state_t *state, size_t header_offset)
+{
+  heap_t *h = state->heap;
+  void *alloc = (char *)h->heap_start + header_offset + sizeof (header_t);
+  size_t size = calc_total_size (alloc);
+  size_t dest;
+  if (!bump_past_objects (h->alloc_map, state->to_end, &state->dest,
+                          &state->dest_limit, size, &dest))
+    {
+      keep_in_place (state, header_offset);
+      return alloc;
+    }
+
+  void *destination = (char *)h->heap_start + dest + sizeof (header_t);
+  bool is_moved = move_alloc (&alloc, destination);
+  assert (is_moved);
+  (void)is_moved;
+  update_alloc_map_range (h->alloc_map, dest, size, true);
+  record_object_start (h->start_map, dest, size);
+  update_mark_map (h->mark_map, dest, true);
+  state->live_bytes += size - sizeof (header_t);
+  return destination;
+}
+
+/**
+ * @brief Updates a reference to the new address of the object it points
+ * to, copying the object first if it has not been reached yet.
+ * @param field the reference
+ * @param arg the copy state
+ */
+static void
+forward_reference (void **field, void *arg)
+{
+  copy_state_t *state = (copy_state_t *)arg;
+  heap_t *h = state->heap;
+  size_t header_offset;
+  if (!find_object_header (h, *field, &header_offset))
+    {
+      return;
+    }
+  header_t header = get_header_value (get_header_pointer (*field));
+  if (get_header_type (header) == HEADER_FORWARDING_ADDRESS)
+    {
+      *field = get_pointer_in_header (header);
+      return;
+    }
+  if (is_offset_marked (h->mark_map, header_offset))
+    {
+      return;
+    }
+  if (header_offset >= state->to_start && header_offset < state->to_end)
+    {
+      /* Left there by an earlier collection, and already where it would
+         be copied to.  */
+      keep_in_place (state, header_offset);
+      return;
+    }
+  *field = copy_object (state, header_offset);
+}
+
+/**
+ * @brief Updates a stack slot to the new address of the object it points
+ * into, if the object was copied. A slot pointing into an object keeps
+ * pointing as far into the copy.
+ * @param stack_address the address of the stack slot
+ * @param arg the copy state
+ */
+static void
+forward_stack_slot (void *stack_address, void *arg)
+{
+  copy_state_t *state = (copy_state_t *)arg;
+  heap_t *h = state->heap;
+  void **slot = (void **)stack_address;
+  size_t header_offset;
+  if (!find_enclosing_object (h, *slot, &header_offset))
+    {
+      return;
+    }
+  void *alloc = (char *)h->heap_start + header_offset + sizeof (header_t);
+  header_t header = get_header_value (get_header_pointer (alloc));
+  if (get_header_type (header) == HEADER_FORWARDING_ADDRESS)
+    {
+      *slot = (char *)get_pointer_in_header (header)
+              + ((char *)*slot - (char *)alloc);
+    }
+}
+
+/**
+ * @brief Scans the copied objects and the objects kept in place until no
+ * object is left unscanned. Copies are scanned with a cursor following the
+ * one they are copied with, so no list of them is needed.
+ * @param state the copy state, with the roots reached
+ */
+static void
+scan_reached_objects (copy_state_t *state)
+{
+  heap_t *h = state->heap;
+  size_t scan = state->to_start;
+  size_t next_in_place = 0;
+  while (scan < state->dest || next_in_place < state->in_place_count)
+    {
+      if (next_in_place < state->in_place_count)
+        {
+          size_t offset = state->in_place[next_in_place++];
+          void *alloc = (char *)h->heap_start + offset + sizeof (header_t);
+          for_each_reference (alloc, forward_reference, state);
+          continue;
+        }
+
+      if (!is_offset_allocated (h->alloc_map, scan))
+        {
+          /* The hole was too small for the copy that came after it */
+          size_t index = scan / MIN_ALLOC_OBJECT_SIZE;
+          scan = find_next_set_bit (h->alloc_map,
+                                    state->dest / MIN_ALLOC_OBJECT_SIZE,
+                                    &index)
+                     ? index * MIN_ALLOC_OBJECT_SIZE
+                     : state->dest;
+          continue;
+        }
+      /* Objects left in the half are passed over, unless they were reached
+         and are scanned in place anyway.  */
+      void *alloc = (char *)h->heap_start + scan + sizeof (header_t);
+      if (is_offset_marked (h->mark_map, scan))
+        {
+          for_each_reference (alloc, forward_reference, state);
+        }
+      scan += calc_total_size (alloc);
+    }
+}
+
+/**
+ * @brief Frees every object that was not reached. The half copied from
+ * keeps only the objects kept in place there, the half copied to loses the
+ * unreached objects left in it by earlier collections.
+ * @param state the copy state, with every reached object scanned
+ * @param half_bytes the size of each half in bytes
+ */
+static void
+free_unreached_objects (copy_state_t *state, size_t half_bytes)
+{
+  heap_t *h = state->heap;
+  update_alloc_map_range (h->alloc_map, state->from_start, half_bytes, false);
+  size_t from_end = state->from_start + half_bytes;
+  for (size_t i = 0; i < state->in_place_count; i++)
+    {
+      size_t offset = state->in_place[i];
+      if (offset >= state->from_start && offset < from_end)
+        {
+          void *alloc = (char *)h->heap_start + offset + sizeof (header_t);
+          update_alloc_map_range (h->alloc_map, offset,
+                                  calc_total_size (alloc), true);
+        }
+    }
+
+  size_t index = state->to_start / MIN_ALLOC_OBJECT_SIZE;
+  size_t bits = state->to_end / MIN_ALLOC_OBJECT_SIZE;
+  while (find_next_set_bit (h->alloc_map, bits, &index))
+    {
+      size_t offset = index * MIN_ALLOC_OBJECT_SIZE;
+      void *alloc = (char *)h->heap_start + offset + sizeof (header_t);
+      size_t size = calc_total_size (alloc);
+      if (!is_offset_marked (h->mark_map, offset))
+        {
+          update_alloc_map_range (h->alloc_map, offset, size, false);
+        }
+      index += size / MIN_ALLOC_OBJECT_SIZE;
+    }
+}
+
+void
+copy_live_objects (heap_t *h, char *root_map, uintptr_t start, uintptr_t end)
+{
+  semispace_t *space = h->semispace;
+  copy_state_t state = { .heap = h,
+                         .from_start = space->active_start,
+                         .to_start = space->active_start == 0
+                                         ? space->half_bytes
+                                         : 0 };
+  state.to_end = state.to_start + space->half_bytes;
+  state.dest = state.to_start;
+  state.dest_limit = state.to_start;
+  reset_mark_map (h);
+
+  /* Every pinned object is known before anything is copied, so none of
+     them is copied when reached through the heap.  */
+  size_t offset = 0;
+  while (find_next_marked_offset (root_map, h->size, &offset))
+    {
+      if (h->is_unsafe_stack)
+        {
+          keep_in_place (&state, offset);
+        }
+      else
+        {
+          void *root = (char *)h->heap_start + offset + sizeof (header_t);
+          forward_reference (&root, &state);
+        }
+      offset += MIN_ALLOC_OBJECT_SIZE;
+    }
+
+  scan_reached_objects (&state);
+  if (!h->is_unsafe_stack)
+    {
+      apply_to_roots (h, start, end, (apply_to_ptr_func *)forward_stack_slot,
+                      &state);
+    }
+  free_unreached_objects (&state, space->half_bytes);
+  free (state.in_place);
+
+  /* Allocation goes on after the last copy */
+  space->active_start = state.to_start;
+  space->cursor = state.dest;
+  space->limit = state.dest;
+  h->used_bytes = state.live_bytes;
+}
@@ -0,0 +1,75 @@
+/**
+ * The two halves of a heap collected by copying, used to bump allocate in
+ * one half and to copy the reachable objects into the other half when it is
+ * full.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "heap.h"
+
+/**
+ * The halves of a semispace heap and the bump pointer of the half in use.
+ * Objects pinned by an unsafe stack stay where they are when the halves are
+ * swapped, so the bump pointer jumps over them. Otherwise a half is empty
+ * when allocation starts in it, and the bump pointer never stops before its
+ * end.
+ */
+typedef struct semispace semispace_t;
+
+/**
+ * @brief Creates the halves of a heap, allocating in the first one.
+ * @param heap_bytes the size of the heap in bytes
+ * @return the created semispace
+ */
+semispace_t *create_semispace (size_t heap_bytes);
+
+/**
+ * @brief Frees all memory allocated to a semispace.
+ * @param space the semispace to destroy, may be NULL
+ */
+void destroy_semispace (semispace_t *space);
+
+/**
+ * @brief Gets the size of one half of the heap, the most that can be
+ * allocated between two collections.
+ * @param space the semispace
+ * @return the size of a half in bytes
+ */
+size_t get_semispace_bytes (semispace_t *space);
+
+/**
+ * @brief Takes room for an allocation by bumping the pointer of the half in
+ * use. The allocation map is only searched when the bump pointer reaches a
+ * pinned object.
+ * @param space the semispace
+ * @param alloc_map the allocation map of the heap
+ * @param bytes the amount of bytes needed
+ * @param offset set to the heap offset of the room taken if there was any
+ * @return false if the half in use has no room left that fits the
+ * allocation
+ */
+bool take_semispace_room (semispace_t *space, char *alloc_map, size_t bytes,
+                          size_t *offset);
+
+/**
+ * @brief Copies every object reachable from the roots into the other half,
+ * breadth first, and continues allocating there. Copied objects are scanned
+ * in the order they were copied, Cheney style, so the cost only depends on
+ * the amount of surviving objects.
+ *
+ * If the stack is unsafe, objects it points to are pinned: they stay where
+ * they are and are scanned in place, as are objects left in the other half
+ * by an earlier collection that are still reachable. If the stack is safe
+ * the stack is updated with the new addresses instead.
+ * @param h the heap
+ * @param root_map a map of the roots found
+ * @param start the lowest stack address, to update if the stack is safe
+ * @param end the highest stack address (non-inclusive)
+ */
+void copy_live_objects (heap_t *h, char *root_map, uintptr_t start,
+                        uintptr_t end);
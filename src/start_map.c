@@ -0,0 +1,145 @@
+/**
+ * Function for creating a start map.
+ * The start map records where each object begins, so that a word that only
+ * looks like a header, such as a field of an object, is never taken for
+ * one, and a pointer into the middle of an object can be traced back to its
+ * header. It shares the layout of the allocation map, so the indexing helpers
+ * of the allocation map are reused. Bits are updated atomically, since
+ * threads place objects in buffers that share bytes of the map.
+ */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "allocation.h"
+#include "allocation_map.h"
+#include "bitmap.h"
+#include "get_header.h"
+#include "header.h"
+#include "heap_internal.h"
+#include "is_pointer_in_alloc.h"
+#include "start_map.h"
+
+char *
+create_start_map (size_t bytes)
+{
+  char *start_map = calloc (calc_bitmap_size (bytes / MIN_ALLOC_OBJECT_SIZE),
+                            sizeof (char));
+  assert (start_map != NULL && "Calloc failed to allocate start map");
+  return start_map;
+}
+
+/**
+ * Clears the bits of the granules [first, end) that share a byte of the map,
+ * without touching the other bits of the byte.
+ */
+static void
+clear_byte_bits (char *start_map, size_t first, size_t end)
+{
+  char mask = 0;
+  for (size_t granule = first; granule < end; granule++)
+    {
+      mask |= create_bitmask (granule * MIN_ALLOC_OBJECT_SIZE);
+    }
+  __atomic_fetch_and (&start_map[first / ALLOCATIONS_PER_BYTE], ~mask,
+                      __ATOMIC_RELAXED);
+}
+
+void
+clear_object_starts (char *start_map, size_t offset, size_t bytes)
+{
+  size_t first = offset / MIN_ALLOC_OBJECT_SIZE;
+  size_t end = (offset + bytes) / MIN_ALLOC_OBJECT_SIZE;
+
+  /* Bytes the range only covers in part may hold the bits of objects placed
+     by other threads, the bytes in between belong to the range alone.  */
+  size_t first_whole = (first + ALLOCATIONS_PER_BYTE - 1)
+                       / ALLOCATIONS_PER_BYTE * ALLOCATIONS_PER_BYTE;
+  if (first_whole >= end)
+    {
+      if (first < end)
+        {
+          clear_byte_bits (start_map, first, end);
+        }
+      return;
+    }
+  if (first < first_whole)
+    {
+      clear_byte_bits (start_map, first, first_whole);
+    }
+  size_t end_whole = end / ALLOCATIONS_PER_BYTE * ALLOCATIONS_PER_BYTE;
+  memset (start_map + first_whole / ALLOCATIONS_PER_BYTE, 0,
+          (end_whole - first_whole) / ALLOCATIONS_PER_BYTE);
+  if (end_whole < end)
+    {
+      clear_byte_bits (start_map, end_whole, end);
+    }
+}
+
+void
+set_object_start (char *start_map, size_t offset)
+{
+  __atomic_fetch_or (&start_map[find_index_in_alloc_map (offset)],
+                     create_bitmask (offset), __ATOMIC_RELAXED);
+}
+
+void
+record_object_start (char *start_map, size_t offset, size_t bytes)
+{
+  clear_object_starts (start_map, offset, bytes);
+  set_object_start (start_map, offset);
+}
+
+bool
+is_object_start (char *start_map, size_t offset)
+{
+  return is_offset_allocated (start_map, offset);
+}
+
+bool
+find_object_start (char *start_map, size_t offset, size_t *start)
+{
+  size_t index = offset / MIN_ALLOC_OBJECT_SIZE;
+  if (!find_prev_set_bit (start_map, &index))
+    {
+      return false;
+    }
+  *start = index * MIN_ALLOC_OBJECT_SIZE;
+  return true;
+}
+
+bool
+find_enclosing_object (heap_t *h, void *ptr, size_t *header_offset)
+{
+  /* Free granules hold no object, but may hold the bit of a freed one */
+  if (!is_heap_pointer ((uintptr_t)ptr, h))
+    {
+      return false;
+    }
+  size_t offset = calc_heap_offset (ptr, h);
+  size_t start;
+  if (!find_object_start (h->start_map, offset, &start)
+      || !is_offset_allocated (h->alloc_map, start))
+    {
+      return false;
+    }
+
+  void *alloc = (char *)h->heap_start + start + sizeof (header_t);
+  header_t header = get_header_value (get_header_pointer (alloc));
+  if (get_header_type (header) == HEADER_FORWARDING_ADDRESS)
+    {
+      /* Copied by a collection in progress, the copy knows its size */
+      alloc = get_pointer_in_header (header);
+    }
+  size_t size = align_alloc_size (calc_alloc_size (alloc)) + sizeof (header_t);
+  if (offset < start + sizeof (header_t) || offset >= start + size)
+    {
+      /* At the header, which is never referred to, or past the end of the
+         last object placed before it.  */
+      return false;
+    }
+  *header_offset = start;
+  return true;
+}
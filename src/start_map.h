@@ -0,0 +1,84 @@
+/**
+ * Functions for creating and searching the start map of a heap.
+ * The start map is laid out exactly like the allocation map, one bit per
+ * MIN_ALLOC_OBJECT_SIZE bytes, but only the bit of the granule holding an
+ * object's header is set. The bits are set when an object is placed, which
+ * clears the bits of the rest of its granules, and are left behind when it
+ * is freed. A set bit is therefore only the start of an object if the
+ * allocation map agrees, and any pointer into an object leads back to its
+ * header by searching the map backwards.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "heap.h"
+
+/**
+ * @brief Creates an empty start map for the memory of given amount of bytes.
+ * @param bytes the total amount of bytes that the start map will represent
+ * @return a start map with no bits set.
+ */
+char *create_start_map (size_t bytes);
+
+/**
+ * @brief Clears the bits of every granule in [offset, offset + bytes).
+ * Bits outside of the range are never written, so threads placing objects
+ * next to the range may set their bits at the same time.
+ * @param start_map the start map
+ * @param offset the heap offset of the first granule, a multiple of
+ * MIN_ALLOC_OBJECT_SIZE
+ * @param bytes the length of the range, a multiple of MIN_ALLOC_OBJECT_SIZE
+ */
+void clear_object_starts (char *start_map, size_t offset, size_t bytes);
+
+/**
+ * @brief Sets the bit of the granule holding an object's header. The bit is
+ * set atomically, so threads may place objects in the same part of the map.
+ * @param start_map the start map
+ * @param offset the heap offset of the header
+ */
+void set_object_start (char *start_map, size_t offset);
+
+/**
+ * @brief Records an object placed at offset, clearing the bits of the rest
+ * of the granules it covers.
+ * @param start_map the start map
+ * @param offset the heap offset of the header
+ * @param bytes the size of the object, header included
+ */
+void record_object_start (char *start_map, size_t offset, size_t bytes);
+
+/**
+ * @brief Checks if an object was placed with its header at offset, and no
+ * object has been placed over it since.
+ * @param start_map the start map
+ * @param offset the heap offset of the possible header
+ * @return true if the bit of the granule is set
+ */
+bool is_object_start (char *start_map, size_t offset);
+
+/**
+ * @brief Finds the last set bit at or before the granule holding offset.
+ * Granules without one are skipped a word, 64 granules, at a time.
+ * @param start_map the start map
+ * @param offset the heap offset to search backwards from
+ * @param start set to the heap offset of the set bit if one was found
+ * @return true if a set bit was found, false if the start of the map was
+ * reached
+ */
+bool find_object_start (char *start_map, size_t offset, size_t *start);
+
+/**
+ * @brief Finds the allocated object a pointer points into, anywhere from its
+ * first byte to its last. A pointer to the header of an object is not a
+ * pointer to the object, it is most likely the end of the object before.
+ * @param h the heap
+ * @param ptr the possible pointer, interior or not
+ * @param header_offset set to the heap offset of the header of the object
+ * if one was found
+ * @return false if ptr does not point into an allocated object
+ */
+bool find_enclosing_object (heap_t *h, void *ptr, size_t *header_offset);
@@ -0,0 +1,65 @@
+/**
+ * Functions for sweeping the heap after marking, and for deciding if it has
+ * become fragmented enough to be compacted instead.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "allocation.h"
+#include "allocation_map.h"
+#include "bitmap.h"
+#include "get_header.h"
+#include "heap_internal.h"
+#include "mark_map.h"
+#include "sweeping.h"
+
+size_t
+sweep_heap (heap_t *h)
+{
+  size_t old_size = h->used_bytes;
+  reset_allocation_map (h);
+  h->used_bytes = 0;
+
+  /* Only the header of a marked object is set in the mark map, its size is
+     read from the header.  */
+  size_t offset = 0;
+  while (find_next_marked_offset (h->mark_map, h->size, &offset))
+    {
+      char *alloc = (char *)h->heap_start + offset + sizeof (header_t);
+      size_t alloc_size = align_alloc_size (calc_alloc_size (alloc));
+      update_alloc_map_range (h->alloc_map, offset,
+                              alloc_size + sizeof (header_t), true);
+      h->used_bytes += alloc_size;
+      offset += MIN_ALLOC_OBJECT_SIZE;
+    }
+
+  return old_size - h->used_bytes;
+}
+
+float
+calc_fragmentation (heap_t *h)
+{
+  size_t granules = h->size / MIN_ALLOC_OBJECT_SIZE;
+  size_t granules_per_page = h->page_size / MIN_ALLOC_OBJECT_SIZE;
+  size_t free_granules = 0;
+  size_t stranded_granules = 0;
+
+  for (size_t start = 0; start < granules; start += granules_per_page)
+    {
+      size_t count = granules - start < granules_per_page ? granules - start
+                                                          : granules_per_page;
+      size_t allocated = count_set_bits (h->alloc_map, start, count);
+      free_granules += count - allocated;
+      if (allocated > 0)
+        {
+          stranded_granules += count - allocated;
+        }
+    }
+
+  if (free_granules == 0)
+    {
+      return 0;
+    }
+  return (float)stranded_granules / (float)free_granules;
+}
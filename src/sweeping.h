@@ -0,0 +1,28 @@
+/**
+ * Functions for collecting a heap without moving any object.
+ */
+
+#pragma once
+
+#include <stdlib.h>
+
+#include "heap.h"
+
+/**
+ * @brief Rebuilds the allocation map from the mark map, freeing the space of
+ * every object that was not marked. Nothing is moved, and the free space is
+ * only added to free lists once allocation needs it.
+ * @param h the heap, with its living objects marked
+ * @return number of bytes released.
+ */
+size_t sweep_heap (heap_t *h);
+
+/**
+ * @brief Measures how fragmented the free space of a heap is, as the share
+ * of it lying on pages that still hold objects. Compacting would turn that
+ * space into empty pages.
+ * @param h the heap
+ * @return 0 if every free byte is on an empty page, up to 1 if every free
+ * byte is stranded between objects
+ */
+float calc_fragmentation (heap_t *h);
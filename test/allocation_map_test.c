@@ -112,6 +112,42 @@ test_large_alloc_map (void)
   free (alloc_map);
 }
 
+void
+test_allocation_map_ranges (void)
+{
+  size_t bytes = 4096;
+
+  char *alloc_map = create_allocation_map (bytes);
+  CU_ASSERT_EQUAL (count_allocated_bytes (alloc_map, bytes), 0);
+
+  /* A 40 byte range covers three granules */
+  update_alloc_map_range (alloc_map, 32, 40, true);
+  CU_ASSERT_FALSE (is_offset_allocated (alloc_map, 16));
+  CU_ASSERT_TRUE (is_offset_allocated (alloc_map, 32));
+  CU_ASSERT_TRUE (is_offset_allocated (alloc_map, 64));
+  CU_ASSERT_FALSE (is_offset_allocated (alloc_map, 80));
+  CU_ASSERT_EQUAL (count_allocated_bytes (alloc_map, bytes), 48);
+
+  /* The hole before the range is too small for 48 bytes */
+  size_t offset = 0;
+  CU_ASSERT_TRUE (find_free_range (alloc_map, bytes, 32, &offset));
+  CU_ASSERT_EQUAL (offset, 0);
+  offset = 0;
+  CU_ASSERT_TRUE (find_free_range (alloc_map, bytes, 48, &offset));
+  CU_ASSERT_EQUAL (offset, 80);
+
+  /* Nothing fits after the map is full */
+  update_alloc_map_range (alloc_map, 0, bytes, true);
+  CU_ASSERT_EQUAL (count_allocated_bytes (alloc_map, bytes), bytes);
+  offset = 0;
+  CU_ASSERT_FALSE (find_free_range (alloc_map, bytes, 16, &offset));
+
+  update_alloc_map_range (alloc_map, 0, bytes, false);
+  CU_ASSERT_EQUAL (count_allocated_bytes (alloc_map, bytes), 0);
+
+  free (alloc_map);
+}
+
 int
 main (void)
 {
@@ -145,6 +181,10 @@ main (void)
                        "Test retrieving index and bit from offset",
                        test_allocation_map_indexing)
               == NULL
+       || CU_add_test (allocationmaptests,
+                       "Test updating, counting and searching ranges",
+                       test_allocation_map_ranges)
+              == NULL
        || 0))
     {
       // If adding any of the tests fails, we tear down CUnit and exit
@@ -341,18 +341,29 @@ void
 test_alloc_bigger_than_page_size (void)
 {
   size_t page_size = 2048;
-  heap_t *h = h_init (2 * page_size, true, 0.5);
+  heap_t *h = h_init (4 * page_size, true, 1);
   h->page_size = page_size;
 
+  void *small1 = h_alloc_raw (h, 24);
+  CU_ASSERT_PTR_NOT_NULL (small1);
+
+  /* Too large for a page, placed in whole pages of the large object space */
   void *alloc1 = h_alloc_raw (h, page_size);
-  CU_ASSERT_PTR_NULL (alloc1);
-  CU_ASSERT_EQUAL (h_used (h), 0);
-  CU_ASSERT_FALSE (is_offset_allocated (h->alloc_map, 0))
+  CU_ASSERT_PTR_NOT_NULL (alloc1);
+  CU_ASSERT_EQUAL (calc_heap_offset (alloc1, h), page_size + sizeof (header_t));
+  CU_ASSERT_EQUAL (h_used (h), 24 + page_size + sizeof (header_t));
+  CU_ASSERT_TRUE (is_offset_allocated (h->alloc_map, page_size));
+  CU_ASSERT_TRUE (is_offset_allocated (h->alloc_map, 2 * page_size));
+
+  /* Small allocations continue from the bump pointer */
+  void *small2 = h_alloc_raw (h, 24);
+  CU_ASSERT_EQUAL (calc_heap_offset (small2, h), 32 + sizeof (header_t));
 
+  /* Only a single whole page is left */
   void *alloc2 = h_alloc_raw (h, page_size - sizeof (header_t) + 1);
   CU_ASSERT_PTR_NULL (alloc2);
-  CU_ASSERT_EQUAL (h_used (h), 0);
-  CU_ASSERT_FALSE (is_offset_allocated (h->alloc_map, 0))
+  CU_ASSERT_EQUAL (h_used (h), 2 * 24 + page_size + sizeof (header_t));
+  CU_ASSERT_FALSE (is_offset_allocated (h->alloc_map, 3 * page_size))
 
   h_delete (h);
 }
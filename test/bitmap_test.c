@@ -0,0 +1,251 @@
+#include <CUnit/Basic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/bitmap.h"
+
+int
+init_suite (void)
+{
+  // Change this function if you want to do something *before* you
+  // run a test suite
+  return 0;
+}
+
+int
+clean_suite (void)
+{
+  // Change this function if you want to do something *after* you
+  // run a test suite
+  return 0;
+}
+
+void
+test_bitmap_size ()
+{
+  /* Always whole words, and never empty */
+  CU_ASSERT_EQUAL (calc_bitmap_size (0), 8);
+  CU_ASSERT_EQUAL (calc_bitmap_size (1), 8);
+  CU_ASSERT_EQUAL (calc_bitmap_size (64), 8);
+  CU_ASSERT_EQUAL (calc_bitmap_size (65), 16);
+  CU_ASSERT_EQUAL (calc_bitmap_size (1000), 128);
+}
+
+void
+test_bitmap_update_range ()
+{
+  size_t bits = 256;
+  char *map = calloc (calc_bitmap_size (bits), sizeof (char));
+
+  /* Range spanning three words */
+  update_bit_range (map, 60, 80, true);
+  for (size_t i = 0; i < bits; i++)
+    {
+      bool expected = i >= 60 && i < 140;
+      CU_ASSERT_EQUAL ((map[i / 8] >> (i % 8)) & 1, expected);
+    }
+
+  /* Byte layout is shared with the allocation map, bit i of byte j */
+  CU_ASSERT_EQUAL ((unsigned char)map[7], 0xF0);
+  CU_ASSERT_EQUAL ((unsigned char)map[8], 0xFF);
+
+  update_bit_range (map, 64, 64, false);
+  CU_ASSERT_EQUAL (count_set_bits (map, 0, bits), 4 + 12);
+
+  /* Empty range changes nothing */
+  update_bit_range (map, 10, 0, true);
+  CU_ASSERT_EQUAL (count_set_bits (map, 0, bits), 16);
+
+  free (map);
+}
+
+void
+test_bitmap_count ()
+{
+  size_t bits = 200;
+  char *map = calloc (calc_bitmap_size (bits), sizeof (char));
+  CU_ASSERT_EQUAL (count_set_bits (map, 0, bits), 0);
+
+  update_bit_range (map, 0, bits, true);
+  CU_ASSERT_EQUAL (count_set_bits (map, 0, bits), bits);
+  CU_ASSERT_EQUAL (count_set_bits (map, 3, 5), 5);
+  CU_ASSERT_EQUAL (count_set_bits (map, 63, 2), 2);
+  CU_ASSERT_EQUAL (count_set_bits (map, 100, 0), 0);
+
+  free (map);
+}
+
+void
+test_bitmap_find_next_set ()
+{
+  size_t bits = 300;
+  char *map = calloc (calc_bitmap_size (bits), sizeof (char));
+
+  size_t index = 0;
+  CU_ASSERT_FALSE (find_next_set_bit (map, bits, &index));
+
+  update_bit_range (map, 5, 1, true);
+  update_bit_range (map, 190, 1, true);
+
+  index = 0;
+  CU_ASSERT_TRUE (find_next_set_bit (map, bits, &index));
+  CU_ASSERT_EQUAL (index, 5);
+
+  /* Start index is inclusive */
+  CU_ASSERT_TRUE (find_next_set_bit (map, bits, &index));
+  CU_ASSERT_EQUAL (index, 5);
+
+  index = 6;
+  CU_ASSERT_TRUE (find_next_set_bit (map, bits, &index));
+  CU_ASSERT_EQUAL (index, 190);
+
+  /* Bits past the end of the map are not found */
+  index = 0;
+  CU_ASSERT_TRUE (find_next_set_bit (map, 6, &index));
+  index = 6;
+  CU_ASSERT_FALSE (find_next_set_bit (map, 190, &index));
+
+  free (map);
+}
+
+void
+test_bitmap_find_prev_set ()
+{
+  size_t bits = 300;
+  char *map = calloc (calc_bitmap_size (bits), sizeof (char));
+
+  size_t index = 299;
+  CU_ASSERT_FALSE (find_prev_set_bit (map, &index));
+
+  update_bit_range (map, 0, 1, true);
+  update_bit_range (map, 63, 1, true);
+  update_bit_range (map, 190, 1, true);
+
+  index = 299;
+  CU_ASSERT_TRUE (find_prev_set_bit (map, &index));
+  CU_ASSERT_EQUAL (index, 190);
+
+  /* Start index is inclusive */
+  CU_ASSERT_TRUE (find_prev_set_bit (map, &index));
+  CU_ASSERT_EQUAL (index, 190);
+
+  /* Whole words without a set bit are skipped */
+  index = 189;
+  CU_ASSERT_TRUE (find_prev_set_bit (map, &index));
+  CU_ASSERT_EQUAL (index, 63);
+
+  index = 62;
+  CU_ASSERT_TRUE (find_prev_set_bit (map, &index));
+  CU_ASSERT_EQUAL (index, 0);
+
+  update_bit_range (map, 0, 1, false);
+  index = 62;
+  CU_ASSERT_FALSE (find_prev_set_bit (map, &index));
+
+  free (map);
+}
+
+void
+test_bitmap_find_zero_run ()
+{
+  size_t bits = 256;
+  char *map = calloc (calc_bitmap_size (bits), sizeof (char));
+
+  /* [0, 10) set, [10, 20) free, [20, 70) set, [70, 256) free */
+  update_bit_range (map, 0, 10, true);
+  update_bit_range (map, 20, 50, true);
+
+  size_t index = 0;
+  CU_ASSERT_TRUE (find_next_zero_run (map, bits, 10, &index));
+  CU_ASSERT_EQUAL (index, 10);
+
+  /* The first hole is too small, skip to the one after the blocker */
+  index = 0;
+  CU_ASSERT_TRUE (find_next_zero_run (map, bits, 11, &index));
+  CU_ASSERT_EQUAL (index, 70);
+
+  /* Run crossing word boundaries */
+  index = 0;
+  CU_ASSERT_TRUE (find_next_zero_run (map, bits, 186, &index));
+  CU_ASSERT_EQUAL (index, 70);
+
+  /* Does not fit before the end of the map */
+  index = 0;
+  CU_ASSERT_FALSE (find_next_zero_run (map, bits, 187, &index));
+  CU_ASSERT_EQUAL (index, 0);
+
+  /* Start index inside a hole */
+  index = 15;
+  CU_ASSERT_TRUE (find_next_zero_run (map, bits, 5, &index));
+  CU_ASSERT_EQUAL (index, 15);
+  index = 16;
+  CU_ASSERT_TRUE (find_next_zero_run (map, bits, 5, &index));
+  CU_ASSERT_EQUAL (index, 70);
+
+  free (map);
+}
+
+int
+main (void)
+{
+  // First we try to set up CUnit, and exit if we fail
+  if (CU_initialize_registry () != CUE_SUCCESS)
+    return CU_get_error ();
+
+  // We then create an empty test suite and specify the name and
+  // the init and cleanup functions
+  CU_pSuite bitmaptests
+      = CU_add_suite ("Bitmap Testing Suite", init_suite, clean_suite);
+  if (bitmaptests == NULL)
+    {
+      // If the test suite could not be added, tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // This is where we add the test functions to our test suite.
+  // For each call to CU_add_test we specify the test suite, the
+  // name or description of the test, and the function that runs
+  // the test in question. If you want to add another test, just
+  // copy a line below and change the information
+  if ((CU_add_test (bitmaptests, "Test bitmap sizes are whole words",
+                    test_bitmap_size)
+           == NULL
+       || CU_add_test (bitmaptests, "Test setting and clearing ranges",
+                       test_bitmap_update_range)
+              == NULL
+       || CU_add_test (bitmaptests, "Test counting set bits",
+                       test_bitmap_count)
+              == NULL
+       || CU_add_test (bitmaptests, "Test finding the next set bit",
+                       test_bitmap_find_next_set)
+              == NULL
+       || CU_add_test (bitmaptests, "Test finding the previous set bit",
+                       test_bitmap_find_prev_set)
+              == NULL
+       || CU_add_test (bitmaptests, "Test finding runs of cleared bits",
+                       test_bitmap_find_zero_run)
+              == NULL
+       || 0))
+    {
+      // If adding any of the tests fails, we tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // Set the running mode. Use CU_BRM_VERBOSE for maximum output.
+  // Use CU_BRM_NORMAL to only print errors and a summary
+  CU_basic_set_mode (CU_BRM_VERBOSE);
+
+  // This is where the tests are actually run!
+  CU_basic_run_tests ();
+
+  int exit_code = CU_get_number_of_tests_failed () == 0
+                      ? CU_get_error ()
+                      : CU_get_number_of_tests_failed ();
+
+  // Tear down CUnit before exiting
+  CU_cleanup_registry ();
+
+  return exit_code;
+}
@@ -0,0 +1,219 @@
+#include <CUnit/Basic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "../src/allocation_map.h"
+#include "../src/blacklist.h"
+#include "../src/gc.h"
+#include "../src/gc_utils.h"
+#include "../src/heap_internal.h"
+#include "../src/page_map.h"
+#include "test_helpers.h"
+
+/* The amount of pages of the heaps used by the tests */
+#define HEAP_PAGES 8
+
+/* The page the tests point into with an integer */
+#define FALSE_PAGE 5
+
+/* The most nodes the tests allocate */
+#define MAX_NODES 10000
+
+int
+init_suite (void)
+{
+  // Change this function if you want to do something *before* you
+  // run a test suite
+  return 0;
+}
+
+int
+clean_suite (void)
+{
+  // Change this function if you want to do something *after* you
+  // run a test suite
+  return 0;
+}
+
+/**
+ * Allocates nodes linked from the first one until count have been allocated
+ * or the heap is full.
+ * @return the first node
+ */
+static void **
+alloc_linked_nodes (heap_t *h, size_t count)
+{
+  void **first = h_alloc_struct (h, "*l");
+  void **last = first;
+  for (size_t i = 1; i < count && last != NULL; i++)
+    {
+      void **node = h_alloc_struct (h, "*l");
+      last[0] = node;
+      last = node;
+    }
+  return first;
+}
+
+void
+test_blacklist_pages ()
+{
+  blacklist_t *blacklist = create_blacklist (HEAP_PAGES * PAGE_SIZE);
+  CU_ASSERT_EQUAL (count_blacklisted_pages (blacklist), 0);
+
+  blacklist_offset (blacklist, 2 * PAGE_SIZE + 100);
+  CU_ASSERT_TRUE (is_range_blacklisted (blacklist, 2 * PAGE_SIZE, 1));
+  CU_ASSERT_FALSE (is_range_blacklisted (blacklist, PAGE_SIZE, PAGE_SIZE));
+  CU_ASSERT_TRUE (is_range_blacklisted (blacklist, PAGE_SIZE, PAGE_SIZE + 1));
+  CU_ASSERT_FALSE (is_range_blacklisted (blacklist, 3 * PAGE_SIZE, 100));
+  CU_ASSERT_EQUAL (count_blacklisted_pages (blacklist), 1);
+
+  /* A page stays blacklisted for the collection after it as well */
+  age_blacklist (blacklist);
+  blacklist_offset (blacklist, 7 * PAGE_SIZE);
+  CU_ASSERT_TRUE (is_range_blacklisted (blacklist, 2 * PAGE_SIZE, 1));
+  CU_ASSERT_EQUAL (count_blacklisted_pages (blacklist), 2);
+  age_blacklist (blacklist);
+  CU_ASSERT_FALSE (is_range_blacklisted (blacklist, 2 * PAGE_SIZE, 1));
+  CU_ASSERT_TRUE (is_range_blacklisted (blacklist, 7 * PAGE_SIZE, 1));
+  age_blacklist (blacklist);
+  CU_ASSERT_EQUAL (count_blacklisted_pages (blacklist), 0);
+
+  destroy_blacklist (blacklist);
+}
+
+void
+test_allocation_avoids_blacklisted_page ()
+{
+  heap_t *h = h_init (HEAP_PAGES * PAGE_SIZE, false, 1);
+
+  /* An integer that happens to point into free memory */
+  volatile uintptr_t id
+      = (uintptr_t)h->heap_start + FALSE_PAGE * PAGE_SIZE + 64;
+  h_gc (h);
+  CU_ASSERT_TRUE (
+      is_range_blacklisted (h->blacklist, FALSE_PAGE * PAGE_SIZE, 1));
+
+  /* Nodes are allocated on the pages around it instead */
+  void **first = alloc_linked_nodes (h, (FALSE_PAGE + 1) * PAGE_SIZE / 32);
+  CU_ASSERT_PTR_NOT_NULL (first);
+  CU_ASSERT_EQUAL (count_page_bytes (h, FALSE_PAGE), 0);
+  CU_ASSERT_TRUE (count_page_bytes (h, FALSE_PAGE + 1) > 0);
+  (void)id;
+
+  h_delete (h);
+}
+
+void
+test_large_object_avoids_blacklisted_page ()
+{
+  heap_t *h = h_init (HEAP_PAGES * PAGE_SIZE, false, 1);
+
+  volatile uintptr_t id = (uintptr_t)h->heap_start + PAGE_SIZE + 8;
+  h_gc (h);
+
+  /* The first extent free of the page lies after it */
+  void *large = h_alloc_raw (h, 2 * PAGE_SIZE);
+  CU_ASSERT_PTR_NOT_NULL_FATAL (large);
+  CU_ASSERT_TRUE (calc_heap_offset (large, h) > 2 * PAGE_SIZE);
+  (void)id;
+
+  h_delete (h);
+}
+
+void
+test_blacklisted_page_used_when_full ()
+{
+  heap_t *h = h_init (HEAP_PAGES * PAGE_SIZE, false, 1);
+
+  volatile uintptr_t id
+      = (uintptr_t)h->heap_start + FALSE_PAGE * PAGE_SIZE + 64;
+  h_gc (h);
+
+  /* Every node is kept alive, so the heap ends up filled */
+  void **volatile first = alloc_linked_nodes (h, MAX_NODES);
+  CU_ASSERT_PTR_NOT_NULL (first);
+  CU_ASSERT_TRUE (count_page_bytes (h, FALSE_PAGE) > 0);
+  (void)id;
+
+  h_delete (h);
+}
+
+void
+test_heap_placed_high ()
+{
+  void *small = malloc (16);
+  heap_t *h = h_init (HEAP_PAGES * PAGE_SIZE, false, 1);
+
+  /* Above the program and the memory malloc hands out in small pieces */
+  CU_ASSERT_TRUE ((uintptr_t)h->heap_start > (uintptr_t)small);
+  CU_ASSERT_TRUE ((uintptr_t)h->heap_start > (uintptr_t)&init_suite);
+  CU_ASSERT_EQUAL ((uintptr_t)h->heap_start % PAGE_SIZE, 0);
+
+  h_delete (h);
+  free (small);
+}
+
+int
+main (void)
+{
+  // First we try to set up CUnit, and exit if we fail
+  if (CU_initialize_registry () != CUE_SUCCESS)
+    return CU_get_error ();
+
+  // We then create an empty test suite and specify the name and
+  // the init and cleanup functions
+  CU_pSuite blacklisttests
+      = CU_add_suite ("Blacklist Testing Suite", init_suite, clean_suite);
+  if (blacklisttests == NULL)
+    {
+      // If the test suite could not be added, tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // This is where we add the test functions to our test suite.
+  // For each call to CU_add_test we specify the test suite, the
+  // name or description of the test, and the function that runs
+  // the test in question. If you want to add another test, just
+  // copy a line below and change the information
+  if ((CU_add_test (blacklisttests, "Test blacklisting pages",
+                    test_blacklist_pages)
+           == NULL
+       || CU_add_test (blacklisttests,
+                       "Test allocating around a blacklisted page",
+                       test_allocation_avoids_blacklisted_page)
+              == NULL
+       || CU_add_test (blacklisttests,
+                       "Test placing a large object off a blacklisted page",
+                       test_large_object_avoids_blacklisted_page)
+              == NULL
+       || CU_add_test (blacklisttests,
+                       "Test using a blacklisted page once the heap is full",
+                       test_blacklisted_page_used_when_full)
+              == NULL
+       || CU_add_test (blacklisttests, "Test placing the heap high",
+                       test_heap_placed_high)
+              == NULL
+       || 0))
+    {
+      // If adding any of the tests fails, we tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // Set the running mode. Use CU_BRM_VERBOSE for maximum output.
+  // Use CU_BRM_NORMAL to only print errors and a summary
+  CU_basic_set_mode (CU_BRM_VERBOSE);
+
+  // This is where the tests are actually run!
+  CU_basic_run_tests ();
+
+  int exit_code = CU_get_number_of_tests_failed () == 0
+                      ? CU_get_error ()
+                      : CU_get_number_of_tests_failed ();
+
+  // Tear down CUnit before exiting
+  CU_cleanup_registry ();
+
+  return exit_code;
+}
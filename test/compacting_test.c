@@ -2,11 +2,16 @@
 #include <math.h>
 #include <stdlib.h>
 
+#include "../src/allocation.h"
 #include "../src/allocation_map.h"
+#include "../src/compacting.h"
+#include "../src/forwarding_table.h"
 #include "../src/gc.h"
 #include "../src/gc_utils.h"
 #include "../src/get_header.h"
 #include "../src/heap_internal.h"
+#include "../src/mark_map.h"
+#include "../src/page_map.h"
 
 int
 init_compacting_suite (void)
@@ -87,7 +92,7 @@ compacting_move_to_start_of_heap_unsafe_stack ()
 
   t *alloc1 = (t *)h_alloc_struct (h, "*");    // On page 0
   void *alloc2 = h_alloc_raw (h, alloc2_size); // On page 0
-  void *alloc3 = h_alloc_raw (h, 1524);        // On page 1
+  void *alloc3 = h_alloc_raw (h, 1524);        // From page 0 into page 1
   size_t old_offset1 = calc_heap_offset (alloc1, h);
   size_t old_offset2 = calc_heap_offset (alloc2, h);
   size_t old_offset3 = calc_heap_offset (alloc3, h);
@@ -101,11 +106,14 @@ compacting_move_to_start_of_heap_unsafe_stack ()
   size_t freed_bytes = h_gc (h);
   CU_ASSERT_EQUAL (freed_bytes, alloc2_size);
 
+  /* Page 0 holds a root, so it is pinned along with every object on it */
   size_t new_offset1 = calc_heap_offset (alloc1, h);
-  size_t new_offset3 = calc_heap_offset (alloc1->ptr, h); // Moved to page 0
+  size_t new_offset3 = calc_heap_offset (alloc1->ptr, h);
   CU_ASSERT_EQUAL (new_offset1, old_offset1);
-  CU_ASSERT_EQUAL (new_offset3, old_offset2)
-  CU_ASSERT_NOT_EQUAL (new_offset3, old_offset3);
+  CU_ASSERT_EQUAL (new_offset3, old_offset3);
+  CU_ASSERT_FALSE (is_offset_allocated (h->alloc_map,
+                                        old_offset2 - sizeof (header_t)));
+  CU_ASSERT_FALSE (is_offset_movable (h->page_map, 0));
 
   h_delete (h);
 }
@@ -150,9 +158,9 @@ compacting_multiple_allocs ()
   size_t old_alloc1_offset = calc_heap_offset (alloc1, h);
   size_t old_alloc3_offset = calc_heap_offset (alloc3, h);
 
+  /* Only the bytes of the objects are counted, as in h_used.  */
   size_t collected_bytes = h_gc (h);
-  CU_ASSERT_EQUAL (collected_bytes,
-                   garbage_size1 + garbage_size2 + 2 * sizeof (header_t));
+  CU_ASSERT_EQUAL (collected_bytes, garbage_size1 + garbage_size2);
 
   CU_ASSERT_EQUAL (calc_heap_offset (alloc1, h), old_alloc1_offset);
   CU_ASSERT_NOT_EQUAL (calc_heap_offset (alloc3, h), old_alloc3_offset);
@@ -211,6 +219,252 @@ compacting_with_format_strings ()
   h_delete (h);
 }
 
+void
+compacting_large_objects ()
+{
+  heap_t *h = h_init (8 * PAGE_SIZE, true, 1);
+
+  void *garbage = h_alloc_raw (h, 1500);
+  void **holder = h_alloc_struct (h, "*");
+  holder[0] = h_alloc_struct (h, "300*"); // Larger than a page
+  void **large = holder[0];
+  large[0] = h_alloc_raw (h, 16);
+  large = NULL;
+  garbage = NULL;
+  (void)garbage;
+
+  size_t large_offset = calc_heap_offset (holder[0], h);
+  CU_ASSERT_EQUAL ((large_offset - sizeof (header_t)) % PAGE_SIZE, 0);
+
+  size_t collected = h_gc (h);
+  CU_ASSERT_TRUE (collected >= 1500);
+
+  /* Large objects are never moved, but objects they refer to are */
+  CU_ASSERT_EQUAL (calc_heap_offset (holder[0], h), large_offset);
+  large = holder[0];
+  CU_ASSERT_TRUE (is_offset_allocated (
+      h->alloc_map, calc_heap_offset (large[0], h) - sizeof (header_t)));
+  large = NULL;
+
+  /* Unreachable large objects are reclaimed */
+  size_t avail_before = h_avail (h);
+  holder[0] = NULL;
+  h_gc (h);
+  CU_ASSERT_TRUE (h_avail (h) >= avail_before + 300 * sizeof (void *));
+  CU_ASSERT_FALSE (
+      is_offset_allocated (h->alloc_map, large_offset - sizeof (header_t)));
+
+  h_delete (h);
+}
+
+void
+compacting_regions_in_parallel ()
+{
+  heap_options_t options = { .bytes = 16 * PAGE_SIZE,
+                             .unsafe_stack = true,
+                             .gc_threshold = 1,
+                             .gc_threads = 4 };
+  heap_t *h = h_init_with_options (&options);
+  size_t list_count = 16;
+  size_t node_count = 300;
+
+  /* Lists of nodes hanging off an array, with garbage before every node */
+  void **lists = h_alloc_array (h, h_register_layout (h, "*"), list_count + 1);
+  for (size_t i = 0; i < node_count; i++)
+    {
+      h_alloc_struct (h, "4l");
+      void **node = h_alloc_struct (h, "*l");
+      node[0] = lists[i % list_count];
+      ((long *)node)[1] = i;
+      lists[i % list_count] = node;
+    }
+  /* An object described by a format string allocated on the heap */
+  h_alloc_struct (h, "4l");
+  void **wide = h_alloc_struct (h, "50*");
+  wide[49] = lists[0];
+  lists[list_count] = wide;
+  void *old_first_node = lists[0];
+
+  /* The array is the only root, and is pinned */
+  char *root_map = create_mark_map (h->size);
+  update_mark_map (root_map, calc_heap_offset (lists, h) - sizeof (header_t),
+                   true);
+
+  find_living_objects (h, root_map);
+  forwarding_table_t *table = compute_forwarding_addresses (h, root_map);
+  update_forwarded_pointers (h, table);
+  size_t collected = compact_objects (h, table);
+  destroy_forwarding_table (table);
+  free (root_map);
+
+  CU_ASSERT_EQUAL (collected,
+                   (node_count + 1) * align_alloc_size (4 * sizeof (long)));
+  CU_ASSERT_PTR_NOT_EQUAL (lists[0], old_first_node);
+
+  /* Every node survives with its value, reached through moved pointers */
+  long sum = 0;
+  size_t found = 0;
+  for (size_t i = 0; i < list_count; i++)
+    {
+      for (void **node = lists[i]; node != NULL; node = node[0])
+        {
+          CU_ASSERT_TRUE (is_offset_allocated (
+              h->alloc_map, calc_heap_offset (node, h) - sizeof (header_t)));
+          sum += ((long *)node)[1];
+          found++;
+        }
+    }
+  CU_ASSERT_EQUAL (found, node_count);
+  CU_ASSERT_EQUAL (sum, (long)(node_count * (node_count - 1) / 2));
+
+  wide = lists[list_count];
+  CU_ASSERT_PTR_EQUAL (wide[49], lists[0]);
+  header_t header = get_header_value (get_header_pointer (wide));
+  CU_ASSERT_EQUAL (get_header_type (header), HEADER_POINTER_TO_FORMAT_STRING);
+  CU_ASSERT_STRING_EQUAL (get_pointer_in_header (header), "50*");
+
+  h_delete (h);
+}
+
+void
+compacting_leaves_no_holes ()
+{
+  heap_t *h = h_init (8 * PAGE_SIZE, false, 1);
+  size_t node_count = 200;
+
+  /* A list with the smallest possible garbage before every node */
+  void **holder = h_alloc_struct (h, "*");
+  for (size_t i = 0; i < node_count; i++)
+    {
+      h_alloc_raw (h, sizeof (long));
+      void **node = h_alloc_struct (h, "*l");
+      node[0] = holder[0];
+      ((long *)node)[1] = i;
+      holder[0] = node;
+    }
+
+  /* The stack is safe so nothing is pinned, holder is the only root */
+  char *root_map = create_mark_map (h->size);
+  update_mark_map (root_map, calc_heap_offset (holder, h) - sizeof (header_t),
+                   true);
+
+  find_living_objects (h, root_map);
+  forwarding_table_t *table = compute_forwarding_addresses (h, root_map);
+  update_forwarded_pointers (h, table);
+  size_t collected = compact_objects (h, table);
+  destroy_forwarding_table (table);
+  free (root_map);
+
+  CU_ASSERT_EQUAL (collected, node_count * align_alloc_size (sizeof (long)));
+  CU_ASSERT_PTR_EQUAL (holder, (char *)h->heap_start + sizeof (header_t));
+  holder = (void **)((char *)h->heap_start + sizeof (header_t));
+
+  /* Every object is packed against the one before it, across page
+     boundaries as well.  */
+  size_t offset = 0;
+  size_t object_count = 0;
+  while (is_offset_allocated (h->alloc_map, offset))
+    {
+      char *alloc = (char *)h->heap_start + offset + sizeof (header_t);
+      offset += align_alloc_size (calc_alloc_size (alloc)) + sizeof (header_t);
+      object_count++;
+    }
+  CU_ASSERT_EQUAL (object_count, node_count + 1);
+  CU_ASSERT_TRUE (offset > PAGE_SIZE);
+  CU_ASSERT_EQUAL (h_used (h),
+                   offset - object_count * sizeof (header_t));
+
+  long expected = node_count - 1;
+  for (void **node = holder[0]; node != NULL; node = node[0])
+    {
+      CU_ASSERT_EQUAL (((long *)node)[1], expected);
+      expected--;
+    }
+  CU_ASSERT_EQUAL (expected, -1);
+
+  h_delete (h);
+}
+
+void
+compacting_pins_root_pages ()
+{
+  heap_t *h = h_init (8 * PAGE_SIZE, true, 1);
+  size_t node_count = 200;
+
+  /* A list with garbage before every node, its holder in the middle */
+  void **list = NULL;
+  void **holder = NULL;
+  for (size_t i = 0; i < node_count; i++)
+    {
+      if (i == node_count / 2)
+        {
+          holder = h_alloc_struct (h, "*");
+        }
+      h_alloc_struct (h, "2l");
+      void **node = h_alloc_struct (h, "*l");
+      node[0] = list;
+      ((long *)node)[1] = i;
+      list = node;
+    }
+  holder[0] = list;
+  list = NULL;
+  size_t holder_offset = calc_heap_offset (holder, h) - sizeof (header_t);
+  size_t pinned_page = holder_offset / PAGE_SIZE * PAGE_SIZE;
+  CU_ASSERT_TRUE (pinned_page > 0);
+
+  /* The holder is the only root */
+  char *root_map = create_mark_map (h->size);
+  update_mark_map (root_map, holder_offset, true);
+
+  find_living_objects (h, root_map);
+  forwarding_table_t *table = compute_forwarding_addresses (h, root_map);
+  for (size_t page = 0; page < h->size; page += PAGE_SIZE)
+    {
+      CU_ASSERT_EQUAL (is_offset_movable (h->page_map, page),
+                       page != pinned_page);
+    }
+
+  /* Objects on the pinned page stay, no other object is moved onto it */
+  size_t staying = 0;
+  size_t offset = 0;
+  while (find_next_marked_offset (h->mark_map, h->size, &offset))
+    {
+      bool is_on_pinned_page = offset / PAGE_SIZE * PAGE_SIZE == pinned_page;
+      if (is_moved_object (table, offset))
+        {
+          size_t dest = get_forwarding_offset (table, offset);
+          CU_ASSERT_FALSE (is_on_pinned_page);
+          CU_ASSERT_NOT_EQUAL (dest / PAGE_SIZE * PAGE_SIZE, pinned_page);
+        }
+      else
+        {
+          CU_ASSERT_TRUE (is_on_pinned_page || offset < pinned_page);
+          staying++;
+        }
+      offset += MIN_ALLOC_OBJECT_SIZE;
+    }
+  CU_ASSERT_TRUE (staying > 1);
+
+  update_forwarded_pointers (h, table);
+  compact_objects (h, table);
+  destroy_forwarding_table (table);
+  free (root_map);
+
+  CU_ASSERT_EQUAL (calc_heap_offset (holder, h) - sizeof (header_t),
+                   holder_offset);
+  long sum = 0;
+  size_t found = 0;
+  for (void **node = holder[0]; node != NULL; node = node[0])
+    {
+      sum += ((long *)node)[1];
+      found++;
+    }
+  CU_ASSERT_EQUAL (found, node_count);
+  CU_ASSERT_EQUAL (sum, (long)(node_count * (node_count - 1) / 2));
+
+  h_delete (h);
+}
+
 int
 main ()
 {
@@ -259,6 +513,24 @@ main ()
                        "format strings.",
                        compacting_with_format_strings)
               == NULL
+       || CU_add_test (compacting_tests,
+                       "Test that large objects are not moved, and are "
+                       "reclaimed when unreachable.",
+                       compacting_large_objects)
+              == NULL
+       || CU_add_test (compacting_tests,
+                       "Test compacting regions of the heap in parallel.",
+                       compacting_regions_in_parallel)
+              == NULL
+       || CU_add_test (compacting_tests,
+                       "Test that compacting leaves no holes between moved "
+                       "objects.",
+                       compacting_leaves_no_holes)
+              == NULL
+       || CU_add_test (compacting_tests,
+                       "Test that pages holding roots are pinned whole.",
+                       compacting_pins_root_pages)
+              == NULL
        || 0))
     {
       CU_cleanup_registry ();
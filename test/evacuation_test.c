@@ -0,0 +1,212 @@
+#include <CUnit/Basic.h>
+#include <stdlib.h>
+
+#include "../src/allocation.h"
+#include "../src/allocation_map.h"
+#include "../src/bitmap.h"
+#include "../src/compacting.h"
+#include "../src/evacuation.h"
+#include "../src/gc.h"
+#include "../src/gc_utils.h"
+#include "../src/get_header.h"
+#include "../src/heap_internal.h"
+#include "../src/mark_map.h"
+#include "../src/page_map.h"
+#include "../src/start_map.h"
+#include "../src/sweeping.h"
+#include "test_helpers.h"
+
+/* The amount of pages filled with nodes by the tests */
+#define FILLED_PAGES 6
+
+int
+init_suite (void)
+{
+  // Change this function if you want to do something *before* you
+  // run a test suite
+  return 0;
+}
+
+int
+clean_suite (void)
+{
+  // Change this function if you want to do something *after* you
+  // run a test suite
+  return 0;
+}
+
+/**
+ * Fills the first pages of a heap with nodes, linking every (page + 1):th
+ * node on each page into a list hanging off a holder at the very start.
+ * Later pages are left sparser, the rest of the nodes are garbage.
+ * @return the sum of the values of the linked nodes
+ */
+static long
+fill_sparse_pages (heap_t *h, void ***holder)
+{
+  *holder = h_alloc_struct (h, "*");
+  long sum = 0;
+  for (long i = 0;; i++)
+    {
+      void **node = h_alloc_struct (h, "*l");
+      size_t page = calc_heap_offset (node, h) / PAGE_SIZE;
+      if (page >= FILLED_PAGES)
+        {
+          break;
+        }
+      if (i % (page + 1) == 0)
+        {
+          node[0] = (*holder)[0];
+          ((long *)node)[1] = i;
+          (*holder)[0] = node;
+          sum += i;
+        }
+    }
+  return sum;
+}
+
+void
+test_evacuate_sparsest_pages ()
+{
+  heap_options_t options = create_test_options (16 * PAGE_SIZE, true);
+  options.evacuated_pages = 2;
+  heap_t *h = h_init_with_options (&options);
+  void **holder = NULL;
+  long sum = fill_sparse_pages (h, &holder);
+  size_t holder_offset = calc_heap_offset (holder, h) - sizeof (header_t);
+
+  /* The holder is the only root */
+  char *root_map = create_mark_map (h->size);
+  update_mark_map (root_map, holder_offset, true);
+  find_living_objects (h, root_map);
+  sweep_heap (h);
+  size_t used = h_used (h);
+  size_t kept_bytes[FILLED_PAGES];
+  for (size_t page = 0; page < FILLED_PAGES; page++)
+    {
+      kept_bytes[page] = count_page_bytes (h, page);
+    }
+
+  CU_ASSERT_EQUAL (evacuate_sparse_pages (h, root_map, 0, 0), 2);
+  free (root_map);
+
+  /* The two sparsest pages are emptied, the others are left as they are */
+  for (size_t page = 0; page < FILLED_PAGES; page++)
+    {
+      size_t expected = page < FILLED_PAGES - 2 ? kept_bytes[page] : 0;
+      CU_ASSERT_EQUAL (count_page_bytes (h, page), expected);
+    }
+  CU_ASSERT_FALSE (is_offset_movable (h->page_map, holder_offset));
+  CU_ASSERT_EQUAL (h_used (h), used);
+
+  /* Every node is reached through updated pointers, the moved ones are on
+     the first empty page.  */
+  long found_sum = 0;
+  size_t moved = 0;
+  for (void **node = holder[0]; node != NULL; node = node[0])
+    {
+      size_t offset = calc_heap_offset (node, h);
+      CU_ASSERT_TRUE (offset / PAGE_SIZE < FILLED_PAGES - 2
+                      || offset / PAGE_SIZE == FILLED_PAGES);
+      CU_ASSERT_TRUE (
+          is_offset_allocated (h->alloc_map, offset - sizeof (header_t)));
+      CU_ASSERT_TRUE (
+          is_object_start (h->start_map, offset - sizeof (header_t)));
+      moved += offset / PAGE_SIZE == FILLED_PAGES;
+      found_sum += ((long *)node)[1];
+    }
+  CU_ASSERT_TRUE (moved > 0);
+  CU_ASSERT_EQUAL (found_sum, sum);
+
+  h_delete (h);
+}
+
+void
+test_evacuate_on_gc ()
+{
+  heap_options_t options = create_test_options (16 * PAGE_SIZE, false);
+  options.evacuated_pages = 4;
+  heap_t *h = h_init_with_options (&options);
+  void **holder = NULL;
+  long sum = fill_sparse_pages (h, &holder);
+
+  /* An object described by a format string allocated on the heap, on a
+     sparse page, refers to the list.  */
+  void **volatile wide = h_alloc_struct (h, "50*");
+  wide[49] = holder;
+  size_t wide_page = calc_heap_offset (wide, h) / PAGE_SIZE;
+  holder = NULL;
+
+  h_gc (h);
+  CU_ASSERT_PTR_NOT_NULL (h->free_lists);
+  CU_ASSERT_PTR_NULL (h->free_runs);
+
+  /* The stack is safe, so the root itself moves off its sparse page */
+  CU_ASSERT_NOT_EQUAL (calc_heap_offset (wide, h) / PAGE_SIZE, wide_page);
+  header_t header = get_header_value (get_header_pointer (wide));
+  CU_ASSERT_EQUAL (get_header_type (header), HEADER_POINTER_TO_FORMAT_STRING);
+  CU_ASSERT_STRING_EQUAL (get_pointer_in_header (header), "50*");
+
+  long found_sum = 0;
+  holder = wide[49];
+  for (void **node = holder[0]; node != NULL; node = node[0])
+    {
+      found_sum += ((long *)node)[1];
+    }
+  CU_ASSERT_EQUAL (found_sum, sum);
+
+  h_delete (h);
+}
+
+int
+main (void)
+{
+  // First we try to set up CUnit, and exit if we fail
+  if (CU_initialize_registry () != CUE_SUCCESS)
+    return CU_get_error ();
+
+  // We then create an empty test suite and specify the name and
+  // the init and cleanup functions
+  CU_pSuite evacuationtests
+      = CU_add_suite ("Evacuation Testing Suite", init_suite, clean_suite);
+  if (evacuationtests == NULL)
+    {
+      // If the test suite could not be added, tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // This is where we add the test functions to our test suite.
+  // For each call to CU_add_test we specify the test suite, the
+  // name or description of the test, and the function that runs
+  // the test in question. If you want to add another test, just
+  // copy a line below and change the information
+  if ((CU_add_test (evacuationtests, "Test evacuating the sparsest pages",
+                    test_evacuate_sparsest_pages)
+           == NULL
+       || CU_add_test (evacuationtests, "Test evacuating during a collection",
+                       test_evacuate_on_gc)
+              == NULL
+       || 0))
+    {
+      // If adding any of the tests fails, we tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // Set the running mode. Use CU_BRM_VERBOSE for maximum output.
+  // Use CU_BRM_NORMAL to only print errors and a summary
+  CU_basic_set_mode (CU_BRM_VERBOSE);
+
+  // This is where the tests are actually run!
+  CU_basic_run_tests ();
+
+  int exit_code = CU_get_number_of_tests_failed () == 0
+                      ? CU_get_error ()
+                      : CU_get_number_of_tests_failed ();
+
+  // Tear down CUnit before exiting
+  CU_cleanup_registry ();
+
+  return exit_code;
+}
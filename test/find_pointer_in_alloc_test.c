@@ -122,6 +122,65 @@ test_multiple_pointers_in_alloc ()
   h_delete (h);
 }
 
+/**
+ * Collects the visited pointer fields in order, used by
+ * test_for_each_pointer_field
+ */
+struct field_collector
+{
+  void **fields[64];
+  size_t count;
+};
+
+static void
+collect_field (void **field, void *arg)
+{
+  struct field_collector *collector = (struct field_collector *)arg;
+  collector->fields[collector->count++] = field;
+}
+
+void
+test_for_each_pointer_field ()
+{
+  struct test_struct
+  {
+    int i;
+    void *p;
+    long l;
+    void *p2;
+  };
+
+  heap_t *h = h_init (4096, true, 0.5);
+
+  /* Described by a bit vector in the header */
+  struct test_struct *t = h_alloc_struct (h, "i*l*");
+  struct field_collector collector = { .count = 0 };
+  for_each_pointer_field (t, collect_field, &collector);
+
+  CU_ASSERT_EQUAL (collector.count, 2);
+  CU_ASSERT_PTR_EQUAL (collector.fields[0], &t->p);
+  CU_ASSERT_PTR_EQUAL (collector.fields[1], &t->p2);
+
+  /* Too many pointers for a bit vector, described by a format string */
+  void **array = h_alloc_struct (h, "i50*");
+  collector.count = 0;
+  for_each_pointer_field (array, collect_field, &collector);
+
+  CU_ASSERT_EQUAL (collector.count, 50);
+  for (size_t i = 0; i < collector.count; i++)
+    {
+      CU_ASSERT_PTR_EQUAL (collector.fields[i], &array[i + 1]);
+    }
+
+  /* Raw allocations have no pointer fields */
+  void *raw = h_alloc_raw (h, 32);
+  collector.count = 0;
+  for_each_pointer_field (raw, collect_field, &collector);
+  CU_ASSERT_EQUAL (collector.count, 0);
+
+  h_delete (h);
+}
+
 int
 main (void)
 {
@@ -151,6 +210,10 @@ main (void)
                       "where two are the same",
                       test_multiple_pointers_in_alloc)
              == NULL
+      || CU_add_test (suite,
+                      "Visits pointer fields in place without a queue",
+                      test_for_each_pointer_field)
+             == NULL
       || 0)
     {
       CU_cleanup_registry ();
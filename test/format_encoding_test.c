@@ -736,6 +736,64 @@ test_multiple_pointers_from_bit_vector ()
   destroy_ptr_queue (pointers);
 }
 
+/* Collects the offsets of pointer fields found in a struct at address 0.  */
+typedef struct
+{
+  size_t offsets[32];
+  size_t count;
+} offsets_t;
+
+static void
+collect_offset (void **field, void *offsets)
+{
+  offsets_t *collected = offsets;
+  collected->offsets[collected->count++] = (uintptr_t)field;
+}
+
+void
+test_vector_matches_format_string (void)
+{
+  char fields[] = "ilfd*";
+  char format_string[31];
+  srand (1);
+
+  for (int run = 0; run < 1000; run++)
+    {
+      int length = 1 + rand () % 30;
+      for (int i = 0; i < length; i++)
+        {
+          format_string[i] = fields[rand () % (sizeof (fields) - 1)];
+        }
+      format_string[length] = '\0';
+
+      bool success = false;
+      uint_fast64_t size = size_from_string (format_string, &success);
+      CU_ASSERT_TRUE (success);
+      uint_fast64_t vector
+          = convert_to_bit_vector (format_string, size, &success);
+      if (!success)
+        {
+          continue;
+        }
+
+      /* Decoding twice also reads the vector back from the cache.  */
+      CU_ASSERT_EQUAL (size_from_vector (vector), size);
+      CU_ASSERT_EQUAL (size_from_vector (vector), size);
+
+      offsets_t from_string = { .count = 0 };
+      offsets_t from_vector = { .count = 0 };
+      for_each_pointer_in_format_string (format_string, NULL, collect_offset,
+                                         &from_string);
+      for_each_pointer_in_bit_vector (vector, NULL, collect_offset,
+                                      &from_vector);
+      CU_ASSERT_EQUAL (from_vector.count, from_string.count);
+      for (size_t i = 0; i < from_string.count && i < from_vector.count; i++)
+        {
+          CU_ASSERT_EQUAL (from_vector.offsets[i], from_string.offsets[i]);
+        }
+    }
+}
+
 int
 main (void)
 {
@@ -927,6 +985,11 @@ main (void)
                       "where two are the same",
                       test_multiple_pointers_from_bit_vector)
              == NULL
+      || CU_add_test (get_pointers_tests,
+                      "Size and pointers from bit vectors match the format "
+                      "string they were converted from",
+                      test_vector_matches_format_string)
+             == NULL
       || 0)
     {
       // If adding any of the tests fails, we tear down CUnit and exit
@@ -0,0 +1,135 @@
+#include <CUnit/Basic.h>
+#include <stdlib.h>
+
+#include "../src/forwarding_table.h"
+
+#define TEST_HEAP_SIZE (4 * FORWARDING_BLOCK_SIZE)
+
+int
+init_suite (void)
+{
+  // Change this function if you want to do something *before* you
+  // run a test suite
+  return 0;
+}
+
+int
+clean_suite (void)
+{
+  // Change this function if you want to do something *after* you
+  // run a test suite
+  return 0;
+}
+
+void
+test_forwarding_table_slide ()
+{
+  forwarding_table_t *table = create_forwarding_table (TEST_HEAP_SIZE);
+
+  /* Objects of 32, 48 and 64 bytes with holes between them, the last one in
+     the second block.  */
+  record_object (table, 32, 32, true);
+  record_object (table, 128, 48, true);
+  record_object (table, FORWARDING_BLOCK_SIZE + 64, 64, true);
+  compute_block_destinations (table, 0, TEST_HEAP_SIZE);
+
+  CU_ASSERT_TRUE (is_moved_object (table, 32));
+  CU_ASSERT_FALSE (is_moved_object (table, 96));
+  CU_ASSERT_EQUAL (get_forwarding_offset (table, 32), 0);
+  CU_ASSERT_EQUAL (get_forwarding_offset (table, 128), 32);
+  CU_ASSERT_EQUAL (get_forwarding_offset (table, FORWARDING_BLOCK_SIZE + 64),
+                   80);
+
+  CU_ASSERT_EQUAL (get_recorded_object_size (table, 32), 32);
+  CU_ASSERT_EQUAL (get_recorded_object_size (table, 128), 48);
+  CU_ASSERT_EQUAL (
+      get_recorded_object_size (table, FORWARDING_BLOCK_SIZE + 64), 64);
+
+  destroy_forwarding_table (table);
+}
+
+void
+test_forwarding_table_fixed_blocks ()
+{
+  forwarding_table_t *table = create_forwarding_table (TEST_HEAP_SIZE);
+
+  /* An object staying at the end of the first block and into the second */
+  size_t pinned = FORWARDING_BLOCK_SIZE - 32;
+  CU_ASSERT_TRUE (fix_object_range (table, pinned, 64));
+  CU_ASSERT_FALSE (fix_object_range (table, pinned, 64));
+  CU_ASSERT_TRUE (is_range_fixed (table, 0, 16));
+  CU_ASSERT_TRUE (is_range_fixed (table, FORWARDING_BLOCK_SIZE + 16, 16));
+  CU_ASSERT_FALSE (is_range_fixed (table, 2 * FORWARDING_BLOCK_SIZE, 16));
+
+  /* Objects in fixed blocks stay, the ones after them slide up to the end
+     of the last object that stays.  */
+  record_object (table, 0, 32, false);
+  record_object (table, pinned, 64, false);
+  record_object (table, 2 * FORWARDING_BLOCK_SIZE + 256, 32, true);
+  record_object (table, 3 * FORWARDING_BLOCK_SIZE, 16, true);
+  compute_block_destinations (table, 0, TEST_HEAP_SIZE);
+
+  CU_ASSERT_FALSE (is_moved_object (table, pinned));
+  CU_ASSERT_EQUAL (get_recorded_object_size (table, pinned), 64);
+  CU_ASSERT_EQUAL (
+      get_forwarding_offset (table, 2 * FORWARDING_BLOCK_SIZE + 256),
+      pinned + 64);
+  CU_ASSERT_EQUAL (get_forwarding_offset (table, 3 * FORWARDING_BLOCK_SIZE),
+                   pinned + 96);
+
+  destroy_forwarding_table (table);
+}
+
+int
+main (void)
+{
+  // First we try to set up CUnit, and exit if we fail
+  if (CU_initialize_registry () != CUE_SUCCESS)
+    return CU_get_error ();
+
+  // We then create an empty test suite and specify the name and
+  // the init and cleanup functions
+  CU_pSuite forwardingtests
+      = CU_add_suite ("Forwarding table Testing Suite", init_suite, clean_suite);
+  if (forwardingtests == NULL)
+    {
+      // If the test suite could not be added, tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // This is where we add the test functions to our test suite.
+  // For each call to CU_add_test we specify the test suite, the
+  // name or description of the test, and the function that runs
+  // the test in question. If you want to add another test, just
+  // copy a line below and change the information
+  if ((CU_add_test (forwardingtests, "Test sliding objects over holes",
+                    test_forwarding_table_slide)
+           == NULL
+       || CU_add_test (forwardingtests,
+                       "Test that objects in fixed blocks stay",
+                       test_forwarding_table_fixed_blocks)
+              == NULL
+       || 0))
+    {
+      // If adding any of the tests fails, we tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // Set the running mode. Use CU_BRM_VERBOSE for maximum output.
+  // Use CU_BRM_NORMAL to only print errors and a summary
+  CU_basic_set_mode (CU_BRM_VERBOSE);
+
+  // This is where the tests are actually run!
+  CU_basic_run_tests ();
+
+  int exit_code = CU_get_number_of_tests_failed () == 0
+                      ? CU_get_error ()
+                      : CU_get_number_of_tests_failed ();
+
+  // Tear down CUnit before exiting
+  CU_cleanup_registry ();
+
+  return exit_code;
+}
@@ -0,0 +1,143 @@
+#include <CUnit/Basic.h>
+#include <stdlib.h>
+
+#include "../src/allocation_map.h"
+#include "../src/free_lists.h"
+
+#define TEST_PAGE_SIZE 2048
+
+int
+init_suite (void)
+{
+  // Change this function if you want to do something *before* you
+  // run a test suite
+  return 0;
+}
+
+int
+clean_suite (void)
+{
+  // Change this function if you want to do something *after* you
+  // run a test suite
+  return 0;
+}
+
+void
+test_free_lists_size_classes ()
+{
+  /* One class per granule count up to 8 granules */
+  CU_ASSERT_EQUAL (get_size_class (16), 0);
+  CU_ASSERT_EQUAL (get_size_class (32), 1);
+  CU_ASSERT_EQUAL (get_size_class (128), 7);
+
+  /* Then one class per power of two */
+  CU_ASSERT_EQUAL (get_size_class (144), 8);
+  CU_ASSERT_EQUAL (get_size_class (256), 8);
+  CU_ASSERT_EQUAL (get_size_class (272), 9);
+  CU_ASSERT_EQUAL (get_size_class (TEST_PAGE_SIZE), 11);
+  CU_ASSERT_EQUAL (get_size_class (64 * TEST_PAGE_SIZE),
+                   SIZE_CLASS_COUNT - 1);
+}
+
+void
+test_free_lists_take ()
+{
+  size_t bytes = 4 * TEST_PAGE_SIZE;
+  char *alloc_map = create_allocation_map (bytes);
+
+  /* Page 0: a hole of 32 bytes. Page 1: a hole of 48 bytes. Page 2 and 3:
+     empty.  */
+  update_alloc_map_range (alloc_map, 0, 32, true);
+  update_alloc_map_range (alloc_map, 64, TEST_PAGE_SIZE - 64, true);
+  update_alloc_map_range (alloc_map, TEST_PAGE_SIZE, 256, true);
+  update_alloc_map_range (alloc_map, TEST_PAGE_SIZE + 304,
+                          TEST_PAGE_SIZE - 304, true);
+
+  free_lists_t *lists = create_free_lists (bytes, TEST_PAGE_SIZE);
+  CU_ASSERT_EQUAL (get_swept_page_count (lists), 0);
+
+  /* Pages are only swept once the chunks found so far do not fit */
+  size_t offset = 0;
+  CU_ASSERT_TRUE (take_free_chunk (lists, alloc_map, 32, &offset));
+  CU_ASSERT_EQUAL (offset, 32);
+  CU_ASSERT_EQUAL (get_swept_page_count (lists), 1);
+
+  CU_ASSERT_TRUE (take_free_chunk (lists, alloc_map, 40, &offset));
+  CU_ASSERT_EQUAL (offset, TEST_PAGE_SIZE + 256);
+  CU_ASSERT_EQUAL (get_swept_page_count (lists), 2);
+
+  /* The rest of a chunk is put back in the class of its new size */
+  CU_ASSERT_TRUE (take_free_chunk (lists, alloc_map, 16, &offset));
+  CU_ASSERT_EQUAL (offset, 2 * TEST_PAGE_SIZE);
+  CU_ASSERT_EQUAL (get_swept_page_count (lists), 3);
+  CU_ASSERT_EQUAL (get_free_chunk_count (lists, get_size_class (2032)), 1);
+
+  CU_ASSERT_TRUE (take_free_chunk (lists, alloc_map, 112, &offset));
+  CU_ASSERT_EQUAL (offset, 2 * TEST_PAGE_SIZE + 16);
+  CU_ASSERT_EQUAL (get_swept_page_count (lists), 3);
+
+  /* Chunks never cross a page */
+  CU_ASSERT_FALSE (
+      take_free_chunk (lists, alloc_map, 2 * TEST_PAGE_SIZE, &offset));
+  CU_ASSERT_EQUAL (get_swept_page_count (lists), 4);
+
+  reset_free_lists (lists);
+  CU_ASSERT_EQUAL (get_swept_page_count (lists), 0);
+  CU_ASSERT_EQUAL (get_free_chunk_count (lists, get_size_class (2032)), 0);
+
+  destroy_free_lists (lists);
+  free (alloc_map);
+}
+
+int
+main (void)
+{
+  // First we try to set up CUnit, and exit if we fail
+  if (CU_initialize_registry () != CUE_SUCCESS)
+    return CU_get_error ();
+
+  // We then create an empty test suite and specify the name and
+  // the init and cleanup functions
+  CU_pSuite freelisttests
+      = CU_add_suite ("Free lists Testing Suite", init_suite, clean_suite);
+  if (freelisttests == NULL)
+    {
+      // If the test suite could not be added, tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // This is where we add the test functions to our test suite.
+  // For each call to CU_add_test we specify the test suite, the
+  // name or description of the test, and the function that runs
+  // the test in question. If you want to add another test, just
+  // copy a line below and change the information
+  if ((CU_add_test (freelisttests, "Test size classes",
+                    test_free_lists_size_classes)
+           == NULL
+       || CU_add_test (freelisttests, "Test taking chunks swept lazily",
+                       test_free_lists_take)
+              == NULL
+       || 0))
+    {
+      // If adding any of the tests fails, we tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // Set the running mode. Use CU_BRM_VERBOSE for maximum output.
+  // Use CU_BRM_NORMAL to only print errors and a summary
+  CU_basic_set_mode (CU_BRM_VERBOSE);
+
+  // This is where the tests are actually run!
+  CU_basic_run_tests ();
+
+  int exit_code = CU_get_number_of_tests_failed () == 0
+                      ? CU_get_error ()
+                      : CU_get_number_of_tests_failed ();
+
+  // Tear down CUnit before exiting
+  CU_cleanup_registry ();
+
+  return exit_code;
+}
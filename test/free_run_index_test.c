@@ -0,0 +1,160 @@
+#include <CUnit/Basic.h>
+#include <stdlib.h>
+
+#include "../src/allocation_map.h"
+#include "../src/free_run_index.h"
+
+#define TEST_PAGE_SIZE 2048
+
+int
+init_suite (void)
+{
+  // Change this function if you want to do something *before* you
+  // run a test suite
+  return 0;
+}
+
+int
+clean_suite (void)
+{
+  // Change this function if you want to do something *after* you
+  // run a test suite
+  return 0;
+}
+
+void
+test_free_run_index_empty_heap ()
+{
+  size_t bytes = 4 * TEST_PAGE_SIZE;
+  char *alloc_map = create_allocation_map (bytes);
+
+  /* An empty heap has one run per page */
+  free_run_index_t *index
+      = create_free_run_index (alloc_map, bytes, TEST_PAGE_SIZE);
+  CU_ASSERT_EQUAL (get_free_run_count (index), 4);
+
+  size_t offset = 0;
+  CU_ASSERT_TRUE (find_free_run (index, TEST_PAGE_SIZE, &offset));
+  CU_ASSERT_EQUAL (offset, 0);
+
+  /* A run can not cross into the next page */
+  offset = 16;
+  CU_ASSERT_TRUE (find_free_run (index, TEST_PAGE_SIZE, &offset));
+  CU_ASSERT_EQUAL (offset, TEST_PAGE_SIZE);
+
+  offset = 16;
+  CU_ASSERT_TRUE (find_free_run (index, 32, &offset));
+  CU_ASSERT_EQUAL (offset, 16);
+
+  destroy_free_run_index (index);
+  free (alloc_map);
+}
+
+void
+test_free_run_index_holes ()
+{
+  size_t bytes = 4 * TEST_PAGE_SIZE;
+  char *alloc_map = create_allocation_map (bytes);
+
+  /* Page 0: pinned islands leaving holes of 32 and 64 bytes, and the rest
+     of the page. Page 1 and 2: full. Page 3: empty. */
+  update_alloc_map_range (alloc_map, 32, 16, true);
+  update_alloc_map_range (alloc_map, 112, 16, true);
+  update_alloc_map_range (alloc_map, 256, 16, true);
+  update_alloc_map_range (alloc_map, TEST_PAGE_SIZE, 2 * TEST_PAGE_SIZE,
+                          true);
+
+  free_run_index_t *index
+      = create_free_run_index (alloc_map, bytes, TEST_PAGE_SIZE);
+  /* [0, 32), [48, 112), [128, 256), [272, 2048) and page 3 */
+  CU_ASSERT_EQUAL (get_free_run_count (index), 5);
+
+  size_t offset = 0;
+  CU_ASSERT_TRUE (find_free_run (index, 32, &offset));
+  CU_ASSERT_EQUAL (offset, 0);
+
+  offset = 0;
+  CU_ASSERT_TRUE (find_free_run (index, 48, &offset));
+  CU_ASSERT_EQUAL (offset, 48);
+
+  /* Non granule sized requests round up */
+  offset = 0;
+  CU_ASSERT_TRUE (find_free_run (index, 65, &offset));
+  CU_ASSERT_EQUAL (offset, 128);
+
+  /* Part of a hole before the start offset is not used */
+  offset = 64;
+  CU_ASSERT_TRUE (find_free_run (index, 48, &offset));
+  CU_ASSERT_EQUAL (offset, 64);
+  offset = 80;
+  CU_ASSERT_TRUE (find_free_run (index, 48, &offset));
+  CU_ASSERT_EQUAL (offset, 128);
+
+  /* Full pages are skipped */
+  offset = 0;
+  CU_ASSERT_TRUE (find_free_run (index, 2000, &offset));
+  CU_ASSERT_EQUAL (offset, 3 * TEST_PAGE_SIZE);
+  offset = 300;
+  CU_ASSERT_TRUE (find_free_run (index, 1776, &offset));
+  CU_ASSERT_EQUAL (offset, 3 * TEST_PAGE_SIZE);
+
+  /* Nothing fits after the last page */
+  offset = 3 * TEST_PAGE_SIZE + 16;
+  CU_ASSERT_FALSE (find_free_run (index, TEST_PAGE_SIZE, &offset));
+
+  destroy_free_run_index (index);
+  free (alloc_map);
+}
+
+int
+main (void)
+{
+  // First we try to set up CUnit, and exit if we fail
+  if (CU_initialize_registry () != CUE_SUCCESS)
+    return CU_get_error ();
+
+  // We then create an empty test suite and specify the name and
+  // the init and cleanup functions
+  CU_pSuite freeruntests
+      = CU_add_suite ("Free run index Testing Suite", init_suite, clean_suite);
+  if (freeruntests == NULL)
+    {
+      // If the test suite could not be added, tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // This is where we add the test functions to our test suite.
+  // For each call to CU_add_test we specify the test suite, the
+  // name or description of the test, and the function that runs
+  // the test in question. If you want to add another test, just
+  // copy a line below and change the information
+  if ((CU_add_test (freeruntests, "Test indexing an empty heap",
+                    test_free_run_index_empty_heap)
+           == NULL
+       || CU_add_test (freeruntests, "Test finding holes between objects",
+                       test_free_run_index_holes)
+              == NULL
+       || 0))
+    {
+      // If adding any of the tests fails, we tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // Set the running mode. Use CU_BRM_VERBOSE for maximum output.
+  // Use CU_BRM_NORMAL to only print errors and a summary
+  CU_basic_set_mode (CU_BRM_VERBOSE);
+
+  // This is where the tests are actually run!
+  CU_basic_run_tests ();
+
+  int exit_code = CU_get_number_of_tests_failed () == 0
+                      ? CU_get_error ()
+                      : CU_get_number_of_tests_failed ();
+
+  // Tear down CUnit before exiting
+  CU_cleanup_registry ();
+
+  return exit_code;
+}
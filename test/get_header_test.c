@@ -90,11 +90,11 @@ test_header_forwarding_address (void)
 }
 
 void
-test_header_unused (void)
+test_header_layout_index (void)
 {
   /* Last 2 bits are 10  */
   int_fast64_t binary_string = 0x2;
-  CU_ASSERT_EQUAL (get_header_type (binary_string), HEADER_UNUSED);
+  CU_ASSERT_EQUAL (get_header_type (binary_string), HEADER_LAYOUT_INDEX);
 }
 
 void
@@ -131,9 +131,10 @@ test_change_header (void)
   CU_ASSERT_EQUAL (point_binary,
                    (binary_string & mask) | HEADER_POINTER_TO_FORMAT_STRING);
 
-  uint64_t unused_binary = set_header_unused (binary_string);
-  CU_ASSERT_EQUAL (get_header_type (unused_binary), HEADER_UNUSED);
-  CU_ASSERT_EQUAL (unused_binary, (binary_string & mask) | HEADER_UNUSED);
+  uint64_t layout_binary = set_header_layout_index (binary_string);
+  CU_ASSERT_EQUAL (get_header_type (layout_binary), HEADER_LAYOUT_INDEX);
+  CU_ASSERT_EQUAL (layout_binary,
+                   (binary_string & mask) | HEADER_LAYOUT_INDEX);
 }
 
 void
@@ -162,9 +163,10 @@ test_change_large_header (void)
   CU_ASSERT_EQUAL (point_binary,
                    (binary_string & mask) | HEADER_POINTER_TO_FORMAT_STRING);
 
-  uint64_t unused_binary = set_header_unused (binary_string);
-  CU_ASSERT_EQUAL (get_header_type (unused_binary), HEADER_UNUSED);
-  CU_ASSERT_EQUAL (unused_binary, (binary_string & mask) | HEADER_UNUSED);
+  uint64_t layout_binary = set_header_layout_index (binary_string);
+  CU_ASSERT_EQUAL (get_header_type (layout_binary), HEADER_LAYOUT_INDEX);
+  CU_ASSERT_EQUAL (layout_binary,
+                   (binary_string & mask) | HEADER_LAYOUT_INDEX);
 }
 
 void
@@ -211,7 +213,8 @@ main ()
                     test_header_pointer_to_format_string)
       || !CU_add_test (suite, "Test HEADER_FORWARDING_ADDRESS",
                        test_header_forwarding_address)
-      || !CU_add_test (suite, "Test HEADER_UNUSED", test_header_unused)
+      || !CU_add_test (suite, "Test HEADER_LAYOUT_INDEX",
+                       test_header_layout_index)
       || !CU_add_test (suite, "Test HEADER_BIT_VECTOR", test_header_bit_vector)
       || !CU_add_test (suite, "Test change", test_change_header)
       || !CU_add_test (suite, "Test change large header",
@@ -0,0 +1,403 @@
+#include <CUnit/Basic.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/allocation.h"
+#include "../src/allocation_map.h"
+#include "../src/bitmap.h"
+#include "../src/compacting.h"
+#include "../src/gc.h"
+#include "../src/gc_utils.h"
+#include "../src/header.h"
+#include "../src/heap_internal.h"
+#include "../src/mark_map.h"
+#include "test_helpers.h"
+
+int
+init_suite (void)
+{
+  // Change this function if you want to do something *before* you
+  // run a test suite
+  return 0;
+}
+
+int
+clean_suite (void)
+{
+  // Change this function if you want to do something *after* you
+  // run a test suite
+  return 0;
+}
+
+/**
+ * Creates a root map holding a single object.
+ */
+static char *
+create_single_root_map (heap_t *h, void *root)
+{
+  char *root_map = create_mark_map (h->size);
+  if (root != NULL)
+    {
+      size_t offset = calc_heap_offset (root, h) - sizeof (header_t);
+      update_mark_map (root_map, offset, true);
+    }
+  return root_map;
+}
+
+/**
+ * Checks if the mark bit of an object is set.
+ */
+static bool
+is_object_marked (heap_t *h, void *object)
+{
+  return is_offset_marked (h->mark_map,
+                           calc_heap_offset (object, h) - sizeof (header_t));
+}
+
+void
+test_incremental_marking_matches_full_marking ()
+{
+  heap_t *h = h_init (32 * PAGE_SIZE, true, 1);
+
+  /* Lists with garbage between their nodes */
+  size_t list_count = 8;
+  void **lists = h_alloc_array (h, h_register_layout (h, "*"), list_count);
+  for (size_t i = 0; i < 500; i++)
+    {
+      h_alloc_struct (h, "2l");
+      void **node = h_alloc_struct (h, "*l");
+      node[0] = lists[i % list_count];
+      lists[i % list_count] = node;
+    }
+  char *root_map = create_single_root_map (h, lists);
+
+  find_living_objects (h, root_map);
+  size_t map_size = calc_bitmap_size (h->size / MIN_ALLOC_OBJECT_SIZE);
+  char *full_marks = malloc (map_size);
+  memcpy (full_marks, h->mark_map, map_size);
+
+  /* Without a budget every slice stops the first time it looks at the
+     clock.  */
+  incremental_mark_t *mark = start_incremental_marking (h, root_map);
+  size_t slices = 1;
+  while (!mark_incrementally (mark, 0))
+    {
+      slices++;
+    }
+  CU_ASSERT_TRUE (slices > 1);
+
+  char *no_roots = create_single_root_map (h, NULL);
+  finish_incremental_marking (mark, no_roots);
+  destroy_incremental_marking (mark);
+  CU_ASSERT_EQUAL (memcmp (full_marks, h->mark_map, map_size), 0);
+
+  free (no_roots);
+  free (full_marks);
+  free (root_map);
+  h_delete (h);
+}
+
+void
+test_write_barrier_shades_stored_object ()
+{
+  heap_t *h = h_init (8 * PAGE_SIZE, true, 1);
+  CU_ASSERT_PTR_EQUAL (global_heap, h);
+
+  void **root = h_alloc_struct (h, "*");
+  void **hidden = h_alloc_struct (h, "*");
+  hidden[0] = h_alloc_struct (h, "l");
+  char *root_map = create_single_root_map (h, root);
+
+  /* Mark everything reachable, turning the root black */
+  h->incremental_mark = start_incremental_marking (h, root_map);
+  CU_ASSERT_TRUE (mark_incrementally (h->incremental_mark, 1));
+  CU_ASSERT_TRUE (is_object_marked (h, root));
+  CU_ASSERT_FALSE (is_object_marked (h, hidden));
+
+  /* Storing a white object into the black root shades it grey */
+  h_write_ptr (root, &root[0], hidden);
+  CU_ASSERT_TRUE (is_object_marked (h, hidden));
+  CU_ASSERT_FALSE (is_object_marked (h, hidden[0]));
+  CU_ASSERT_TRUE (mark_incrementally (h->incremental_mark, 1));
+  CU_ASSERT_TRUE (is_object_marked (h, hidden[0]));
+
+  destroy_incremental_marking (h->incremental_mark);
+  h->incremental_mark = NULL;
+  free (root_map);
+  h_delete (h);
+}
+
+void
+test_allocation_during_marking_is_black ()
+{
+  heap_t *h = h_init (8 * PAGE_SIZE, true, 1);
+  char *root_map = create_single_root_map (h, NULL);
+
+  void *before = h_alloc_struct (h, "*l");
+  h->incremental_mark = start_incremental_marking (h, root_map);
+  void *during = h_alloc_struct (h, "*l");
+  void *large = h_alloc_raw (h, 2 * PAGE_SIZE);
+  CU_ASSERT_FALSE (is_object_marked (h, before));
+  CU_ASSERT_TRUE (is_object_marked (h, during));
+  CU_ASSERT_TRUE (is_object_marked (h, large));
+
+  destroy_incremental_marking (h->incremental_mark);
+  h->incremental_mark = NULL;
+  free (root_map);
+  h_delete (h);
+}
+
+void
+test_gc_step_collects_in_slices ()
+{
+  heap_options_t options = create_test_options (32 * PAGE_SIZE, true);
+  options.max_pause_ms = 0.001f;
+  heap_t *h = h_init_with_options (&options);
+
+  size_t node_count = 500;
+  void **volatile list = NULL;
+  for (size_t i = 0; i < node_count; i++)
+    {
+      h_alloc_struct (h, "2l");
+      void **node = h_alloc_struct (h, "*l");
+      node[0] = list;
+      ((long *)node)[1] = i;
+      list = node;
+    }
+  size_t used = h_used (h);
+
+  size_t steps = 0;
+  size_t collected = 0;
+  do
+    {
+      collected = h_gc_step (h);
+      steps++;
+    }
+  while (h->incremental_mark != NULL);
+  CU_ASSERT_TRUE (steps > 1);
+  CU_ASSERT_TRUE (collected > 0);
+  CU_ASSERT_EQUAL (h_used (h), used - collected);
+
+  /* Every node survives with its value */
+  long sum = 0;
+  size_t found = 0;
+  for (void **node = list; node != NULL; node = node[0])
+    {
+      sum += ((long *)node)[1];
+      found++;
+    }
+  CU_ASSERT_EQUAL (found, node_count);
+  CU_ASSERT_EQUAL (sum, (long)(node_count * (node_count - 1) / 2));
+
+  h_delete (h);
+}
+
+/**
+ * Waits for the marking thread of a concurrent mark to run out of work.
+ */
+static void
+wait_for_concurrent_marking (incremental_mark_t *mark)
+{
+  while (!is_concurrent_marking_done (mark))
+    {
+      sched_yield ();
+    }
+}
+
+void
+test_concurrent_marking_matches_full_marking ()
+{
+  heap_t *h = h_init (32 * PAGE_SIZE, true, 1);
+
+  size_t list_count = 8;
+  void **lists = h_alloc_array (h, h_register_layout (h, "*"), list_count);
+  for (size_t i = 0; i < 500; i++)
+    {
+      h_alloc_struct (h, "2l");
+      void **node = h_alloc_struct (h, "*l");
+      node[0] = lists[i % list_count];
+      lists[i % list_count] = node;
+    }
+  char *root_map = create_single_root_map (h, lists);
+
+  find_living_objects (h, root_map);
+  size_t map_size = calc_bitmap_size (h->size / MIN_ALLOC_OBJECT_SIZE);
+  char *full_marks = malloc (map_size);
+  memcpy (full_marks, h->mark_map, map_size);
+
+  incremental_mark_t *mark = start_incremental_marking (h, root_map);
+  start_concurrent_marking (mark);
+  wait_for_concurrent_marking (mark);
+
+  char *no_roots = create_single_root_map (h, NULL);
+  finish_incremental_marking (mark, no_roots);
+  destroy_incremental_marking (mark);
+  CU_ASSERT_EQUAL (memcmp (full_marks, h->mark_map, map_size), 0);
+
+  free (no_roots);
+  free (full_marks);
+  free (root_map);
+  h_delete (h);
+}
+
+void
+test_concurrent_marking_keeps_snapshot ()
+{
+  heap_options_t options = create_test_options (32 * PAGE_SIZE, true);
+  options.concurrent_marking = true;
+  heap_t *h = h_init_with_options (&options);
+  CU_ASSERT_PTR_EQUAL (global_heap, h);
+
+  /* A long list hanging off the root keeps the marking thread busy */
+  void **root = h_alloc_struct (h, "**");
+  for (size_t i = 0; i < 1000; i++)
+    {
+      void **node = h_alloc_struct (h, "*l");
+      node[0] = root[1];
+      root[1] = node;
+    }
+  void **moved = h_alloc_struct (h, "*");
+  moved[0] = h_alloc_struct (h, "l");
+  root[0] = moved;
+  char *root_map = create_single_root_map (h, root);
+
+  h->incremental_mark = start_incremental_marking (h, root_map);
+  start_concurrent_marking (h->incremental_mark);
+
+  /* Moving the only path to an object while the marking thread runs, it
+     may have traced either place or neither.  */
+  void **new_holder = h_alloc_struct (h, "*");
+  h_write_ptr (new_holder, &new_holder[0], moved);
+  h_write_ptr (root, &root[0], NULL);
+  wait_for_concurrent_marking (h->incremental_mark);
+
+  char *no_roots = create_single_root_map (h, NULL);
+  finish_incremental_marking (h->incremental_mark, no_roots);
+  CU_ASSERT_TRUE (is_object_marked (h, new_holder));
+  CU_ASSERT_TRUE (is_object_marked (h, moved));
+  CU_ASSERT_TRUE (is_object_marked (h, moved[0]));
+
+  destroy_incremental_marking (h->incremental_mark);
+  h->incremental_mark = NULL;
+  free (no_roots);
+  free (root_map);
+  h_delete (h);
+}
+
+void
+test_gc_step_with_concurrent_marking ()
+{
+  heap_options_t options = create_test_options (32 * PAGE_SIZE, true);
+  options.concurrent_marking = true;
+  heap_t *h = h_init_with_options (&options);
+
+  size_t node_count = 500;
+  void **volatile list = NULL;
+  for (size_t i = 0; i < node_count; i++)
+    {
+      h_alloc_struct (h, "2l");
+      void **node = h_alloc_struct (h, "*l");
+      node[0] = list;
+      ((long *)node)[1] = i;
+      list = node;
+    }
+  size_t used = h_used (h);
+
+  /* The first step only starts the marking thread */
+  CU_ASSERT_EQUAL (h_gc_step (h), 0);
+  CU_ASSERT_PTR_NOT_NULL (h->incremental_mark);
+  size_t collected = 0;
+  while (h->incremental_mark != NULL)
+    {
+      collected = h_gc_step (h);
+    }
+  CU_ASSERT_TRUE (collected > 0);
+  CU_ASSERT_EQUAL (h_used (h), used - collected);
+
+  long sum = 0;
+  size_t found = 0;
+  for (void **node = list; node != NULL; node = node[0])
+    {
+      sum += ((long *)node)[1];
+      found++;
+    }
+  CU_ASSERT_EQUAL (found, node_count);
+  CU_ASSERT_EQUAL (sum, (long)(node_count * (node_count - 1) / 2));
+
+  h_delete (h);
+}
+
+int
+main (void)
+{
+  // First we try to set up CUnit, and exit if we fail
+  if (CU_initialize_registry () != CUE_SUCCESS)
+    return CU_get_error ();
+
+  // We then create an empty test suite and specify the name and
+  // the init and cleanup functions
+  CU_pSuite incrementaltests = CU_add_suite (
+      "Incremental Marking Testing Suite", init_suite, clean_suite);
+  if (incrementaltests == NULL)
+    {
+      // If the test suite could not be added, tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // This is where we add the test functions to our test suite.
+  // For each call to CU_add_test we specify the test suite, the
+  // name or description of the test, and the function that runs
+  // the test in question. If you want to add another test, just
+  // copy a line below and change the information
+  if ((CU_add_test (incrementaltests,
+                    "Test that slices mark the same objects as a full mark",
+                    test_incremental_marking_matches_full_marking)
+           == NULL
+       || CU_add_test (incrementaltests,
+                       "Test that the write barrier shades stored objects",
+                       test_write_barrier_shades_stored_object)
+              == NULL
+       || CU_add_test (incrementaltests,
+                       "Test that objects allocated while marking are black",
+                       test_allocation_during_marking_is_black)
+              == NULL
+       || CU_add_test (incrementaltests,
+                       "Test a collection done a slice at a time",
+                       test_gc_step_collects_in_slices)
+              == NULL
+       || CU_add_test (incrementaltests,
+                       "Test that a marking thread marks like a full mark",
+                       test_concurrent_marking_matches_full_marking)
+              == NULL
+       || CU_add_test (incrementaltests,
+                       "Test that overwritten pointers are still marked",
+                       test_concurrent_marking_keeps_snapshot)
+              == NULL
+       || CU_add_test (incrementaltests,
+                       "Test a collection marked on a thread of its own",
+                       test_gc_step_with_concurrent_marking)
+              == NULL
+       || 0))
+    {
+      // If adding any of the tests fails, we tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // Set the running mode. Use CU_BRM_VERBOSE for maximum output.
+  // Use CU_BRM_NORMAL to only print errors and a summary
+  CU_basic_set_mode (CU_BRM_VERBOSE);
+
+  // This is where the tests are actually run!
+  CU_basic_run_tests ();
+
+  int exit_code = CU_get_number_of_tests_failed () == 0
+                      ? CU_get_error ()
+                      : CU_get_number_of_tests_failed ();
+
+  // Tear down CUnit before exiting
+  CU_cleanup_registry ();
+  return exit_code;
+}
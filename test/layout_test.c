@@ -0,0 +1,323 @@
+#include <CUnit/Basic.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../src/allocation.h"
+#include "../src/gc.h"
+#include "../src/get_header.h"
+#include "../src/header.h"
+#include "../src/heap_internal.h"
+#include "../src/layout.h"
+
+/* The amount of threads registering layouts at once */
+#define REGISTERING_THREADS 4
+
+/* The amount of layouts registered by each thread, more than fit a chunk */
+#define LAYOUTS_PER_THREAD 300
+
+int
+init_suite (void)
+{
+  // Change this function if you want to do something *before* you
+  // run a test suite
+  return 0;
+}
+
+int
+clean_suite (void)
+{
+  // Change this function if you want to do something *after* you
+  // run a test suite
+  return 0;
+}
+
+static void
+count_field (void **field, void *count)
+{
+  (void)field;
+  (*(size_t *)count)++;
+}
+
+void
+test_register_layout ()
+{
+  heap_t *h = h_init (1024, true, 1);
+
+  layout_handle_t pair = h_register_layout (h, "**");
+  CU_ASSERT_NOT_EQUAL (pair, INVALID_LAYOUT);
+  CU_ASSERT_EQUAL (h_register_layout (h, "**"), pair);
+
+  layout_handle_t other = h_register_layout (h, "*il");
+  CU_ASSERT_NOT_EQUAL (other, INVALID_LAYOUT);
+  CU_ASSERT_NOT_EQUAL (other, pair);
+
+  CU_ASSERT_PTR_NULL (h_alloc_layout (h, INVALID_LAYOUT));
+
+  /* Handles outlive the heap they were registered with.  */
+  h_delete (h);
+  h = h_init (1024, true, 1);
+  CU_ASSERT_EQUAL (h_register_layout (h, "**"), pair);
+  h_delete (h);
+}
+
+/**
+ * Registers the layouts of structs with 1 to LAYOUTS_PER_THREAD pointers and
+ * a long, into the array of handles given as argument.
+ */
+static void *
+register_pointer_layouts (void *arg)
+{
+  layout_handle_t *handles = arg;
+  for (int i = 0; i < LAYOUTS_PER_THREAD; i++)
+    {
+      char format[16];
+      snprintf (format, sizeof (format), "%d*l", i + 1);
+      handles[i] = register_layout (format);
+    }
+  return NULL;
+}
+
+void
+test_register_layout_in_threads ()
+{
+  pthread_t threads[REGISTERING_THREADS];
+  layout_handle_t handles[REGISTERING_THREADS][LAYOUTS_PER_THREAD];
+  for (int t = 0; t < REGISTERING_THREADS; t++)
+    {
+      pthread_create (&threads[t], NULL, register_pointer_layouts,
+                      handles[t]);
+    }
+  for (int t = 0; t < REGISTERING_THREADS; t++)
+    {
+      pthread_join (threads[t], NULL);
+    }
+
+  /* Every thread got the same handle for the same layout */
+  for (int i = 0; i < LAYOUTS_PER_THREAD; i++)
+    {
+      CU_ASSERT_TRUE (is_registered_layout (handles[0][i]));
+      CU_ASSERT_EQUAL (get_layout_size (handles[0][i]),
+                       align_alloc_size ((i + 2) * sizeof (void *)));
+      for (int t = 1; t < REGISTERING_THREADS; t++)
+        {
+          CU_ASSERT_EQUAL (handles[t][i], handles[0][i]);
+        }
+    }
+}
+
+void
+test_alloc_small_layout ()
+{
+  heap_t *h = h_init (1024, true, 1);
+
+  layout_handle_t handle = h_register_layout (h, "*i*");
+  void **alloc = h_alloc_layout (h, handle);
+  CU_ASSERT_PTR_NOT_NULL (alloc);
+
+  /* Small layouts get the same header as h_alloc_struct gives them.  */
+  void **expected = h_alloc_struct (h, "*i*");
+  CU_ASSERT_EQUAL (get_header_value (get_header_pointer (alloc)),
+                   get_header_value (get_header_pointer (expected)));
+  CU_ASSERT_EQUAL (calc_alloc_size ((char *)alloc),
+                   calc_alloc_size ((char *)expected));
+
+  h_delete (h);
+}
+
+void
+test_alloc_large_layout ()
+{
+  heap_t *h = h_init (4096, true, 1);
+  size_t used_before = h_used (h);
+
+  layout_handle_t handle = h_register_layout (h, "50*");
+  void **alloc = h_alloc_layout (h, handle);
+  CU_ASSERT_PTR_NOT_NULL (alloc);
+
+  /* Too many fields for a bit vector, and no format string in the heap.  */
+  header_t header = get_header_value (get_header_pointer (alloc));
+  CU_ASSERT_EQUAL (get_header_type (header), HEADER_LAYOUT_INDEX);
+  CU_ASSERT_EQUAL (get_layout_in_header (header), handle);
+  size_t size = align_alloc_size (50 * sizeof (void *));
+  CU_ASSERT_EQUAL (calc_alloc_size ((char *)alloc), size);
+  CU_ASSERT_EQUAL (h_used (h) - used_before, size);
+
+  size_t pointer_count = 0;
+  for_each_pointer_field (alloc, count_field, &pointer_count);
+  CU_ASSERT_EQUAL (pointer_count, 50);
+
+  h_delete (h);
+}
+
+void
+test_layout_survives_gc ()
+{
+  heap_t *h = h_init (4096, false, 1);
+
+  layout_handle_t handle = h_register_layout (h, "40*");
+  void **alloc = h_alloc_layout (h, handle);
+  for (size_t i = 0; i < 40; i++)
+    {
+      alloc[i] = h_alloc_raw (h, sizeof (long));
+      *(long *)alloc[i] = i;
+    }
+
+  h_gc (h);
+
+  CU_ASSERT_EQUAL (get_header_type (get_header_value (get_header_pointer (
+                       alloc))),
+                   HEADER_LAYOUT_INDEX);
+  for (size_t i = 0; i < 40; i++)
+    {
+      CU_ASSERT_EQUAL (*(long *)alloc[i], (long)i);
+    }
+  CU_ASSERT_EQUAL (h_used (h),
+                   align_alloc_size (40 * sizeof (void *))
+                       + 40 * align_alloc_size (sizeof (long)));
+
+  h_delete (h);
+}
+
+void
+test_alloc_array ()
+{
+  heap_t *h = h_init (4096, true, 1);
+
+  void **pointers = h_alloc_array (h, h_register_layout (h, "*"), 100);
+  CU_ASSERT_PTR_NOT_NULL (pointers);
+  header_t header = get_header_value (get_header_pointer (pointers));
+  CU_ASSERT_EQUAL (get_header_type (header), HEADER_LAYOUT_INDEX);
+  CU_ASSERT_TRUE (is_array_header (header));
+  CU_ASSERT_EQUAL (get_array_length (header), 100);
+  CU_ASSERT_EQUAL (get_array_element_layout (header),
+                   h_register_layout (h, "*"));
+  CU_ASSERT_EQUAL (calc_alloc_size ((char *)pointers),
+                   align_alloc_size (100 * sizeof (void *)));
+
+  size_t pointer_count = 0;
+  for_each_pointer_field (pointers, count_field, &pointer_count);
+  CU_ASSERT_EQUAL (pointer_count, 100);
+
+  /* Elements are laid out like a C array of structs.  */
+  struct
+  {
+    void *p;
+    int i;
+  } *pairs = h_alloc_array (h, h_register_layout (h, "*i"), 10);
+  CU_ASSERT_EQUAL (calc_alloc_size ((char *)pairs),
+                   align_alloc_size (10 * sizeof (*pairs)));
+  pointer_count = 0;
+  for_each_pointer_field (pairs, count_field, &pointer_count);
+  CU_ASSERT_EQUAL (pointer_count, 10);
+
+  CU_ASSERT_PTR_NOT_NULL (h_alloc_array (h, h_register_layout (h, "i"), 0));
+  CU_ASSERT_PTR_NULL (h_alloc_array (h, INVALID_LAYOUT, 1));
+
+  h_delete (h);
+}
+
+/* Fills an array in its own frame, so no pointers into the middle of it are
+   left on the stack of the test to be taken for objects.  */
+static void __attribute__ ((noinline))
+fill_array (heap_t *h, long **array, size_t length)
+{
+  for (size_t i = 0; i < length; i++)
+    {
+      h_alloc_raw (h, sizeof (long)); /* garbage between the elements */
+      array[i] = h_alloc_raw (h, sizeof (long));
+      *array[i] = i;
+    }
+}
+
+void
+test_array_survives_gc ()
+{
+  heap_t *h = h_init (16384, false, 1);
+  /* Leaves no room on the stack for the rest of the array at times.  */
+  h->mark_stack_size = 4;
+
+  size_t length = 3 * 128 + 7;
+  long **array = h_alloc_array (h, h_register_layout (h, "*"), length);
+  fill_array (h, array, length);
+
+  h_gc (h);
+
+  for (size_t i = 0; i < length; i++)
+    {
+      CU_ASSERT_EQUAL (*array[i], (long)i);
+    }
+  CU_ASSERT_EQUAL (h_used (h),
+                   align_alloc_size (length * sizeof (void *))
+                       + length * align_alloc_size (sizeof (long)));
+
+  h_delete (h);
+}
+
+int
+main ()
+{
+  // First we try to set up CUnit, and exit if we fail
+  if (CU_initialize_registry () != CUE_SUCCESS)
+    return CU_get_error ();
+
+  // We then create an empty test suite and specify the name and
+  // the init and cleanup functions
+  CU_pSuite layouttests
+      = CU_add_suite ("Tests for the layout registry", init_suite,
+                      clean_suite);
+  if (layouttests == NULL)
+    {
+      // If the test suite could not be added, tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // This is where we add the test functions to our test suite.
+  // For each call to CU_add_test we specify the test suite, the
+  // name or description of the test, and the function that runs
+  // the test in question. If you want to add another test, just
+  // copy a line below and change the information
+  if ((CU_add_test (layouttests, "Test registering layouts",
+                    test_register_layout)
+           == NULL
+       || CU_add_test (layouttests, "Test registering layouts in threads",
+                       test_register_layout_in_threads)
+              == NULL
+       || CU_add_test (layouttests, "Test allocating a small layout",
+                       test_alloc_small_layout)
+              == NULL
+       || CU_add_test (layouttests, "Test allocating a large layout",
+                       test_alloc_large_layout)
+              == NULL
+       || CU_add_test (layouttests, "Test layout objects surviving gc",
+                       test_layout_survives_gc)
+              == NULL
+       || CU_add_test (layouttests, "Test allocating arrays", test_alloc_array)
+              == NULL
+       || CU_add_test (layouttests, "Test arrays surviving gc",
+                       test_array_survives_gc)
+              == NULL
+       || 0))
+    {
+      // If adding any of the tests fails, we tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // Set the running mode. Use CU_BRM_VERBOSE for maximum output.
+  // Use CU_BRM_NORMAL to only print errors and a summary
+  CU_basic_set_mode (CU_BRM_VERBOSE);
+
+  // This is where the tests are actually run!
+  CU_basic_run_tests ();
+
+  int exit_code = CU_get_number_of_tests_failed () == 0
+                      ? CU_get_error ()
+                      : CU_get_number_of_tests_failed ();
+
+  // Tear down CUnit before exiting
+  CU_cleanup_registry ();
+
+  return exit_code;
+}
@@ -0,0 +1,188 @@
+#include <CUnit/Basic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/allocation_map.h"
+#include "../src/gc.h"
+#include "../src/heap_internal.h"
+#include "../src/mark_map.h"
+
+int
+init_suite (void)
+{
+  // Change this function if you want to do something *before* you
+  // run a test suite
+  return 0;
+}
+
+int
+clean_suite (void)
+{
+  // Change this function if you want to do something *after* you
+  // run a test suite
+  return 0;
+}
+
+void
+test_mark_map_create (void)
+{
+  size_t bytes = 2048;
+
+  char *mark_map = create_mark_map (bytes);
+  CU_ASSERT_PTR_NOT_NULL (mark_map);
+
+  // No granule should be marked in a new map
+  for (size_t offset = 0; offset < bytes; offset += MIN_ALLOC_OBJECT_SIZE)
+    {
+      CU_ASSERT_FALSE (is_offset_marked (mark_map, offset));
+    }
+
+  free (mark_map);
+}
+
+void
+test_mark_map_update (void)
+{
+  size_t bytes = 2048;
+  char *mark_map = create_mark_map (bytes);
+
+  update_mark_map (mark_map, 32, true);
+  CU_ASSERT_TRUE (is_offset_marked (mark_map, 32));
+  CU_ASSERT_TRUE (is_offset_marked (mark_map, 47)); // Same granule
+  CU_ASSERT_FALSE (is_offset_marked (mark_map, 16));
+  CU_ASSERT_FALSE (is_offset_marked (mark_map, 48));
+
+  update_mark_map (mark_map, 32, false);
+  CU_ASSERT_FALSE (is_offset_marked (mark_map, 32));
+
+  free (mark_map);
+}
+
+void
+test_mark_map_try_mark (void)
+{
+  size_t bytes = 2048;
+  char *mark_map = create_mark_map (bytes);
+
+  /* Only the first mark of an offset claims it */
+  CU_ASSERT_TRUE (try_mark_offset (mark_map, 32));
+  CU_ASSERT_FALSE (try_mark_offset (mark_map, 32));
+  CU_ASSERT_TRUE (is_offset_marked (mark_map, 32));
+
+  /* Other bits of the same byte are not affected */
+  CU_ASSERT_FALSE (is_offset_marked (mark_map, 48));
+  CU_ASSERT_TRUE (try_mark_offset (mark_map, 48));
+  CU_ASSERT_TRUE (is_offset_marked (mark_map, 32));
+
+  free (mark_map);
+}
+
+void
+test_mark_map_scan (void)
+{
+  size_t bytes = 4096;
+  char *mark_map = create_mark_map (bytes);
+
+  size_t offset = 0;
+  CU_ASSERT_FALSE (find_next_marked_offset (mark_map, bytes, &offset));
+
+  // Marks in different bytes of the map, including the last granule
+  update_mark_map (mark_map, 16, true);
+  update_mark_map (mark_map, 1040, true);
+  update_mark_map (mark_map, bytes - MIN_ALLOC_OBJECT_SIZE, true);
+
+  size_t expected[] = { 16, 1040, bytes - MIN_ALLOC_OBJECT_SIZE };
+  size_t found = 0;
+  offset = 0;
+  while (find_next_marked_offset (mark_map, bytes, &offset))
+    {
+      CU_ASSERT_EQUAL (offset, expected[found]);
+      found++;
+      offset += MIN_ALLOC_OBJECT_SIZE;
+    }
+  CU_ASSERT_EQUAL (found, 3);
+
+  // Searching from within a granule starts at the next granule
+  offset = 17;
+  CU_ASSERT_TRUE (find_next_marked_offset (mark_map, bytes, &offset));
+  CU_ASSERT_EQUAL (offset, 1040);
+
+  free (mark_map);
+}
+
+void
+test_mark_map_reset (void)
+{
+  heap_t *h = h_init (2048, false, 1);
+
+  update_mark_map (h->mark_map, 0, true);
+  update_mark_map (h->mark_map, 2032, true);
+  reset_mark_map (h);
+
+  size_t offset = 0;
+  CU_ASSERT_FALSE (find_next_marked_offset (h->mark_map, h->size, &offset));
+
+  h_delete (h);
+}
+
+int
+main (void)
+{
+  // First we try to set up CUnit, and exit if we fail
+  if (CU_initialize_registry () != CUE_SUCCESS)
+    return CU_get_error ();
+
+  // We then create an empty test suite and specify the name and
+  // the init and cleanup functions
+  CU_pSuite markmaptests
+      = CU_add_suite ("Mark map Testing Suite", init_suite, clean_suite);
+  if (markmaptests == NULL)
+    {
+      // If the test suite could not be added, tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // This is where we add the test functions to our test suite.
+  // For each call to CU_add_test we specify the test suite, the
+  // name or description of the test, and the function that runs
+  // the test in question. If you want to add another test, just
+  // copy a line below and change the information
+  if ((CU_add_test (markmaptests, "Test creating a mark map",
+                    test_mark_map_create)
+           == NULL
+       || CU_add_test (markmaptests, "Test marking and unmarking offsets",
+                       test_mark_map_update)
+              == NULL
+       || CU_add_test (markmaptests, "Test claiming offsets atomically",
+                       test_mark_map_try_mark)
+              == NULL
+       || CU_add_test (markmaptests, "Test scanning for marked offsets",
+                       test_mark_map_scan)
+              == NULL
+       || CU_add_test (markmaptests, "Test resetting the mark map of a heap",
+                       test_mark_map_reset)
+              == NULL
+       || 0))
+    {
+      // If adding any of the tests fails, we tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // Set the running mode. Use CU_BRM_VERBOSE for maximum output.
+  // Use CU_BRM_NORMAL to only print errors and a summary
+  CU_basic_set_mode (CU_BRM_VERBOSE);
+
+  // This is where the tests are actually run!
+  CU_basic_run_tests ();
+
+  int exit_code = CU_get_number_of_tests_failed () == 0
+                      ? CU_get_error ()
+                      : CU_get_number_of_tests_failed ();
+
+  // Tear down CUnit before exiting
+  CU_cleanup_registry ();
+
+  return exit_code;
+}
@@ -0,0 +1,324 @@
+#include <CUnit/Basic.h>
+#include <stdlib.h>
+
+#include "../src/allocation.h"
+#include "../src/allocation_map.h"
+#include "../src/gc.h"
+#include "../src/gc_utils.h"
+#include "../src/heap_internal.h"
+#include "../src/mark_region.h"
+#include "test_helpers.h"
+
+/* The amount of lines in each block */
+#define BLOCK_LINES (BLOCK_SIZE / LINE_SIZE)
+
+/* The amount of nodes linked into the list of the collection tests */
+#define LIST_NODES 160
+
+/* The amount of garbage objects allocated after every node of the list */
+#define GARBAGE_PER_NODE 7
+
+int
+init_suite (void)
+{
+  // Change this function if you want to do something *before* you
+  // run a test suite
+  return 0;
+}
+
+int
+clean_suite (void)
+{
+  // Change this function if you want to do something *after* you
+  // run a test suite
+  return 0;
+}
+
+/**
+ * Creates the allocation map of three blocks, where only the first and the
+ * sixth line of the first block and the first line of the last block are
+ * allocated.
+ */
+static char *
+create_three_block_map (void)
+{
+  char *alloc_map = calloc (3 * BLOCK_LINES, sizeof (char));
+  alloc_map[0] = 1;
+  alloc_map[5] = (char)0x80;
+  alloc_map[2 * BLOCK_LINES] = 1;
+  return alloc_map;
+}
+
+void
+test_mark_lines ()
+{
+  mark_region_t *region = create_mark_region (3 * BLOCK_SIZE, PAGE_SIZE);
+  CU_ASSERT_EQUAL (get_recycled_block_count (region), 0);
+  CU_ASSERT_EQUAL (get_free_block_count (region), 3);
+
+  char *alloc_map = create_three_block_map ();
+  mark_lines (region, alloc_map);
+  CU_ASSERT_TRUE (is_line_marked (region, 0));
+  CU_ASSERT_FALSE (is_line_marked (region, LINE_SIZE));
+  CU_ASSERT_TRUE (is_line_marked (region, 5 * LINE_SIZE + 16));
+  CU_ASSERT_TRUE (is_line_marked (region, 2 * BLOCK_SIZE));
+  CU_ASSERT_FALSE (is_line_marked (region, BLOCK_SIZE));
+
+  /* The first and last blocks are recycled, the middle one is free */
+  CU_ASSERT_EQUAL (get_recycled_block_count (region), 2);
+  CU_ASSERT_EQUAL (get_free_block_count (region), 1);
+  float recycled_lines = 2 * BLOCK_LINES - 3;
+  CU_ASSERT_DOUBLE_EQUAL (calc_line_fragmentation (region),
+                          recycled_lines / (recycled_lines + BLOCK_LINES),
+                          0.0001);
+
+  free (alloc_map);
+  destroy_mark_region (region);
+}
+
+void
+test_take_line_space_fills_holes ()
+{
+  mark_region_t *region = create_mark_region (3 * BLOCK_SIZE, PAGE_SIZE);
+  char *alloc_map = create_three_block_map ();
+  mark_lines (region, alloc_map);
+
+  /* The hole between the marked lines is filled first */
+  size_t offset = 0;
+  CU_ASSERT_TRUE (take_line_space (region, 64, &offset));
+  CU_ASSERT_EQUAL (offset, LINE_SIZE);
+  for (size_t i = 0; i < 3; i++)
+    {
+      CU_ASSERT_TRUE (take_line_space (region, LINE_SIZE, &offset));
+      CU_ASSERT_EQUAL (offset, LINE_SIZE + 64 + i * LINE_SIZE);
+    }
+  CU_ASSERT_TRUE (take_line_space (region, 64, &offset));
+  CU_ASSERT_EQUAL (offset, 5 * LINE_SIZE - 64);
+
+  /* The next hole starts after the marked line */
+  CU_ASSERT_TRUE (take_line_space (region, 16, &offset));
+  CU_ASSERT_EQUAL (offset, 6 * LINE_SIZE);
+  CU_ASSERT_FALSE (is_line_marked (region, offset));
+
+  /* The recycled blocks are used up before the free block,
+     with every hole cut short at the end of its page.  */
+  while (offset < BLOCK_SIZE)
+    {
+      CU_ASSERT_FALSE (is_line_marked (region, offset));
+      CU_ASSERT_EQUAL (offset / PAGE_SIZE, (offset + 47) / PAGE_SIZE);
+      CU_ASSERT_TRUE (take_line_space (region, 48, &offset));
+    }
+  CU_ASSERT_EQUAL (offset, 2 * BLOCK_SIZE + LINE_SIZE);
+
+  free (alloc_map);
+  destroy_mark_region (region);
+}
+
+void
+test_take_line_space_overflows ()
+{
+  mark_region_t *region = create_mark_region (3 * BLOCK_SIZE, PAGE_SIZE);
+  char *alloc_map = create_three_block_map ();
+  mark_lines (region, alloc_map);
+
+  size_t offset = 0;
+  CU_ASSERT_TRUE (take_line_space (region, 3 * LINE_SIZE, &offset));
+  CU_ASSERT_EQUAL (offset, LINE_SIZE);
+
+  /* An object larger than a line goes to the free block, and the rest of
+     the hole is kept for smaller objects.  */
+  CU_ASSERT_TRUE (take_line_space (region, 2 * LINE_SIZE, &offset));
+  CU_ASSERT_EQUAL (offset, BLOCK_SIZE);
+  CU_ASSERT_TRUE (take_line_space (region, LINE_SIZE, &offset));
+  CU_ASSERT_EQUAL (offset, 4 * LINE_SIZE);
+
+  /* A used up hole is left for the next one, which it fits */
+  CU_ASSERT_TRUE (take_line_space (region, 2 * LINE_SIZE, &offset));
+  CU_ASSERT_EQUAL (offset, 6 * LINE_SIZE);
+
+  /* Once no free block is left nothing is found for a whole page, and the
+     holes are still there for smaller objects.  */
+  CU_ASSERT_TRUE (take_line_space (region, PAGE_SIZE, &offset));
+  CU_ASSERT_EQUAL (offset, BLOCK_SIZE + PAGE_SIZE);
+  free (alloc_map);
+  alloc_map = calloc (3 * BLOCK_LINES, sizeof (char));
+  for (size_t line = 0; line < 3 * BLOCK_LINES; line += 8)
+    {
+      alloc_map[line] = 1;
+    }
+  mark_lines (region, alloc_map);
+  CU_ASSERT_FALSE (take_line_space (region, PAGE_SIZE, &offset));
+  CU_ASSERT_TRUE (take_line_space (region, 7 * LINE_SIZE, &offset));
+  CU_ASSERT_EQUAL (offset, LINE_SIZE);
+
+  free (alloc_map);
+  destroy_mark_region (region);
+}
+
+void
+test_mark_extent ()
+{
+  mark_region_t *region = create_mark_region (3 * BLOCK_SIZE, PAGE_SIZE);
+  char *alloc_map = create_three_block_map ();
+  mark_lines (region, alloc_map);
+  size_t offset = 0;
+  CU_ASSERT_TRUE (take_line_space (region, 64, &offset));
+  CU_ASSERT_EQUAL (offset, LINE_SIZE);
+
+  /* An extent from the middle of the current hole into the free block */
+  mark_extent (region, 3 * LINE_SIZE, BLOCK_SIZE);
+  CU_ASSERT_TRUE (is_line_marked (region, 3 * LINE_SIZE));
+  CU_ASSERT_TRUE (is_line_marked (region, BLOCK_SIZE + 2 * LINE_SIZE));
+  CU_ASSERT_FALSE (is_line_marked (region, BLOCK_SIZE + 3 * LINE_SIZE));
+  CU_ASSERT_EQUAL (get_recycled_block_count (region), 2);
+  CU_ASSERT_EQUAL (get_free_block_count (region), 1);
+
+  /* The hole is kept up to the extent */
+  CU_ASSERT_TRUE (take_line_space (region, LINE_SIZE, &offset));
+  CU_ASSERT_EQUAL (offset, LINE_SIZE + 64);
+  CU_ASSERT_TRUE (take_line_space (region, LINE_SIZE, &offset));
+  CU_ASSERT_EQUAL (offset, 2 * BLOCK_SIZE + LINE_SIZE);
+
+  /* A block left without a free line is no longer allocated in */
+  mark_extent (region, BLOCK_SIZE, BLOCK_SIZE);
+  CU_ASSERT_EQUAL (get_free_block_count (region), 0);
+  CU_ASSERT_DOUBLE_EQUAL (calc_line_fragmentation (region), 1, 0.0001);
+
+  free (alloc_map);
+  destroy_mark_region (region);
+}
+
+void
+test_gc_reuses_free_lines ()
+{
+  heap_options_t options = create_test_options (2 * BLOCK_SIZE, false);
+  options.fragmentation_threshold = 0.5;
+  options.mark_region = true;
+  heap_t *h = h_init_with_options (&options);
+  CU_ASSERT_PTR_NOT_NULL (h->mark_region);
+  void **volatile holder = NULL;
+  void **nodes = calloc (LIST_NODES, sizeof (void *));
+  long sum = alloc_list_with_garbage (h, "*", (void ***)&holder,
+                                      LIST_NODES, GARBAGE_PER_NODE, nodes);
+  size_t used = h_used (h);
+
+  h_gc (h);
+  CU_ASSERT_PTR_NULL (h->free_lists);
+  CU_ASSERT_PTR_NULL (h->free_runs);
+  CU_ASSERT_TRUE (h_used (h) < used);
+  CU_ASSERT_TRUE (get_recycled_block_count (h->mark_region) > 0);
+
+  /* Nothing moved, and the garbage between the nodes is reused without
+     touching a line holding one of them.  */
+  CU_ASSERT_EQUAL (sum_list (holder), sum);
+  void **node = holder[0];
+  for (long i = LIST_NODES - 1; i >= 0; i--, node = node[0])
+    {
+      CU_ASSERT_PTR_EQUAL (node, nodes[i]);
+    }
+  for (size_t i = 0; i < LIST_NODES; i++)
+    {
+      void *allocation = h_alloc_struct (h, "*l");
+      size_t offset = calc_heap_offset (allocation, h) - sizeof (header_t);
+      CU_ASSERT_FALSE (is_line_marked (h->mark_region, offset));
+    }
+  CU_ASSERT_EQUAL (sum_list (holder), sum);
+
+  free (nodes);
+  h_delete (h);
+}
+
+void
+test_gc_evacuates_fragmented_lines ()
+{
+  heap_options_t options = create_test_options (2 * BLOCK_SIZE, false);
+  options.fragmentation_threshold = 0.1;
+  options.evacuated_pages = 2;
+  options.mark_region = true;
+  heap_t *h = h_init_with_options (&options);
+  void **volatile holder = NULL;
+  void **nodes = calloc (LIST_NODES, sizeof (void *));
+  long sum = alloc_list_with_garbage (h, "*", (void ***)&holder,
+                                      LIST_NODES, GARBAGE_PER_NODE, nodes);
+
+  h_gc (h);
+
+  /* The free lines were too scattered, so some nodes were evacuated */
+  size_t moved = 0;
+  void **node = holder[0];
+  for (long i = LIST_NODES - 1; i >= 0; i--, node = node[0])
+    {
+      moved += node != nodes[i];
+    }
+  CU_ASSERT_TRUE (moved > 0);
+  CU_ASSERT_EQUAL (sum_list (holder), sum);
+
+  free (nodes);
+  h_delete (h);
+}
+
+int
+main (void)
+{
+  // First we try to set up CUnit, and exit if we fail
+  if (CU_initialize_registry () != CUE_SUCCESS)
+    return CU_get_error ();
+
+  // We then create an empty test suite and specify the name and
+  // the init and cleanup functions
+  CU_pSuite markregiontests
+      = CU_add_suite ("Mark Region Testing Suite", init_suite, clean_suite);
+  if (markregiontests == NULL)
+    {
+      // If the test suite could not be added, tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // This is where we add the test functions to our test suite.
+  // For each call to CU_add_test we specify the test suite, the
+  // name or description of the test, and the function that runs
+  // the test in question. If you want to add another test, just
+  // copy a line below and change the information
+  if ((CU_add_test (markregiontests, "Test marking lines and blocks",
+                    test_mark_lines)
+           == NULL
+       || CU_add_test (markregiontests, "Test bumping through holes",
+                       test_take_line_space_fills_holes)
+              == NULL
+       || CU_add_test (markregiontests, "Test overflow allocation",
+                       test_take_line_space_overflows)
+              == NULL
+       || CU_add_test (markregiontests, "Test marking an extent",
+                       test_mark_extent)
+              == NULL
+       || CU_add_test (markregiontests, "Test reusing free lines after gc",
+                       test_gc_reuses_free_lines)
+              == NULL
+       || CU_add_test (markregiontests,
+                       "Test evacuating when lines are fragmented",
+                       test_gc_evacuates_fragmented_lines)
+              == NULL
+       || 0))
+    {
+      // If adding any of the tests fails, we tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // Set the running mode. Use CU_BRM_VERBOSE for maximum output.
+  // Use CU_BRM_NORMAL to only print errors and a summary
+  CU_basic_set_mode (CU_BRM_VERBOSE);
+
+  // This is where the tests are actually run!
+  CU_basic_run_tests ();
+
+  int exit_code = CU_get_number_of_tests_failed () == 0
+                      ? CU_get_error ()
+                      : CU_get_number_of_tests_failed ();
+
+  // Tear down CUnit before exiting
+  CU_cleanup_registry ();
+
+  return exit_code;
+}
@@ -0,0 +1,289 @@
+#include <CUnit/Basic.h>
+#include <stdlib.h>
+
+#include "../src/allocation_map.h"
+#include "../src/compacting.h"
+#include "../src/gc.h"
+#include "../src/gc_utils.h"
+#include "../src/gc_workers.h"
+#include "../src/heap_internal.h"
+#include "../src/mark_map.h"
+#include "../src/mark_stack.h"
+
+int
+init_suite (void)
+{
+  // Change this function if you want to do something *before* you
+  // run a test suite
+  return 0;
+}
+
+int
+clean_suite (void)
+{
+  // Change this function if you want to do something *after* you
+  // run a test suite
+  return 0;
+}
+
+void
+test_mark_stack_push_pop ()
+{
+  mark_stack_t *stack = create_mark_stack (4);
+  char a = 'a';
+  char b = 'b';
+
+  CU_ASSERT_TRUE (is_mark_stack_empty (stack));
+  CU_ASSERT_PTR_NULL (pop_mark_stack (stack));
+
+  CU_ASSERT_TRUE (push_mark_stack (stack, &a));
+  CU_ASSERT_TRUE (push_mark_stack (stack, &b));
+  CU_ASSERT_FALSE (is_mark_stack_empty (stack));
+
+  /* Last pushed is popped first */
+  CU_ASSERT_PTR_EQUAL (pop_mark_stack (stack), &b);
+  CU_ASSERT_PTR_EQUAL (pop_mark_stack (stack), &a);
+  CU_ASSERT_PTR_NULL (pop_mark_stack (stack));
+  CU_ASSERT_TRUE (is_mark_stack_empty (stack));
+  CU_ASSERT_FALSE (has_mark_stack_overflowed (stack));
+
+  destroy_mark_stack (stack);
+}
+
+void
+test_mark_stack_overflow ()
+{
+  mark_stack_t *stack = create_mark_stack (2);
+  char a = 'a';
+  char b = 'b';
+  char c = 'c';
+
+  CU_ASSERT_TRUE (has_mark_stack_space (stack, 2));
+  CU_ASSERT_FALSE (has_mark_stack_space (stack, 3));
+  CU_ASSERT_TRUE (push_mark_stack (stack, &a));
+  CU_ASSERT_FALSE (has_mark_stack_space (stack, 2));
+  CU_ASSERT_TRUE (push_mark_stack (stack, &b));
+  CU_ASSERT_FALSE (has_mark_stack_overflowed (stack));
+
+  /* Stack is full, the push fails and is recorded */
+  CU_ASSERT_FALSE (push_mark_stack (stack, &c));
+  CU_ASSERT_TRUE (has_mark_stack_overflowed (stack));
+
+  /* Entries already on the stack are kept */
+  CU_ASSERT_PTR_EQUAL (pop_mark_stack (stack), &b);
+  CU_ASSERT_TRUE (push_mark_stack (stack, &c));
+  CU_ASSERT_PTR_EQUAL (pop_mark_stack (stack), &c);
+
+  /* Flag stays set until cleared */
+  CU_ASSERT_TRUE (has_mark_stack_overflowed (stack));
+  clear_mark_stack_overflow (stack);
+  CU_ASSERT_FALSE (has_mark_stack_overflowed (stack));
+
+  destroy_mark_stack (stack);
+}
+
+void
+test_mark_stack_steal ()
+{
+  mark_stack_t *stack = create_mark_stack (4);
+  char a = 'a';
+  char b = 'b';
+  char c = 'c';
+  void *stolen[4];
+
+  push_mark_stack (stack, &a);
+  push_mark_stack (stack, &b);
+  push_mark_stack (stack, &c);
+  CU_ASSERT_EQUAL (get_mark_stack_size (stack), 3);
+  CU_ASSERT_PTR_EQUAL (get_mark_stack_entry (stack, 0), &a);
+  CU_ASSERT_PTR_EQUAL (get_mark_stack_entry (stack, 2), &c);
+
+  /* The oldest entries are stolen, oldest first */
+  CU_ASSERT_EQUAL (steal_mark_stack (stack, stolen, 2), 2);
+  CU_ASSERT_PTR_EQUAL (stolen[0], &a);
+  CU_ASSERT_PTR_EQUAL (stolen[1], &b);
+  CU_ASSERT_EQUAL (get_mark_stack_size (stack), 1);
+  CU_ASSERT_PTR_EQUAL (get_mark_stack_entry (stack, 0), &c);
+
+  /* No more than the stack holds can be stolen */
+  CU_ASSERT_EQUAL (steal_mark_stack (stack, stolen, 4), 1);
+  CU_ASSERT_PTR_EQUAL (stolen[0], &c);
+  CU_ASSERT_TRUE (is_mark_stack_empty (stack));
+  CU_ASSERT_EQUAL (steal_mark_stack (stack, stolen, 4), 0);
+
+  destroy_mark_stack (stack);
+}
+
+/**
+ * Counts the amount of objects marked in the mark map of the heap.
+ */
+static size_t
+count_marked_objects (heap_t *h)
+{
+  size_t count = 0;
+  size_t offset = 0;
+  while (find_next_marked_offset (h->mark_map, h->size, &offset))
+    {
+      count++;
+      offset += MIN_ALLOC_OBJECT_SIZE;
+    }
+  return count;
+}
+
+void
+test_mark_with_overflowing_stack ()
+{
+  heap_t *h = h_init (10 * PAGE_SIZE, true, 1);
+  /* Allow a single object to wait for scanning, forcing overflows */
+  h->mark_stack_size = 1;
+
+  /* A tree where every node has more children than the stack can hold */
+  void **root = h_alloc_struct (h, "3*");
+  for (size_t i = 0; i < 3; i++)
+    {
+      void **node = h_alloc_struct (h, "2*");
+      node[0] = h_alloc_struct (h, "l");
+      node[1] = h_alloc_struct (h, "l");
+      root[i] = node;
+    }
+  /* Garbage that must not be marked */
+  h_alloc_struct (h, "*");
+
+  char *root_map = create_mark_map (h->size);
+  update_mark_map (root_map,
+                   calc_heap_offset (root, h) - sizeof (header_t), true);
+
+  find_living_objects (h, root_map);
+
+  /* root, three nodes and six leaves */
+  CU_ASSERT_EQUAL (count_marked_objects (h), 10);
+
+  h->mark_stack_size = DEFAULT_MARK_STACK_SIZE;
+  find_living_objects (h, root_map);
+  CU_ASSERT_EQUAL (count_marked_objects (h), 10);
+
+  free (root_map);
+  h_delete (h);
+}
+
+/**
+ * Builds an array of nodes with two leaves each and marks the array and
+ * every hundredth node as roots, spreading the roots over the heap.
+ */
+static char *
+build_node_array (heap_t *h, size_t length)
+{
+  char *root_map = create_mark_map (h->size);
+  void **array = h_alloc_array (h, h_register_layout (h, "*"), length);
+  update_mark_map (root_map,
+                   calc_heap_offset (array, h) - sizeof (header_t), true);
+  for (size_t i = 0; i < length; i++)
+    {
+      void **node = h_alloc_struct (h, "2*");
+      node[0] = h_alloc_struct (h, "l");
+      node[1] = h_alloc_struct (h, "l");
+      array[i] = node;
+      if (i % 100 == 0)
+        {
+          update_mark_map (root_map,
+                           calc_heap_offset (node, h) - sizeof (header_t),
+                           true);
+        }
+    }
+  return root_map;
+}
+
+void
+test_mark_in_parallel ()
+{
+  heap_options_t options = { .bytes = 64 * PAGE_SIZE,
+                             .unsafe_stack = true,
+                             .gc_threads = 4,
+                             .gc_threshold = 1 };
+  heap_t *h = h_init_with_options (&options);
+  char *root_map = build_node_array (h, 600);
+  /* Garbage that must not be marked */
+  h_alloc_struct (h, "*");
+
+  find_living_objects (h, root_map);
+  /* array, nodes and two leaves per node */
+  CU_ASSERT_EQUAL (count_marked_objects (h), 1 + 600 * 3);
+
+  /* Workers overflow their stacks and steal array continuations */
+  h->mark_stack_size = 4;
+  find_living_objects (h, root_map);
+  CU_ASSERT_EQUAL (count_marked_objects (h), 1 + 600 * 3);
+
+  free (root_map);
+  h_delete (h);
+
+  /* The workers are kept between collections */
+  h = h_init_with_options (&options);
+  h_gc (h);
+  h_gc (h);
+  CU_ASSERT_EQUAL (get_gc_worker_count (h->gc_workers), 4);
+  h_delete (h);
+}
+
+int
+main (void)
+{
+  // First we try to set up CUnit, and exit if we fail
+  if (CU_initialize_registry () != CUE_SUCCESS)
+    return CU_get_error ();
+
+  // We then create an empty test suite and specify the name and
+  // the init and cleanup functions
+  CU_pSuite markstacktests
+      = CU_add_suite ("Mark stack Testing Suite", init_suite, clean_suite);
+  if (markstacktests == NULL)
+    {
+      // If the test suite could not be added, tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // This is where we add the test functions to our test suite.
+  // For each call to CU_add_test we specify the test suite, the
+  // name or description of the test, and the function that runs
+  // the test in question. If you want to add another test, just
+  // copy a line below and change the information
+  if ((CU_add_test (markstacktests, "Test pushing and popping objects",
+                    test_mark_stack_push_pop)
+           == NULL
+       || CU_add_test (markstacktests, "Test pushing to a full stack",
+                       test_mark_stack_overflow)
+              == NULL
+       || CU_add_test (markstacktests,
+                       "Test marking the heap when the stack overflows",
+                       test_mark_with_overflowing_stack)
+              == NULL
+       || CU_add_test (markstacktests, "Test stealing the oldest entries",
+                       test_mark_stack_steal)
+              == NULL
+       || CU_add_test (markstacktests, "Test marking with several threads",
+                       test_mark_in_parallel)
+              == NULL
+       || 0))
+    {
+      // If adding any of the tests fails, we tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // Set the running mode. Use CU_BRM_VERBOSE for maximum output.
+  // Use CU_BRM_NORMAL to only print errors and a summary
+  CU_basic_set_mode (CU_BRM_VERBOSE);
+
+  // This is where the tests are actually run!
+  CU_basic_run_tests ();
+
+  int exit_code = CU_get_number_of_tests_failed () == 0
+                      ? CU_get_error ()
+                      : CU_get_number_of_tests_failed ();
+
+  // Tear down CUnit before exiting
+  CU_cleanup_registry ();
+
+  return exit_code;
+}
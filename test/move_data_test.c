@@ -100,10 +100,8 @@ test_move_data_not_successful (void)
   t *old_alloc2 = alloc2;
 
   header_t old_header = get_header_value (get_header_pointer (alloc1));
-  update_header_of_a_pointer (
-      alloc1,
-      set_header_unused (
-          old_header)); // Sets header to unused so that the move will fail.
+  /* Sets header to an unregistered layout so that the move will fail.  */
+  update_header_of_a_pointer (alloc1, set_header_layout_index (old_header));
 
   bool success = move_alloc ((void **)&alloc1, (void *)alloc2);
   CU_ASSERT_FALSE (success);
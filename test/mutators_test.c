@@ -0,0 +1,430 @@
+#include <CUnit/Basic.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "../src/allocation.h"
+#include "../src/allocation_map.h"
+#include "../src/gc.h"
+#include "../src/gc_utils.h"
+#include "../src/heap_internal.h"
+#include "../src/mutators.h"
+#include "test_helpers.h"
+
+/* The size of the heaps used by the tests */
+#define HEAP_BYTES (64 * 1024)
+
+/* The amount of threads sharing the heap in the stress test */
+#define THREAD_COUNT 4
+
+/* The amount of times each thread builds and checks a list */
+#define ROUNDS 20
+
+/* The amount of nodes linked into each list */
+#define LIST_NODES 100
+
+/* The amount of garbage objects allocated after every node of a list */
+#define GARBAGE_PER_NODE 3
+
+/**
+ * What a thread sharing a heap is given and hands back.
+ * @param heap: The heap to allocate on.
+ * @param lock: Guards the fields below.
+ * @param changed: Broadcast when a field below changes.
+ * @param is_waiting: Set by the thread once it waits to be released.
+ * @param is_released: Set when the thread may go on.
+ * @param is_ok: Set by the thread if every list it built was intact.
+ */
+typedef struct thread_state
+{
+  heap_t *heap;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  bool is_waiting;
+  bool is_released;
+  bool is_ok;
+} thread_state_t;
+
+int
+init_suite (void)
+{
+  // Change this function if you want to do something *before* you
+  // run a test suite
+  return 0;
+}
+
+int
+clean_suite (void)
+{
+  // Change this function if you want to do something *after* you
+  // run a test suite
+  return 0;
+}
+
+static void
+init_thread_state (thread_state_t *state, heap_t *h)
+{
+  *state = (thread_state_t){ .heap = h };
+  pthread_mutex_init (&state->lock, NULL);
+  pthread_cond_init (&state->changed, NULL);
+}
+
+static void
+destroy_thread_state (thread_state_t *state)
+{
+  pthread_cond_destroy (&state->changed);
+  pthread_mutex_destroy (&state->lock);
+}
+
+/**
+ * Waits until the thread is released, run through h_do_blocking.
+ */
+static void *
+wait_until_released (void *arg)
+{
+  thread_state_t *state = arg;
+  pthread_mutex_lock (&state->lock);
+  state->is_waiting = true;
+  pthread_cond_broadcast (&state->changed);
+  while (!state->is_released)
+    {
+      pthread_cond_wait (&state->changed, &state->lock);
+    }
+  pthread_mutex_unlock (&state->lock);
+  return NULL;
+}
+
+/**
+ * Waits until a thread waits to be released, run through h_do_blocking.
+ */
+static void *
+wait_until_waiting (void *arg)
+{
+  thread_state_t *state = arg;
+  pthread_mutex_lock (&state->lock);
+  while (!state->is_waiting)
+    {
+      pthread_cond_wait (&state->changed, &state->lock);
+    }
+  pthread_mutex_unlock (&state->lock);
+  return NULL;
+}
+
+/**
+ * Joins a thread, run through h_do_blocking.
+ */
+static void *
+join_thread (void *arg)
+{
+  pthread_join (*(pthread_t *)arg, NULL);
+  return NULL;
+}
+
+/**
+ * Calculates the size of the garbage allocated along with a list.
+ */
+static size_t
+calc_garbage_bytes (void)
+{
+  return LIST_NODES * GARBAGE_PER_NODE * align_alloc_size (2 * sizeof (long));
+}
+
+/**
+ * Releases a waiting thread.
+ */
+static void
+release (thread_state_t *state)
+{
+  pthread_mutex_lock (&state->lock);
+  state->is_released = true;
+  pthread_cond_broadcast (&state->changed);
+  pthread_mutex_unlock (&state->lock);
+}
+
+/**
+ * Builds and checks lists over and over, collecting the heap now and then.
+ */
+static void *
+build_lists (void *arg)
+{
+  thread_state_t *state = arg;
+  heap_t *h = state->heap;
+  state->is_ok = h_register_thread (h);
+  for (int round = 0; round < ROUNDS && state->is_ok; round++)
+    {
+      void **volatile holder = NULL;
+      long sum = alloc_list_with_garbage (h, "*", (void ***)&holder,
+                                          LIST_NODES, GARBAGE_PER_NODE, NULL);
+      h_safepoint (h);
+      if (round % 5 == 4)
+        {
+          h_gc (h);
+        }
+      state->is_ok = sum >= 0 && sum_list (holder) == sum;
+    }
+  h_unregister_thread (h);
+  return NULL;
+}
+
+/**
+ * Builds a list, then blocks until released and checks it.
+ */
+static void *
+build_list_and_block (void *arg)
+{
+  thread_state_t *state = arg;
+  heap_t *h = state->heap;
+  h_register_thread (h);
+  void **volatile holder = NULL;
+  long sum = alloc_list_with_garbage (h, "*", (void ***)&holder,
+                                      LIST_NODES, GARBAGE_PER_NODE, NULL);
+  h_do_blocking (h, wait_until_released, state);
+  state->is_ok = sum >= 0 && sum_list (holder) == sum;
+  h_unregister_thread (h);
+  return NULL;
+}
+
+/**
+ * Builds a list, then polls safepoints until released and checks it.
+ */
+static void *
+build_list_and_poll (void *arg)
+{
+  thread_state_t *state = arg;
+  heap_t *h = state->heap;
+  h_register_thread (h);
+  void **volatile holder = NULL;
+  long sum = alloc_list_with_garbage (h, "*", (void ***)&holder,
+                                      LIST_NODES, GARBAGE_PER_NODE, NULL);
+
+  pthread_mutex_lock (&state->lock);
+  state->is_waiting = true;
+  pthread_cond_broadcast (&state->changed);
+  pthread_mutex_unlock (&state->lock);
+  while (!__atomic_load_n (&state->is_released, __ATOMIC_ACQUIRE))
+    {
+      h_safepoint (h);
+    }
+
+  state->is_ok = sum >= 0 && sum_list (holder) == sum;
+  h_unregister_thread (h);
+  return NULL;
+}
+
+void
+test_register_thread ()
+{
+  heap_t *h = h_init (HEAP_BYTES, true, 0.5);
+  CU_ASSERT_PTR_NULL (get_current_mutator (h->mutators));
+
+  CU_ASSERT_TRUE (h_register_thread (h));
+  CU_ASSERT_PTR_NOT_NULL (get_current_mutator (h->mutators));
+  CU_ASSERT_FALSE (has_other_mutators (h->mutators));
+
+  /* A thread is only registered once */
+  CU_ASSERT_FALSE (h_register_thread (h));
+  heap_t *other = h_init (HEAP_BYTES, true, 0.5);
+  CU_ASSERT_FALSE (h_register_thread (other));
+  CU_ASSERT_PTR_NULL (get_current_mutator (other->mutators));
+  h_delete (other);
+
+  h_unregister_thread (h);
+  CU_ASSERT_PTR_NULL (get_current_mutator (h->mutators));
+  CU_ASSERT_TRUE (h_register_thread (h));
+  h_unregister_thread (h);
+
+  h_delete (h);
+}
+
+void
+test_alloc_buffer ()
+{
+  heap_t *h = h_init (HEAP_BYTES, true, 0.5);
+  h_register_thread (h);
+
+  /* Small objects follow each other in the buffer, which is reserved in
+     the allocation map as a whole.  */
+  char *first = h_alloc_raw (h, 8);
+  char *second = h_alloc_raw (h, 24);
+  CU_ASSERT_PTR_EQUAL (second, first + 16);
+  CU_ASSERT_EQUAL (count_allocated_bytes (h->alloc_map, h->size),
+                   ALLOC_BUFFER_SIZE);
+
+  /* Larger objects are allocated outside of it */
+  char *large = h_alloc_raw (h, MAX_BUFFERED_SIZE);
+  size_t buffer_start = calc_heap_offset (first, h) - sizeof (header_t);
+  size_t large_offset = calc_heap_offset (large, h);
+  CU_ASSERT_TRUE (large_offset < buffer_start
+                  || large_offset >= buffer_start + ALLOC_BUFFER_SIZE);
+  char *third = h_alloc_raw (h, 8);
+  CU_ASSERT_PTR_EQUAL (third, second + 32);
+
+  /* What is left of the buffer is given back */
+  h_unregister_thread (h);
+  size_t used = 8 + 24 + 8 + align_alloc_size (MAX_BUFFERED_SIZE);
+  CU_ASSERT_EQUAL (h_used (h), used);
+  CU_ASSERT_EQUAL (count_allocated_bytes (h->alloc_map, h->size),
+                   used + 4 * sizeof (header_t));
+
+  h_delete (h);
+}
+
+void
+test_gc_retires_buffers ()
+{
+  heap_t *h = h_init (HEAP_BYTES, true, 0.5);
+  h_register_thread (h);
+  void **volatile holder = NULL;
+  long sum = alloc_list_with_garbage (h, "*", (void ***)&holder,
+                                      LIST_NODES, GARBAGE_PER_NODE, NULL);
+
+  /* The end of the buffer is given back before collecting, so only the
+     garbage counts as collected.  */
+  size_t collected = h_gc (h);
+  CU_ASSERT_TRUE (collected > calc_garbage_bytes () / 2);
+  CU_ASSERT_TRUE (collected <= calc_garbage_bytes ());
+  CU_ASSERT_EQUAL (count_allocated_bytes (h->alloc_map, h->size),
+                   h_used (h) + (LIST_NODES + 1) * sizeof (header_t));
+  CU_ASSERT_EQUAL (sum_list (holder), sum);
+
+  /* Allocation goes on in a new buffer */
+  CU_ASSERT_PTR_NOT_NULL (h_alloc_struct (h, "*l"));
+  CU_ASSERT_EQUAL (sum_list (holder), sum);
+
+  h_unregister_thread (h);
+  h_delete (h);
+}
+
+void
+test_threads_share_heap ()
+{
+  heap_t *h = h_init (HEAP_BYTES, false, 0.5);
+  pthread_t threads[THREAD_COUNT];
+  thread_state_t states[THREAD_COUNT];
+  for (int i = 0; i < THREAD_COUNT; i++)
+    {
+      init_thread_state (&states[i], h);
+      pthread_create (&threads[i], NULL, build_lists, &states[i]);
+    }
+  for (int i = 0; i < THREAD_COUNT; i++)
+    {
+      pthread_join (threads[i], NULL);
+      CU_ASSERT_TRUE (states[i].is_ok);
+      destroy_thread_state (&states[i]);
+    }
+
+  /* Every list is garbage once the threads are done */
+  h_gc (h);
+  CU_ASSERT_TRUE (h_used (h) < HEAP_BYTES / 4);
+  h_delete (h);
+}
+
+void
+test_gc_while_blocking ()
+{
+  heap_t *h = h_init (HEAP_BYTES, false, 1);
+  h_register_thread (h);
+  thread_state_t state;
+  init_thread_state (&state, h);
+  pthread_t thread;
+  pthread_create (&thread, NULL, build_list_and_block, &state);
+
+  /* The other thread counts as stopped while it blocks */
+  h_do_blocking (h, wait_until_waiting, &state);
+  CU_ASSERT_TRUE (has_other_mutators (h->mutators));
+  CU_ASSERT_TRUE (h_gc (h) > calc_garbage_bytes () / 2);
+  release (&state);
+
+  h_do_blocking (h, join_thread, &thread);
+  CU_ASSERT_TRUE (state.is_ok);
+  destroy_thread_state (&state);
+  h_unregister_thread (h);
+  h_delete (h);
+}
+
+void
+test_gc_stops_at_safepoint ()
+{
+  heap_t *h = h_init (HEAP_BYTES, false, 1);
+  h_register_thread (h);
+  thread_state_t state;
+  init_thread_state (&state, h);
+  pthread_t thread;
+  pthread_create (&thread, NULL, build_list_and_poll, &state);
+
+  /* The other thread stops at its next safepoint */
+  h_do_blocking (h, wait_until_waiting, &state);
+  CU_ASSERT_TRUE (h_gc (h) > calc_garbage_bytes () / 2);
+  __atomic_store_n (&state.is_released, true, __ATOMIC_RELEASE);
+
+  h_do_blocking (h, join_thread, &thread);
+  CU_ASSERT_TRUE (state.is_ok);
+  destroy_thread_state (&state);
+  h_unregister_thread (h);
+  h_delete (h);
+}
+
+int
+main (void)
+{
+  // First we try to set up CUnit, and exit if we fail
+  if (CU_initialize_registry () != CUE_SUCCESS)
+    return CU_get_error ();
+
+  // We then create an empty test suite and specify the name and
+  // the init and cleanup functions
+  CU_pSuite mutatortests
+      = CU_add_suite ("Mutator Threads Testing Suite", init_suite,
+                      clean_suite);
+  if (mutatortests == NULL)
+    {
+      // If the test suite could not be added, tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // This is where we add the test functions to our test suite.
+  // For each call to CU_add_test we specify the test suite, the
+  // name or description of the test, and the function that runs
+  // the test in question. If you want to add another test, just
+  // copy a line below and change the information
+  if ((CU_add_test (mutatortests, "Test registering threads",
+                    test_register_thread)
+           == NULL
+       || CU_add_test (mutatortests, "Test allocating in a buffer",
+                       test_alloc_buffer)
+              == NULL
+       || CU_add_test (mutatortests, "Test retiring buffers on gc",
+                       test_gc_retires_buffers)
+              == NULL
+       || CU_add_test (mutatortests, "Test threads sharing a heap",
+                       test_threads_share_heap)
+              == NULL
+       || CU_add_test (mutatortests, "Test collecting while a thread blocks",
+                       test_gc_while_blocking)
+              == NULL
+       || CU_add_test (mutatortests, "Test stopping threads at safepoints",
+                       test_gc_stops_at_safepoint)
+              == NULL
+       || 0))
+    {
+      // If adding any of the tests fails, we tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // Set the running mode. Use CU_BRM_VERBOSE for maximum output.
+  // Use CU_BRM_NORMAL to only print errors and a summary
+  CU_basic_set_mode (CU_BRM_VERBOSE);
+
+  // This is where the tests are actually run!
+  CU_basic_run_tests ();
+
+  int exit_code = CU_get_number_of_tests_failed () == 0
+                      ? CU_get_error ()
+                      : CU_get_number_of_tests_failed ();
+
+  // Tear down CUnit before exiting
+  CU_cleanup_registry ();
+
+  return exit_code;
+}
@@ -0,0 +1,294 @@
+#include <CUnit/Basic.h>
+#include <stdlib.h>
+
+#include "../lib/linked_list.h"
+#include "../src/allocation_map.h"
+#include "../src/gc.h"
+#include "../src/gc_utils.h"
+#include "../src/heap_internal.h"
+#include "../src/nursery.h"
+#include "test_helpers.h"
+
+#define TEST_PAGE_SIZE 2048
+
+int
+init_suite (void)
+{
+  // Change this function if you want to do something *before* you
+  // run a test suite
+  return 0;
+}
+
+int
+clean_suite (void)
+{
+  // Change this function if you want to do something *after* you
+  // run a test suite
+  return 0;
+}
+
+/**
+ * Creates a heap with a nursery of the given amount of pages.
+ */
+static heap_t *
+create_generational_heap (size_t nursery_pages)
+{
+  heap_options_t options = create_test_options (32 * PAGE_SIZE, true);
+  options.nursery_bytes = nursery_pages * PAGE_SIZE;
+  return h_init_with_options (&options);
+}
+
+void
+test_nursery_pages_and_cards ()
+{
+  nursery_t *nursery = create_nursery (8 * TEST_PAGE_SIZE, TEST_PAGE_SIZE,
+                                       TEST_PAGE_SIZE + 1);
+  CU_ASSERT_FALSE (is_nursery_full (nursery));
+  CU_ASSERT_FALSE (has_nursery_space (nursery, 0, 16));
+
+  /* Allocation only continues on the page added last */
+  add_young_page (nursery, 3 * TEST_PAGE_SIZE);
+  CU_ASSERT_TRUE (is_young_offset (nursery, 3 * TEST_PAGE_SIZE + 100));
+  CU_ASSERT_FALSE (is_young_offset (nursery, 2 * TEST_PAGE_SIZE));
+  CU_ASSERT_TRUE (has_nursery_space (nursery, 4 * TEST_PAGE_SIZE - 32, 32));
+  CU_ASSERT_FALSE (has_nursery_space (nursery, 4 * TEST_PAGE_SIZE - 32, 48));
+  CU_ASSERT_FALSE (has_nursery_space (nursery, 2 * TEST_PAGE_SIZE, 16));
+  CU_ASSERT_FALSE (is_nursery_full (nursery));
+
+  add_young_page (nursery, TEST_PAGE_SIZE);
+  CU_ASSERT_TRUE (is_nursery_full (nursery));
+  CU_ASSERT_EQUAL (get_young_page_count (nursery), 2);
+
+  size_t offset = 0;
+  CU_ASSERT_TRUE (find_next_young_page (nursery, &offset));
+  CU_ASSERT_EQUAL (offset, TEST_PAGE_SIZE);
+  offset += TEST_PAGE_SIZE;
+  CU_ASSERT_TRUE (find_next_young_page (nursery, &offset));
+  CU_ASSERT_EQUAL (offset, 3 * TEST_PAGE_SIZE);
+  offset += TEST_PAGE_SIZE;
+  CU_ASSERT_FALSE (find_next_young_page (nursery, &offset));
+
+  /* Cards */
+  mark_card (nursery, 5 * CARD_SIZE + 8);
+  CU_ASSERT_TRUE (is_card_dirty (nursery, 5 * CARD_SIZE));
+  CU_ASSERT_FALSE (is_card_dirty (nursery, 4 * CARD_SIZE));
+  offset = 0;
+  CU_ASSERT_TRUE (find_next_dirty_card (nursery, &offset));
+  CU_ASSERT_EQUAL (offset, 5 * CARD_SIZE);
+  offset += CARD_SIZE;
+  CU_ASSERT_FALSE (find_next_dirty_card (nursery, &offset));
+
+  reset_nursery (nursery);
+  CU_ASSERT_EQUAL (get_young_page_count (nursery), 0);
+  CU_ASSERT_FALSE (is_young_offset (nursery, TEST_PAGE_SIZE));
+  CU_ASSERT_FALSE (is_card_dirty (nursery, 5 * CARD_SIZE));
+
+  destroy_nursery (nursery);
+}
+
+void
+test_minor_gc_frees_young_garbage ()
+{
+  heap_t *h = create_generational_heap (4);
+  void *volatile survivor = h_alloc_struct (h, "*l");
+  size_t survivor_offset = calc_heap_offset (survivor, h);
+  CU_ASSERT_TRUE (is_young_offset (h->nursery, survivor_offset));
+
+  for (size_t i = 0; i < 100; i++)
+    {
+      h_alloc_struct (h, "2l");
+    }
+  size_t used = h_used (h);
+
+  size_t collected = h_gc_minor (h);
+  CU_ASSERT_TRUE (collected > 0);
+  CU_ASSERT_EQUAL (h_used (h), used - collected);
+  CU_ASSERT_EQUAL (get_young_page_count (h->nursery), 0);
+
+  /* The survivor is promoted where it is */
+  size_t offset = calc_heap_offset (survivor, h);
+  CU_ASSERT_FALSE (is_young_offset (h->nursery, offset));
+  CU_ASSERT_TRUE (
+      is_offset_allocated (h->alloc_map, offset - sizeof (header_t)));
+
+  /* New objects go on a new young page */
+  void *young = h_alloc_struct (h, "*l");
+  CU_ASSERT_TRUE (is_young_offset (h->nursery, calc_heap_offset (young, h)));
+
+  h_delete (h);
+}
+
+void
+test_minor_gc_remembered_set ()
+{
+  heap_t *h = create_generational_heap (4);
+  void **volatile old = h_alloc_struct (h, "*");
+  h_gc_minor (h);
+  CU_ASSERT_FALSE (is_young_offset (h->nursery, calc_heap_offset (old, h)));
+
+  /* A young object only referenced from an old one */
+  long *young = h_alloc_struct (h, "*l");
+  young[1] = 42;
+  h_write_ptr (old, &old[0], young);
+  young = NULL;
+  CU_ASSERT_TRUE (is_card_dirty (h->nursery, calc_heap_offset (old, h)));
+
+  /* Pointers stored into young objects are not remembered */
+  void **young_holder = h_alloc_struct (h, "*");
+  h_write_ptr (young_holder, &young_holder[0], old[0]);
+  CU_ASSERT_FALSE (
+      is_card_dirty (h->nursery, calc_heap_offset (young_holder, h)));
+
+  h_gc_minor (h);
+  young = old[0];
+  size_t offset = calc_heap_offset (young, h) - sizeof (header_t);
+  CU_ASSERT_TRUE (is_offset_allocated (h->alloc_map, offset));
+  CU_ASSERT_EQUAL (young[1], 42);
+  CU_ASSERT_FALSE (is_card_dirty (h->nursery, calc_heap_offset (old, h)));
+
+  h_delete (h);
+}
+
+void
+test_remembered_set_of_second_heap ()
+{
+  /* Stores into a heap that is not the global heap are remembered too */
+  heap_t *first = create_generational_heap (4);
+  heap_t *h = create_generational_heap (4);
+  CU_ASSERT_PTR_NOT_EQUAL (global_heap, h);
+  void **volatile old = h_alloc_struct (h, "*");
+  h_gc_minor (h);
+
+  long *young = h_alloc_struct (h, "*l");
+  young[1] = 42;
+  h_write_ptr (old, &old[0], young);
+  young = NULL;
+  CU_ASSERT_TRUE (is_card_dirty (h->nursery, calc_heap_offset (old, h)));
+
+  h_gc_minor (h);
+  young = old[0];
+  CU_ASSERT_EQUAL (young[1], 42);
+
+  h_delete (h);
+  h_delete (first);
+}
+
+void
+test_too_many_generational_heaps ()
+{
+  /* The write barrier finds at most 16 heaps, the next one is refused */
+  heap_t *heaps[16];
+  for (size_t i = 0; i < 16; i++)
+    {
+      heaps[i] = create_generational_heap (1);
+      CU_ASSERT_PTR_NOT_NULL_FATAL (heaps[i]);
+    }
+  CU_ASSERT_PTR_NULL (create_generational_heap (1));
+
+  /* Deleting one makes room again */
+  h_delete (heaps[15]);
+  heaps[15] = create_generational_heap (1);
+  CU_ASSERT_PTR_NOT_NULL (heaps[15]);
+
+  for (size_t i = 0; i < 16; i++)
+    {
+      h_delete (heaps[i]);
+    }
+}
+
+void
+test_minor_gc_linked_list ()
+{
+  /* The lib containers allocate on the global heap */
+  heap_t *h = create_generational_heap (2);
+  CU_ASSERT_PTR_EQUAL (global_heap, h);
+
+  /* Appending links new nodes to promoted ones through the barrier, while
+     the small nursery is collected many times.  */
+  ioopm_list_t *list = NULL;
+  ioopm_linked_list_create (&list, NULL);
+  size_t count = 1000;
+  for (size_t i = 0; i < count; i++)
+    {
+      ioopm_linked_list_append (list, int_to_elem ((int)i));
+    }
+
+  size_t size = 0;
+  ioopm_linked_list_size (&size, list);
+  CU_ASSERT_EQUAL (size, count);
+  for (size_t i = 0; i < count; i += 97)
+    {
+      elem_t value;
+      CU_ASSERT_EQUAL (ioopm_linked_list_get (&value, list, i), SUCCESS);
+      CU_ASSERT_EQUAL (elem_to_int (value), (int)i);
+    }
+
+  h_delete (h);
+}
+
+int
+main (void)
+{
+  // First we try to set up CUnit, and exit if we fail
+  if (CU_initialize_registry () != CUE_SUCCESS)
+    return CU_get_error ();
+
+  // We then create an empty test suite and specify the name and
+  // the init and cleanup functions
+  CU_pSuite nurserytests
+      = CU_add_suite ("Nursery Testing Suite", init_suite, clean_suite);
+  if (nurserytests == NULL)
+    {
+      // If the test suite could not be added, tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // This is where we add the test functions to our test suite.
+  // For each call to CU_add_test we specify the test suite, the
+  // name or description of the test, and the function that runs
+  // the test in question. If you want to add another test, just
+  // copy a line below and change the information
+  if ((CU_add_test (nurserytests, "Test young pages and cards",
+                    test_nursery_pages_and_cards)
+           == NULL
+       || CU_add_test (nurserytests, "Test minor collection of young garbage",
+                       test_minor_gc_frees_young_garbage)
+              == NULL
+       || CU_add_test (nurserytests, "Test the remembered set of old objects",
+                       test_minor_gc_remembered_set)
+              == NULL
+       || CU_add_test (nurserytests,
+                       "Test the remembered set of a second heap",
+                       test_remembered_set_of_second_heap)
+              == NULL
+       || CU_add_test (nurserytests, "Test too many generational heaps",
+                       test_too_many_generational_heaps)
+              == NULL
+       || CU_add_test (nurserytests,
+                       "Test a linked list on a generational heap",
+                       test_minor_gc_linked_list)
+              == NULL
+       || 0))
+    {
+      // If adding any of the tests fails, we tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // Set the running mode. Use CU_BRM_VERBOSE for maximum output.
+  // Use CU_BRM_NORMAL to only print errors and a summary
+  CU_basic_set_mode (CU_BRM_VERBOSE);
+
+  // This is where the tests are actually run!
+  CU_basic_run_tests ();
+
+  int exit_code = CU_get_number_of_tests_failed () == 0
+                      ? CU_get_error ()
+                      : CU_get_number_of_tests_failed ();
+
+  // Tear down CUnit before exiting
+  CU_cleanup_registry ();
+
+  return exit_code;
+}
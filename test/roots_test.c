@@ -0,0 +1,349 @@
+#include <CUnit/Basic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/allocation.h"
+#include "../src/allocation_map.h"
+#include "../src/gc.h"
+#include "../src/gc_utils.h"
+#include "../src/get_header.h"
+#include "../src/heap_internal.h"
+#include "../src/roots.h"
+#include "../src/semispace.h"
+#include "test_helpers.h"
+
+/* The size of the heaps used by the tests */
+#define HEAP_BYTES (16 * 1024)
+
+/* The amount of garbage objects allocated before the rooted ones */
+#define GARBAGE_OBJECTS 20
+
+/* A global variable added as a root by the tests */
+static void **global_node = NULL;
+
+int
+init_suite (void)
+{
+  // Change this function if you want to do something *before* you
+  // run a test suite
+  return 0;
+}
+
+int
+clean_suite (void)
+{
+  // Change this function if you want to do something *after* you
+  // run a test suite
+  return 0;
+}
+
+/**
+ * Creates a heap with precise roots, that is compacted on every collection
+ * or copied if semispace is set. The stack is claimed to be unsafe, which
+ * precise roots ignore.
+ */
+static heap_t *
+create_precise_heap (bool semispace)
+{
+  heap_options_t options = create_test_options (HEAP_BYTES, true);
+  options.semispace = semispace;
+  options.precise_roots = true;
+  return h_init_with_options (&options);
+}
+
+/**
+ * Gets the heap offset of the header of an object.
+ */
+static size_t
+calc_object_offset (heap_t *h, void *alloc)
+{
+  return calc_heap_offset (alloc, h) - sizeof (header_t);
+}
+
+/**
+ * Counts the slots a root stack applies a function to.
+ */
+static void
+count_slot (void *slot, void *arg)
+{
+  (void)slot;
+  (*(size_t *)arg)++;
+}
+
+void
+test_root_stack ()
+{
+  root_stack_t *roots = create_root_stack ();
+  void *slots[100] = { NULL };
+
+  /* Grows past its initial capacity */
+  for (size_t i = 0; i < 100; i++)
+    {
+      push_root (roots, &slots[i]);
+    }
+  CU_ASSERT_EQUAL (count_roots (roots), 100);
+  size_t applied = 0;
+  apply_to_root_slots (roots, count_slot, &applied);
+  CU_ASSERT_EQUAL (applied, 100);
+
+  pop_roots (roots, 40);
+  CU_ASSERT_EQUAL (count_roots (roots), 60);
+
+  /* Removing keeps the order of the slots left */
+  CU_ASSERT_TRUE (remove_root (roots, &slots[10]));
+  CU_ASSERT_FALSE (remove_root (roots, &slots[10]));
+  CU_ASSERT_FALSE (remove_root (roots, &slots[70]));
+  CU_ASSERT_EQUAL (count_roots (roots), 59);
+  pop_roots (roots, 49);
+  CU_ASSERT_TRUE (remove_root (roots, &slots[9]));
+  CU_ASSERT_EQUAL (count_roots (roots), 9);
+
+  destroy_root_stack (roots);
+}
+
+void
+test_precise_roots_move_everything ()
+{
+  heap_t *h = create_precise_heap (false);
+  CU_ASSERT_TRUE (h->is_precise_roots);
+  CU_ASSERT_FALSE (h->is_unsafe_stack);
+
+  alloc_garbage (h, GARBAGE_OBJECTS);
+  void *volatile unrooted = h_alloc_struct (h, "*l");
+  void **node = h_alloc_struct (h, "*l");
+  h_push_root (h, &node);
+  node[0] = h_alloc_struct (h, "*l");
+  ((long *)node)[1] = 42;
+
+  /* Only the pushed node and what it points to survive, even though the
+     stack still points to another object. Nothing is pinned, so the node
+     slides to the start of the heap.  */
+  CU_ASSERT_TRUE (h_gc (h) > 0);
+  CU_ASSERT_EQUAL (h_used (h), 2 * align_alloc_size (16));
+  CU_ASSERT_EQUAL (calc_object_offset (h, node), 0);
+  CU_ASSERT_EQUAL (((long *)node)[1], 42);
+  CU_ASSERT_PTR_NOT_NULL (node[0]);
+  (void)unrooted;
+
+  /* Once popped, the node is garbage as well */
+  h_pop_roots (h, 1);
+  CU_ASSERT_EQUAL (count_roots (h->shadow_stack), 0);
+  h_gc (h);
+  CU_ASSERT_EQUAL (h_used (h), 0);
+
+  h_delete (h);
+}
+
+/**
+ * Allocates a node kept by H_ROOT for as long as the function runs.
+ * @return the amount of roots pushed by the calling thread meanwhile
+ */
+static size_t
+alloc_in_root_scope (heap_t *h, long value)
+{
+  alloc_garbage (h, GARBAGE_OBJECTS);
+  void **node = h_alloc_struct (h, "*l");
+  H_ROOT (h, node);
+  ((long *)node)[1] = value;
+  h_gc (h);
+  CU_ASSERT_EQUAL (calc_object_offset (h, node), 0);
+  CU_ASSERT_EQUAL (((long *)node)[1], value);
+  return count_roots (h->shadow_stack);
+}
+
+void
+test_root_scope ()
+{
+  heap_t *h = create_precise_heap (false);
+
+  CU_ASSERT_EQUAL (alloc_in_root_scope (h, 7), 1);
+  CU_ASSERT_EQUAL (count_roots (h->shadow_stack), 0);
+  h_gc (h);
+  CU_ASSERT_EQUAL (h_used (h), 0);
+
+  h_delete (h);
+}
+
+void
+test_global_roots ()
+{
+  heap_t *h = create_precise_heap (false);
+
+  alloc_garbage (h, GARBAGE_OBJECTS);
+  global_node = h_alloc_struct (h, "*l");
+  ((long *)global_node)[1] = 11;
+  h_add_global_root (h, &global_node);
+
+  /* The global variable is updated when its node moves */
+  h_gc (h);
+  CU_ASSERT_EQUAL (calc_object_offset (h, global_node), 0);
+  CU_ASSERT_EQUAL (((long *)global_node)[1], 11);
+  CU_ASSERT_EQUAL (h_used (h), align_alloc_size (16));
+
+  CU_ASSERT_TRUE (h_remove_global_root (h, &global_node));
+  CU_ASSERT_FALSE (h_remove_global_root (h, &global_node));
+  h_gc (h);
+  CU_ASSERT_EQUAL (h_used (h), 0);
+  global_node = NULL;
+
+  h_delete (h);
+}
+
+void
+test_global_roots_without_precise_roots ()
+{
+  heap_t *h = h_init (HEAP_BYTES, false, 1);
+
+  /* Only the global variable refers to the node, and it is moved along
+     with it.  */
+  alloc_garbage (h, GARBAGE_OBJECTS);
+  global_node = h_alloc_struct (h, "*l");
+  ((long *)global_node)[1] = 13;
+  h_add_global_root (h, &global_node);
+  h_gc (h);
+  CU_ASSERT_TRUE (h_used (h) >= align_alloc_size (16));
+  CU_ASSERT_EQUAL (((long *)global_node)[1], 13);
+
+  h_remove_global_root (h, &global_node);
+  global_node = NULL;
+  h_delete (h);
+}
+
+void
+test_precise_roots_of_registered_thread ()
+{
+  heap_t *h = create_precise_heap (false);
+  CU_ASSERT_TRUE_FATAL (h_register_thread (h));
+
+  alloc_garbage (h, GARBAGE_OBJECTS);
+  void **node = h_alloc_struct (h, "*l");
+  ((long *)node)[1] = 5;
+  h_push_root (h, &node);
+
+  /* The root was pushed on the shadow stack of the thread */
+  CU_ASSERT_EQUAL (count_roots (h->shadow_stack), 0);
+  h_gc (h);
+  CU_ASSERT_EQUAL (calc_object_offset (h, node), 0);
+  CU_ASSERT_EQUAL (((long *)node)[1], 5);
+  CU_ASSERT_EQUAL (h_used (h), align_alloc_size (16));
+
+  h_pop_roots (h, 1);
+  h_unregister_thread (h);
+  h_delete (h);
+}
+
+void
+test_precise_roots_copied ()
+{
+  heap_t *h = create_precise_heap (true);
+
+  void **holder = h_alloc_struct (h, "50*");
+  h_push_root (h, &holder);
+  alloc_garbage (h, GARBAGE_OBJECTS);
+  holder[0] = h_alloc_struct (h, "*l");
+
+  /* The holder is copied even though the stack was claimed unsafe */
+  size_t half = get_semispace_bytes (h->semispace);
+  h_gc (h);
+  CU_ASSERT_TRUE (calc_heap_offset (holder, h) >= half);
+  CU_ASSERT_TRUE (calc_heap_offset (holder[0], h) >= half);
+
+  h_pop_roots (h, 1);
+  h_delete (h);
+}
+
+void
+test_format_string_kept_while_collecting ()
+{
+  heap_t *h = create_precise_heap (true);
+  size_t half = get_semispace_bytes (h->semispace);
+
+  /* Leave room for the format string of the holder but not the holder, so
+     that the collection making room for it runs in between.  */
+  h_alloc_raw (h, half - 2 * MIN_ALLOC_OBJECT_SIZE - sizeof (header_t));
+  void **holder = h_alloc_struct (h, "50*");
+  CU_ASSERT_PTR_NOT_NULL_FATAL (holder);
+  CU_ASSERT_EQUAL (count_roots (h->shadow_stack), 0);
+
+  /* The format string was copied by the collection, and the header of the
+     holder points to the copy.  */
+  header_t header = get_header_value (get_header_pointer (holder));
+  CU_ASSERT_EQUAL (get_header_type (header), HEADER_POINTER_TO_FORMAT_STRING);
+  char *layout = get_pointer_in_header (header);
+  CU_ASSERT_TRUE (calc_heap_offset (layout, h) >= half);
+  CU_ASSERT_STRING_EQUAL (layout, "50*");
+
+  h_delete (h);
+}
+
+int
+main (void)
+{
+  // First we try to set up CUnit, and exit if we fail
+  if (CU_initialize_registry () != CUE_SUCCESS)
+    return CU_get_error ();
+
+  // We then create an empty test suite and specify the name and
+  // the init and cleanup functions
+  CU_pSuite rootstests
+      = CU_add_suite ("Precise roots Testing Suite", init_suite, clean_suite);
+  if (rootstests == NULL)
+    {
+      // If the test suite could not be added, tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // This is where we add the test functions to our test suite.
+  // For each call to CU_add_test we specify the test suite, the
+  // name or description of the test, and the function that runs
+  // the test in question. If you want to add another test, just
+  // copy a line below and change the information
+  if ((CU_add_test (rootstests, "Test pushing and removing root slots",
+                    test_root_stack)
+           == NULL
+       || CU_add_test (rootstests, "Test moving every object with precise roots",
+                       test_precise_roots_move_everything)
+              == NULL
+       || CU_add_test (rootstests, "Test popping roots at the end of a scope",
+                       test_root_scope)
+              == NULL
+       || CU_add_test (rootstests, "Test global roots",
+                       test_global_roots)
+              == NULL
+       || CU_add_test (rootstests, "Test global roots on a scanned stack",
+                       test_global_roots_without_precise_roots)
+              == NULL
+       || CU_add_test (rootstests, "Test roots of a registered thread",
+                       test_precise_roots_of_registered_thread)
+              == NULL
+       || CU_add_test (rootstests, "Test copying precise roots",
+                       test_precise_roots_copied)
+              == NULL
+       || CU_add_test (rootstests,
+                       "Test keeping a format string while collecting",
+                       test_format_string_kept_while_collecting)
+              == NULL
+       || 0))
+    {
+      // If adding any of the tests fails, we tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // Set the running mode. Use CU_BRM_VERBOSE for maximum output.
+  // Use CU_BRM_NORMAL to only print errors and a summary
+  CU_basic_set_mode (CU_BRM_VERBOSE);
+
+  // This is where the tests are actually run!
+  CU_basic_run_tests ();
+
+  int exit_code = CU_get_number_of_tests_failed () == 0
+                      ? CU_get_error ()
+                      : CU_get_number_of_tests_failed ();
+
+  // Tear down CUnit before exiting
+  CU_cleanup_registry ();
+
+  return exit_code;
+}
@@ -0,0 +1,251 @@
+#include <CUnit/Basic.h>
+#include <stdlib.h>
+
+#include "../src/allocation.h"
+#include "../src/allocation_map.h"
+#include "../src/gc.h"
+#include "../src/gc_utils.h"
+#include "../src/get_header.h"
+#include "../src/heap_internal.h"
+#include "../src/semispace.h"
+#include "test_helpers.h"
+
+/* The size of the heaps used by the tests */
+#define HEAP_BYTES (16 * 1024)
+
+/* The amount of nodes linked into the list of the collection tests, few
+   enough for the list and its garbage to fit in one half.  */
+#define LIST_NODES 48
+
+/* The amount of garbage objects allocated after every node of the list */
+#define GARBAGE_PER_NODE 3
+
+int
+init_suite (void)
+{
+  // Change this function if you want to do something *before* you
+  // run a test suite
+  return 0;
+}
+
+int
+clean_suite (void)
+{
+  // Change this function if you want to do something *after* you
+  // run a test suite
+  return 0;
+}
+
+/**
+ * Creates a semispace heap that only collects when a half is full.
+ */
+static heap_t *
+create_semispace_heap (bool unsafe_stack)
+{
+  heap_options_t options = create_test_options (HEAP_BYTES, unsafe_stack);
+  options.semispace = true;
+  return h_init_with_options (&options);
+}
+
+/**
+ * Checks which half of a heap an object is in.
+ * @return true if the object is in the second half
+ */
+static bool
+is_in_second_half (heap_t *h, void *alloc)
+{
+  return calc_heap_offset (alloc, h) >= get_semispace_bytes (h->semispace);
+}
+
+/**
+ * Counts the nodes of a list in the second half of a heap.
+ */
+static size_t
+count_second_half_nodes (heap_t *h, void **holder)
+{
+  size_t count = 0;
+  for (void **node = holder[0]; node != NULL; node = node[0])
+    {
+      count += is_in_second_half (h, node);
+    }
+  return count;
+}
+
+void
+test_semispace_bump_allocation ()
+{
+  heap_t *h = create_semispace_heap (false);
+  CU_ASSERT_PTR_NOT_NULL (h->semispace);
+  CU_ASSERT_EQUAL (get_semispace_bytes (h->semispace), HEAP_BYTES / 2);
+
+  /* Objects follow each other, larger than a page or not */
+  char *first = h_alloc_raw (h, 8);
+  char *second = h_alloc_raw (h, 3 * PAGE_SIZE);
+  char *third = h_alloc_raw (h, 24);
+  CU_ASSERT_PTR_EQUAL (second, first + 16);
+  CU_ASSERT_PTR_EQUAL (third, second + align_alloc_size (3 * PAGE_SIZE)
+                                  + sizeof (header_t));
+  CU_ASSERT_FALSE (is_in_second_half (h, third));
+
+  /* An allocation larger than a half never fits */
+  CU_ASSERT_PTR_NULL (h_alloc_raw (h, HEAP_BYTES / 2));
+
+  h_delete (h);
+}
+
+void
+test_semispace_copies_survivors ()
+{
+  heap_t *h = create_semispace_heap (false);
+  void **volatile holder = NULL;
+  long sum = alloc_list_with_garbage (h, "50*", (void ***)&holder,
+                                      LIST_NODES, GARBAGE_PER_NODE, NULL);
+  size_t used = h_used (h);
+  CU_ASSERT_FALSE (is_in_second_half (h, holder));
+
+  CU_ASSERT_TRUE (h_gc (h) > 0);
+  CU_ASSERT_TRUE (h_used (h) < used);
+
+  /* The stack is safe, so even the root is copied. Nothing is left
+     allocated in the first half.  */
+  CU_ASSERT_TRUE (is_in_second_half (h, holder));
+  CU_ASSERT_EQUAL (count_allocated_bytes (h->alloc_map, HEAP_BYTES / 2), 0);
+  CU_ASSERT_EQUAL (sum_list (holder), sum);
+  CU_ASSERT_EQUAL (count_second_half_nodes (h, holder), LIST_NODES);
+
+  /* The format string was copied along with the holder */
+  header_t header = get_header_value (get_header_pointer (holder));
+  CU_ASSERT_EQUAL (get_header_type (header), HEADER_POINTER_TO_FORMAT_STRING);
+  CU_ASSERT_TRUE (is_in_second_half (h, get_pointer_in_header (header)));
+  CU_ASSERT_STRING_EQUAL (get_pointer_in_header (header), "50*");
+
+  /* The survivors were copied breadth first, the holder and its format
+     string before the list, and allocation continues after them.  */
+  CU_ASSERT_TRUE (holder[0] > (void *)holder);
+  void *next = h_alloc_raw (h, 8);
+  CU_ASSERT_TRUE (is_in_second_half (h, next));
+  for (void **node = holder[0]; node != NULL; node = node[0])
+    {
+      CU_ASSERT_TRUE ((void *)node < next);
+    }
+
+  /* A second collection copies them back */
+  h_gc (h);
+  CU_ASSERT_FALSE (is_in_second_half (h, holder));
+  CU_ASSERT_EQUAL (sum_list (holder), sum);
+  CU_ASSERT_EQUAL (count_second_half_nodes (h, holder), 0);
+
+  h_delete (h);
+}
+
+void
+test_semispace_pins_stack_roots ()
+{
+  heap_t *h = create_semispace_heap (true);
+  void **volatile holder = NULL;
+  long sum = alloc_list_with_garbage (h, "50*", (void ***)&holder,
+                                      LIST_NODES, GARBAGE_PER_NODE, NULL);
+  size_t holder_offset = calc_heap_offset (holder, h) - sizeof (header_t);
+
+  /* The holder is pinned where it is, the list it holds is copied. Stale
+     values on the stack may pin a few of the nodes as well.  */
+  h_gc (h);
+  CU_ASSERT_EQUAL (calc_heap_offset (holder, h) - sizeof (header_t),
+                   holder_offset);
+  CU_ASSERT_EQUAL (sum_list (holder), sum);
+  CU_ASSERT_TRUE (count_second_half_nodes (h, holder) > LIST_NODES / 2);
+
+  /* Copying the list back jumps over the holder */
+  h_gc (h);
+  CU_ASSERT_EQUAL (calc_heap_offset (holder, h) - sizeof (header_t),
+                   holder_offset);
+  CU_ASSERT_EQUAL (sum_list (holder), sum);
+  CU_ASSERT_TRUE (count_second_half_nodes (h, holder) < LIST_NODES / 2);
+  size_t holder_size
+      = align_alloc_size (50 * sizeof (void *)) + sizeof (header_t);
+  for (void **node = holder[0]; node != NULL; node = node[0])
+    {
+      size_t offset = calc_heap_offset (node, h) - sizeof (header_t);
+      CU_ASSERT_TRUE (offset + 2 * MIN_ALLOC_OBJECT_SIZE <= holder_offset
+                      || offset >= holder_offset + holder_size);
+    }
+
+  h_delete (h);
+}
+
+void
+test_semispace_collects_when_full ()
+{
+  heap_t *h = create_semispace_heap (false);
+  void **volatile holder = NULL;
+  long sum = alloc_list_with_garbage (h, "50*", (void ***)&holder,
+                                      LIST_NODES, GARBAGE_PER_NODE, NULL);
+
+  /* Several halves worth of garbage are allocated without running out */
+  for (size_t i = 0; i < 4 * HEAP_BYTES / 32; i++)
+    {
+      CU_ASSERT_PTR_NOT_NULL_FATAL (h_alloc_struct (h, "*l"));
+    }
+  CU_ASSERT_EQUAL (sum_list (holder), sum);
+
+  h_delete (h);
+}
+
+int
+main (void)
+{
+  // First we try to set up CUnit, and exit if we fail
+  if (CU_initialize_registry () != CUE_SUCCESS)
+    return CU_get_error ();
+
+  // We then create an empty test suite and specify the name and
+  // the init and cleanup functions
+  CU_pSuite semispacetests
+      = CU_add_suite ("Semispace Testing Suite", init_suite, clean_suite);
+  if (semispacetests == NULL)
+    {
+      // If the test suite could not be added, tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // This is where we add the test functions to our test suite.
+  // For each call to CU_add_test we specify the test suite, the
+  // name or description of the test, and the function that runs
+  // the test in question. If you want to add another test, just
+  // copy a line below and change the information
+  if ((CU_add_test (semispacetests, "Test bump allocating in a half",
+                    test_semispace_bump_allocation)
+           == NULL
+       || CU_add_test (semispacetests, "Test copying the survivors",
+                       test_semispace_copies_survivors)
+              == NULL
+       || CU_add_test (semispacetests, "Test pinning the stack roots",
+                       test_semispace_pins_stack_roots)
+              == NULL
+       || CU_add_test (semispacetests, "Test collecting when a half is full",
+                       test_semispace_collects_when_full)
+              == NULL
+       || 0))
+    {
+      // If adding any of the tests fails, we tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // Set the running mode. Use CU_BRM_VERBOSE for maximum output.
+  // Use CU_BRM_NORMAL to only print errors and a summary
+  CU_basic_set_mode (CU_BRM_VERBOSE);
+
+  // This is where the tests are actually run!
+  CU_basic_run_tests ();
+
+  int exit_code = CU_get_number_of_tests_failed () == 0
+                      ? CU_get_error ()
+                      : CU_get_number_of_tests_failed ();
+
+  // Tear down CUnit before exiting
+  CU_cleanup_registry ();
+
+  return exit_code;
+}
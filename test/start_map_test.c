@@ -0,0 +1,348 @@
+#include <CUnit/Basic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/allocation.h"
+#include "../src/allocation_map.h"
+#include "../src/gc.h"
+#include "../src/gc_utils.h"
+#include "../src/heap_internal.h"
+#include "../src/semispace.h"
+#include "../src/start_map.h"
+#include "test_helpers.h"
+
+/* The size of the heaps used by the tests */
+#define HEAP_BYTES (16 * 1024)
+
+/* The amount of garbage objects allocated before the kept one */
+#define GARBAGE_OBJECTS 20
+
+/* The size of the buffer pointed into by the tests */
+#define BUFFER_BYTES 64
+
+/* How far into the buffer the tests point */
+#define CURSOR_OFFSET 40
+
+int
+init_suite (void)
+{
+  // Change this function if you want to do something *before* you
+  // run a test suite
+  return 0;
+}
+
+int
+clean_suite (void)
+{
+  // Change this function if you want to do something *after* you
+  // run a test suite
+  return 0;
+}
+
+/**
+ * Allocates a buffer after some garbage, filled with its own indexes.
+ * @return a pointer CURSOR_OFFSET bytes into the buffer
+ */
+static char *
+alloc_buffer_cursor (heap_t *h)
+{
+  alloc_garbage (h, GARBAGE_OBJECTS);
+  unsigned char *buffer = h_alloc_raw (h, BUFFER_BYTES);
+  for (int i = 0; i < BUFFER_BYTES; i++)
+    {
+      buffer[i] = i;
+    }
+  return (char *)buffer + CURSOR_OFFSET;
+}
+
+/**
+ * Checks that a cursor still points CURSOR_OFFSET bytes into a buffer filled
+ * by alloc_buffer_cursor.
+ */
+static void
+assert_cursor_intact (char *cursor)
+{
+  unsigned char *buffer = (unsigned char *)cursor - CURSOR_OFFSET;
+  for (int i = 0; i < BUFFER_BYTES; i++)
+    {
+      CU_ASSERT_EQUAL (buffer[i], i);
+    }
+}
+
+void
+test_record_object_start ()
+{
+  char *start_map = create_start_map (HEAP_BYTES);
+  CU_ASSERT_FALSE (is_object_start (start_map, 256));
+
+  record_object_start (start_map, 256, 4 * MIN_ALLOC_OBJECT_SIZE);
+  CU_ASSERT_TRUE (is_object_start (start_map, 256));
+  CU_ASSERT_FALSE (is_object_start (start_map, 256 + MIN_ALLOC_OBJECT_SIZE));
+  CU_ASSERT_FALSE (is_object_start (start_map, 256 - MIN_ALLOC_OBJECT_SIZE));
+
+  /* Far away starts are found a word at a time */
+  size_t start = 0;
+  CU_ASSERT_TRUE (find_object_start (start_map, HEAP_BYTES - 1, &start));
+  CU_ASSERT_EQUAL (start, 256);
+  CU_ASSERT_FALSE (find_object_start (start_map, 255, &start));
+
+  /* An object placed over the old one replaces its start */
+  record_object_start (start_map, 224, 8 * MIN_ALLOC_OBJECT_SIZE);
+  CU_ASSERT_TRUE (is_object_start (start_map, 224));
+  CU_ASSERT_FALSE (is_object_start (start_map, 256));
+
+  free (start_map);
+}
+
+void
+test_clear_object_starts ()
+{
+  char *start_map = create_start_map (HEAP_BYTES);
+  for (size_t offset = 0; offset < 64 * MIN_ALLOC_OBJECT_SIZE;
+       offset += MIN_ALLOC_OBJECT_SIZE)
+    {
+      set_object_start (start_map, offset);
+    }
+
+  /* Starts and ends in the middle of bytes of the map */
+  clear_object_starts (start_map, 3 * MIN_ALLOC_OBJECT_SIZE,
+                       37 * MIN_ALLOC_OBJECT_SIZE);
+  for (size_t granule = 0; granule < 64; granule++)
+    {
+      CU_ASSERT_EQUAL (
+          is_object_start (start_map, granule * MIN_ALLOC_OBJECT_SIZE),
+          granule < 3 || granule >= 40);
+    }
+
+  /* Within a single byte */
+  clear_object_starts (start_map, 49 * MIN_ALLOC_OBJECT_SIZE,
+                       2 * MIN_ALLOC_OBJECT_SIZE);
+  CU_ASSERT_TRUE (is_object_start (start_map, 48 * MIN_ALLOC_OBJECT_SIZE));
+  CU_ASSERT_FALSE (is_object_start (start_map, 49 * MIN_ALLOC_OBJECT_SIZE));
+  CU_ASSERT_FALSE (is_object_start (start_map, 50 * MIN_ALLOC_OBJECT_SIZE));
+  CU_ASSERT_TRUE (is_object_start (start_map, 51 * MIN_ALLOC_OBJECT_SIZE));
+
+  free (start_map);
+}
+
+void
+test_allocations_are_recorded ()
+{
+  heap_t *h = h_init (HEAP_BYTES, true, 1);
+  char *first = h_alloc_raw (h, 20);
+  char *second = h_alloc_raw (h, 100);
+  size_t first_offset = calc_heap_offset (first, h) - sizeof (header_t);
+  size_t second_offset = calc_heap_offset (second, h) - sizeof (header_t);
+
+  CU_ASSERT_TRUE (is_object_start (h->start_map, first_offset));
+  CU_ASSERT_TRUE (is_object_start (h->start_map, second_offset));
+  CU_ASSERT_FALSE (
+      is_object_start (h->start_map, second_offset + MIN_ALLOC_OBJECT_SIZE));
+
+  h_delete (h);
+}
+
+void
+test_field_is_not_an_object ()
+{
+  heap_t *h = h_init (HEAP_BYTES, true, 1);
+  void **fields = h_alloc_struct (h, "3*");
+  char *text = h_alloc_raw (h, 16);
+  strcpy (text, "not a format");
+  fields[1] = text;
+
+  /* The word before the last field passes for a header pointing to a
+     format string, but no object starts there.  */
+  void *volatile cursor = &fields[2];
+  h_gc (h);
+  CU_ASSERT_PTR_EQUAL (cursor, &fields[2]);
+
+  h_delete (h);
+}
+
+void
+test_find_enclosing_object ()
+{
+  heap_t *h = h_init (HEAP_BYTES, true, 1);
+  char *first = h_alloc_raw (h, 20);
+  char *second = h_alloc_raw (h, 100);
+  size_t first_offset = calc_heap_offset (first, h) - sizeof (header_t);
+  size_t second_offset = calc_heap_offset (second, h) - sizeof (header_t);
+
+  size_t header_offset = 0;
+  CU_ASSERT_TRUE (find_enclosing_object (h, first, &header_offset));
+  CU_ASSERT_EQUAL (header_offset, first_offset);
+  CU_ASSERT_FALSE (find_enclosing_object (h, first - sizeof (header_t),
+                                          &header_offset));
+  CU_ASSERT_TRUE (find_enclosing_object (h, first + 19, &header_offset));
+  CU_ASSERT_EQUAL (header_offset, first_offset);
+  CU_ASSERT_TRUE (find_enclosing_object (h, second + 99, &header_offset));
+  CU_ASSERT_EQUAL (header_offset, second_offset);
+
+  /* Nothing is allocated after the last object */
+  CU_ASSERT_FALSE (find_enclosing_object (h, second + 128, &header_offset));
+  CU_ASSERT_FALSE (find_enclosing_object (h, &header_offset, &header_offset));
+
+  h_delete (h);
+}
+
+/**
+ * Creates a heap with a scanned stack that takes interior pointers, and is
+ * compacted on every collection.
+ */
+static heap_t *
+create_interior_heap (bool unsafe_stack)
+{
+  heap_options_t options = create_test_options (HEAP_BYTES, unsafe_stack);
+  options.interior_pointers = true;
+  return h_init_with_options (&options);
+}
+
+void
+test_interior_pointer_on_unsafe_stack ()
+{
+  heap_t *h = create_interior_heap (true);
+
+  /* Nothing but the cursor points to the buffer, which is pinned */
+  char *volatile cursor = alloc_buffer_cursor (h);
+  char *before = cursor;
+  h_gc (h);
+  CU_ASSERT_PTR_EQUAL (cursor, before);
+  CU_ASSERT_TRUE (h_used (h) >= align_alloc_size (BUFFER_BYTES));
+  assert_cursor_intact (cursor);
+
+  h_delete (h);
+}
+
+void
+test_interior_pointer_on_safe_stack ()
+{
+  heap_t *h = create_interior_heap (false);
+
+  /* The buffer may be moved, and the cursor is moved along with it */
+  char *volatile cursor = alloc_buffer_cursor (h);
+  h_gc (h);
+  CU_ASSERT_TRUE (h_used (h) >= align_alloc_size (BUFFER_BYTES));
+  assert_cursor_intact (cursor);
+
+  h_delete (h);
+}
+
+/**
+ * Checks that a buffer pointed into by a precise root alone is kept and
+ * moved, with the root moved as far into the new address.
+ */
+static void
+assert_interior_root_moved (bool semispace)
+{
+  heap_options_t options = create_test_options (HEAP_BYTES, false);
+  options.semispace = semispace;
+  options.precise_roots = true;
+  heap_t *h = h_init_with_options (&options);
+
+  char *cursor = alloc_buffer_cursor (h);
+  size_t offset = calc_heap_offset (cursor, h);
+  h_push_root (h, (void **)&cursor);
+  h_gc (h);
+  CU_ASSERT_EQUAL (h_used (h), align_alloc_size (BUFFER_BYTES));
+  CU_ASSERT_NOT_EQUAL (calc_heap_offset (cursor, h), offset);
+  assert_cursor_intact (cursor);
+
+  /* The buffer is found from the cursor at its new address as well */
+  size_t header_offset = 0;
+  CU_ASSERT_TRUE (find_enclosing_object (h, cursor, &header_offset));
+  CU_ASSERT_EQUAL (header_offset + sizeof (header_t) + CURSOR_OFFSET,
+                   calc_heap_offset (cursor, h));
+
+  h_pop_roots (h, 1);
+  h_delete (h);
+}
+
+void
+test_interior_root_compacted ()
+{
+  assert_interior_root_moved (false);
+}
+
+void
+test_interior_root_copied ()
+{
+  assert_interior_root_moved (true);
+}
+
+int
+main (void)
+{
+  // First we try to set up CUnit, and exit if we fail
+  if (CU_initialize_registry () != CUE_SUCCESS)
+    return CU_get_error ();
+
+  // We then create an empty test suite and specify the name and
+  // the init and cleanup functions
+  CU_pSuite startmaptests
+      = CU_add_suite ("Start map Testing Suite", init_suite, clean_suite);
+  if (startmaptests == NULL)
+    {
+      // If the test suite could not be added, tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // This is where we add the test functions to our test suite.
+  // For each call to CU_add_test we specify the test suite, the
+  // name or description of the test, and the function that runs
+  // the test in question. If you want to add another test, just
+  // copy a line below and change the information
+  if ((CU_add_test (startmaptests, "Test recording object starts",
+                    test_record_object_start)
+           == NULL
+       || CU_add_test (startmaptests, "Test clearing object starts",
+                       test_clear_object_starts)
+              == NULL
+       || CU_add_test (startmaptests, "Test allocations are recorded",
+                       test_allocations_are_recorded)
+              == NULL
+       || CU_add_test (startmaptests,
+                       "Test a pointer to a field is not an object",
+                       test_field_is_not_an_object)
+              == NULL
+       || CU_add_test (startmaptests, "Test finding the enclosing object",
+                       test_find_enclosing_object)
+              == NULL
+       || CU_add_test (startmaptests,
+                       "Test an interior pointer on an unsafe stack",
+                       test_interior_pointer_on_unsafe_stack)
+              == NULL
+       || CU_add_test (startmaptests,
+                       "Test an interior pointer on a safe stack",
+                       test_interior_pointer_on_safe_stack)
+              == NULL
+       || CU_add_test (startmaptests, "Test compacting an interior root",
+                       test_interior_root_compacted)
+              == NULL
+       || CU_add_test (startmaptests, "Test copying an interior root",
+                       test_interior_root_copied)
+              == NULL
+       || 0))
+    {
+      // If adding any of the tests fails, we tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // Set the running mode. Use CU_BRM_VERBOSE for maximum output.
+  // Use CU_BRM_NORMAL to only print errors and a summary
+  CU_basic_set_mode (CU_BRM_VERBOSE);
+
+  // This is where the tests are actually run!
+  CU_basic_run_tests ();
+
+  int exit_code = CU_get_number_of_tests_failed () == 0
+                      ? CU_get_error ()
+                      : CU_get_number_of_tests_failed ();
+
+  // Tear down CUnit before exiting
+  CU_cleanup_registry ();
+
+  return exit_code;
+}
@@ -0,0 +1,218 @@
+#include <CUnit/Basic.h>
+#include <stdlib.h>
+
+#include "../src/allocation.h"
+#include "../src/allocation_map.h"
+#include "../src/compacting.h"
+#include "../src/gc.h"
+#include "../src/gc_utils.h"
+#include "../src/heap_internal.h"
+#include "../src/mark_map.h"
+#include "../src/sweeping.h"
+#include "test_helpers.h"
+
+#define NODE_COUNT 10
+
+int
+init_suite (void)
+{
+  // Change this function if you want to do something *before* you
+  // run a test suite
+  return 0;
+}
+
+int
+clean_suite (void)
+{
+  // Change this function if you want to do something *after* you
+  // run a test suite
+  return 0;
+}
+
+/**
+ * Creates a heap that is swept, with a list of nodes and a garbage object
+ * of 16 bytes before each node, and marks the list.
+ */
+static heap_t *
+create_swept_heap (void ***holder, size_t *garbage_offsets)
+{
+  heap_options_t options = create_test_options (8 * PAGE_SIZE, true);
+  options.fragmentation_threshold = 0.5;
+  heap_t *h = h_init_with_options (&options);
+  *holder = h_alloc_struct (h, "*");
+  for (size_t i = 0; i < NODE_COUNT; i++)
+    {
+      void *garbage = h_alloc_raw (h, sizeof (long));
+      garbage_offsets[i] = calc_heap_offset (garbage, h) - sizeof (header_t);
+      void **node = h_alloc_struct (h, "*l");
+      node[0] = (*holder)[0];
+      (*holder)[0] = node;
+    }
+
+  char *root_map = create_mark_map (h->size);
+  update_mark_map (root_map,
+                   calc_heap_offset (*holder, h) - sizeof (header_t), true);
+  find_living_objects (h, root_map);
+  free (root_map);
+  return h;
+}
+
+void
+test_sweep_heap ()
+{
+  void **holder = NULL;
+  size_t garbage_offsets[NODE_COUNT];
+  heap_t *h = create_swept_heap (&holder, garbage_offsets);
+  void *first_node = holder[0];
+  size_t used = h_used (h);
+
+  size_t collected = sweep_heap (h);
+  CU_ASSERT_EQUAL (collected, NODE_COUNT * align_alloc_size (sizeof (long)));
+  CU_ASSERT_EQUAL (h_used (h), used - collected);
+
+  /* Nothing moved, the garbage is freed where it was */
+  CU_ASSERT_PTR_EQUAL (holder[0], first_node);
+  size_t found = 0;
+  for (void **node = holder[0]; node != NULL; node = node[0])
+    {
+      CU_ASSERT_TRUE (is_offset_allocated (
+          h->alloc_map, calc_heap_offset (node, h) - sizeof (header_t)));
+      found++;
+    }
+  CU_ASSERT_EQUAL (found, NODE_COUNT);
+  for (size_t i = 0; i < NODE_COUNT; i++)
+    {
+      CU_ASSERT_FALSE (is_offset_allocated (h->alloc_map, garbage_offsets[i]));
+    }
+
+  /* The holes on the first page are stranded, the other pages are empty */
+  size_t free_bytes = h->size - count_allocated_bytes (h->alloc_map, h->size);
+  size_t stranded = PAGE_SIZE
+                    - count_allocated_bytes (h->alloc_map, PAGE_SIZE);
+  float fragmentation = calc_fragmentation (h);
+  CU_ASSERT_EQUAL (fragmentation, (float)stranded / (float)free_bytes);
+  CU_ASSERT_TRUE (fragmentation > 0 && fragmentation < 0.5);
+
+  h_delete (h);
+}
+
+void
+test_sweep_allocate ()
+{
+  void **holder = NULL;
+  size_t garbage_offsets[NODE_COUNT];
+  heap_t *h = create_swept_heap (&holder, garbage_offsets);
+  sweep_heap (h);
+  h->free_lists = create_free_lists (h->size, h->page_size);
+
+  /* Every hole left by the garbage is filled before the empty pages */
+  for (size_t i = 0; i < NODE_COUNT; i++)
+    {
+      void *alloc = h_alloc_raw (h, sizeof (long));
+      size_t offset = calc_heap_offset (alloc, h) - sizeof (header_t);
+      bool is_in_hole = false;
+      for (size_t j = 0; j < NODE_COUNT; j++)
+        {
+          is_in_hole = is_in_hole || offset == garbage_offsets[j];
+        }
+      CU_ASSERT_TRUE (is_in_hole);
+    }
+  CU_ASSERT_EQUAL (get_swept_page_count (h->free_lists), 1);
+
+  /* Then the free space after the last node on the first page */
+  void *alloc = h_alloc_raw (h, sizeof (long));
+  CU_ASSERT_TRUE (calc_heap_offset (alloc, h)
+                  > garbage_offsets[NODE_COUNT - 1] + sizeof (header_t));
+  CU_ASSERT_TRUE (calc_heap_offset (alloc, h) < PAGE_SIZE);
+  CU_ASSERT_EQUAL (get_swept_page_count (h->free_lists), 1);
+
+  h_delete (h);
+}
+
+void
+test_sweep_fragmentation_threshold ()
+{
+  /* A live object at the start of a heap that is otherwise garbage, a
+     little of the free space is stranded on the first page.  */
+  heap_options_t options = create_test_options (8 * PAGE_SIZE, true);
+  options.fragmentation_threshold = 0.99;
+  heap_t *h = h_init_with_options (&options);
+  void *volatile live = h_alloc_raw (h, sizeof (long));
+  for (size_t i = 0; i < NODE_COUNT; i++)
+    {
+      h_alloc_raw (h, sizeof (long));
+    }
+
+  /* Below the threshold the heap is swept */
+  h_gc (h);
+  CU_ASSERT_PTR_NOT_NULL (h->free_lists);
+  CU_ASSERT_PTR_NULL (h->free_runs);
+  CU_ASSERT_TRUE (is_offset_allocated (
+      h->alloc_map, calc_heap_offset (live, h) - sizeof (header_t)));
+
+  /* Above it the heap is compacted */
+  h->fragmentation_threshold = 0.01;
+  h_gc (h);
+  CU_ASSERT_PTR_NULL (h->free_lists);
+  CU_ASSERT_PTR_NOT_NULL (h->free_runs);
+  CU_ASSERT_TRUE (is_offset_allocated (
+      h->alloc_map, calc_heap_offset (live, h) - sizeof (header_t)));
+
+  h_delete (h);
+}
+
+int
+main (void)
+{
+  // First we try to set up CUnit, and exit if we fail
+  if (CU_initialize_registry () != CUE_SUCCESS)
+    return CU_get_error ();
+
+  // We then create an empty test suite and specify the name and
+  // the init and cleanup functions
+  CU_pSuite sweepingtests
+      = CU_add_suite ("Sweeping Testing Suite", init_suite, clean_suite);
+  if (sweepingtests == NULL)
+    {
+      // If the test suite could not be added, tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // This is where we add the test functions to our test suite.
+  // For each call to CU_add_test we specify the test suite, the
+  // name or description of the test, and the function that runs
+  // the test in question. If you want to add another test, just
+  // copy a line below and change the information
+  if ((CU_add_test (sweepingtests, "Test sweeping a heap in place",
+                    test_sweep_heap)
+           == NULL
+       || CU_add_test (sweepingtests, "Test allocating from the swept heap",
+                       test_sweep_allocate)
+              == NULL
+       || CU_add_test (sweepingtests, "Test compacting once fragmented",
+                       test_sweep_fragmentation_threshold)
+              == NULL
+       || 0))
+    {
+      // If adding any of the tests fails, we tear down CUnit and exit
+      CU_cleanup_registry ();
+      return CU_get_error ();
+    }
+
+  // Set the running mode. Use CU_BRM_VERBOSE for maximum output.
+  // Use CU_BRM_NORMAL to only print errors and a summary
+  CU_basic_set_mode (CU_BRM_VERBOSE);
+
+  // This is where the tests are actually run!
+  CU_basic_run_tests ();
+
+  int exit_code = CU_get_number_of_tests_failed () == 0
+                      ? CU_get_error ()
+                      : CU_get_number_of_tests_failed ();
+
+  // Tear down CUnit before exiting
+  CU_cleanup_registry ();
+
+  return exit_code;
+}
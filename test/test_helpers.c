@@ -0,0 +1,74 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "../src/allocation_map.h"
+#include "../src/gc.h"
+#include "../src/heap_internal.h"
+#include "test_helpers.h"
+
+heap_options_t
+create_test_options (size_t bytes, bool unsafe_stack)
+{
+  return (heap_options_t){ .bytes = bytes,
+                           .unsafe_stack = unsafe_stack,
+                           .gc_threshold = 1,
+                           .gc_threads = 1 };
+}
+
+void
+alloc_garbage (heap_t *h, size_t count)
+{
+  for (size_t i = 0; i < count; i++)
+    {
+      h_alloc_struct (h, "*l");
+    }
+}
+
+long
+alloc_list_with_garbage (heap_t *h, char *holder_layout, void ***holder,
+                         size_t node_count, size_t garbage_per_node,
+                         void **nodes)
+{
+  *holder = h_alloc_struct (h, holder_layout);
+  if (*holder == NULL)
+    {
+      return -1;
+    }
+  long sum = 0;
+  for (size_t i = 0; i < node_count; i++)
+    {
+      void **node = h_alloc_struct (h, "*l");
+      if (node == NULL)
+        {
+          return -1;
+        }
+      node[0] = (*holder)[0];
+      ((long *)node)[1] = (long)i;
+      (*holder)[0] = node;
+      if (nodes != NULL)
+        {
+          nodes[i] = node;
+        }
+      sum += (long)i;
+      alloc_garbage (h, garbage_per_node);
+    }
+  return sum;
+}
+
+long
+sum_list (void **holder)
+{
+  long sum = 0;
+  for (void **node = holder[0]; node != NULL; node = node[0])
+    {
+      sum += ((long *)node)[1];
+    }
+  return sum;
+}
+
+size_t
+count_page_bytes (heap_t *h, size_t page)
+{
+  return count_allocated_bytes (h->alloc_map, (page + 1) * PAGE_SIZE)
+         - count_allocated_bytes (h->alloc_map, page * PAGE_SIZE);
+}
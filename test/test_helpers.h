@@ -0,0 +1,60 @@
+/**
+ * Helpers shared by the tests of the collector, linked into every test like
+ * the mocking objects.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "../src/gc.h"
+
+/**
+ * @brief Creates the options of a heap that is collected whenever an
+ * allocation does not fit, on the calling thread alone, with every other
+ * setting off. A test sets the options it is about before creating the heap.
+ * @param bytes the size of the heap
+ * @param unsafe_stack true if objects pointed to from the stack may not move
+ * @return the options
+ */
+heap_options_t create_test_options (size_t bytes, bool unsafe_stack);
+
+/**
+ * @brief Allocates objects that nothing but the stack refers to.
+ * @param h the heap to allocate on
+ * @param count how many objects to allocate
+ */
+void alloc_garbage (heap_t *h, size_t count);
+
+/**
+ * @brief Allocates a list of nodes with garbage objects after every node,
+ * hanging off the first field of a holder. Each node is a "*l" struct
+ * holding the next node and the index it was allocated at, and is linked in
+ * front of the nodes allocated before it.
+ * @param h the heap to allocate on
+ * @param holder_layout the format string of the holder
+ * @param holder set to the holder
+ * @param node_count how many nodes to link into the list
+ * @param garbage_per_node how many garbage objects to allocate after a node
+ * @param nodes set to every node in allocation order, unless NULL
+ * @return the sum of the values of the nodes, or -1 if the heap ran out
+ */
+long alloc_list_with_garbage (heap_t *h, char *holder_layout, void ***holder,
+                              size_t node_count, size_t garbage_per_node,
+                              void **nodes);
+
+/**
+ * @brief Sums the values of the nodes in a list.
+ * @param holder the holder of a list made by alloc_list_with_garbage
+ * @return the sum of the values of the nodes
+ */
+long sum_list (void **holder);
+
+/**
+ * @brief Counts the allocated bytes on a page of a heap.
+ * @param h the heap
+ * @param page the index of the page
+ * @return the amount of bytes allocated on the page
+ */
+size_t count_page_bytes (heap_t *h, size_t page);